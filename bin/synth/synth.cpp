@@ -1,12 +1,25 @@
 #include <libsynth.hpp>
 #include "unistd.h"
+#include <algorithm>
+#include <iomanip>
 
 void help()
 {
 	cout << "Syntax : " << endl;
 	cout << "  synth [duration] [sample_freq] generator_1 [generator_2 [...]]" << endl;
+	cout << "  synth --midi song.mid --patch lead.synth [--patch ...] --render out.wav" << endl;
+	cout << "  synth [-s rate] --emit-cpp patch.synth > patch.cpp" << endl;
+	cout << "  synth [duration] --watch patch.synth [--watch ...]" << endl;
+	cout << "  synth [duration] --profile generator_1 [...]" << endl;
 	cout << endl;
 	cout << "  duration     : sound duration (ms)" << endl;
+	cout << "  --midi       : render a standard midi file (type 0/1) offline" << endl;
+	cout << "  --patch      : [cN:|pN:]patch, patch of channel N (1..16), program N (0..127) or default" << endl;
+	cout << "  --voices n   : voices per instrument (default 16)" << endl;
+	cout << "  --render     : output file (.wav, raw, - or |cmd)" << endl;
+	cout << "  --emit-cpp   : write the patch as a compiled generator (see libsynth_static.hpp)" << endl;
+	cout << "  --watch      : play a patch file, reloaded each time it is saved" << endl;
+	cout << "  --profile    : print the most expensive nodes after playing" << endl;
 	cout << endl;
 	cout << "Available sound generators : " << endl;
 	cout << "  file.synth : read synth file" << endl;
@@ -16,11 +29,105 @@ void help()
 	exit(1);
 }
 
+int renderMidi(const string& midi_file, const vector<string>& patches, uint16_t voices, const string& output)
+{
+	MidiFile midi;
+	if (!midi.load(midi_file))
+		return 1;
+	if (output.empty())
+	{
+		cerr << "--midi needs --render" << endl;
+		return 1;
+	}
+
+	MidiRenderer renderer(Engine::getDefault());
+	renderer.setVoices(voices);
+	for (auto& patch : patches)
+	{
+		size_t colon = patch.find(':');
+		if ((patch[0] == 'c' || patch[0] == 'p') && colon != string::npos && colon > 1
+			&& patch.find_first_not_of("0123456789", 1) == colon)
+		{
+			int number = atoi(patch.c_str() + 1);
+			if (patch[0] == 'c')
+				renderer.setChannelPatch(number, patch.substr(colon + 1));
+			else
+				renderer.setProgramPatch(number, patch.substr(colon + 1));
+		}
+		else
+			renderer.setPatch(patch);
+	}
+
+	auto start = chrono::steady_clock::now();
+	double seconds = renderer.render(midi, output);
+	if (seconds < 0)
+		return 1;
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cerr << "Rendered " << seconds << "s in " << elapsed << "s (x" << seconds / elapsed << " real time)" << endl;
+	return 0;
+}
+
+int emitCpp(const string& patch, stringstream& options)
+{
+	// Options (-s rate...) then the patch
+	options << patch;
+	ParseContext ctx(Engine::getDefault());
+	ctx.echo = false;
+	SoundGenerator* generator = ctx.factory(options, true);
+	if (generator == nullptr || !generator->isValid())
+	{
+		cerr << "Unable to build " << patch << endl;
+		return 1;
+	}
+
+	string name = patch.substr(patch.find_last_of('/') + 1);
+	name = name.substr(0, name.find('.'));
+	bool emitted = CppEmitter::emit(cout, generator, name);
+	delete generator;
+	return emitted ? 0 : 1;
+}
+
+// Nodes of the tree, depth first, with their path
+static void flatten(const NodeStats& node, const string& path, vector<pair<string, const NodeStats*>>& nodes)
+{
+	nodes.push_back(make_pair(path, &node));
+	for (auto& input : node.inputs)
+		flatten(input, path + " > " + input.name, nodes);
+}
+
+static void printProfile(const NodeStats& engine, size_t top)
+{
+	vector<pair<string, const NodeStats*>> nodes;
+	for (auto& sound : engine.inputs)
+		flatten(sound, sound.name, nodes);
+	sort(nodes.begin(), nodes.end(), [](const pair<string, const NodeStats*>& a, const pair<string, const NodeStats*>& b)
+		{ return a.second->self > b.second->self; });
+
+	uint64_t renders = max(engine.calls, uint64_t(1));
+	cout << "Profile : " << engine.calls << " callbacks, " << engine.inclusive / renders << " cycles each ("
+		<< engine.self / renders << " mixing)" << endl;
+	cout << "  self/cb   incl/cb       %  allocs  node" << endl;
+	for (size_t i = 0; i < nodes.size() && i < top; i++)
+	{
+		const NodeStats* node = nodes[i].second;
+		cout << setw(9) << node->self / renders << ' ' << setw(9) << node->inclusive / renders << ' '
+			<< setw(7) << fixed << setprecision(1) << 100.0 * node->self / max(engine.inclusive, uint64_t(1)) << ' '
+			<< setw(7) << (NodeProfile::countsAllocations() ? to_string(node->allocations) : "-") << "  " << nodes[i].first << endl;
+	}
+}
+
 int main(int argc, const char* argv[])
 {
 	long duration;
 	int i(1);
 	stringstream input;
+	string midi_file;
+	string output;
+	string emit_cpp;
+	vector<string> patches;
+	vector<string> watched;
+	uint16_t voices = 16;
+	bool profile = false;
 
 	if (argc<2)
 		help();
@@ -36,14 +143,46 @@ int main(int argc, const char* argv[])
 		string arg(argv[i]);
 		if (arg=="help" || arg=="-h")
 			help();
+		else if ((arg=="--midi" || arg=="--patch" || arg=="--render" || arg=="--voices" || arg=="--emit-cpp" || arg=="--watch") && i+1 >= argc)
+			help();
+		else if (arg=="--midi")
+			midi_file = argv[++i];
+		else if (arg=="--patch")
+			patches.push_back(argv[++i]);
+		else if (arg=="--render")
+			output = argv[++i];
+		else if (arg=="--voices")
+			voices = atoi(argv[++i]);
+		else if (arg=="--emit-cpp")
+			emit_cpp = argv[++i];
+		else if (arg=="--watch")
+			watched.push_back(argv[++i]);
+		else if (arg=="--profile")
+			profile = true;
 		else
 			input << arg << ' ';
 	}
 
+	if (emit_cpp.length())
+		return emitCpp(emit_cpp, input);
+
+	if (midi_file.length())
+	{
+		// Options only (-s, -b, -v, define...)
+		while (input.good())
+			if (SoundGenerator::factory(input, false))
+			{
+				cerr << "No generator allowed with --midi" << endl;
+				return 1;
+			}
+		return renderMidi(midi_file, patches, voices, output);
+	}
+
     SoundGenerator::setVolume(0);   // Avoid sound clicks at start
 	SoundGenerator::fade_in(10);
+	Engine::getDefault().setProfiling(profile);
 
-	bool needed = true;
+	bool needed = watched.empty();
 	while(input.good())
 	{
 		SoundGenerator* g = SoundGenerator::factory(input, needed);
@@ -51,6 +190,10 @@ int main(int argc, const char* argv[])
 		needed = false;
 	}
 
+	PatchWatcher watcher(Engine::getDefault());
+	for (auto& file : watched)
+		watcher.play(file);
+
 	if (SoundGenerator::count()==0)
 	{
 		cerr << "Parsing ok, but generator list is empty" << endl;
@@ -73,6 +216,8 @@ int main(int argc, const char* argv[])
 	    SDL_Delay(fade_time); // Play for ms (while fading out)
     }
     SDL_Delay(1000); // Wait till the end of buffer is played (avoid clicks) TODO this is buffer size dependant
+	if (profile)
+		printProfile(Engine::getDefault().stats(), 10);
 
 	return 0;
 }
@@ -0,0 +1,51 @@
+#include <libsynth.hpp>
+
+void help()
+{
+	cout << "Syntax : " << endl;
+	cout << "  synthc [-s sample_freq] output.synthc patch.synth [patch.synth [...]]" << endl;
+	cout << endl;
+	cout << "  Compiles patches to a file loaded without parsing (see PatchReader)," << endl;
+	cout << "  each patch is named after its file (pad.synth -> pad)." << endl;
+	cout << "  Use it as file.synthc (first patch) or file.synthc:name" << endl;
+	exit(1);
+}
+
+int main(int argc, const char* argv[])
+{
+	int i(1);
+	Engine& engine = Engine::getDefault();
+	if (argc > 2 && string(argv[i]) == "-s")
+	{
+		engine.setSamplesPerSeconds(atol(argv[i + 1]));
+		i += 2;
+	}
+	if (argc - i < 2)
+		help();
+
+	string output(argv[i++]);
+	PatchWriter writer(engine.samplesPerSeconds());
+	for (; i < argc; i++)
+	{
+		string patch(argv[i]);
+		ParseContext ctx(engine);
+		ctx.echo = false;
+		SoundGenerator* generator = ctx.optimize(ctx.factory(patch));
+		if (generator == nullptr || !generator->isValid())
+		{
+			cerr << "Unable to build " << patch << endl;
+			return 1;
+		}
+
+		string name = patch.substr(patch.find_last_of('/') + 1);
+		name = name.substr(0, name.find('.'));
+		bool added = writer.add(name, generator);
+		ctx.drop(generator);
+		if (!added)
+		{
+			cerr << "Unable to compile " << patch << ", no compiled version of " << writer.unsupported() << endl;
+			return 1;
+		}
+	}
+	return writer.save(output) ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+# synth_patches(target dir)
+#
+# Compiles the .synth patches of dir into the static library target :
+# each patch is written as C++ by synth --emit-cpp (libsynth_static.hpp),
+# and target_index.cpp lists them in a nullptr terminated table
+#   extern const StaticPatchEntry target[];
+# to use with staticPatch(target, "name", ctx).
+# Patches are baked for the default sample rate of synth, see SYNTH_PATCHES_RATE.
+function(synth_patches target dir)
+	file(GLOB patches ${dir}/*.synth)
+	set(options)
+	if (SYNTH_PATCHES_RATE)
+		set(options -s ${SYNTH_PATCHES_RATE})
+	endif()
+
+	set(sources)
+	set(declarations "")
+	set(entries "")
+	foreach(patch ${patches})
+		get_filename_component(name ${patch} NAME_WE)
+		string(REGEX REPLACE "[^A-Za-z0-9]" "_" id ${name})
+		set(source ${CMAKE_CURRENT_BINARY_DIR}/${target}_${id}.cpp)
+		add_custom_command(
+			OUTPUT ${source}
+			COMMAND synth ${options} --emit-cpp ${patch} > ${source}
+			DEPENDS synth ${patch}
+			COMMENT "Compiling patch ${name}"
+			)
+		list(APPEND sources ${source})
+		set(declarations "${declarations}SoundGenerator* synth_patch_${id}(ParseContext&);\n")
+		set(entries "${entries}\t{ \"${id}\", synth_patch_${id} },\n")
+	endforeach()
+
+	set(index ${CMAKE_CURRENT_BINARY_DIR}/${target}_index.cpp)
+	file(WRITE ${index}.in
+		"// Generated by synth_patches(), do not edit\n"
+		"#include <libsynth_static.hpp>\n\n"
+		"${declarations}\n"
+		"extern const StaticPatchEntry ${target}[] =\n{\n${entries}\t{ nullptr, nullptr }\n};\n")
+	configure_file(${index}.in ${index} COPYONLY)
+
+	add_library(${target} STATIC ${sources} ${index})
+	target_link_libraries(${target} synthetizer)
+endfunction()
@@ -17,11 +17,1421 @@
 #    include <atomic>
 #    include <mutex>
 #    include <memory>
+#    include <thread>
+#    include <functional>
+#    include <condition_variable>
 
 using namespace std;
 
 typedef float sgfloat;
 
+/**
+ * Lock free single producer / single consumer ring buffer.
+ * One thread may write while another one reads, without any lock.
+ */
+template<class T>
+class RingBuffer
+{
+  public:
+	RingBuffer(size_t capacity) : size(capacity + 1), buffer(new T[capacity + 1]), head(0), tail(0) { }
+
+	~RingBuffer()
+	{
+		delete[] buffer;
+	}
+
+	// Number of items ready to be read
+	size_t available() const
+	{
+		size_t h = head.load(memory_order_acquire);
+		size_t t = tail.load(memory_order_acquire);
+		return h >= t ? h - t : h + size - t;
+	}
+
+	// Number of items that can be written
+	size_t space() const
+	{
+		return size - 1 - available();
+	}
+
+	size_t capacity() const
+	{
+		return size - 1;
+	}
+
+	// Producer side, @return number of items written
+	size_t write(const T* data, size_t count)
+	{
+		size_t h = head.load(memory_order_relaxed);
+		size_t free = space();
+		if (count > free) count = free;
+		for (size_t i = 0; i < count; i++)
+		{
+			buffer[h] = data[i];
+			if (++h == size) h = 0;
+		}
+		head.store(h, memory_order_release);
+		return count;
+	}
+
+	// Consumer side, @return number of items read
+	size_t read(T* data, size_t count)
+	{
+		size_t t = tail.load(memory_order_relaxed);
+		size_t avail = available();
+		if (count > avail) count = avail;
+		for (size_t i = 0; i < count; i++)
+		{
+			data[i] = buffer[t];
+			if (++t == size) t = 0;
+		}
+		tail.store(t, memory_order_release);
+		return count;
+	}
+
+  private:
+	RingBuffer(const RingBuffer&) = delete;
+	RingBuffer& operator=(const RingBuffer&) = delete;
+
+	const size_t size;
+	T* buffer;
+	atomic<size_t> head;	// next write position
+	atomic<size_t> tail;	// next read position
+};
+
+/**
+ * Audio output where the engine sends its samples.
+ * The backend calls want.callback(want.userdata, stream, length) each time
+ * it needs a new buffer.
+ */
+class AudioBackend
+{
+  public:
+	virtual ~AudioBackend() { }
+
+	/**
+	 * Build a backend from its name : sdl, null or file:name
+	 * (name may be - for stdout or |command for a pipe)
+	 * @return nullptr if unknown
+	 */
+	static AudioBackend* create(const string& spec);
+
+	// Open the output, have receives the actual parameters
+	virtual bool open(const SDL_AudioSpec& want, SDL_AudioSpec& have) = 0;
+
+	// Start calling the audio callback
+	virtual void start() = 0;
+
+	virtual void close() = 0;
+
+	// Print statistics (if any)
+	virtual void report(ostream&) const { }
+};
+
+// Sound card output through SDL (default)
+class SdlBackend : public AudioBackend
+{
+  public:
+	virtual bool open(const SDL_AudioSpec& want, SDL_AudioSpec& have) override;
+	virtual void start() override;
+	virtual void close() override;
+
+  private:
+	SDL_AudioDeviceID dev = 0;
+	bool initialized = false;
+};
+
+// No output, the callback is called by a precise timer at the buffer rate
+// (or by process() in offline mode, as fast as possible)
+class NullBackend : public AudioBackend
+{
+  public:
+	virtual ~NullBackend() { close(); }
+
+	virtual bool open(const SDL_AudioSpec& want, SDL_AudioSpec& have) override;
+	virtual void start() override;
+	virtual void close() override;
+
+	// Offline : no timer, the owner renders with process() (set before start)
+	void setOffline(bool off) { offline = off; }
+
+	// Render frames now (offline mode only), @return false if not possible
+	bool process(uint32_t frames);
+
+	// Callback jitter and cpu load
+	virtual void report(ostream&) const override;
+
+  protected:
+	// Called with each rendered buffer
+	virtual void output(const Uint8* stream, int length) { }
+
+	SDL_AudioSpec spec;
+
+  private:
+	void loop();
+
+	vector<Uint8> buffer;
+	thread* timer = nullptr;
+	bool offline = false;
+	atomic<bool> running;
+	uint64_t callbacks = 0;
+	double max_jitter;
+	double total_jitter;
+	double max_busy;
+	double total_busy;
+};
+
+// Write raw samples (or wav if name ends with .wav) to a file or a pipe
+class FileBackend : public NullBackend
+{
+  public:
+	FileBackend(const string& file_name) : name(file_name) { }
+	virtual ~FileBackend() { close(); }
+
+	virtual bool open(const SDL_AudioSpec& want, SDL_AudioSpec& have) override;
+	virtual void close() override;
+
+  protected:
+	virtual void output(const Uint8* stream, int length) override;
+
+  private:
+	void writeWavHeader();
+
+	string name;
+	FILE* file = nullptr;
+	bool pipe;
+	bool wav;
+	uint32_t written;
+};
+
+/**
+ * Look-ahead peak limiter : the sound is delayed by lookahead ms so that its
+ * gain goes down smoothly before a peak above ceiling arrives, instead of
+ * being clipped, then goes back up in release ms. Blocks without any peak
+ * and without reduction in progress are only delayed. true_peak also
+ * detects the peaks between samples (4x oversampling).
+ */
+class Limiter
+{
+  public:
+	Limiter(uint32_t samples_per_seconds, sgfloat lookahead_ms = 5, sgfloat release_ms = 80,
+		sgfloat ceiling = 0.98, bool true_peak = false);
+
+	// Limit frames in place
+	void process(sgfloat* left, sgfloat* right, uint32_t frames);
+
+	// Gain applied to the last frame (1 : no reduction)
+	sgfloat gain() const
+	{
+		return current;
+	}
+
+	// Frames the sound is delayed by
+	uint32_t latency() const
+	{
+		return delay;
+	}
+
+	// Largest absolute value of the frames
+	static sgfloat peak(const sgfloat* left, const sgfloat* right, uint32_t frames);
+
+  private:
+	static const int TAPS = 8;		// interpolation filter, per phase
+	static const int PHASES = 4;
+
+	// Peak of the last frame (filter history updated), true peak if enabled
+	sgfloat framePeak(sgfloat left, sgfloat right);
+
+	uint32_t lookahead;				// frames of the gain ramp
+	uint32_t delay;					// lookahead and the interpolation delay
+	uint32_t window;				// frames a reduction is held
+	sgfloat ceiling;
+	sgfloat release;				// release coefficient per frame
+	bool true_peak;
+	sgfloat coeffs[PHASES - 1][TAPS];
+	sgfloat overshoot = 1;			// largest gain of the interpolation filter
+
+	vector<sgfloat> delayed;		// left, right (delay frames)
+	uint32_t delay_pos = 0;
+	vector<sgfloat> history;		// left, right (TAPS frames) for true peak
+	uint32_t history_pos = 0;
+	vector<pair<uint64_t, sgfloat>> minimum;	// increasing gains over window (ring)
+	uint32_t min_head = 0;
+	uint32_t min_size = 0;
+	vector<sgfloat> held;			// gains being averaged (lookahead)
+	uint32_t held_pos = 0;
+	double held_sum;
+	sgfloat envelope = 1;
+	sgfloat current = 1;
+	uint64_t frame = 0;
+	uint64_t quiet = 0;				// first frame without any reduction held
+	uint32_t unity;					// frames since envelope is back to 1 (up to lookahead)
+};
+
+/**
+ * Gain stage of the master and of the buses : the gain goes from its value
+ * to a target in an exact count of frames, along a curve. Frames are scaled
+ * by linear pieces between exact curve values every 16 frames (loops without
+ * any branch, they vectorize), the last frame of the ramp is at the target.
+ */
+class GainRamp
+{
+  public:
+	enum Curve
+	{
+		LINEAR,
+		EQUAL_POWER,	// sin / cos quarter, constant power with the opposite ramp
+		EXPONENTIAL		// constant dB per frame (from or to -60dB for 0)
+	};
+
+	GainRamp(sgfloat gain = 1) : gain(gain), from(gain), target(gain) { }
+
+	// Ramp from the actual gain to target in frames (0 : at once)
+	void start(sgfloat target, uint32_t frames, Curve curve = LINEAR);
+
+	// Gain set at once, stops the ramp
+	void set(sgfloat value)
+	{
+		start(value, 0);
+	}
+
+	sgfloat value() const
+	{
+		return gain;
+	}
+
+	bool ramping() const
+	{
+		return done < length;
+	}
+
+	// Scale frames in place, the ramp goes on
+	void process(sgfloat* left, sgfloat* right, uint32_t frames);
+
+	// The ramp goes on for frames not scaled (silent)
+	void advance(uint32_t frames);
+
+  private:
+	static const uint32_t SEGMENT = 16;	// frames of a linear piece of the curve
+
+	// Gain of the curve after frame frames of the ramp
+	sgfloat at(uint32_t frame) const;
+
+	sgfloat gain;
+	sgfloat from;
+	sgfloat target;
+	Curve curve = LINEAR;
+	uint32_t length = 0;
+	uint32_t done = 0;
+	sgfloat ratio[SEGMENT];		// exponential : gains of a piece relative to its first frame
+};
+
+/**
+ * Cost of a generator node measured by the profiler (Engine::stats), totals
+ * since the node is profiled. Cycles are time stamp counter ticks
+ * (nanoseconds on cpus without one).
+ */
+struct NodeStats
+{
+	string name;
+	uint64_t calls = 0;
+	uint64_t self = 0;			// cycles in the node only
+	uint64_t inclusive = 0;		// cycles with its inputs
+	uint64_t allocations = 0;	// operator new calls of the node only (see countsAllocations)
+	vector<NodeStats> inputs;
+};
+
+/**
+ * Counters of a profiled node, written by the thread rendering it only.
+ * Scope measures a call, the scopes opened inside it (inputs) are not
+ * part of its self time and allocations.
+ */
+struct NodeProfile
+{
+	atomic<uint64_t> calls;
+	atomic<uint64_t> self;
+	atomic<uint64_t> inclusive;
+	atomic<uint64_t> allocations;
+
+	NodeProfile() { clear(); }
+
+	void clear()
+	{
+		calls = self = inclusive = allocations = 0;
+	}
+
+	// Copy of the counters, inputs left empty
+	NodeStats read(const string& name) const;
+
+	static uint64_t cycles();
+
+	// Built with -DSYNTH_PROFILE_ALLOCATIONS=ON (operator new replaced), else allocations stay 0
+	static bool countsAllocations()
+	{
+#ifdef SYNTH_PROFILE_ALLOCATIONS
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	class Scope
+	{
+	  public:
+		// Nothing measured without profile
+		Scope(NodeProfile* profile) : profile(profile)
+		{
+			if (profile == nullptr)
+				return;
+			outer_cycles = children_cycles;
+			outer_allocations = children_allocations;
+			children_cycles = 0;
+			children_allocations = 0;
+			allocated = thread_allocations;
+			start = cycles();
+		}
+
+		~Scope()
+		{
+			if (profile == nullptr)
+				return;
+			uint64_t spent = cycles() - start;
+			uint64_t allocated_here = thread_allocations - allocated;
+			auto add = [](atomic<uint64_t>& counter, uint64_t value)
+			{
+				counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+			};
+			add(profile->calls, 1);
+			add(profile->inclusive, spent);
+			add(profile->self, spent > children_cycles ? spent - children_cycles : 0);
+			add(profile->allocations, allocated_here - children_allocations);
+			children_cycles = outer_cycles + spent;
+			children_allocations = outer_allocations + allocated_here;
+		}
+
+	  private:
+		NodeProfile* profile;
+		uint64_t start;
+		uint64_t allocated;
+		uint64_t outer_cycles;
+		uint64_t outer_allocations;
+	};
+
+	static thread_local uint64_t thread_allocations;	// operator new calls of the thread
+
+  private:
+	static thread_local uint64_t children_cycles;		// of the scopes inside the current one
+	static thread_local uint64_t children_allocations;
+};
+
+/**
+ * Audio callback timing against the budget (duration of a buffer) : render
+ * durations and periods between callbacks go in histograms of 5% wide
+ * buckets (0.01% to 2000% of the budget). Written by the audio thread
+ * without lock, read by any thread.
+ */
+class CallbackTiming
+{
+  public:
+	static const uint32_t BUCKETS = 256;
+
+	struct Report
+	{
+		double budget = 0;			// seconds
+		uint64_t callbacks = 0;
+		uint64_t renders = 0;
+		uint64_t misses = 0;		// renders longer than the budget
+		uint64_t underruns = 0;		// buffers not (fully) rendered in time
+		double mean = 0;			// render duration (seconds)
+		double max = 0;
+		double p50 = 0;				// percentiles of the render duration
+		double p90 = 0;
+		double p99 = 0;
+		double p999 = 0;
+		double period_p99 = 0;		// time between callbacks
+		double period_max = 0;
+
+		// Mean part of the budget used
+		double load() const
+		{
+			return budget > 0 ? mean / budget : 0;
+		}
+
+		// One line summary
+		void print(ostream&) const;
+	};
+
+	CallbackTiming() { clear(); }
+
+	void setBudget(double seconds)
+	{
+		budget_ns = seconds * 1e9;
+	}
+
+	static uint64_t now()
+	{
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// A buffer has been rendered in ns
+	void rendered(uint64_t ns);
+
+	// The audio callback starts (at now()), underrun if it had nothing ready to play
+	void called(uint64_t start, bool underrun);
+
+	Report read() const;
+	void clear();
+
+  private:
+	uint32_t bucket(uint64_t ns) const;
+
+	// Percentile (0..1) of a histogram in seconds, max if above it
+	double percentile(const atomic<uint32_t>* histogram, uint64_t count, double p, double max) const;
+
+	uint64_t budget_ns = 0;
+	atomic<uint64_t> last_call;
+	atomic<uint32_t> durations[BUCKETS];
+	atomic<uint32_t> periods[BUCKETS];
+	atomic<uint64_t> callbacks;
+	atomic<uint64_t> renders;
+	atomic<uint64_t> misses;
+	atomic<uint64_t> underruns;
+	atomic<uint64_t> total_ns;
+	atomic<uint64_t> max_ns;
+	atomic<uint64_t> max_period_ns;
+};
+
+/**
+ * Events of the audio threads (callbacks, renders, sampled node spans,
+ * request drains, play / remove) in a preallocated ring, the oldest ones
+ * being overwritten. Any thread records without lock nor allocation, the
+ * ring is written as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+ */
+class Tracer
+{
+  public:
+	static const uint32_t NAME_SIZE = 40;
+
+	// capacity events kept, nodes measured one render out of sample
+	Tracer(uint32_t capacity, uint16_t sample);
+	~Tracer();
+
+	/**
+	 * Complete event from start to end (CallbackTiming::now()) with one
+	 * optional argument. category and arg are literals, name is copied.
+	 */
+	void span(const char* category, const char* name, uint64_t start, uint64_t end,
+		const char* arg = nullptr, int64_t value = 0);
+
+	// Event without duration, now, named "category name" in the trace
+	void instant(const char* category, const char* name, const char* arg = nullptr, int64_t value = 0);
+
+	// Name of the calling thread in the trace (a literal)
+	static void setThreadName(const char* name);
+
+	// Does that render measure the nodes
+	bool sampled(uint64_t render) const
+	{
+		return render % sample == 0;
+	}
+
+	// Events recorded (more than the ones kept if the ring has wrapped)
+	uint64_t recorded() const
+	{
+		return head;
+	}
+
+	// Chrome trace JSON of the events kept, @return number of events written
+	size_t write(ostream&) const;
+
+  private:
+	Tracer(const Tracer&) = delete;
+	Tracer& operator=(const Tracer&) = delete;
+
+	struct Event
+	{
+		atomic<uint64_t> sequence;	// index + 1 once written, 0 while written
+		uint64_t start;				// ns
+		uint64_t duration;
+		int64_t value;
+		const char* category;
+		const char* arg;
+		uint16_t thread;
+		char phase;					// X complete, i instant
+		char name[NAME_SIZE];
+	};
+
+	void record(char phase, const char* category, const char* name, uint64_t start, uint64_t duration,
+		const char* arg, int64_t value);
+
+	Event* events;
+	uint32_t capacity;
+	uint16_t sample;
+	atomic<uint64_t> head;
+};
+
+class SoundGenerator;
+
+/**
+ * Real-time safety checker, built with -DSYNTH_RT_CHECK=ON : malloc, calloc,
+ * realloc, free, pthread_mutex_lock, pthread_create, pthread_join, write,
+ * fwrite and nanosleep are interposed, a call made by a thread while it
+ * renders a bus (sounds, effect, volume and limiter) is recorded with the
+ * sound being rendered and the stack. The violations are printed at exit.
+ * In other builds nothing is checked and the hooks compile to nothing.
+ */
+class RtCheck
+{
+  public:
+	struct Violation
+	{
+		string call;			// malloc, pthread_mutex_lock...
+		string generator;		// root of the sound rendered, empty for the engine
+		uint64_t count;
+		vector<string> stack;	// innermost first
+	};
+
+	// The thread renders audio while a scope exists
+	class Scope
+	{
+	  public:
+#ifdef SYNTH_RT_CHECK
+		Scope() { enter(); }
+		~Scope() { leave(); }
+#else
+		Scope() { }
+		~Scope() { }
+#endif
+	};
+
+	// Sound rendered by the thread from now on (nullptr : the engine)
+#ifdef SYNTH_RT_CHECK
+	static void setGenerator(const SoundGenerator*);
+#else
+	static void setGenerator(const SoundGenerator*) { }
+#endif
+
+	static bool enabled()
+	{
+#ifdef SYNTH_RT_CHECK
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// Distinct calls (same call, sound and stack) recorded so far
+	static vector<Violation> violations();
+	static void clear();
+	static void print(ostream&);
+
+  private:
+	static void enter();
+	static void leave();
+};
+
+class SharedNode;
+class Engine;
+
+/**
+ * State of a patch parsing. It is passed through the construction of
+ * generators, so patches can be built concurrently on many threads
+ * (one context per thread). Defines are shared by all the contexts
+ * of the same engine.
+ */
+class ParseContext
+{
+  public:
+	ParseContext(Engine& engine) : engine(engine) { }
+
+	SoundGenerator* factory(istream& in, bool needed = false);
+	SoundGenerator* factory(string type, istream& in);
+	SoundGenerator* factory(string s);
+
+	// Needed generator, and the text it is built from (to build it again)
+	SoundGenerator* factory(istream& in, string& text);
+
+	// Same as SoundGenerator::readFloat/readFrequency, verbose aware
+	sgfloat readFloat(istream &in, sgfloat  min, sgfloat  max, string varname);
+	sgfloat readFrequency(istream &, string name="");
+
+	/**
+	 * Parse error : exits when fatal, else the first error is kept and the
+	 * factory then returns nullptr (what was built so far is dropped).
+	 */
+	void fail(const string& message);
+	void missingGenerator(string msg = "");
+
+	bool failed() const
+	{
+		return error.length();
+	}
+
+	/**
+	 * Rewrite a tree into a cheaper one with the same output, nodes not
+	 * used anymore are deleted. Changes are reported in verbose mode.
+	 */
+	SoundGenerator* optimize(SoundGenerator*);
+
+	// Delete the nodes of root, except the ones of keep
+	static void drop(SoundGenerator* root, SoundGenerator* keep = nullptr);
+
+	Engine& engine;			// Engine generators are built for
+	string last_type;		// Last type read by factory
+	bool echo = true;		// print statements are displayed
+	uint8_t verbose = 0;
+	bool optimizing = true;	// Engine::factory optimizes what it builds
+	bool fatal = true;		// a parse error exits (false : see fail)
+	string error;			// first error of a non fatal parse
+
+  private:
+	SoundGenerator* parse(istream& in, bool needed);
+
+	uint16_t depth = 0;		// nested factory calls
+};
+
+/**
+ * Sound engine : owns the list of playing generators, the audio output,
+ * the clock, the defines and the settings.
+ * Many engines can run independently in the same process, the static
+ * SoundGenerator api uses the default one.
+ */
+class Engine
+{
+  public:
+	Engine(uint32_t samples_per_seconds = 48000, uint32_t buffer_size = 1024);
+	~Engine();
+
+	/**
+	 * Playing sound identifier returned by play(), 0 is never a valid handle.
+	 * A handle becomes invalid as soon as its sound is removed, even if its
+	 * slot is reused later (generation counter).
+	 */
+	typedef uint32_t Handle;
+
+	/**
+	 * Playing sounds are mixed by bus (music, sfx...), each bus with its own
+	 * volume, fade and insert effect, then the buses are summed. Bus 0 (main)
+	 * is where play() puts sounds by default.
+	 */
+	typedef uint16_t Bus;
+
+	// Frames mixed at once, bus by bus
+	static const uint32_t MIX_BLOCK = 256;
+
+	// Engine used by the static SoundGenerator api
+	static Engine& getDefault();
+
+	bool init();
+	void close();
+
+	// Stop sound and forget all playing generators
+	void quit();
+
+	/**
+	 * Build generators with the engine own parse context (flags and verbosity
+	 * are kept between calls). Calls are serialized, use a ParseContext per
+	 * thread to build patches in parallel.
+	 */
+	SoundGenerator* factory(istream& in, bool needed = false);
+	SoundGenerator* factory(string s);
+
+	ParseContext& getParser()
+	{
+		return parser;
+	}
+
+	Handle play(SoundGenerator*, Bus bus = 0); // Add it if necessary
+	bool remove(SoundGenerator*); // Remove it
+	bool has(SoundGenerator*, bool bLock = false); // Does it playing ?
+
+	// O(1) operations on playing sounds
+	bool remove(Handle);
+	bool has(Handle);
+	SoundGenerator* get(Handle);
+	bool setVolume(Handle, sgfloat vol);
+	bool setValue(Handle, string name, sgfloat value);
+
+	/**
+	 * Replace the sound of a playing handle by generator, both are heard
+	 * during an equal power crossfade of ms (the handle stays the same).
+	 * The replaced tree is deleted by collect(), never by the audio thread.
+	 */
+	bool swap(Handle, SoundGenerator* generator, uint32_t ms);
+
+	/**
+	 * Same as swap for the playing sound old, without locking the audio
+	 * thread : the request is queued and the next rendered block starts the
+	 * crossfade, computed sample by sample. generator takes the handle of old.
+	 * If old is not playing anymore by then, generator is dropped instead. The
+	 * engine owns both trees from now on, collect() deletes the replaced ones.
+	 * @return false if generator is invalid or too many requests are pending
+	 */
+	bool replace(SoundGenerator* old, SoundGenerator* generator, uint32_t ms);
+
+	/**
+	 * Delete the trees replaced by swap and give the sounds auto removed to
+	 * their callback (not from the audio thread), @return how many trees
+	 */
+	size_t collect();
+
+	// Bus of that name, created if needed
+	Bus bus(const string& name);
+
+	uint16_t busCount();
+
+	bool setBusVolume(Bus, sgfloat vol);
+	sgfloat getBusVolume(Bus);
+
+	// Same as fade_in / fade_out, for one bus
+	void fadeBusIn(Bus bus, int time, GainRamp::Curve curve = GainRamp::LINEAR) { rampBusVolume(bus, 1, time, curve); }
+	void fadeBusOut(Bus bus, int time, GainRamp::Curve curve = GainRamp::LINEAR) { rampBusVolume(bus, 0, time, curve); }
+
+	// Bus volume goes to vol in time ms
+	bool rampBusVolume(Bus, sgfloat vol, int time, GainRamp::Curve curve = GainRamp::LINEAR);
+
+	/**
+	 * Insert effect of a bus : a patch where the word bus is the mix of the
+	 * bus sounds, e.g. "reverb 10:50 low 4000 bus" ("" removes it).
+	 * The previous effect is deleted by collect().
+	 */
+	bool setBusEffect(Bus, const string& effect);
+
+	/**
+	 * Threads helping the audio thread to render the buses in parallel,
+	 * 0 (default) renders them all in the audio thread.
+	 * Must be called before the sound engine is started.
+	 */
+	bool setBusThreads(uint16_t threads);
+
+	/**
+	 * Master limiter : keeps the sum of the buses under its ceiling instead
+	 * of clipping it (default : 5ms look-ahead, 80ms release, ceiling 0.98,
+	 * created when the sound engine starts). nullptr leaves only the hard
+	 * clipping. The engine owns it.
+	 */
+	void setLimiter(Limiter*);
+
+	Limiter* getLimiter() const
+	{
+		return limiter;
+	}
+
+	/**
+	 * Profiling mode : the nodes of the playing trees (and of the ones played
+	 * later) are measured, see stats(). Costs nothing when disabled, the
+	 * measures are removed from the trees.
+	 */
+	void setProfiling(bool);
+
+	bool isProfiling() const
+	{
+		return profiling;
+	}
+
+	/**
+	 * Costs since profiling is enabled : the root is the engine (calls are
+	 * renders), its inputs the playing sounds then the bus effects.
+	 */
+	NodeStats stats();
+
+	// Limiter of a bus, after its volume (nullptr : none), owned by the engine
+	// (deleted at once if the bus does not exist)
+	bool setBusLimiter(Bus, Limiter*);
+
+	/**
+	 * Silent sounds (see SoundGenerator::silent) are skipped by render.
+	 * With auto remove, they are removed instead, and then given to the
+	 * callback by the next collect(), on the thread calling it (never the
+	 * audio thread) : it may delete or replay them.
+	 */
+	typedef function<void(Handle, SoundGenerator*)> Finished;
+	void setAutoRemove(bool, Finished finished = nullptr);
+
+	// Number of playing sounds currently silent
+	uint16_t sleeping() const
+	{
+		return sleeping_count;
+	}
+
+	// Mix all playing generators into stream (ech = number of int16_t to fill)
+	void render(int16_t* stream, uint32_t ech);
+
+	// Note: fade starts from the actual volume and ends exactly after time ms,
+	// one may want to change the volume before calling fade_xx
+	void fade_in(int time, GainRamp::Curve curve = GainRamp::LINEAR) { rampVolume(1, time, curve); }
+	void fade_out(int time, GainRamp::Curve curve = GainRamp::LINEAR) { rampVolume(0, time, curve); }
+
+	// Main volume goes to vol in time ms
+	void rampVolume(sgfloat vol, int time, GainRamp::Curve curve = GainRamp::LINEAR);
+
+	void setVolume(sgfloat vol) { rampVolume(vol, 0); }
+	sgfloat getVolume() const { return main_volume.value(); }
+
+	// Return the number of active playing generators.
+	uint16_t count() const
+	{
+		return list_generator_size;
+	}
+
+	uint32_t samplesPerSeconds() const
+	{
+		return samples_per_seconds;
+	}
+
+	uint16_t bufSize() const
+	{
+		return buf_size;
+	}
+
+	// Number of frames rendered since the engine has started
+	uint64_t getClock() const
+	{
+		return clock;
+	}
+
+	// Settings, only before the sound engine is started
+	bool setSamplesPerSeconds(uint32_t);
+	bool setBufferSize(uint32_t);
+
+	uint32_t wantedBufferSize() const
+	{
+		return wanted_buffer_size;
+	}
+
+	/**
+	 * Render ahead mode : a dedicated thread renders up to 'blocks' buffers
+	 * in advance, the audio callback then only copies them.
+	 * 0 (default) renders directly in the audio callback.
+	 * Must be called before the sound engine is started.
+	 */
+	bool setRenderAhead(uint16_t blocks);
+
+	uint16_t renderAhead() const
+	{
+		return render_ahead;
+	}
+
+	// Number of blocks currently rendered ahead (0 if render ahead is off)
+	uint16_t queueDepth() const;
+
+	/**
+	 * Audio callback timing since the engine started (or resetTiming) :
+	 * render load, percentiles, deadline misses and underruns (render ahead
+	 * queue empty). Printed every 2 seconds in verbose mode (-v).
+	 */
+	CallbackTiming::Report timing() const
+	{
+		return callback_timing.read();
+	}
+
+	void resetTiming()
+	{
+		callback_timing.clear();
+	}
+
+	/**
+	 * Trace of the audio threads (see Tracer) keeping the last events, the
+	 * sounds and bus effects are measured one render out of sample. The
+	 * trace is written to file, if any, when the engine is closed.
+	 * 0 events stops tracing. Must be called before the sound engine is started.
+	 */
+	bool setTracing(uint32_t events, uint16_t sample = 16, const string& file = "");
+
+	Tracer* getTracer() const
+	{
+		return tracer;
+	}
+
+	// Write the trace now (Chrome trace JSON), @return false if not tracing or on error
+	bool dumpTrace(const string& file);
+
+	/**
+	 * Select the audio output (see AudioBackend::create), default: sdl
+	 * Must be called before the sound engine is started.
+	 */
+	bool setBackend(const string& spec);
+	bool setBackend(AudioBackend*);
+
+	AudioBackend* getBackend() const
+	{
+		return backend;
+	}
+
+	bool isStarted() const
+	{
+		return init_done;
+	}
+
+	void define(const string& name, const string& definition);
+	bool getDefine(const string& name, string& definition);
+
+	// Shared sounds (shared name sound), computed once for all their users
+	void share(const string& name, SoundGenerator* sound);
+	shared_ptr<SharedNode> getShared(const string& name);
+
+	// Samples of a frozen sound, rendered only if no one has them for this key
+	shared_ptr<const vector<sgfloat>> frozen(const string& key, function<vector<sgfloat>()> render);
+
+	/**
+	 * @return bool saturation has occured (reseted)
+	 */
+	bool saturated()
+	{
+		if (saturate)
+		{
+			saturate = false;
+			return true;
+		}
+		return false;
+	}
+
+  private:
+	Engine(const Engine&) = delete;
+	Engine& operator=(const Engine&) = delete;
+
+	// Main audio callback
+	static void audioCallback(void *engine, Uint8 *byteStream, int byteStreamLength);
+
+	void renderAheadLoop();
+	void stopRenderAhead();
+	void reportLoop();
+	void stopReport();
+	// Trace written when the engine is closed
+	void writeTrace();
+
+	struct Voice
+	{
+		SoundGenerator* generator;
+		sgfloat volume;
+		uint32_t slot;
+		bool asleep;
+		Bus bus;
+		SoundGenerator* outgoing;	// replaced by generator, fading out
+		uint32_t xfade;				// crossfade position and length (frames)
+		uint32_t xfade_length;
+	};
+
+	struct Slot
+	{
+		uint16_t generation;
+		uint32_t index;		// in voices when used, next free slot when not
+		NodeProfile* profile;	// root of the sound, when profiled
+	};
+
+	// Measure the nodes of a sound played in slot
+	void profileVoice(SoundGenerator*, Slot&);
+
+	// Handle of the sound playing in slot (generation in the high 16 bits)
+	Handle makeHandle(uint32_t slot) const
+	{
+		return (Handle(slots[slot].generation) << 16) | slot;
+	}
+
+	// Slot of a valid handle or nullptr (mtx must be locked)
+	Slot* find(Handle);
+	void removeVoice(Slot*);
+	// Put silent voices asleep or remove them (mtx must be locked)
+	void sleepVoices();
+	// Start fading a voice out to generator (mtx must be locked)
+	void fadeTo(Voice&, SoundGenerator* generator, uint32_t frames);
+	// Mix the outgoing sound of a voice into its sample (from any bus thread)
+	void crossfade(Voice&, sgfloat& left, sgfloat& right);
+	// Retire the outgoing sounds of the ended crossfades (audio thread, mtx locked)
+	void retireFaded();
+	// Apply the pending replace requests (audio thread, mtx locked)
+	void takeRequests();
+	// Give a replaced tree to collect() (mtx must be locked)
+	void retire(SoundGenerator*);
+
+	struct BusMix
+	{
+		BusMix(const string& name) : name(name), left(MIX_BLOCK), right(MIX_BLOCK) { }
+
+		string name;
+		GainRamp volume;
+		SoundGenerator* effect = nullptr;
+		NodeProfile effect_profile;
+		Limiter* limiter = nullptr;
+		uint32_t limiter_tail = 0;	// frames still delayed by the limiter once idle
+		sgfloat input[2];			// mix of the sounds, read by the bus of effect
+		vector<sgfloat> left;		// rendered frames
+		vector<sgfloat> right;
+		vector<uint32_t> playing;	// voices not asleep (reserved by play)
+		vector<uint64_t> spent;		// by the playing voices, traced renders (reserved by play)
+	};
+
+	// Mix frames of the sounds of a bus into its buffers
+	void renderBus(BusMix&, uint32_t frames);
+	// Render the buses having work, in parallel with the bus threads if any
+	void renderBuses(uint32_t frames);
+	// Take and render one bus of a round, @return false when there is none left
+	bool renderJob(uint32_t round);
+	void busLoop();
+	void stopBusThreads();
+
+	ParseContext parser;
+	mutex parser_mtx;
+	map<string, string> defines;
+	map<string, shared_ptr<SharedNode>> shared;
+	mutex defines_mtx;		// defines and shared
+	map<string, weak_ptr<const vector<sgfloat>>> frozen_samples;
+	mutex frozen_mtx;
+	bool init_done = false;
+	AudioBackend* backend = nullptr;
+	vector<Voice> voices;	// dense array of playing sounds
+	vector<Slot> slots;		// handle -> voice
+	uint32_t free_slot = 0;	// first free slot (slots.size() if none)
+	uint16_t list_generator_size = 0; // avoid mx use
+	uint16_t sleeping_count = 0;
+	bool auto_remove = false;
+	Finished on_finished;
+	RingBuffer<pair<Handle, SoundGenerator*>> finished;	// written under mtx, read by collect()
+	mutex mtx;
+	uint16_t buf_size;
+	bool saturate = false;
+	uint32_t wanted_buffer_size;
+	uint32_t samples_per_seconds;
+	uint64_t clock = 0;
+	SDL_AudioSpec have;
+	GainRamp main_volume;
+	uint16_t render_ahead = 0;
+	RingBuffer<int16_t>* ring = nullptr;
+	thread* render_thread = nullptr;
+	atomic<bool> render_running;
+	struct Replace
+	{
+		SoundGenerator* old;		// compared only, never dereferenced by render
+		Handle handle;				// of old when replace() was called
+		SoundGenerator* generator;
+		uint32_t frames;
+	};
+
+	RingBuffer<Replace> requests;			// read by render
+	mutex requests_mtx;					// between the threads calling replace
+	RingBuffer<SoundGenerator*> retired;	// written under mtx, read by collect()
+	vector<SoundGenerator*> retired_late;	// when retired is full (not from render)
+	mutex retired_mtx;
+
+	vector<BusMix*> buses;
+	vector<Bus> jobs;					// buses rendered this block
+	uint16_t bus_thread_count = 0;
+	vector<thread*> bus_threads;
+	atomic<bool> bus_running;
+	atomic<uint64_t> next_job;			// round (32 bits), jobs count (16) and next job (16)
+	atomic<uint32_t> jobs_done;
+	uint32_t job_frames = 0;
+	mutex bus_mtx;						// bus threads only, to wait for a round
+	condition_variable bus_wake;
+
+	vector<sgfloat> master_left;		// sum of the buses (MIX_BLOCK)
+	vector<sgfloat> master_right;
+	Limiter* limiter = nullptr;
+	bool default_limiter = true;		// created by init() if none is set
+
+	atomic<bool> profiling;
+	NodeProfile engine_profile;			// renders
+
+	CallbackTiming callback_timing;
+	thread* report_thread = nullptr;	// verbose mode
+	bool reporting = false;
+	mutex report_mtx;
+	condition_variable report_wake;
+
+	Tracer* tracer = nullptr;
+	string trace_file;
+	uint64_t trace_renders = 0;
+	bool trace_nodes = false;			// this render measures the nodes
+};
+
+/**
+ * Voices of the same patch processed together : each node of the tree keeps
+ * the state of all the lanes (one voice per lane) in arrays and processes
+ * them in one loop, that the compiler vectorizes.
+ */
+class WideGenerator
+{
+  public:
+	static const int LANES = 8;
+
+	virtual ~WideGenerator();
+
+	// Add one sample of every lane to left and right
+	virtual void next(sgfloat* left, sgfloat* right, const sgfloat* speed) = 0;
+
+	// Note on / note off of one lane, for the whole tree
+	virtual void reset(int lane);
+	virtual void release(int lane);
+
+	// All envelopes of the lane have ended
+	virtual bool finished(int lane) const;
+
+	/**
+	 * Wide version of structurally identical trees (at most LANES,
+	 * missing lanes copy the first one).
+	 * @return nullptr if a node has no wide version
+	 */
+	static WideGenerator* build(vector<SoundGenerator*> lanes);
+
+	// Wide versions of the inputs of lanes, @return false if not possible
+	bool buildInputs(const vector<SoundGenerator*>& lanes);
+
+  protected:
+	vector<WideGenerator*> inputs;
+};
+
+/**
+ * Writes a parsed (and optimized) tree as C++ : nested templates of
+ * libsynth_static.hpp nodes run by a StaticPatch (synth --emit-cpp).
+ */
+class CppEmitter
+{
+  public:
+	/**
+	 * Source defining SoundGenerator* synth_patch_<name>(ParseContext&),
+	 * rate dependent values are baked for the engine of the tree.
+	 * @return false if a node has no static version
+	 */
+	static bool emit(ostream& out, const SoundGenerator* tree, const string& name);
+
+	// Static type and constructor call of a node, @return false if not supported
+	static bool node(const SoundGenerator*, string& type, string& init);
+
+	// Literal reading back as the same sgfloat
+	static string number(sgfloat);
+
+	// Name usable in C++ identifiers
+	static string identifier(const string& name);
+};
+
+/**
+ * Compiled patch file (.synthc) : parsed and optimized trees with their
+ * baked parameters and tables, instantiated without any text parsing.
+ *
+ * 32 bits words, native endianness (the magic tells) :
+ *   "SYNC" version rate
+ *   type count, type names
+ *   patch count, { patch name, offset of its root node }
+ *   nodes : type index, fields, then inputs (depth first)
+ * Strings are a length followed by their chars padded to a word.
+ */
+class PatchWriter
+{
+  public:
+	static const uint32_t MAGIC = 0x434E5953;	// "SYNC"
+	static const uint32_t VERSION = 1;
+
+	PatchWriter(uint32_t rate) : rate(rate) { }
+
+	// @return false if a node has no compiled version (nothing added)
+	bool add(const string& name, const SoundGenerator* tree);
+
+	// Name of the last node without compiled version
+	const string& unsupported() const
+	{
+		return missing;
+	}
+
+	bool save(const string& file) const;
+
+	// File content
+	vector<uint32_t> data() const;
+
+	// Node fields
+	void real(sgfloat);
+	void integer(uint32_t);
+	bool input(const SoundGenerator*);
+
+  private:
+	void text(vector<uint32_t>&, const string&) const;
+
+	uint32_t rate;
+	string missing;
+	vector<string> types;
+	vector<pair<string, uint32_t>> patches;
+	vector<uint32_t> nodes;
+};
+
+// Maps a .synthc file and builds its patches, one build at a time
+class PatchReader
+{
+  public:
+	PatchReader() { }
+	~PatchReader() { close(); }
+
+	bool open(const string& file);
+
+	// File content already in memory, kept by the caller while reading
+	bool open(const uint32_t* data, size_t words);
+
+	void close();
+
+	vector<string> names() const;
+
+	// Patch of the file (built for its sample rate), nullptr if missing or corrupted
+	SoundGenerator* build(const string& name, ParseContext& ctx);
+
+	uint32_t sampleRate() const
+	{
+		return rate;
+	}
+
+	// Node fields, 0 / nullptr once past the end or corrupted
+	sgfloat real();
+	uint32_t integer();
+	SoundGenerator* input();
+
+	bool good() const
+	{
+		return !failed;
+	}
+
+	// Invalid field value
+	void fail()
+	{
+		failed = true;
+	}
+
+  private:
+	bool header();
+	bool text(string&);
+
+	bool mapped = false;
+	const uint32_t* words = nullptr;
+	size_t size = 0;		// words
+	size_t base = 0;		// first node word
+	size_t position = 0;
+	bool failed = false;
+	uint32_t rate = 0;
+	vector<string> types;
+	map<string, uint32_t> patches;
+	ParseContext* ctx = nullptr;
+};
+
+/**
+ * Patches of a directory, parsed on first use only. index() reads the
+ * patch names and the defines each file provides and uses, build() parses
+ * a patch once (after the files defining what it uses) into a prototype :
+ * its compiled tree (PatchWriter), or its text when a node has no compiled
+ * version. Prototypes stay in a memory bounded LRU cache.
+ */
+class PatchLibrary
+{
+  public:
+	struct Stats
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		double parse_time = 0;	// seconds spent parsing prototypes
+		size_t bytes = 0;		// prototypes in cache
+		size_t prototypes = 0;
+
+		double hitRate() const
+		{
+			return hits + misses ? (double) hits / (hits + misses) : 0;
+		}
+	};
+
+	PatchLibrary(Engine& engine, size_t max_bytes = 4 << 20);
+	~PatchLibrary();
+
+	// Adds the *.synth files of dir (name.synth is patch name), @return patch count
+	size_t index(const string& dir);
+
+	vector<string> names() const;
+
+	// Patches defining what name uses
+	vector<string> dependencies(const string& name) const;
+
+	// New instance of a patch, nullptr if unknown or invalid
+	SoundGenerator* build(const string& name);
+
+	// Parse prototypes on a background thread, before they are needed
+	void prefetch(const vector<string>& names);
+
+	Stats stats() const;
+
+  private:
+	struct Entry
+	{
+		string file;
+		vector<string> needs;			// patches providing the defines used
+		bool defined = false;			// its defines are in the engine
+		shared_ptr<const vector<uint32_t>> compiled;
+		shared_ptr<const string> text;
+		size_t bytes = 0;
+		bool cached = false;
+		list<string>::iterator lru;
+	};
+
+	// Prototype of name in the cache, @return false if it does not build
+	bool load(const string& name);
+
+	// Defines of the patches name depends on are in the engine
+	void define(const string& name, vector<string>& visited);
+
+	void evict();
+	void worker();
+
+	Engine& engine;
+	size_t max_bytes;
+	map<string, Entry> entries;
+	list<string> lru;				// most recently used first
+	Stats counters;
+	mutable mutex mtx;
+
+	thread* prefetcher = nullptr;
+	list<string> queue;
+	condition_variable queued;
+	bool stopping = false;
+};
+
+/**
+ * Hot reload : plays patch files and, each time one is saved, parses it again
+ * on its own thread and swaps the playing sounds with a crossfade (see
+ * Engine::swap). The parse never holds the audio lock. Replaced trees are
+ * deleted by this thread too.
+ */
+class PatchWatcher
+{
+  public:
+	PatchWatcher(Engine& engine, uint32_t crossfade_ms = 20);
+	~PatchWatcher();
+
+	// Build and play a .synth file, reloaded while the handle plays
+	Engine::Handle play(const string& file);
+
+	// Stop reloading a handle (it keeps playing)
+	void forget(Engine::Handle);
+
+	// Number of sounds replaced so far
+	uint32_t reloads() const
+	{
+		return reload_count;
+	}
+
+  private:
+	struct Watched
+	{
+		string file;
+		vector<Engine::Handle> handles;
+	};
+
+	SoundGenerator* build(const string& file);
+	void reload(pair<int, string> key);
+	void loop();
+
+	Engine& engine;
+	uint32_t crossfade_ms;
+	int fd;						// inotify
+	map<pair<int, string>, Watched> files;	// (directory watch, file name)
+	mutex mtx;
+	thread* watcher = nullptr;
+	atomic<bool> running;
+	atomic<uint32_t> reload_count;
+};
+
 class SoundGenerator
 {
   public:
@@ -38,8 +1448,32 @@ class SoundGenerator
 	// speed = samples/sec modifier
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) = 0;
 
+	// Next sample of a mono() generator, only one channel is computed
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0);
+
 	virtual void reset() { };
 
+	// Sub generators of this one (for tree walks)
+	virtual void inputs(vector<SoundGenerator**>&) { }
+
+	// This generator and all its sub generators, depth first
+	void collect(vector<SoundGenerator*>& nodes);
+
+	// Only zeros from now on (until reset)
+	virtual bool silent() const { return false; }
+
+	// Seconds it may still sound once its sources are silent (echoes...)
+	virtual sgfloat tail() const;
+
+	// Left and right are always the same
+	virtual bool mono() const { return false; }
+
+	/**
+	 * Cheaper generator with the same output, or this. Called by
+	 * ParseContext::optimize once the inputs are optimized.
+	 */
+	virtual SoundGenerator* optimize(ParseContext&) { return this; }
+
 	bool setValue(string name, sgfloat  value);
 	bool setValue(string name, string value);
 	bool setValue(string name, istream& value);
@@ -54,10 +1488,10 @@ class SoundGenerator
 		return true;
 	}
 
+	// Build with the default engine
 	static SoundGenerator* factory(istream& in, bool needed = false);
-	static SoundGenerator* factory(string type, istream& in);
-
 	static SoundGenerator* factory(string s);
+
 	static string getTypes();
 
 	/**
@@ -67,22 +1501,25 @@ class SoundGenerator
 
 	static void help();
 
-	static string last_type;
-
-	static void missingGeneratorExit(string msg = "");
-
-	static void play(SoundGenerator*); // Add it if necessary
+	// Static api, applies to the default engine
+	static Engine::Handle play(SoundGenerator*); // Add it if necessary
 	static bool stop(SoundGenerator*);
 	static bool remove(SoundGenerator*); // Remove it
 	static bool has(SoundGenerator*, bool bLock = false); // Does it playing ?
+
+	static bool remove(Engine::Handle handle) { return Engine::getDefault().remove(handle); }
+	static bool has(Engine::Handle handle) { return Engine::getDefault().has(handle); }
+	static bool setVolume(Engine::Handle handle, sgfloat vol) { return Engine::getDefault().setVolume(handle, vol); }
+	static bool replace(SoundGenerator* old, SoundGenerator* generator, uint32_t ms) { return Engine::getDefault().replace(old, generator, ms); }
+	static void setAutoRemove(bool remove, Engine::Finished finished = nullptr) { Engine::getDefault().setAutoRemove(remove, finished); }
 	
-	// Note: fade does not change the actual volume
-	// one may want to change it before calling fade_xx
-	static void fade_in(int time) { fade(1, time); }
-  static void fade_out(int time) { fade(-1, time); }
+	// Note: fade starts from the actual volume and ends exactly after time ms,
+	// one may want to change the volume before calling fade_xx
+	static void fade_in(int time, GainRamp::Curve curve = GainRamp::LINEAR) { Engine::getDefault().fade_in(time, curve); }
+	static void fade_out(int time, GainRamp::Curve curve = GainRamp::LINEAR) { Engine::getDefault().fade_out(time, curve); }
 
-	static void setVolume(sgfloat vol) { main_volume = vol; }
-	static sgfloat getVolume() { return main_volume; }
+	static void setVolume(sgfloat vol) { Engine::getDefault().setVolume(vol); }
+	static sgfloat getVolume() { return Engine::getDefault().getVolume(); }
 
 	/**
 	 * Eat expected word if exist else 'in' is left unchanged and false is returned
@@ -115,17 +1552,53 @@ class SoundGenerator
 
 	static uint16_t count()
 	{
-		return list_generator_size;
+		return Engine::getDefault().count();
 	}
 
 	static uint32_t samplesPerSeconds()
 	{
-		return samples_per_seconds;
+		return Engine::getDefault().samplesPerSeconds();
 	}
 
 	static uint16_t bufSize()
 	{
-		return buf_size;
+		return Engine::getDefault().bufSize();
+	}
+
+	static bool setRenderAhead(uint16_t blocks)
+	{
+		return Engine::getDefault().setRenderAhead(blocks);
+	}
+
+	static uint16_t renderAhead()
+	{
+		return Engine::getDefault().renderAhead();
+	}
+
+	static uint16_t queueDepth()
+	{
+		return Engine::getDefault().queueDepth();
+	}
+
+	static bool setBackend(const string& spec)
+	{
+		return Engine::getDefault().setBackend(spec);
+	}
+
+	static bool setBackend(AudioBackend* backend)
+	{
+		return Engine::getDefault().setBackend(backend);
+	}
+
+	static AudioBackend* getBackend()
+	{
+		return Engine::getDefault().getBackend();
+	}
+
+	// Engine this generator has been built for
+	Engine* getEngine() const
+	{
+		return engine;
 	}
 
 	class HelpOption
@@ -245,59 +1718,65 @@ class SoundGenerator
   protected:
 	virtual bool _setValue(string name, istream& value);
 
-	SoundGenerator() { };
+	SoundGenerator(ParseContext& ctx) : engine(&ctx.engine) { };
+
+	// Auto register for the factory
+	SoundGenerator(string name);
+
+	// Sample rate of the engine this generator is built for
+	uint32_t sampleRate() const
+	{
+		return engine->samplesPerSeconds();
+	}
+
+	bool readFrequencyVolume(istream &in);
+
+	// next() of a single channel generator
+	void widen(sgfloat  &left, sgfloat  &right, sgfloat  speed)
+	{
+		sgfloat  v = nextMono(speed);
+		left += v;
+		right += v;
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const = 0;
 
-	// Auto register for the factory
-	SoundGenerator(string name);
+	// Kernel running lanes (copies of this) at once, see WideGenerator
+	virtual WideGenerator* wide(const vector<SoundGenerator*>& lanes) const { return nullptr; }
 
-	bool readFrequencyVolume(istream &in);
+	// Static node type and constructor arguments, see CppEmitter
+	virtual bool cpp(string& type, string& args) const { return false; }
+
+	// Compiled patch file (.synthc) : fields and inputs written by save are read back by load
+	virtual bool save(PatchWriter&) const { return false; }
+	virtual SoundGenerator* load(PatchReader&, ParseContext&) const { return nullptr; }
 
-	virtual SoundGenerator* build(istream& in) const = 0;
 	virtual void help(Help& help) const;
 	void help(ostream&) const;
 	HelpEntry* addHelpOption(HelpEntry*) const;
 
-	// Main audio callback
-	static void audioCallback(void *unused, Uint8 *byteStream, int byteStreamLength);
-
 	sgfloat  volume;
 	sgfloat  freq;
+	Engine*  engine = nullptr;
+	Engine::Handle handle = 0;	// when playing
+	bool single = false;		// mono() tree running nextMono (see ParseContext::optimize)
 
 	static void close();
 
-	/**
-	 * @return bool saturation has occured (reseted) 
-	 */
 	static bool saturated()
 	{
-		if (saturate)
-		{
-			saturate = false;
-			return true;
-		}
-		return false;
+		return Engine::getDefault().saturated();
 	}
 
   private:
-  static void fade(int dir, int time);
+	friend class ParseContext;
+	friend class Engine;
+	friend class WideGenerator;
+	friend class CppEmitter;
+	friend class PatchWriter;
+	friend class PatchReader;
 
 	static map<string, const SoundGenerator*> generators;
-	static map<string, string> defines;
-	static bool echo;
-	static uint8_t verbose;
-	static bool init_done;
-	static SDL_AudioDeviceID dev;
-	static list<SoundGenerator*> list_generator;
-	static uint16_t list_generator_size;
-	static mutex mtx;
-	static uint16_t buf_size;
-	static bool saturate;
-	static uint32_t wanted_buffer_size;
-	static uint32_t samples_per_seconds;
-	static SDL_AudioSpec have;
-	static bool fading;
-	static sgfloat dvol;      // delta (main_volume each dt)
-	static sgfloat main_volume;
 };
 
 template<class T>
@@ -312,9 +1791,9 @@ class SoundGeneratorVarHook : public SoundGenerator
 	mmax(max),
 	SoundGenerator(name) { }
 
-	SoundGeneratorVarHook(istream &in, atomic<T>* v, T min, T max)
+	SoundGeneratorVarHook(istream &in, ParseContext& ctx, atomic<T>* v, T min, T max)
 	:
-	mref(v), mmin(min), mmax(max) { }
+	SoundGenerator(ctx), mref(v), mmin(min), mmax(max) { }
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override
 	{
@@ -331,9 +1810,9 @@ class SoundGeneratorVarHook : public SoundGenerator
 
   protected:
 
-	virtual SoundGenerator* build(istream &in) const override
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new SoundGeneratorVarHook<T>(in, mref, mmin, mmax);
+		return new SoundGeneratorVarHook<T>(in, ctx, mref, mmin, mmax);
 	}
 
   private:
@@ -348,7 +1827,8 @@ class WhiteNoiseGenerator : public SoundGenerator
 
 	WhiteNoiseGenerator() : SoundGenerator("wnoise") { } // factory
 
-	WhiteNoiseGenerator(istream& in) { };
+	WhiteNoiseGenerator(PatchReader& in, ParseContext& ctx);
+	WhiteNoiseGenerator(istream& in, ParseContext& ctx) : SoundGenerator(ctx) { };
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override
 	{
@@ -358,9 +1838,18 @@ class WhiteNoiseGenerator : public SoundGenerator
 
   protected:
 
-	virtual SoundGenerator* build(istream &in) const override
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
+	{
+		return new WhiteNoiseGenerator(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new WhiteNoiseGenerator(in);
+		return new WhiteNoiseGenerator(in, ctx);
 	}
 
 	virtual void help(Help& help) const override
@@ -380,17 +1869,33 @@ class TriangleGenerator : public SoundGenerator
 
 	TriangleGenerator() : SoundGenerator("tri triangle") { }; // factory
 
-	TriangleGenerator(istream& in);
+	TriangleGenerator(PatchReader& in, ParseContext& ctx);
+	TriangleGenerator(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual bool mono() const override
+	{
+		return true;
+	}
 	virtual void reset() override;
 
   protected:
 	virtual bool _setValue(string name, istream& in) override;
 
-	virtual SoundGenerator* build(istream& in) const override
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
+	{
+		return new TriangleGenerator(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new TriangleGenerator(in);
+		return new TriangleGenerator(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
@@ -410,17 +1915,41 @@ class SquareGenerator : public SoundGenerator
 
 	SquareGenerator() : SoundGenerator("sq square") { };
 
-	SquareGenerator(istream& in);
+	SquareGenerator(PatchReader& in, ParseContext& ctx);
+	SquareGenerator(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual bool mono() const override
+	{
+		return true;
+	}
+
+	virtual void reset() override
+	{
+		a = 0;
+		val = 1;
+	}
 
 
   protected:
 	virtual bool _setValue(string name, istream& in) override;
 
-	virtual SoundGenerator* build(istream& in) const override
+	virtual WideGenerator* wide(const vector<SoundGenerator*>& lanes) const override;
+
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
 	{
-		return new SquareGenerator(in);
+		return new SquareGenerator(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return new SquareGenerator(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
@@ -438,16 +1967,39 @@ class SinusGenerator : public SoundGenerator
 
 	SinusGenerator() : SoundGenerator("sin sinus") { };
 
-	SinusGenerator(istream& in);
+	SinusGenerator(PatchReader& in, ParseContext& ctx);
+	SinusGenerator(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual bool mono() const override
+	{
+		return true;
+	}
+
+	virtual void reset() override
+	{
+		a = 0;
+	}
 
   protected:
 	virtual bool _setValue(string name, istream& in) override;
 
-	virtual SoundGenerator* build(istream& in) const override
+	virtual WideGenerator* wide(const vector<SoundGenerator*>& lanes) const override;
+
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
+	{
+		return new SinusGenerator(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new SinusGenerator(in);
+		return new SinusGenerator(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
@@ -464,9 +2016,26 @@ class DistortionGenerator : public SoundGenerator
 
 	DistortionGenerator() : SoundGenerator("distorsion") { }
 
-	DistortionGenerator(istream& in);
+	DistortionGenerator(PatchReader& in, ParseContext& ctx);
+	DistortionGenerator(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
+	virtual bool mono() const override
+	{
+		return generator->mono();
+	}
+
+	virtual bool silent() const override
+	{
+		return generator->silent();
+	}
 
 	virtual bool isValid() const override
 	{
@@ -475,9 +2044,18 @@ class DistortionGenerator : public SoundGenerator
 
   protected:
 
-	virtual SoundGenerator* build(istream& in) const override
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
 	{
-		return new DistortionGenerator(in);
+		return new DistortionGenerator(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return new DistortionGenerator(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
@@ -493,15 +2071,43 @@ class LevelSound : public SoundGenerator
 
 	LevelSound() : SoundGenerator("level") { }
 
-	LevelSound(istream &in);
+	LevelSound(PatchReader& in, ParseContext& ctx);
+	LevelSound(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 0.1) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	sgfloat  getLevel() const
+	{
+		return level;
+	}
+
+	virtual bool mono() const override
+	{
+		return true;
+	}
+
+	virtual bool silent() const override
+	{
+		return level == 0;
+	}
 
   protected:
 
-	virtual SoundGenerator* build(istream &in) const override
+	virtual WideGenerator* wide(const vector<SoundGenerator*>& lanes) const override;
+
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
 	{
-		return new LevelSound(in);
+		return new LevelSound(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return new LevelSound(in, ctx);
 	}
 
   private:
@@ -514,9 +2120,29 @@ class FmModulator : public SoundGenerator
 
 	FmModulator() : SoundGenerator("fm") { } // for thefactory
 
-	FmModulator(istream& in);
+	FmModulator(PatchReader& in, ParseContext& ctx);
+	FmModulator(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&sound);
+		in.push_back(&modulator);
+	}
+
+	virtual bool mono() const override
+	{
+		return sound->mono();
+	}
+
+	virtual SoundGenerator* optimize(ParseContext&) override;
+
+	virtual bool silent() const override
+	{
+		return sound == 0 || sound->silent();
+	}
 
 	virtual bool isValid() const override
 	{
@@ -527,9 +2153,20 @@ class FmModulator : public SoundGenerator
 
   protected:
 
-	virtual SoundGenerator* build(istream& in) const override
+	virtual WideGenerator* wide(const vector<SoundGenerator*>& lanes) const override;
+
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
 	{
-		return new FmModulator(in);
+		return new FmModulator(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return new FmModulator(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
@@ -551,23 +2188,56 @@ class MixerGenerator : public SoundGenerator
 
 	MixerGenerator() : SoundGenerator("{") { };
 
-	MixerGenerator(istream& in);
+	MixerGenerator(PatchReader& in, ParseContext& ctx);
+	MixerGenerator(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		for (auto& generator : generators)
+			in.push_back(&generator);
+	}
+
+	virtual bool mono() const override;
+
+	virtual SoundGenerator* optimize(ParseContext&) override;
 
+	virtual bool silent() const override;
+
+	virtual void reset() override
+	{
+		silence_check = 0;
+	}
 
   protected:
 
-	virtual SoundGenerator* build(istream &in) const override
+	virtual WideGenerator* wide(const vector<SoundGenerator*>& lanes) const override;
+
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
+	{
+		return new MixerGenerator(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new MixerGenerator(in);
+		return new MixerGenerator(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
 
   private:
-	list<SoundGenerator*> generators;
+	// Silence of the inputs, evaluated once per block (silent() walks a tree)
+	void checkSilence();
 
+	list<SoundGenerator*> generators;
+	vector<bool> quiet;				// by input, at the last check
+	uint32_t silence_check = 0;		// samples until the next check
 };
 
 class LeftSound : public SoundGenerator
@@ -576,13 +2246,26 @@ class LeftSound : public SoundGenerator
 
 	LeftSound() : SoundGenerator("left") { }
 
-	LeftSound(istream& in)
+	LeftSound(PatchReader& in, ParseContext& ctx);
+	LeftSound(istream& in, ParseContext& ctx) : SoundGenerator(ctx)
 	{
-		generator = factory(in, true);
+		generator = ctx.factory(in, true);
 	}
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
 
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
+	virtual SoundGenerator* optimize(ParseContext&) override;
+
+	virtual bool silent() const override
+	{
+		return generator->silent();
+	}
+
 	virtual bool isValid() const override
 	{
 		return generator != 0;
@@ -590,9 +2273,18 @@ class LeftSound : public SoundGenerator
 
   protected:
 
-	virtual SoundGenerator* build(istream& in) const override
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
+	{
+		return new LeftSound(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new LeftSound(in);
+		return new LeftSound(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
@@ -607,10 +2299,23 @@ class RightSound : public SoundGenerator
   public:
 
 	RightSound() : SoundGenerator("right") { }
-	RightSound(istream &in);
+	RightSound(PatchReader& in, ParseContext& ctx);
+	RightSound(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
 
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
+	virtual SoundGenerator* optimize(ParseContext&) override;
+
+	virtual bool silent() const override
+	{
+		return generator->silent();
+	}
+
 	virtual bool isValid() const override
 	{
 		return generator != 0;
@@ -618,9 +2323,18 @@ class RightSound : public SoundGenerator
 
   protected:
 
-	virtual SoundGenerator* build(istream& in) const override
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
+	{
+		return new RightSound(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new RightSound(in);
+		return new RightSound(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
@@ -634,9 +2348,26 @@ class ClampSound : public SoundGenerator
   public:
 
 	ClampSound() : SoundGenerator("clamp") { }
-	ClampSound(istream &in);
+	ClampSound(PatchReader& in, ParseContext& ctx);
+	ClampSound(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
+	virtual bool mono() const override
+	{
+		return generator && generator->mono();
+	}
+
+	virtual bool silent() const override
+	{
+		return generator->silent();
+	}
 
 	virtual bool isValid() const override
 	{
@@ -644,9 +2375,18 @@ class ClampSound : public SoundGenerator
 	}
 
   protected:
-	virtual SoundGenerator* build(istream &in) const override
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
+	{
+		return new ClampSound(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new ClampSound(in);
+		return new ClampSound(in, ctx);
 	}
 	
 	void init();
@@ -664,9 +2404,29 @@ class EnvelopeSound : public SoundGenerator
 
 	EnvelopeSound() : SoundGenerator("envelope env") { }
 
-	EnvelopeSound(istream &in);
+	EnvelopeSound(PatchReader& in, ParseContext& ctx);
+	EnvelopeSound(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
+	virtual bool mono() const override
+	{
+		return generator && generator->mono();
+	}
+
+	// Duration of a loop in seconds, 0 if not looping
+	sgfloat  loopTime() const
+	{
+		return loop ? (data.size() - 1) / dindex / sampleRate() : 0;
+	}
+
+	virtual bool silent() const override;
 
 	virtual bool isValid() const override
 	{
@@ -678,19 +2438,33 @@ class EnvelopeSound : public SoundGenerator
 
   protected:
 
-	virtual SoundGenerator* build(istream& in) const override
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
+	{
+		return new EnvelopeSound(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new EnvelopeSound(in);
+		return new EnvelopeSound(in, ctx);
 	}
 
 
   private:
+	// Once envelope that has reached its final zero, or its end
+	bool ended() const;
+	// Level of the next sample
+	sgfloat  gain();
+
 	bool loop;
 	sgfloat  index;
 	sgfloat  dindex;
 
 	vector<sgfloat > data;
-	SoundGenerator* generator;
+	SoundGenerator* generator = nullptr;
 };
 
 class MonoGenerator : public SoundGenerator
@@ -699,9 +2473,28 @@ class MonoGenerator : public SoundGenerator
 
 	MonoGenerator() : SoundGenerator("mono") { }
 
-	MonoGenerator(istream &in);
+	MonoGenerator(PatchReader& in, ParseContext& ctx);
+	MonoGenerator(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
+	virtual bool mono() const override
+	{
+		return true;
+	}
+
+	virtual SoundGenerator* optimize(ParseContext&) override;
+
+	virtual bool silent() const override
+	{
+		return generator->silent();
+	}
 
 	virtual bool isValid() const override
 	{
@@ -712,9 +2505,18 @@ class MonoGenerator : public SoundGenerator
 
   protected:
 
-	virtual SoundGenerator* build(istream &in) const override
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
 	{
-		return new MonoGenerator(in);
+		return new MonoGenerator(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return new MonoGenerator(in, ctx);
 	}
 
   private:
@@ -727,21 +2529,53 @@ class AmGenerator : public SoundGenerator
 
 	AmGenerator() : SoundGenerator("am") { }; // for the factory
 
-	AmGenerator(istream &in);
+	AmGenerator(PatchReader& in, ParseContext& ctx);
+	AmGenerator(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+		in.push_back(&modulator);
+	}
+
+	virtual bool mono() const override
+	{
+		return generator->mono() && (min == max || modulator->mono());
+	}
+
+	virtual SoundGenerator* optimize(ParseContext&) override;
+
+	virtual bool silent() const override
+	{
+		return generator == 0 || generator->silent();
+	}
+
 	virtual void help(Help& help) const override;
 
 	virtual bool isValid() const override
 	{
-		return generator != 0 && modulator != 0;
+		return generator != 0 && (modulator != 0 || min == max);
 	}
 
   protected:
 
-	virtual SoundGenerator* build(istream& in) const override
+	virtual WideGenerator* wide(const vector<SoundGenerator*>& lanes) const override;
+
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
+	{
+		return new AmGenerator(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new AmGenerator(in);
+		return new AmGenerator(in, ctx);
 	}
 
 
@@ -749,7 +2583,7 @@ class AmGenerator : public SoundGenerator
 	sgfloat  min;
 	sgfloat  max;
 	SoundGenerator* generator;
-	SoundGenerator* modulator;
+	SoundGenerator* modulator = nullptr;
 };
 
 class ReverbGenerator : public SoundGenerator
@@ -758,9 +2592,38 @@ class ReverbGenerator : public SoundGenerator
 
 	ReverbGenerator() : SoundGenerator("reverb echo") { }
 
-	ReverbGenerator(istream& in);
+	ReverbGenerator(PatchReader& in, ParseContext& ctx);
+	ReverbGenerator(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
+	virtual bool mono() const override
+	{
+		return generator && generator->mono();
+	}
+
+	// Tail over and input still silent (a re-triggered input wakes it)
+	virtual bool silent() const override
+	{
+		return quiet >= tail_samples && generator->silent();
+	}
+
+	virtual void reset() override
+	{
+		fill(buf_left, buf_left + buf_size, 0);
+		fill(buf_right, buf_right + buf_size, 0);
+		index = 0;
+		quiet = 0;
+		silence_check = 0;
+	}
+
+	virtual sgfloat  tail() const override;
 
 	virtual void help(Help& help) const override;
 
@@ -771,12 +2634,33 @@ class ReverbGenerator : public SoundGenerator
 
   protected:
 
-	virtual SoundGenerator* build(istream &in) const override
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
+	{
+		return new ReverbGenerator(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new ReverbGenerator(in);
+		return new ReverbGenerator(in, ctx);
 	}
 
   private:
+	// Silence of the input, evaluated once per block (silent() may walk a tree)
+	bool inputSilent()
+	{
+		if (silence_check == 0)
+		{
+			input_silent = generator->silent();
+			silence_check = Engine::MIX_BLOCK;
+		}
+		silence_check--;
+		return input_silent;
+	}
+
 	bool echo;
 	sgfloat  vol;
 	sgfloat  ech_vol;
@@ -784,7 +2668,11 @@ class ReverbGenerator : public SoundGenerator
 	sgfloat * buf_right;
 	uint32_t buf_size;
 	uint32_t index;
-	SoundGenerator* generator;
+	uint32_t quiet = 0;			// samples since the sound is silent
+	uint32_t tail_samples;		// until echoes are below -80dB
+	uint32_t silence_check = 0;	// samples until the input silence is checked
+	bool input_silent = false;
+	SoundGenerator* generator = nullptr;
 };
 
 
@@ -794,17 +2682,23 @@ class BlepOscillator : public SoundGenerator
 
 	BlepOscillator() : SoundGenerator("blep") { }
 
-	BlepOscillator(istream& in);
+	BlepOscillator(istream& in, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	virtual bool mono() const override
+	{
+		return true;
+	}
 
 	virtual void help(Help& help) const override;
 
   protected:
 
-	virtual SoundGenerator* build(istream &in) const override
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new BlepOscillator(in);
+		return new BlepOscillator(in, ctx);
 	}
 	
 	void update();
@@ -822,7 +2716,7 @@ class AvcRegulator : public SoundGenerator
 
 	AvcRegulator() : SoundGenerator("avc") { };
 
-	AvcRegulator(istream &in);
+	AvcRegulator(istream& in, ParseContext& ctx);
 
 	virtual void reset() override
 	{
@@ -831,6 +2725,16 @@ class AvcRegulator : public SoundGenerator
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
 
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
+	virtual bool silent() const override
+	{
+		return generator->silent();
+	}
+
 	virtual bool isValid() const override
 	{
 		return generator != 0;
@@ -840,13 +2744,15 @@ class AvcRegulator : public SoundGenerator
 
   private:
 
-	virtual SoundGenerator* build(istream& in) const override
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new AvcRegulator(in);
+		return new AvcRegulator(in, ctx);
 	}
 
 	SoundGenerator* generator;
 	sgfloat  factor = 0.999f;
+	sgfloat  attack;		// factor, at the sample rate
+	double   recovery;
 	sgfloat  gain;
 	sgfloat  min_gain;
 };
@@ -855,18 +2761,43 @@ class Filter : public SoundGenerator
 {
   public:
 	Filter(const string &name) : SoundGenerator(name){}
-	Filter(istream& in);
+	Filter(istream& in, ParseContext& ctx);
+	Filter(PatchReader& in, ParseContext& ctx);
 	~Filter() {}
 	
 	virtual bool isValid() const override
 	{
-		return generator != 0;
+		return generator != 0;
+	}
+	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override=0;
+
+	virtual void reset() override
+	{
+		lleft = 0;
+		lright = 0;
+	}
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
+	virtual bool mono() const override
+	{
+		return generator && generator->mono();
 	}
-	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override=0;
-	
+
+	virtual bool silent() const override
+	{
+		return generator->silent() && fabs(lleft) < 1e-6 && fabs(lright) < 1e-6;
+	}
+
+	virtual sgfloat  tail() const override;
+
   protected:
-	Filter();
+	virtual bool save(PatchWriter& out) const override;
 	
+  protected:
 	SoundGenerator* generator;
 	sgfloat  lleft;
 	sgfloat  lright;
@@ -879,15 +2810,26 @@ class LowFilter : public Filter
   public:
 
 	LowFilter() : Filter("low") { }
-	LowFilter(istream& in) : Filter(in) {}
+	LowFilter(PatchReader& in, ParseContext& ctx);
+	LowFilter(istream& in, ParseContext& ctx) : Filter(in, ctx) {}
 	
 	void next(sgfloat & left, sgfloat & right, sgfloat  speed=1.0);
+	sgfloat  nextMono(sgfloat  speed=1.0) override;
 	
   protected:
 	
-	virtual SoundGenerator* build(istream& in) const override
+	virtual WideGenerator* wide(const vector<SoundGenerator*>& lanes) const override;
+
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
+	{
+		return new LowFilter(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new LowFilter(in);
+		return new LowFilter(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
@@ -898,14 +2840,25 @@ class HighFilter : public Filter
   public:
 
 	HighFilter() : Filter("high") { }
-	HighFilter(istream& in);
+	HighFilter(PatchReader& in, ParseContext& ctx);
+	HighFilter(istream& in, ParseContext& ctx);
 	void next(sgfloat & left, sgfloat & right, sgfloat  speed=1.0) override;
+	sgfloat  nextMono(sgfloat  speed=1.0) override;
 
   protected:
 	
-	virtual SoundGenerator* build(istream& in) const override
+	virtual WideGenerator* wide(const vector<SoundGenerator*>& lanes) const override;
+
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
 	{
-		return new HighFilter(in);
+		return new HighFilter(in, ctx);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return new HighFilter(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
@@ -916,7 +2869,7 @@ class ResoFilter : public SoundGenerator
   public:
 
 	ResoFilter() : SoundGenerator("reso") { }
-	ResoFilter(istream& in);
+	ResoFilter(istream& in, ParseContext& ctx);
 	virtual ~ResoFilter() {}
 	
 	virtual bool isValid() const override
@@ -925,11 +2878,16 @@ class ResoFilter : public SoundGenerator
 	}
 	void next(sgfloat & left, sgfloat & right, sgfloat  speed=1.0) override;
 
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
   protected:
 	
-	virtual SoundGenerator* build(istream& in) const override
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new ResoFilter(in);
+		return new ResoFilter(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
@@ -954,7 +2912,7 @@ class IIRFilter : public SoundGenerator
   public:
 
 	IIRFilter();
-	IIRFilter(istream& in);
+	IIRFilter(istream& in, ParseContext& ctx);
 	virtual ~IIRFilter() {}
 	
 	virtual bool isValid() const override
@@ -963,11 +2921,16 @@ class IIRFilter : public SoundGenerator
 	}
 	void next(sgfloat & left, sgfloat & right, sgfloat  speed=1.0) override;
 
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
   protected:
 	
-	virtual SoundGenerator* build(istream& in) const override
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new IIRFilter(in);
+		return new IIRFilter(in, ctx);
 	}
 
 	virtual void help(Help& help) const override;
@@ -1009,13 +2972,45 @@ class AdsrGenerator : public SoundGenerator
 
 	AdsrGenerator() : SoundGenerator("adsr") { }
 
-	AdsrGenerator(istream& in);
+	AdsrGenerator(PatchReader& in, ParseContext& ctx);
+	AdsrGenerator(istream& in, ParseContext& ctx);
 
 	virtual void reset() override;
 
-	bool read(istream &in, value &val);
+	bool read(istream &in, value &val, ParseContext& ctx);
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override;
+
+	// Note off : leave sustain (or go to the last segment) and stop looping
+	void release();
+
+	// Envelope ended (never true while looping)
+	bool finished() const
+	{
+		return index >= values.size();
+	}
+
+	// Duration of a loop in seconds, 0 if not looping
+	sgfloat  loopTime() const
+	{
+		return loop ? values.back().s : 0;
+	}
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&generator);
+	}
+
+	virtual bool mono() const override
+	{
+		return generator && generator->mono();
+	}
+
+	virtual bool silent() const override
+	{
+		return (finished() && target.vol == 0) || generator == 0 || generator->silent();
+	}
 
 	virtual void help(Help &) const override;
 
@@ -1031,13 +3026,26 @@ class AdsrGenerator : public SoundGenerator
 
   protected:
 
-	virtual SoundGenerator* build(istream &in) const override
+	virtual WideGenerator* wide(const vector<SoundGenerator*>& lanes) const override;
+
+	virtual bool cpp(string& type, string& args) const override;
+
+	virtual bool save(PatchWriter& out) const override;
+
+	virtual SoundGenerator* load(PatchReader& in, ParseContext& ctx) const override
 	{
-		return new AdsrGenerator(in);
+		return new AdsrGenerator(in, ctx);
 	}
 
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return new AdsrGenerator(in, ctx);
+	}
 
   private:
+	// Envelope level of the next sample (vol)
+	void advance();
+
 	sgfloat  t;
 	sgfloat  dt;
 
@@ -1045,8 +3053,11 @@ class AdsrGenerator : public SoundGenerator
 	value target;
 	uint32_t index;
 	vector<value> values;
-	SoundGenerator* generator;
-	bool loop;
+	SoundGenerator* generator = nullptr;
+	bool loop = false;
+	uint32_t sustain = 0;	// index of the first release value, 0 if none
+	bool gate = true;		// false once released
+	sgfloat  vol = 0;		// last envelope level
 };
 
 class ChainSound : public SoundGenerator
@@ -1066,7 +3077,7 @@ class ChainSound : public SoundGenerator
 
 		ChainSound() : SoundGenerator("chain") { }
 
-		ChainSound(istream& in);
+		ChainSound(istream& in, ParseContext& ctx);
 
 		void add(uint32_t ms, SoundGenerator* g);
 
@@ -1074,6 +3085,17 @@ class ChainSound : public SoundGenerator
 
 		virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
 
+		virtual void inputs(vector<SoundGenerator**>& in) override
+		{
+			for (auto& element : sounds)
+				in.push_back(&element.sound);
+		}
+
+		virtual bool silent() const override
+		{
+			return it == sounds.end() && !loop;
+		}
+
 		virtual bool isValid() const override
 		{
 			return true;
@@ -1083,9 +3105,9 @@ class ChainSound : public SoundGenerator
 
   private:
 
-		virtual SoundGenerator* build(istream& in) const override
+		virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 		{
-			return new ChainSound(in);
+			return new ChainSound(in, ctx);
 		}
 
 		list<ChainElement> sounds;
@@ -1099,6 +3121,436 @@ class ChainSound : public SoundGenerator
 		sgfloat  mix_t=0.01; // duration of mix (sec)
 };
 
+/**
+ * Sound rendered once, when built, then played from memory :
+ * freeze seconds|auto [once] [xfade ms] sound
+ * auto is the longest loop of the sound (adsr, envelope), a loop can end by
+ * a crossfade with what follows it. Identical frozen sounds share their samples.
+ */
+class FreezeSound : public SoundGenerator
+{
+  public:
+	FreezeSound() : SoundGenerator("freeze") { }
+
+	FreezeSound(istream& in, ParseContext& ctx);
+
+	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+
+	virtual void reset() override
+	{
+		position = 0;
+		looped = false;
+	}
+
+	virtual bool mono() const override
+	{
+		return is_mono;
+	}
+
+	virtual bool silent() const override
+	{
+		return once && position >= length;
+	}
+
+	virtual bool isValid() const override
+	{
+		return samples && length;
+	}
+
+	virtual void help(Help& help) const override;
+
+  protected:
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return new FreezeSound(in, ctx);
+	}
+
+  private:
+	// Frame at index (0..length), looping or not
+	void frame(uint32_t index, bool wrapped, sgfloat  &left, sgfloat  &right) const;
+
+	shared_ptr<const vector<sgfloat>> samples;	// left, right (length + fade frames)
+	uint32_t length = 0;	// frames played (loop length)
+	uint32_t fade = 0;		// crossfade frames
+	double position = 0;
+	bool once = false;
+	bool looped = false;	// crossfade from the second loop
+	bool is_mono = false;
+};
+
+/**
+ * Polyphonic instrument : n voices are built once from the same patch and
+ * reused by noteOn / noteOff, so triggering a note neither parses nor allocates.
+ * The patch is written at the reference frequency (440Hz by default), a note
+ * plays it at freq/reference speed.
+ * Notes are queued lock free : one control thread may send them while playing.
+ * When all the nodes of the patch have a wide kernel, voices run in lanes.
+ */
+class PolySound : public SoundGenerator
+{
+	class Voice
+	{
+	  public:
+		SoundGenerator* sound = nullptr;
+		vector<SoundGenerator*> nodes;			// whole tree, for reset
+		vector<AdsrGenerator*> envelopes;		// released by note off
+		sgfloat  freq = 0;
+		sgfloat  speed = 1.0;
+		sgfloat  velocity = 0;
+		sgfloat  level = 0;		// peak follower (quietest stealing)
+		uint64_t started = 0;	// note on order (oldest stealing)
+		bool active = false;
+		bool released = false;
+	};
+
+	struct Event
+	{
+		sgfloat  freq;
+		sgfloat  velocity;		// < 0 for note off
+	};
+
+  public:
+	enum Steal { OLDEST, QUIETEST };
+
+	PolySound() : SoundGenerator("poly") { }
+
+	PolySound(istream& in, ParseContext& ctx);
+
+	virtual ~PolySound()
+	{
+		for (auto wide : wides)
+			delete wide;
+		delete events;
+	}
+
+	// Allocation free, @return false if the event queue is full
+	bool noteOn(sgfloat  freq, sgfloat  velocity = 1.0);
+	bool noteOff(sgfloat  freq);
+	bool allNotesOff() { return noteOff(0); }
+
+	uint16_t voiceCount() const
+	{
+		return voices.size();
+	}
+
+	// Sounding voices (only exact from the thread that renders)
+	uint16_t activeVoices() const;
+
+	// Voices run in WideGenerator lanes
+	bool isWide() const
+	{
+		return wides.size() != 0;
+	}
+
+	virtual void reset() override;
+
+	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		for (auto& voice : voices)
+			in.push_back(&voice.sound);
+	}
+
+	virtual bool isValid() const override
+	{
+		return voices.size() && voices[0].sound != 0;
+	}
+
+	virtual void help(Help& help) const override;
+
+  protected:
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return new PolySound(in, ctx);
+	}
+
+  private:
+	void start(sgfloat  freq, sgfloat  velocity);
+	void stop(sgfloat  freq);
+	Voice* steal();
+	void nextWide(sgfloat  &left, sgfloat  &right, sgfloat  speed);
+
+	vector<Voice> voices;
+	vector<WideGenerator*> wides;	// one per LANES voices, empty if scalar
+	bool scalar = false;
+	RingBuffer<Event>* events = nullptr;
+	Steal policy = OLDEST;
+	sgfloat  reference = 440.0;
+	sgfloat  decay = 0;		// level follower decay per sample
+	uint64_t notes = 0;
+};
+
+/**
+ * Sound computed once for all its users (shared name sound), so that many
+ * voices can use the same lfo, in phase. It is computed by blocks, when a
+ * user needs a sample after the last block : a shared sound using another
+ * one computes it first.
+ * Users speed is ignored, a shared sound plays at its own speed.
+ */
+class SharedNode
+{
+  public:
+	static const uint32_t BLOCK = Engine::MIX_BLOCK;
+
+	SharedNode(SoundGenerator* sound) : sound(sound) { }
+
+	// Deletes the shared tree (last user gone, redefined or engine deleted)
+	~SharedNode();
+
+	/**
+	 * Sample at position of a user (moved to the next one). Users may be
+	 * up to one block apart (buses are mixed block by block, maybe on
+	 * different threads).
+	 */
+	void get(uint64_t& position, sgfloat  &left, sgfloat  &right);
+
+	SoundGenerator* getSound() const
+	{
+		return sound;
+	}
+
+  private:
+	SharedNode(const SharedNode&) = delete;
+	SharedNode& operator=(const SharedNode&) = delete;
+
+	void fill();
+
+	static const uint32_t HISTORY = 2 * BLOCK;
+
+	SoundGenerator* sound;
+	sgfloat  left[HISTORY];	// position % HISTORY
+	sgfloat  right[HISTORY];
+	uint64_t start = 0;		// first position still there
+	uint64_t end = 0;		// first position not computed
+	uint64_t latest = 0;	// furthest position read
+	atomic_flag busy = ATOMIC_FLAG_INIT;
+};
+
+// One user of a SharedNode, built by the parser when a shared name is used
+class SharedSound : public SoundGenerator
+{
+  public:
+	SharedSound(ParseContext& ctx, shared_ptr<SharedNode> node) : SoundGenerator(ctx), node(node) { }
+
+	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override
+	{
+		node->get(position, left, right);
+	}
+
+	virtual sgfloat  nextMono(sgfloat  speed = 1.0) override
+	{
+		sgfloat  left = 0, right = 0;
+		node->get(position, left, right);
+		return left;
+	}
+
+	// Not inputs : the shared sound is not owned
+	virtual bool mono() const override
+	{
+		return node->getSound()->mono();
+	}
+
+	virtual bool silent() const override
+	{
+		return node->getSound()->silent();
+	}
+
+	virtual sgfloat  tail() const override
+	{
+		return node->getSound()->tail();
+	}
+
+  protected:
+
+	virtual WideGenerator* wide(const vector<SoundGenerator*>& lanes) const override;
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return nullptr;
+	}
+
+  private:
+	friend class WideShared;
+
+	shared_ptr<SharedNode> node;
+	uint64_t position = 0;
+};
+
+// Input of a bus insert effect (see Engine::setBusEffect) : the mix of the bus sounds
+class BusInput : public SoundGenerator
+{
+  public:
+	BusInput() : SoundGenerator("bus") { }
+
+	BusInput(ParseContext& ctx) : SoundGenerator(ctx) { }
+
+	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override
+	{
+		if (source)
+		{
+			left += source[0];
+			right += source[1];
+		}
+	}
+
+	virtual void help(Help& help) const override
+	{
+		help.add(new HelpEntry("bus", "Sounds of a bus, in a bus insert effect"));
+	}
+
+	const sgfloat* source = nullptr;	// left and right, silence if not in an effect
+
+  protected:
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return new BusInput(ctx);
+	}
+};
+
+/**
+ * Measures the calls of the generator above which Engine::setProfiling
+ * inserts it (see NodeProfile). Transparent for the tree : the generator
+ * is its only input and is deleted with it.
+ */
+class ProfiledSound : public SoundGenerator
+{
+  public:
+	ProfiledSound(ParseContext& ctx, SoundGenerator* generator);
+
+	virtual ~ProfiledSound()
+	{
+		delete generator;
+	}
+
+	// Insert profiled sounds above the inputs of the nodes of root, or remove them
+	static void profile(ParseContext& ctx, SoundGenerator* root);
+	static void unprofile(SoundGenerator* root);
+
+	// Tree of the costs, a root not profiled by a ProfiledSound has root_profile
+	static NodeStats stats(SoundGenerator* root, const NodeProfile* root_profile);
+
+	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override
+	{
+		NodeProfile::Scope scope(&profiled);
+		generator->next(left, right, speed);
+	}
+
+	virtual sgfloat nextMono(sgfloat  speed = 1.0) override
+	{
+		NodeProfile::Scope scope(&profiled);
+		return generator->nextMono(speed);
+	}
+
+	virtual void reset() override { generator->reset(); }
+	virtual void inputs(vector<SoundGenerator**>& in) override { in.push_back(&generator); }
+	virtual bool silent() const override { return generator->silent(); }
+	virtual sgfloat tail() const override { return generator->tail(); }
+	virtual bool mono() const override { return generator->mono(); }
+	virtual string getValue(string name) const override { return generator->getValue(name); }
+	virtual bool isValid() const override { return generator != nullptr; }
+
+	SoundGenerator* generator;
+	NodeProfile profiled;
+
+  protected:
+	virtual bool _setValue(string name, istream& value) override
+	{
+		return generator->setValue(name, value);
+	}
+
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return nullptr;		// not in the factory
+	}
+};
+
+/**
+ * Standard midi file (type 0 or 1) loaded in memory.
+ * Tracks are merged in one list of events sorted by time, tempo changes applied.
+ */
+class MidiFile
+{
+  public:
+	struct Event
+	{
+		double time;		// seconds
+		uint8_t status;		// channel message (0x80..0xEF)
+		uint8_t data1;
+		uint8_t data2;
+	};
+
+	// @return false (with a message on cerr) if not a valid midi file
+	bool load(const string& file_name);
+
+	const vector<Event>& getEvents() const { return events; }
+
+	uint16_t getFormat() const { return format; }
+	uint16_t getTracks() const { return tracks; }
+
+	// Time of the last event (seconds)
+	double duration() const
+	{
+		return events.size() ? events.back().time : 0;
+	}
+
+  private:
+	struct TrackEvent
+	{
+		uint64_t tick;
+		uint32_t order;		// keeps file order for same tick events
+		uint32_t tempo;		// us per quarter note, 0 if not a tempo change
+		Event event;
+	};
+
+	bool readTrack(const uint8_t* data, uint32_t size, vector<TrackEvent>& list);
+
+	vector<Event> events;
+	uint16_t format = 0;
+	uint16_t tracks = 0;
+	uint16_t division = 0;
+};
+
+/**
+ * Offline rendering of a MidiFile : each channel plays a poly instrument built
+ * from the patch of its channel, else of its program, else the default patch.
+ * Patches are written at 440Hz (A4, note 69) and are a .synth file or a
+ * generator definition.
+ */
+class MidiRenderer
+{
+  public:
+	MidiRenderer(Engine& e) : engine(e) { }
+
+	void setPatch(const string& patch) { default_patch = patch; }
+	void setChannelPatch(uint8_t channel, const string& patch) { channel_patches[channel] = patch; }	// 1..16
+	void setProgramPatch(uint8_t program, const string& patch) { program_patches[program] = patch; }	// 0..127
+	void setVoices(uint16_t count) { voices = count; }
+
+	// Max time (s) given to the release of the last notes
+	void setTail(sgfloat seconds) { tail = seconds; }
+
+	/**
+	 * Render as fast as possible to output (file name or file backend spec
+	 * without file:, see FileBackend). The engine must not be started.
+	 * @return rendered seconds, < 0 on error
+	 */
+	double render(const MidiFile& midi, const string& output);
+
+  private:
+	const string* patchFor(uint8_t channel, uint8_t program) const;
+
+	Engine& engine;
+	string default_patch;
+	map<uint8_t, string> channel_patches;
+	map<uint8_t, string> program_patches;
+	uint16_t voices = 16;
+	sgfloat  tail = 5.0;
+};
+
 class Oscilloscope : public SoundGenerator
 {
 
@@ -1140,11 +3592,16 @@ class Oscilloscope : public SoundGenerator
 	Oscilloscope();
 	~Oscilloscope();
 
-	Oscilloscope(istream& in);
+	Oscilloscope(istream& in, ParseContext& ctx);
 
 
 	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override;
 
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&sound);
+	}
+
 	virtual bool isValid() const override
 	{
 		return sound != 0;
@@ -1152,13 +3609,19 @@ class Oscilloscope : public SoundGenerator
 
   private:
 
-	virtual SoundGenerator* build(istream &in) const override
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
 	{
-		return new Oscilloscope(in);
+		return new Oscilloscope(in, ctx);
 	}
 
+	// Draws the buffer each time the audio thread has filled it
+	void drawLoop();
+
 	Buffer* buffer;
 	SoundGenerator* sound;
+	thread* drawer = nullptr;
+	atomic<bool> running{false};
+	atomic<bool> full{false};		// owned by the drawing thread when true
 };
 
 #endif
@@ -0,0 +1,837 @@
+#ifndef LIBSYNTH_STATIC
+#    define LIBSYNTH_STATIC
+
+#    include <libsynth.hpp>
+
+/**
+ * Compiled patches : synth --emit-cpp writes a parsed tree as nested
+ * templates of the nodes below, so the compiler sees the whole patch at
+ * once (no virtual calls, constants folded, small nodes inlined).
+ *
+ * Each node does exactly what its interpreted SoundGenerator does, in the
+ * same order and with the same types, so both sound bit for bit the same.
+ * Values derived from the sample rate are baked at emit time.
+ */
+
+struct StaticSinus
+{
+	StaticSinus(sgfloat a, sgfloat da, sgfloat volume) : a(a), da(da), volume(volume) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		a += da * speed;
+		sgfloat  v = volume * (sgfloat ) sin(a);
+		if (a > 2 * M_PI)
+			a -= 2 * M_PI;
+		left += v;
+		right += v;
+	}
+
+	void reset() { a = 0; }
+	bool silent() const { return false; }
+
+	sgfloat  a;
+	sgfloat  da;
+	sgfloat  volume;
+};
+
+struct StaticSquare
+{
+	StaticSquare(sgfloat a, sgfloat invert, int val, sgfloat volume) : a(a), invert(invert), val(val), volume(volume) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		a += speed;
+		sgfloat  v = (sgfloat ) val * volume;
+		if (a > invert)
+		{
+			a -= invert;
+			val = -val;
+		}
+		left += v;
+		right += v;
+	}
+
+	void reset()
+	{
+		a = 0;
+		val = 1;
+	}
+
+	bool silent() const { return false; }
+
+	sgfloat  a;
+	sgfloat  invert;
+	int val;
+	sgfloat  volume;
+};
+
+struct StaticTriangle
+{
+	enum { ASC = 0, DESC = 1, BIDIR = 2 };
+
+	StaticTriangle(sgfloat a, sgfloat da, sgfloat asc_da, sgfloat desc_da, uint8_t dir, sgfloat volume)
+	: a(a), da(da), asc_da(asc_da), desc_da(desc_da), dir(dir), volume(volume) { }
+
+	// Speed is ignored, as by TriangleGenerator
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		a += da;
+		if (a > 1.0)
+		{
+			if (dir == ASC)
+				a = a - 2.0;
+			else
+			{
+				a = 2.0 - a;
+				da = desc_da;
+			}
+		}
+		else if (a < -1.0)
+		{
+			if (dir == DESC)
+				a = a + 2.0;
+			else
+			{
+				a = -2.0 - a;
+				da = asc_da;
+			}
+		}
+		sgfloat  v = a * volume;
+		left += v;
+		right += v;
+	}
+
+	void reset()
+	{
+		if (dir == ASC)
+		{
+			a = -1;
+			da = asc_da;
+		}
+		else if (dir == DESC)
+		{
+			a = 1;
+			da = desc_da;
+		}
+		else
+			a = 0;
+	}
+
+	bool silent() const { return false; }
+
+	sgfloat  a;
+	sgfloat  da;
+	sgfloat  asc_da;
+	sgfloat  desc_da;
+	uint8_t dir;
+	sgfloat  volume;
+};
+
+struct StaticLevel
+{
+	StaticLevel(sgfloat level) : level(level) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		left += level;
+		right += level;
+	}
+
+	void reset() { }
+	bool silent() const { return level == 0; }
+
+	sgfloat  level;
+};
+
+struct StaticNoise
+{
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		left += SoundGenerator::rand();
+		right += SoundGenerator::rand();
+	}
+
+	void reset() { }
+	bool silent() const { return false; }
+};
+
+template <class Sound, class Modulator>
+struct StaticFm
+{
+	StaticFm(sgfloat min, sgfloat max, bool mod_gen, bool mod_mod, const Sound& sound, const Modulator& modulator)
+	: min(min), max(max), mod_gen(mod_gen), mod_mod(mod_mod), sound(sound), modulator(modulator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		if (min == max)
+		{
+			sound.next(left, right, mod_gen ? speed : 1.0f);
+			return;
+		}
+
+		sgfloat  l = 0, r = 0;
+		modulator.next(l, r, mod_mod ? speed : 1.0f);
+
+		l = (l + r) / 2.0;
+		l = min + (max - min)*(l + 1.0) / 2.0;
+
+		if (mod_gen) l *= speed;
+		sound.next(left, right, l);
+	}
+
+	void reset()
+	{
+		sound.reset();
+		modulator.reset();
+	}
+
+	bool silent() const { return sound.silent(); }
+
+	sgfloat  min;
+	sgfloat  max;
+	bool mod_gen;
+	bool mod_mod;
+	Sound sound;
+	Modulator modulator;
+};
+
+template <class Sound, class Modulator>
+struct StaticAm
+{
+	StaticAm(sgfloat min, sgfloat max, const Sound& generator, const Modulator& modulator)
+	: min(min), max(max), generator(generator), modulator(modulator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		sgfloat  l = 0, r = 0;
+		generator.next(l, r, speed);
+
+		if (min == max)
+		{
+			left += min * l;
+			right += min * r;
+			return;
+		}
+
+		sgfloat  lv = 0, rv = 0;
+		modulator.next(lv, rv, speed);
+
+		lv = min + (max - min)*(lv + 1) / 2;
+		rv = min + (max - min)*(rv + 1) / 2;
+
+		left += lv*l;
+		right += rv*r;
+	}
+
+	void reset()
+	{
+		generator.reset();
+		modulator.reset();
+	}
+
+	bool silent() const { return generator.silent(); }
+
+	sgfloat  min;
+	sgfloat  max;
+	Sound generator;
+	Modulator modulator;
+};
+
+// Am whose modulator has been optimized away
+template <class Sound>
+struct StaticGain
+{
+	StaticGain(sgfloat gain, const Sound& generator) : gain(gain), generator(generator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		sgfloat  l = 0, r = 0;
+		generator.next(l, r, speed);
+		left += gain * l;
+		right += gain * r;
+	}
+
+	void reset() { generator.reset(); }
+	bool silent() const { return generator.silent(); }
+
+	sgfloat  gain;
+	Sound generator;
+};
+
+// Sounds of a mixer : StaticMix<A, StaticMix<B, StaticMixEnd>>
+struct StaticMixEnd
+{
+	void next(sgfloat &left, sgfloat &right, sgfloat speed) { }
+	void reset() { }
+	bool silent() const { return true; }
+	void checkSilence() { }
+};
+
+template <class Head, class Tail>
+struct StaticMix
+{
+	StaticMix(const Head& head, const Tail& tail) : head(head), tail(tail) { }
+
+	// Silent sounds are skipped, as by MixerGenerator
+	void next(sgfloat &left, sgfloat &right, sgfloat speed)
+	{
+		if (!quiet)
+			head.next(left, right, speed);
+		tail.next(left, right, speed);
+	}
+
+	void reset()
+	{
+		head.reset();
+		tail.reset();
+	}
+
+	bool silent() const { return head.silent() && tail.silent(); }
+
+	void checkSilence()
+	{
+		quiet = head.silent();
+		tail.checkSilence();
+	}
+
+	Head head;
+	Tail tail;
+	bool quiet = false;		// head silent at the last check
+};
+
+template <class Sounds>
+struct StaticMixer
+{
+	StaticMixer(size_t size, const Sounds& sounds) : size(size), sounds(sounds) { }
+
+	// Silence of the sounds checked once per block, as by MixerGenerator
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		if (silence_check == 0)
+		{
+			sounds.checkSilence();
+			silence_check = Engine::MIX_BLOCK;
+		}
+		silence_check--;
+
+		sgfloat  l = 0;
+		sgfloat  r = 0;
+		sounds.next(l, r, speed);
+		left += l / size;
+		right += r / size;
+	}
+
+	void reset()
+	{
+		sounds.reset();
+		silence_check = 0;
+	}
+
+	bool silent() const { return sounds.silent(); }
+
+	size_t size;
+	Sounds sounds;
+	uint32_t silence_check = 0;
+};
+
+template <class Sound>
+struct StaticLow
+{
+	StaticLow(sgfloat coeff, sgfloat mcoeff, const Sound& generator)
+	: lleft(0), lright(0), coeff(coeff), mcoeff(mcoeff), generator(generator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		sgfloat  l = 0, r = 0;
+		generator.next(l, r, speed);
+		l = lleft * coeff + mcoeff * l;
+		r = lright* coeff + mcoeff * r;
+		left += l;
+		right += r;
+		lleft = l;
+		lright = r;
+	}
+
+	void reset()
+	{
+		lleft = 0;
+		lright = 0;
+		generator.reset();
+	}
+
+	bool silent() const { return generator.silent() && fabs(lleft) < 1e-6 && fabs(lright) < 1e-6; }
+
+	sgfloat  lleft;
+	sgfloat  lright;
+	sgfloat  coeff;
+	sgfloat  mcoeff;
+	Sound generator;
+};
+
+template <class Sound>
+struct StaticHigh
+{
+	StaticHigh(sgfloat coeff, sgfloat mcoeff, const Sound& generator)
+	: lleft(0), lright(0), coeff(coeff), mcoeff(mcoeff), generator(generator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		sgfloat  l = 0, r = 0;
+		generator.next(l, r, speed);
+		lleft = lleft * mcoeff + l*coeff;
+		lright = lright* mcoeff + r*coeff;
+		left += l - lleft;
+		right += r - lright;
+	}
+
+	void reset()
+	{
+		lleft = 0;
+		lright = 0;
+		generator.reset();
+	}
+
+	bool silent() const { return generator.silent() && fabs(lleft) < 1e-6 && fabs(lright) < 1e-6; }
+
+	sgfloat  lleft;
+	sgfloat  lright;
+	sgfloat  coeff;
+	sgfloat  mcoeff;
+	Sound generator;
+};
+
+struct StaticAdsrValue
+{
+	sgfloat  s;
+	sgfloat  vol;
+};
+
+// Always gated : compiled patches have no note off
+template <class Sound>
+struct StaticAdsr
+{
+	StaticAdsr(const vector<StaticAdsrValue>& values, bool loop, uint32_t sustain, sgfloat dt, const Sound& generator)
+	: values(values), loop(loop), sustain(sustain), dt(dt), generator(generator)
+	{
+		restart();
+	}
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		if (index >= values.size() && target.vol == 0)
+		{
+			vol = 0;
+			return;
+		}
+
+		sgfloat  l = 0;
+		sgfloat  r = 0;
+		generator.next(l, r, speed);
+
+		advance();
+		left += l*vol;
+		right += r*vol;
+	}
+
+	void reset()
+	{
+		restart();
+		generator.reset();
+	}
+
+	bool silent() const { return (index >= values.size() && target.vol == 0) || generator.silent(); }
+
+	void advance()
+	{
+		if (index >= values.size())
+		{
+			vol = target.vol;
+			return;
+		}
+
+		if (sustain && index == sustain)
+		{
+			vol = previous.vol;
+			return;
+		}
+
+		t += dt;
+		while (t >= target.s)
+		{
+			previous = target;
+			index++;
+			if (index < values.size())
+				target = values[index];
+			else
+			{
+				if (loop) restart();
+				break;
+			}
+			if (sustain && index == sustain)
+				break;
+		}
+
+		if (index < values.size())
+		{
+			sgfloat  factor = (t - previous.s) / (target.s - previous.s);
+			vol = previous.vol + (target.vol - previous.vol) * factor;
+		}
+		else
+			vol = target.vol;
+	}
+
+	// AdsrGenerator::reset, the sound keeps playing
+	void restart()
+	{
+		vol = 0;
+		t = 0;
+		index = 0;
+		target = values[0];
+		previous.s = 0;
+		previous.vol = 0;
+	}
+
+	vector<StaticAdsrValue> values;
+	bool loop;
+	uint32_t sustain;
+	sgfloat  dt;
+	Sound generator;
+	sgfloat  t;
+	StaticAdsrValue previous;
+	StaticAdsrValue target;
+	uint32_t index;
+	sgfloat  vol;
+};
+
+template <class Sound>
+struct StaticEnvelope
+{
+	StaticEnvelope(bool loop, sgfloat index, sgfloat dindex, const vector<sgfloat>& data, const Sound& generator)
+	: loop(loop), index(index), dindex(dindex), data(data), generator(generator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		if (ended())
+			return;
+
+		sgfloat  l = 0;
+		sgfloat  r = 0;
+		generator.next(l, r, speed);
+
+		sgfloat  f = gain();
+		left += l*f;
+		right += r*f;
+	}
+
+	void reset()
+	{
+		index = 0;
+		generator.reset();
+	}
+
+	bool silent() const { return ended() || generator.silent(); }
+
+	bool ended() const
+	{
+		if (loop || index < (sgfloat ) data.size() - 1)
+			return false;
+		return index > data.size() || data.back() == 0;
+	}
+
+	sgfloat  gain()
+	{
+		index += dindex;
+
+		int idx = (int) index;
+		sgfloat  dec = index - idx;
+
+		if (idx < 0) idx = 0;
+		if (index >= (sgfloat ) data.size() - 1)
+		{
+			idx = data.size() - 1;
+			if (loop)
+				index -= (sgfloat ) data.size() - 1;
+		}
+		sgfloat  cur = data[idx];
+		if (idx + 1 < (int) data.size())
+			idx++;
+		sgfloat  next = data[idx];
+
+		return cur + (next - cur) * dec;
+	}
+
+	bool loop;
+	sgfloat  index;
+	sgfloat  dindex;
+	vector<sgfloat> data;
+	Sound generator;
+};
+
+template <class Sound>
+struct StaticReverb
+{
+	StaticReverb(bool echo, sgfloat vol, sgfloat ech_vol, uint32_t buf_size, uint32_t tail_samples, const Sound& generator)
+	: echo(echo), vol(vol), ech_vol(ech_vol), buf_left(buf_size), buf_right(buf_size), index(0), quiet(0),
+	  tail_samples(tail_samples), generator(generator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		// Silence of the input checked once per block, as by ReverbGenerator
+		if (silence_check == 0)
+		{
+			input_silent = generator.silent();
+			silence_check = Engine::MIX_BLOCK;
+		}
+		silence_check--;
+
+		sgfloat  l = 0;
+		sgfloat  r = 0;
+		if (!input_silent)
+		{
+			quiet = 0;
+			generator.next(l, r, speed);
+		}
+		else if (quiet < tail_samples)
+			quiet++;
+		else
+			return;
+
+		if (echo)
+		{
+			sgfloat  ll = buf_left[index];
+			sgfloat  rr = buf_right[index];
+
+			buf_left[index] = l;
+			buf_right[index] = r;
+
+			l = l * ech_vol + ll*vol;
+			r = r * ech_vol + rr*vol;
+		}
+		else
+		{
+			l = l * ech_vol + buf_left[index] * vol;
+			r = r * ech_vol + buf_right[index] * vol;
+
+			buf_left[index] = l;
+			buf_right[index] = r;
+		}
+		index++;
+		if (index == buf_left.size())
+			index = 0;
+
+		left += l;
+		right += r;
+	}
+
+	void reset()
+	{
+		fill(buf_left.begin(), buf_left.end(), 0);
+		fill(buf_right.begin(), buf_right.end(), 0);
+		index = 0;
+		quiet = 0;
+		silence_check = 0;
+		generator.reset();
+	}
+
+	bool silent() const { return quiet >= tail_samples && generator.silent(); }
+
+	bool echo;
+	sgfloat  vol;
+	sgfloat  ech_vol;
+	vector<sgfloat> buf_left;
+	vector<sgfloat> buf_right;
+	uint32_t index;
+	uint32_t quiet;
+	uint32_t tail_samples;
+	uint32_t silence_check = 0;
+	bool input_silent = false;
+	Sound generator;
+};
+
+template <class Sound>
+struct StaticMono
+{
+	StaticMono(const Sound& generator) : generator(generator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		sgfloat  l = 0;
+		sgfloat  v = 0;
+		generator.next(l, v, speed);
+		l = (l + v) / 2;
+		left += l;
+		right += l;
+	}
+
+	void reset() { generator.reset(); }
+	bool silent() const { return generator.silent(); }
+
+	Sound generator;
+};
+
+// Speed is not forwarded, as by LeftSound
+template <class Sound>
+struct StaticLeft
+{
+	StaticLeft(const Sound& generator) : generator(generator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		sgfloat  v = 0;
+		generator.next(left, v);
+	}
+
+	void reset() { generator.reset(); }
+	bool silent() const { return generator.silent(); }
+
+	Sound generator;
+};
+
+template <class Sound>
+struct StaticRight
+{
+	StaticRight(const Sound& generator) : generator(generator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		sgfloat  v = 0;
+		generator.next(v, right);
+	}
+
+	void reset() { generator.reset(); }
+	bool silent() const { return generator.silent(); }
+
+	Sound generator;
+};
+
+template <class Sound>
+struct StaticClamp
+{
+	StaticClamp(sgfloat level, const Sound& generator) : level(level), generator(generator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		sgfloat  mlevel = -level;
+		sgfloat  l = 0;
+		sgfloat  r = 0;
+		generator.next(l, r, speed);
+		if (l > level)	l = level;
+		if (l < mlevel)	l = mlevel;
+		if (r > level)	r = level;
+		if (r < mlevel)	r = mlevel;
+		left += l;
+		right += r;
+	}
+
+	void reset() { generator.reset(); }
+	bool silent() const { return generator.silent(); }
+
+	sgfloat  level;
+	Sound generator;
+};
+
+template <class Sound>
+struct StaticDistortion
+{
+	StaticDistortion(sgfloat level, const Sound& generator) : level(level), generator(generator) { }
+
+	void next(sgfloat &left, sgfloat &right, sgfloat speed = 1.0)
+	{
+		sgfloat  l = 0, r = 0;
+		generator.next(l, r, speed);
+		l *= level;
+		r *= level;
+
+		if (l > 1) l = 1;
+		else if (l<-1) l = -1;
+		if (r > 1) r = 1;
+		else if (r<-1) r = -1;
+
+		left += l;
+		right += r;
+	}
+
+	void reset() { generator.reset(); }
+	bool silent() const { return generator.silent(); }
+
+	sgfloat  level;
+	Sound generator;
+};
+
+/**
+ * SoundGenerator running a compiled tree, built by the synth_patch_<name>
+ * function that synth --emit-cpp writes. Only valid on an engine running
+ * at the sample rate the patch has been emitted for.
+ */
+template <class Tree>
+class StaticPatch : public SoundGenerator
+{
+  public:
+	StaticPatch(ParseContext& ctx, const string& patch, uint32_t rate, const Tree& tree)
+	: SoundGenerator(ctx), rate(rate), tree(tree)
+	{
+		name = patch;
+	}
+
+	// @return nullptr (and a message) if the engine rate is not the baked one
+	static SoundGenerator* create(ParseContext& ctx, const string& patch, uint32_t rate, const Tree& tree)
+	{
+		if (ctx.engine.samplesPerSeconds() != rate)
+		{
+			cerr << "Patch " << patch << " compiled for " << rate << "Hz, engine runs at "
+				<< ctx.engine.samplesPerSeconds() << "Hz" << endl;
+			return nullptr;
+		}
+		return new StaticPatch(ctx, patch, rate, tree);
+	}
+
+	virtual void next(sgfloat  &left, sgfloat  &right, sgfloat  speed = 1.0) override
+	{
+		tree.next(left, right, speed);
+	}
+
+	// The whole tree, as a poly resets all the nodes of a voice
+	virtual void reset() override
+	{
+		tree.reset();
+	}
+
+	virtual bool silent() const override
+	{
+		return tree.silent();
+	}
+
+	virtual bool isValid() const override
+	{
+		return sampleRate() == rate;
+	}
+
+  protected:
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return nullptr;	// not in the factory
+	}
+
+  private:
+	uint32_t rate;
+	Tree tree;
+};
+
+// Compiled patches of a directory, see synth_patches() in cmake/SynthPatches.cmake
+struct StaticPatchEntry
+{
+	const char* name;
+	SoundGenerator* (*build)(ParseContext&);
+};
+
+// @return nullptr if name is not in the (nullptr terminated) table
+inline SoundGenerator* staticPatch(const StaticPatchEntry* table, const string& name, ParseContext& ctx)
+{
+	for (; table->name; table++)
+		if (name == table->name)
+			return table->build(ctx);
+	return nullptr;
+}
+
+#endif
@@ -0,0 +1,225 @@
+#include <libsynth.hpp>
+
+AudioBackend* AudioBackend::create(const string& spec)
+{
+	if (spec == "sdl")
+		return new SdlBackend;
+	else if (spec == "null")
+		return new NullBackend;
+	else if (spec.substr(0, 5) == "file:" && spec.length() > 5)
+		return new FileBackend(spec.substr(5));
+
+	cerr << "libsynth, ERROR Unknown audio backend (" << spec << "), expecting sdl, null or file:name" << endl;
+	return nullptr;
+}
+
+bool SdlBackend::open(const SDL_AudioSpec& want, SDL_AudioSpec& have)
+{
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO | SDL_INIT_TIMER))
+	{
+		SDL_Log("Error while initializing sdl audio subsystem.");
+		return false;
+	}
+	initialized = true;
+
+	dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FORMAT_CHANGE);
+	if (dev == 0)
+	{
+		SDL_Log("Failed to open audio: %s", SDL_GetError());
+		return false;
+	}
+	if (have.format != want.format)
+	{ /* we let this one thing change. */
+		SDL_Log("We didn't get Float32 audio format.");
+	}
+	return true;
+}
+
+void SdlBackend::start()
+{
+	if (dev)
+		SDL_PauseAudioDevice(dev, 0); /* start audio playing. */
+}
+
+void SdlBackend::close()
+{
+	if (!initialized)
+		return;
+	if (dev)
+		SDL_CloseAudioDevice(dev);
+	dev = 0;
+	SDL_QuitSubSystem(SDL_INIT_AUDIO | SDL_INIT_TIMER);
+	initialized = false;
+}
+
+bool NullBackend::open(const SDL_AudioSpec& want, SDL_AudioSpec& have)
+{
+	if (want.freq <= 0 || want.samples == 0)
+		return false;
+	spec = have = want;
+	buffer.resize(spec.samples * spec.channels * sizeof(int16_t));
+	return true;
+}
+
+void NullBackend::start()
+{
+	if (timer || offline)
+		return;
+	callbacks = 0;
+	max_jitter = 0;
+	total_jitter = 0;
+	max_busy = 0;
+	total_busy = 0;
+	running = true;
+	timer = new thread([this] { loop(); });
+}
+
+void NullBackend::close()
+{
+	if (timer)
+	{
+		running = false;
+		timer->join();
+		delete timer;
+		timer = nullptr;
+	}
+}
+
+bool NullBackend::process(uint32_t frames)
+{
+	if (!offline || buffer.empty())
+		return false;
+
+	uint32_t frame_size = spec.channels * sizeof(int16_t);
+	while (frames)
+	{
+		uint32_t count = frames < spec.samples ? frames : spec.samples;
+		spec.callback(spec.userdata, &buffer[0], count * frame_size);
+		output(&buffer[0], count * frame_size);
+		frames -= count;
+	}
+	return true;
+}
+
+void NullBackend::loop()
+{
+	typedef chrono::steady_clock clock;
+	chrono::nanoseconds period(1000000000ull * spec.samples / spec.freq);
+	clock::time_point deadline = clock::now();
+
+	while (running)
+	{
+		deadline += period;
+		this_thread::sleep_until(deadline);
+
+		clock::time_point wakeup = clock::now();
+		spec.callback(spec.userdata, &buffer[0], buffer.size());
+		output(&buffer[0], buffer.size());
+		clock::time_point done = clock::now();
+
+		double jitter = chrono::duration<double>(wakeup - deadline).count();
+		double busy = chrono::duration<double>(done - wakeup).count();
+		callbacks++;
+		total_jitter += jitter;
+		total_busy += busy;
+		if (jitter > max_jitter) max_jitter = jitter;
+		if (busy > max_busy) max_busy = busy;
+
+		// Do not try to catch up if we are late by more than a buffer
+		if (done - deadline > period)
+			deadline = done;
+	}
+}
+
+void NullBackend::report(ostream& out) const
+{
+	if (callbacks == 0)
+		return;
+	double period = (double) spec.samples / spec.freq;
+	out << "Callbacks      : " << callbacks << " of " << spec.samples << " samples" << endl;
+	out << "Jitter (us)    : avg " << 1e6 * total_jitter / callbacks << ", max " << 1e6 * max_jitter << endl;
+	out << "Cpu load (%)   : avg " << 100.0 * total_busy / callbacks / period
+		<< ", max " << 100.0 * max_busy / period << endl;
+}
+
+bool FileBackend::open(const SDL_AudioSpec& want, SDL_AudioSpec& have)
+{
+	if (!NullBackend::open(want, have))
+		return false;
+
+	pipe = false;
+	wav = false;
+	if (name == "-")
+		file = stdout;
+	else if (name[0] == '|')
+	{
+		file = popen(name.c_str() + 1, "w");
+		pipe = true;
+	}
+	else
+	{
+		file = fopen(name.c_str(), "wb");
+		wav = name.length() > 4 && name.substr(name.length() - 4) == ".wav";
+	}
+
+	if (file == nullptr)
+	{
+		cerr << "libsynth, ERROR Unable to open " << name << endl;
+		return false;
+	}
+	written = 0;
+	if (wav)
+		writeWavHeader();
+	return true;
+}
+
+void FileBackend::output(const Uint8* stream, int length)
+{
+	written += fwrite(stream, 1, length, file);
+}
+
+void FileBackend::close()
+{
+	NullBackend::close();
+	if (file == nullptr)
+		return;
+	if (wav)
+	{
+		fseek(file, 0, SEEK_SET);
+		writeWavHeader();
+	}
+	if (pipe)
+		pclose(file);
+	else if (file != stdout)
+		fclose(file);
+	else
+		fflush(file);
+	file = nullptr;
+}
+
+static void writeLe(FILE* file, uint32_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+	{
+		fputc(value & 0xFF, file);
+		value >>= 8;
+	}
+}
+
+void FileBackend::writeWavHeader()
+{
+	uint32_t bytes_per_frame = spec.channels * sizeof(int16_t);
+
+	fwrite("RIFF", 1, 4, file);
+	writeLe(file, 36 + written, 4);
+	fwrite("WAVEfmt ", 1, 8, file);
+	writeLe(file, 16, 4);	// fmt chunk size
+	writeLe(file, 1, 2);	// PCM
+	writeLe(file, spec.channels, 2);
+	writeLe(file, spec.freq, 4);
+	writeLe(file, spec.freq * bytes_per_frame, 4);
+	writeLe(file, bytes_per_frame, 2);
+	writeLe(file, 16, 2);	// bits per sample
+	fwrite("data", 1, 4, file);
+	writeLe(file, written, 4);
+}
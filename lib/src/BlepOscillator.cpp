@@ -21,20 +21,27 @@ void BlepOscillator::help(Help& help) const
 	help.add(entry);
 }
 
-BlepOscillator::BlepOscillator(istream& in)
-: phase(0)
+BlepOscillator::BlepOscillator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx), phase(0)
 {
-	freq = readFrequency(in);
-	pw = readFloat(in, 0, 1, "ratio");
+	freq = ctx.readFrequency(in);
+	pw = ctx.readFloat(in, 0, 1, "ratio");
 	update();
 }
 
 void BlepOscillator::update()
 {
-	phase_inc = freq / (sgfloat) samplesPerSeconds();
+	phase_inc = freq / (sgfloat) sampleRate();
 }
 
 void BlepOscillator::next(sgfloat& left, sgfloat& right, sgfloat speed)
+{
+	sgfloat sample = BlepOscillator::nextMono(speed);
+	left += sample;
+	right += sample;
+}
+
+sgfloat BlepOscillator::nextMono(sgfloat speed)
 {
 	sgfloat sample;
 	sgfloat pinc = phase_inc * speed;
@@ -52,6 +59,5 @@ void BlepOscillator::next(sgfloat& left, sgfloat& right, sgfloat speed)
 	phase += pinc;
 	phase -= floor(phase);
 	
-	left += sample;
-	right += sample;
+	return sample;
 }
@@ -0,0 +1,123 @@
+#include <libsynth.hpp>
+#include <iomanip>
+
+// Single writer : plain increments, relaxed for the readers
+static inline void add(atomic<uint64_t>& counter, uint64_t value)
+{
+	counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline void add(atomic<uint32_t>& counter)
+{
+	counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+void CallbackTiming::clear()
+{
+	for (uint32_t i = 0; i < BUCKETS; i++)
+	{
+		durations[i] = 0;
+		periods[i] = 0;
+	}
+	last_call = 0;
+	callbacks = 0;
+	renders = 0;
+	misses = 0;
+	underruns = 0;
+	total_ns = 0;
+	max_ns = 0;
+	max_period_ns = 0;
+}
+
+// Bucket i > 0 : durations up to SMALLEST * STEP^i of the budget
+static const double SMALLEST = 1e-4;
+static const double STEP = 1.05;
+
+uint32_t CallbackTiming::bucket(uint64_t ns) const
+{
+	if (budget_ns == 0)
+		return BUCKETS - 1;
+	double ratio = double(ns) / budget_ns;
+	if (ratio < SMALLEST)
+		return 0;
+	double index = 1 + floor(log(ratio / SMALLEST) / log(STEP));
+	return index < BUCKETS - 1 ? index : BUCKETS - 1;
+}
+
+void CallbackTiming::rendered(uint64_t ns)
+{
+	add(durations[bucket(ns)]);
+	add(renders, 1);
+	add(total_ns, ns);
+	if (ns > budget_ns)
+		add(misses, 1);
+	if (ns > max_ns.load(memory_order_relaxed))
+		max_ns.store(ns, memory_order_relaxed);
+}
+
+void CallbackTiming::called(uint64_t start, bool underrun)
+{
+	uint64_t last = last_call.load(memory_order_relaxed);
+	if (last && start > last)
+	{
+		uint64_t period = start - last;
+		add(periods[bucket(period)]);
+		if (period > max_period_ns.load(memory_order_relaxed))
+			max_period_ns.store(period, memory_order_relaxed);
+	}
+	last_call.store(start, memory_order_relaxed);
+	add(callbacks, 1);
+	if (underrun)
+		add(underruns, 1);
+}
+
+double CallbackTiming::percentile(const atomic<uint32_t>* histogram, uint64_t count, double p, double max) const
+{
+	if (count == 0)
+		return 0;
+	uint64_t wanted = ceil(p * count);
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < BUCKETS - 1; i++)
+	{
+		seen += histogram[i].load(memory_order_relaxed);
+		if (seen >= wanted)
+			return min(max, SMALLEST * pow(STEP, i) * budget_ns * 1e-9);	// upper bound of the bucket
+	}
+	return max;
+}
+
+CallbackTiming::Report CallbackTiming::read() const
+{
+	Report report;
+	report.budget = budget_ns * 1e-9;
+	report.callbacks = callbacks;
+	report.renders = renders;
+	report.misses = misses;
+	report.underruns = underruns;
+	report.max = max_ns * 1e-9;
+	report.mean = report.renders ? total_ns * 1e-9 / report.renders : 0;
+	report.p50 = percentile(durations, report.renders, 0.5, report.max);
+	report.p90 = percentile(durations, report.renders, 0.9, report.max);
+	report.p99 = percentile(durations, report.renders, 0.99, report.max);
+	report.p999 = percentile(durations, report.renders, 0.999, report.max);
+	report.period_max = max_period_ns * 1e-9;
+	uint64_t periods_count = 0;
+	for (uint32_t i = 0; i < BUCKETS; i++)
+		periods_count += periods[i].load(memory_order_relaxed);
+	report.period_p99 = percentile(periods, periods_count, 0.99, report.period_max);
+	return report;
+}
+
+void CallbackTiming::Report::print(ostream& out) const
+{
+	auto ms = [](double seconds) { return seconds * 1e3; };
+	ios::fmtflags flags = out.flags();
+	streamsize precision = out.precision();
+	out << fixed << setprecision(2);
+	out << "Callbacks      : " << callbacks << ", budget " << ms(budget) << "ms, load " << 100 * load()
+		<< "%, render p50 " << ms(p50) << " p99 " << ms(p99) << " p99.9 " << ms(p999) << " max " << ms(max)
+		<< "ms, period p99 " << ms(period_p99) << " max " << ms(period_max) << "ms, "
+		<< misses << " misses, " << underruns << " underruns" << endl;
+	out.flags(flags);
+	out.precision(precision);
+}
@@ -1,10 +1,11 @@
 #include "libsynth.hpp"
 #include "math.h"
 
-ClampSound::ClampSound(istream& in)
+ClampSound::ClampSound(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
-	level = fabs(readFloat(in, 0, 100, "level")/100.0);
-	generator = factory(in, true);
+	level = fabs(ctx.readFloat(in, 0, 100, "level")/100.0);
+	generator = ctx.factory(in, true);
 
 	init();
 }
@@ -16,6 +17,9 @@ void ClampSound::init()
 
 void ClampSound::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 {
+	if (single)
+		return widen(left, right, speed);
+
 	sgfloat  mlevel = -level;
 	sgfloat  l = 0;
 	sgfloat  r = 0;
@@ -31,6 +35,14 @@ void ClampSound::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 	right += r;
 }
 
+sgfloat  ClampSound::nextMono(sgfloat  speed)
+{
+	sgfloat  v = generator->nextMono(speed);
+	if (v > level)	v = level;
+	if (v < -level)	v = -level;
+	return v;
+}
+
 void ClampSound::help(Help& help) const
 {
 	HelpEntry* entry = new HelpEntry("clamp", "Limit abruptly signal excursion");
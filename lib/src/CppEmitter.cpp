@@ -0,0 +1,272 @@
+#include <libsynth.hpp>
+#include <iomanip>
+#include <cctype>
+
+bool CppEmitter::emit(ostream& out, const SoundGenerator* tree, const string& name)
+{
+	string type, init;
+	if (!node(tree, type, init))
+		return false;
+
+	string id = identifier(name);
+	uint32_t rate = tree->sampleRate();
+	out << "// Generated by synth --emit-cpp, do not edit" << endl;
+	out << "// Patch " << name << ", " << rate << "Hz" << endl;
+	out << "#include <libsynth_static.hpp>" << endl;
+	out << endl;
+	out << "typedef " << type << " synth_patch_" << id << "_tree;" << endl;
+	out << endl;
+	out << "SoundGenerator* synth_patch_" << id << "(ParseContext& ctx)" << endl;
+	out << '{' << endl;
+	out << "\treturn StaticPatch<synth_patch_" << id << "_tree>::create(ctx, \"" << id << "\", " << rate << ',' << endl;
+	out << "\t\t" << init << ");" << endl;
+	out << '}' << endl;
+	return true;
+}
+
+bool CppEmitter::node(const SoundGenerator* generator, string& type, string& init)
+{
+	string args;
+	if (generator == nullptr || !generator->cpp(type, args))
+	{
+		cerr << "emit-cpp: no static version of " << (generator ? generator->name : string("(none)")) << endl;
+		return false;
+	}
+	init = type + '(' + args + ')';
+	return true;
+}
+
+string CppEmitter::number(sgfloat value)
+{
+	if (isinf(value))
+		return value > 0 ? "HUGE_VALF" : "-HUGE_VALF";
+	stringstream out;
+	out << setprecision(9) << value;	// enough digits to read back the same float
+	string s = out.str();
+	if (s.find_first_of(".e") == string::npos)
+		s += ".0";
+	return s + 'f';
+}
+
+string CppEmitter::identifier(const string& name)
+{
+	string id(name);
+	for (auto& c : id)
+		if (!isalnum((unsigned char) c))
+			c = '_';
+	return id;
+}
+
+static string boolean(bool value)
+{
+	return value ? "true" : "false";
+}
+
+// Appends the static version of an input to the template and constructor arguments
+static bool input(const SoundGenerator* generator, string& types, string& args)
+{
+	string type, init;
+	if (!CppEmitter::node(generator, type, init))
+		return false;
+	types += (types.empty() ? "" : ", ") + type;
+	args += (args.empty() ? "" : ", ") + init;
+	return true;
+}
+
+bool WhiteNoiseGenerator::cpp(string& type, string& args) const
+{
+	type = "StaticNoise";
+	return true;
+}
+
+bool TriangleGenerator::cpp(string& type, string& args) const
+{
+	type = "StaticTriangle";
+	args = CppEmitter::number(a) + ", " + CppEmitter::number(da) + ", " + CppEmitter::number(asc_da) + ", "
+		+ CppEmitter::number(desc_da) + ", " + to_string(dir) + ", " + CppEmitter::number(volume);
+	return true;
+}
+
+bool SquareGenerator::cpp(string& type, string& args) const
+{
+	type = "StaticSquare";
+	args = CppEmitter::number(a) + ", " + CppEmitter::number(invert) + ", " + to_string(val) + ", " + CppEmitter::number(volume);
+	return true;
+}
+
+bool SinusGenerator::cpp(string& type, string& args) const
+{
+	type = "StaticSinus";
+	args = CppEmitter::number(a) + ", " + CppEmitter::number(da) + ", " + CppEmitter::number(volume);
+	return true;
+}
+
+bool LevelSound::cpp(string& type, string& args) const
+{
+	type = "StaticLevel";
+	args = CppEmitter::number(level);
+	return true;
+}
+
+bool DistortionGenerator::cpp(string& type, string& args) const
+{
+	string types;
+	args = CppEmitter::number(level);
+	if (!input(generator, types, args))
+		return false;
+	type = "StaticDistortion<" + types + '>';
+	return true;
+}
+
+bool ClampSound::cpp(string& type, string& args) const
+{
+	string types;
+	args = CppEmitter::number(level);
+	if (!input(generator, types, args))
+		return false;
+	type = "StaticClamp<" + types + '>';
+	return true;
+}
+
+bool FmModulator::cpp(string& type, string& args) const
+{
+	string types;
+	args = CppEmitter::number(min) + ", " + CppEmitter::number(max) + ", " + boolean(mod_gen) + ", " + boolean(mod_mod);
+	if (!input(sound, types, args) || !input(modulator, types, args))
+		return false;
+	type = "StaticFm<" + types + '>';
+	return true;
+}
+
+bool AmGenerator::cpp(string& type, string& args) const
+{
+	string types;
+	if (modulator == nullptr)
+	{
+		// Constant gain (optimized)
+		args = CppEmitter::number(min);
+		if (!input(generator, types, args))
+			return false;
+		type = "StaticGain<" + types + '>';
+		return true;
+	}
+	args = CppEmitter::number(min) + ", " + CppEmitter::number(max);
+	if (!input(generator, types, args) || !input(modulator, types, args))
+		return false;
+	type = "StaticAm<" + types + '>';
+	return true;
+}
+
+bool MixerGenerator::cpp(string& type, string& args) const
+{
+	if (generators.empty())
+	{
+		type = "StaticLevel";
+		args = CppEmitter::number(0);
+		return true;
+	}
+	if (generators.size() == 1)
+		return CppEmitter::node(generators.front(), type, args);	// copy of the only sound
+
+	// Same order as generators, the sum is not associative
+	string list_type = "StaticMixEnd";
+	string list_init = "StaticMixEnd()";
+	for (auto it = generators.rbegin(); it != generators.rend(); it++)
+	{
+		string item_type, item_init;
+		if (!CppEmitter::node(*it, item_type, item_init))
+			return false;
+		list_type = "StaticMix<" + item_type + ", " + list_type + '>';
+		list_init = list_type + '(' + item_init + ", " + list_init + ')';
+	}
+	type = "StaticMixer<" + list_type + '>';
+	args = to_string(generators.size()) + ", " + list_init;
+	return true;
+}
+
+bool LeftSound::cpp(string& type, string& args) const
+{
+	string types;
+	if (!input(generator, types, args))
+		return false;
+	type = "StaticLeft<" + types + '>';
+	return true;
+}
+
+bool RightSound::cpp(string& type, string& args) const
+{
+	string types;
+	if (!input(generator, types, args))
+		return false;
+	type = "StaticRight<" + types + '>';
+	return true;
+}
+
+bool EnvelopeSound::cpp(string& type, string& args) const
+{
+	string types;
+	args = boolean(loop) + ", " + CppEmitter::number(index) + ", " + CppEmitter::number(dindex) + ", vector<sgfloat>{ ";
+	for (auto v : data)
+		args += CppEmitter::number(v) + ", ";
+	args += '}';
+	if (!input(generator, types, args))
+		return false;
+	type = "StaticEnvelope<" + types + '>';
+	return true;
+}
+
+bool MonoGenerator::cpp(string& type, string& args) const
+{
+	string types;
+	if (!input(generator, types, args))
+		return false;
+	type = "StaticMono<" + types + '>';
+	return true;
+}
+
+bool LowFilter::cpp(string& type, string& args) const
+{
+	string types;
+	args = CppEmitter::number(coeff) + ", " + CppEmitter::number(mcoeff);
+	if (!input(generator, types, args))
+		return false;
+	type = "StaticLow<" + types + '>';
+	return true;
+}
+
+bool HighFilter::cpp(string& type, string& args) const
+{
+	string types;
+	args = CppEmitter::number(coeff) + ", " + CppEmitter::number(mcoeff);
+	if (!input(generator, types, args))
+		return false;
+	type = "StaticHigh<" + types + '>';
+	return true;
+}
+
+bool AdsrGenerator::cpp(string& type, string& args) const
+{
+	if (!gate)
+		return false;	// no note off in compiled patches
+
+	string types;
+	args = "vector<StaticAdsrValue>{ ";
+	for (auto& v : values)
+		args += "{ " + CppEmitter::number(v.s) + ", " + CppEmitter::number(v.vol) + " }, ";
+	args += "}, " + boolean(loop) + ", " + to_string(sustain) + ", " + CppEmitter::number(dt);
+	if (!input(generator, types, args))
+		return false;
+	type = "StaticAdsr<" + types + '>';
+	return true;
+}
+
+bool ReverbGenerator::cpp(string& type, string& args) const
+{
+	string types;
+	args = boolean(echo) + ", " + CppEmitter::number(vol) + ", " + CppEmitter::number(ech_vol) + ", "
+		+ to_string(buf_size) + ", " + to_string(tail_samples);
+	if (!input(generator, types, args))
+		return false;
+	type = "StaticReverb<" + types + '>';
+	return true;
+}
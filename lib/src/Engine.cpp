@@ -0,0 +1,1158 @@
+#include "libsynth.hpp"
+#include <algorithm>
+
+const uint32_t Engine::MIX_BLOCK;
+
+Engine::Engine(uint32_t samples, uint32_t buffer_size)
+: parser(*this),
+  finished(256),
+  buf_size(buffer_size),
+  wanted_buffer_size(buffer_size),
+  samples_per_seconds(samples),
+  render_running(false),
+  requests(256),
+  retired(256),
+  bus_running(false),
+  next_job(0),
+  jobs_done(0),
+  master_left(MIX_BLOCK),
+  master_right(MIX_BLOCK),
+  profiling(false)
+{
+	buses.push_back(new BusMix("main"));
+	jobs.reserve(1);
+}
+
+Engine::~Engine()
+{
+	if (init_done)
+		close();
+	delete backend;
+	Replace request;
+	while (requests.read(&request, 1))
+		retire(request.generator);
+	for (auto bus : buses)
+	{
+		if (bus->effect)
+			retire(bus->effect);
+		delete bus->limiter;
+		delete bus;
+	}
+	delete limiter;
+	delete tracer;
+	for (auto& slot : slots)
+		delete slot.profile;
+	collect();
+}
+
+Engine& Engine::getDefault()
+{
+	static Engine engine;
+	return engine;
+}
+
+SoundGenerator* Engine::factory(string s)
+{
+	stringstream stream;
+	stream << s;
+	return factory(stream);
+}
+
+SoundGenerator* Engine::factory(istream& in, bool needed)
+{
+	lock_guard<mutex> lock(parser_mtx);
+	SoundGenerator* generator = parser.factory(in, needed);
+	return parser.optimizing ? parser.optimize(generator) : generator;
+}
+
+void Engine::define(const string& name, const string& definition)
+{
+	lock_guard<mutex> lock(defines_mtx);
+	defines[name] = definition;
+}
+
+bool Engine::getDefine(const string& name, string& definition)
+{
+	lock_guard<mutex> lock(defines_mtx);
+	auto it = defines.find(name);
+	if (it == defines.end())
+		return false;
+	definition = it->second;
+	return true;
+}
+
+void Engine::share(const string& name, SoundGenerator* sound)
+{
+	lock_guard<mutex> lock(defines_mtx);
+	shared[name] = make_shared<SharedNode>(sound);
+}
+
+shared_ptr<SharedNode> Engine::getShared(const string& name)
+{
+	lock_guard<mutex> lock(defines_mtx);
+	auto it = shared.find(name);
+	if (it == shared.end())
+		return nullptr;
+	return it->second;
+}
+
+shared_ptr<const vector<sgfloat>> Engine::frozen(const string& key, function<vector<sgfloat>()> render)
+{
+	lock_guard<mutex> lock(frozen_mtx);
+	weak_ptr<const vector<sgfloat>>& cached = frozen_samples[key];
+	shared_ptr<const vector<sgfloat>> samples = cached.lock();
+	if (samples == nullptr)
+	{
+		samples = make_shared<const vector<sgfloat>>(render());
+		cached = samples;
+	}
+	return samples;
+}
+
+void Engine::rampVolume(sgfloat vol, int time_ms, GainRamp::Curve curve)
+{
+	lock_guard<mutex> lock(mtx);
+	main_volume.start(vol, uint64_t(max(time_ms, 0)) * samples_per_seconds / 1000, curve);
+}
+
+void Engine::audioCallback(void *data, Uint8 *byteStream, int byteStreamLength)
+{
+	Engine* engine = static_cast<Engine*>(data);
+	uint32_t ech = byteStreamLength / sizeof (int16_t);
+	int16_t* stream =  reinterpret_cast<int16_t*> ( byteStream );
+
+	uint64_t start = CallbackTiming::now();
+	bool underrun = false;
+	if (engine->ring)
+	{
+		// Render ahead mode, only copy what the render thread has produced
+		uint32_t done = engine->ring->read(stream, ech);
+		if (done < ech)
+			memset(stream + done, 0, (ech - done) * sizeof(int16_t));
+		underrun = done < ech;
+		engine->callback_timing.called(start, underrun);
+	}
+	else
+	{
+		engine->render(stream, ech);
+		engine->callback_timing.called(start, false);
+		engine->callback_timing.rendered(CallbackTiming::now() - start);
+	}
+	if (engine->tracer)
+	{
+		Tracer::setThreadName("audio callback");
+		engine->tracer->span("audio", "callback", start, CallbackTiming::now(), "underrun", underrun);
+	}
+}
+
+void Engine::render(int16_t* stream, uint32_t ech)
+{
+	// Whole callback, waiting for the lock included
+	NodeProfile::Scope scope(profiling ? &engine_profile : nullptr);
+	uint64_t start = tracer ? CallbackTiming::now() : 0;
+	mtx.lock();
+	if (tracer)
+	{
+		tracer->span("engine", "lock", start, CallbackTiming::now());
+		trace_nodes = tracer->sampled(trace_renders++);
+	}
+
+	takeRequests();
+	sleepVoices();
+
+	// Sounds to render, by bus
+	for (auto bus : buses)
+		bus->playing.clear();
+	for (uint32_t index = 0; index < voices.size(); index++)
+		if (!voices[index].asleep)
+			buses[voices[index].bus]->playing.push_back(index);
+	jobs.clear();
+	for (Bus bus = 0; bus < buses.size(); bus++)
+	{
+		BusMix& mix = *buses[bus];
+		if (mix.playing.size() || mix.effect)
+		{
+			mix.limiter_tail = mix.limiter ? mix.limiter->latency() : 0;
+			jobs.push_back(bus);
+		}
+		else if (mix.limiter_tail)
+		{
+			// Idle bus : its limiter delay line is flushed before it stops
+			mix.limiter_tail -= min(mix.limiter_tail, ech / 2);
+			jobs.push_back(bus);
+		}
+		else if (mix.volume.ramping())
+			mix.volume.advance(ech / 2);	// not rendered, its fade goes on
+	}
+
+	// Rendered even without sounds : effect and limiter tails
+	for (uint32_t start = 0; start < ech; start += 2 * MIX_BLOCK)
+	{
+		uint32_t frames = min(MIX_BLOCK, (ech - start) / 2);
+		renderBuses(frames);
+
+		sgfloat* left = &master_left[0];
+		sgfloat* right = &master_right[0];
+		for (uint32_t frame = 0; frame < frames; frame++)
+		{
+			sgfloat l = 0;
+			sgfloat r = 0;
+			for (auto bus : jobs)
+			{
+				l += buses[bus]->left[frame];
+				r += buses[bus]->right[frame];
+			}
+			left[frame] = l;
+			right[frame] = r;
+		}
+
+		main_volume.process(left, right, frames);
+		if (limiter)
+			limiter->process(left, right, frames);
+
+		for (uint32_t frame = 0; frame < frames; frame++)
+		{
+			sgfloat l = left[frame];
+			sgfloat r = right[frame];
+			if (l > 1.0)
+			{
+				l = 1;
+				saturate = true;
+			}
+			else if (l < -1.0)
+			{
+				l = -1;
+				saturate = true;
+			}
+			if (r > 1.0)
+			{
+				r = 1;
+				saturate = true;
+			}
+			else if (r < -1.0)
+			{
+				r = -1;
+				saturate = true;
+			}
+			stream[start + 2 * frame] = 32767 * l;
+			stream[start + 2 * frame + 1] = 32767 * r;
+		}
+	}
+	retireFaded();
+	clock += ech / 2;
+	if (tracer)
+		tracer->span("engine", "render", start, CallbackTiming::now(), "voices", voices.size());
+	mtx.unlock();
+}
+
+void Engine::crossfade(Voice& voice, sgfloat& left, sgfloat& right)
+{
+	if (voice.xfade < voice.xfade_length)
+	{
+		sgfloat l = 0;
+		sgfloat r = 0;
+		voice.outgoing->next(l, r);
+		// Equal power, the sum of the squared gains stays 1
+		sgfloat angle = M_PI_2 * voice.xfade++ / voice.xfade_length;
+		sgfloat in = sin(angle);
+		sgfloat out = cos(angle);
+		left = left * in + l * out;
+		right = right * in + r * out;
+	}
+}
+
+void Engine::retireFaded()
+{
+	// Kept until there is room for it (no allocation here)
+	for (auto& voice : voices)
+		if (voice.outgoing && voice.xfade >= voice.xfade_length && retired.write(&voice.outgoing, 1))
+			voice.outgoing = nullptr;
+}
+
+void Engine::retire(SoundGenerator* generator)
+{
+	generator->handle = 0;
+	if (!retired.write(&generator, 1))
+		retired_late.push_back(generator);
+}
+
+bool Engine::swap(Handle handle, SoundGenerator* generator, uint32_t ms)
+{
+	if (generator == nullptr || !generator->isValid())
+		return false;
+	if (profiling)
+	{
+		ParseContext ctx(*this);
+		ProfiledSound::profile(ctx, generator);
+	}
+
+	lock_guard<mutex> lock(mtx);
+	Slot* slot = find(handle);
+	if (slot == nullptr)
+		return false;
+	fadeTo(voices[slot->index], generator, uint64_t(ms) * samples_per_seconds / 1000);
+	return true;
+}
+
+bool Engine::replace(SoundGenerator* old, SoundGenerator* generator, uint32_t ms)
+{
+	if (old == nullptr || generator == nullptr || !generator->isValid())
+		return false;
+
+	if (profiling)
+	{
+		ParseContext ctx(*this);
+		ProfiledSound::profile(ctx, generator);
+	}
+
+	Replace request;
+	request.old = old;
+	request.generator = generator;
+	request.frames = uint64_t(ms) * samples_per_seconds / 1000;
+	{
+		lock_guard<mutex> lock(requests_mtx);
+		// Read here, old may be deleted by collect() before the request is taken.
+		// generator gets it now, so it can be replaced in turn while pending.
+		request.handle = old->handle;
+		if (requests.write(&request, 1) == 0)
+			return false;
+		generator->handle = request.handle;
+	}
+	if (tracer)
+		tracer->instant("replace", generator->name.c_str(), "handle", request.handle);
+	return true;
+}
+
+void Engine::takeRequests()
+{
+	// A request retires two trees at most, it never waits for room
+	Replace request;
+	uint64_t start = tracer ? CallbackTiming::now() : 0;
+	uint32_t taken = 0;
+	while (retired.space() >= 2 && requests.read(&request, 1))
+	{
+		Slot* slot = find(request.handle);
+		if (slot && voices[slot->index].generator == request.old)
+			fadeTo(voices[slot->index], request.generator, request.frames);
+		else
+			retire(request.generator);
+		taken++;
+	}
+	if (tracer && taken)
+		tracer->span("engine", "requests", start, CallbackTiming::now(), "replaced", taken);
+}
+
+void Engine::fadeTo(Voice& voice, SoundGenerator* generator, uint32_t frames)
+{
+	if (voice.outgoing)
+		retire(voice.outgoing);	// previous crossfade cut short
+	generator->handle = voice.generator->handle;
+	voice.generator->handle = 0;
+	voice.outgoing = voice.generator;
+	voice.generator = generator;
+	voice.asleep = false;
+	voice.xfade = 0;
+	voice.xfade_length = frames;
+	if (frames == 0)
+	{
+		retire(voice.outgoing);
+		voice.outgoing = nullptr;
+	}
+}
+
+size_t Engine::collect()
+{
+	vector<SoundGenerator*> trees;
+	Finished callback;
+	{
+		lock_guard<mutex> lock(mtx);
+		trees.swap(retired_late);
+		callback = on_finished;
+	}
+	vector<pair<Handle, SoundGenerator*>> ended;
+	{
+		lock_guard<mutex> lock(retired_mtx);
+		SoundGenerator* generator;
+		while (retired.read(&generator, 1))
+			trees.push_back(generator);
+		pair<Handle, SoundGenerator*> item;
+		while (finished.read(&item, 1))
+			ended.push_back(item);
+
+		ParseContext ctx(*this);
+		for (auto tree : trees)
+			ctx.drop(tree);
+	}
+
+	// Out of the locks : the callback may play, delete or collect
+	if (callback)
+		for (auto& item : ended)
+			callback(item.first, item.second);
+	return trees.size();
+}
+
+void Engine::renderBus(BusMix& bus, uint32_t frames)
+{
+	RtCheck::Scope check;
+	bool profiled = profiling;
+	bool traced = trace_nodes;
+	uint64_t bus_start = 0;
+	uint64_t effect_spent = 0;
+	if (traced)
+	{
+		bus_start = CallbackTiming::now();
+		bus.spent.assign(bus.playing.size(), 0);
+	}
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		sgfloat  left = 0;
+		sgfloat  right = 0;
+
+		uint64_t* spent = bus.spent.data();
+		for (auto index : bus.playing)
+		{
+			Voice& voice = voices[index];
+			sgfloat l = 0;
+			sgfloat r = 0;
+			uint64_t start = traced ? CallbackTiming::now() : 0;
+			RtCheck::setGenerator(voice.generator);
+			{
+				NodeProfile::Scope scope(profiled ? slots[voice.slot].profile : nullptr);
+				voice.generator->next(l, r);
+			}
+			if (voice.outgoing)
+				crossfade(voice, l, r);
+			if (traced)
+				*spent++ += CallbackTiming::now() - start;
+			left += l * voice.volume;
+			right += r * voice.volume;
+		}
+
+		if (bus.effect)
+		{
+			bus.input[0] = left;
+			bus.input[1] = right;
+			left = 0;
+			right = 0;
+			uint64_t start = traced ? CallbackTiming::now() : 0;
+			RtCheck::setGenerator(bus.effect);
+			NodeProfile::Scope scope(profiled ? &bus.effect_profile : nullptr);
+			bus.effect->next(left, right);
+			if (traced)
+				effect_spent += CallbackTiming::now() - start;
+		}
+		bus.left[frame] = left;
+		bus.right[frame] = right;
+		RtCheck::setGenerator(nullptr);
+	}
+	bus.volume.process(&bus.left[0], &bus.right[0], frames);
+	if (bus.limiter)
+		bus.limiter->process(&bus.left[0], &bus.right[0], frames);
+
+	if (traced)
+	{
+		// Node times are summed over the frames, shown one after the other
+		uint64_t at = bus_start;
+		for (size_t i = 0; i < bus.playing.size(); i++)
+		{
+			const SoundGenerator* generator = voices[bus.playing[i]].generator;
+			tracer->span("node", generator->name.c_str(), at, at + bus.spent[i], "handle", generator->handle);
+			at += bus.spent[i];
+		}
+		if (bus.effect)
+			tracer->span("node", bus.effect->name.c_str(), at, at + effect_spent);
+		tracer->span("bus", bus.name.c_str(), bus_start, CallbackTiming::now(), "voices", bus.playing.size());
+	}
+}
+
+void Engine::renderBuses(uint32_t frames)
+{
+	if (bus_threads.empty() || jobs.size() < 2)
+	{
+		for (auto bus : jobs)
+			renderBus(*buses[bus], frames);
+		return;
+	}
+
+	// New round : the bus threads and this one take the buses one by one
+	uint32_t round = uint32_t(next_job >> 32) + 1;
+	job_frames = frames;
+	jobs_done = 0;
+	next_job = (uint64_t(round) << 32) | (jobs.size() << 16);
+	bus_wake.notify_all();
+	while (renderJob(round))
+		;
+	while (jobs_done < jobs.size())
+		this_thread::yield();	// last buses are being finished by the bus threads
+}
+
+bool Engine::renderJob(uint32_t round)
+{
+	uint64_t job = next_job;
+	do
+	{
+		if (uint32_t(job >> 32) != round || (job & 0xFFFF) >= ((job >> 16) & 0xFFFF))
+			return false;
+	} while (!next_job.compare_exchange_weak(job, job + 1));
+
+	renderBus(*buses[jobs[job & 0xFFFF]], job_frames);
+	jobs_done++;
+	return true;
+}
+
+void Engine::busLoop()
+{
+	if (tracer)
+		Tracer::setThreadName("bus thread");
+	uint32_t round = 0;
+	while (bus_running)
+	{
+		{
+			// The audio thread does not lock, a missed wake up only leaves it more work
+			unique_lock<mutex> lock(bus_mtx);
+			bus_wake.wait_for(lock, chrono::milliseconds(1),
+				[this, round] { return uint32_t(next_job >> 32) != round || !bus_running; });
+		}
+		round = next_job >> 32;
+		while (renderJob(round))
+			;
+	}
+}
+
+bool Engine::setBusThreads(uint16_t threads)
+{
+	if (init_done)
+	{
+		cerr << "libsynth, ERROR Unable to change bus threads once sound is played." << endl;
+		return false;
+	}
+	bus_thread_count = threads;
+	return true;
+}
+
+void Engine::stopBusThreads()
+{
+	bus_running = false;
+	bus_wake.notify_all();
+	for (auto worker : bus_threads)
+	{
+		worker->join();
+		delete worker;
+	}
+	bus_threads.clear();
+}
+
+Engine::Bus Engine::bus(const string& name)
+{
+	lock_guard<mutex> lock(mtx);
+	for (Bus bus = 0; bus < buses.size(); bus++)
+		if (buses[bus]->name == name)
+			return bus;
+	buses.push_back(new BusMix(name));
+	buses.back()->playing.reserve(voices.capacity());
+	buses.back()->spent.reserve(voices.capacity());
+	jobs.reserve(buses.size());
+	return buses.size() - 1;
+}
+
+uint16_t Engine::busCount()
+{
+	lock_guard<mutex> lock(mtx);
+	return buses.size();
+}
+
+bool Engine::setBusVolume(Bus bus, sgfloat vol)
+{
+	lock_guard<mutex> lock(mtx);
+	if (bus >= buses.size())
+		return false;
+	buses[bus]->volume.set(vol);
+	return true;
+}
+
+sgfloat Engine::getBusVolume(Bus bus)
+{
+	lock_guard<mutex> lock(mtx);
+	return bus < buses.size() ? buses[bus]->volume.value() : 0;
+}
+
+bool Engine::rampBusVolume(Bus bus, sgfloat vol, int time_ms, GainRamp::Curve curve)
+{
+	lock_guard<mutex> lock(mtx);
+	if (bus >= buses.size())
+		return false;
+	buses[bus]->volume.start(vol, uint64_t(max(time_ms, 0)) * samples_per_seconds / 1000, curve);
+	return true;
+}
+
+bool Engine::setBusEffect(Bus bus, const string& effect)
+{
+	SoundGenerator* generator = nullptr;
+	if (effect.length())
+	{
+		// Built out of the audio lock
+		ParseContext ctx(*this);
+		ctx.echo = false;
+		generator = ctx.factory(effect);
+		if (generator == nullptr || !generator->isValid())
+		{
+			cerr << "libsynth, ERROR unable to build bus effect " << effect << endl;
+			return false;
+		}
+		generator = ctx.optimize(generator);
+	}
+
+	lock_guard<mutex> lock(mtx);
+	if (bus >= buses.size())
+	{
+		if (generator)
+			retire(generator);
+		return false;
+	}
+	BusMix* mix = buses[bus];
+	if (generator)
+	{
+		if (profiling)
+		{
+			ParseContext ctx(*this);
+			ProfiledSound::profile(ctx, generator);
+			mix->effect_profile.clear();
+		}
+		vector<SoundGenerator*> nodes;
+		generator->collect(nodes);
+		for (auto node : nodes)
+			if (BusInput* input = dynamic_cast<BusInput*>(node))
+				input->source = mix->input;
+	}
+	if (mix->effect)
+		retire(mix->effect);
+	mix->effect = generator;
+	return true;
+}
+
+bool Engine::setBusLimiter(Bus bus, Limiter* wanted)
+{
+	Limiter* old = wanted;
+	bool found = false;
+	{
+		lock_guard<mutex> lock(mtx);
+		if (bus < buses.size())
+		{
+			std::swap(old, buses[bus]->limiter);
+			found = true;
+		}
+	}
+	delete old;
+	return found;
+}
+
+void Engine::setLimiter(Limiter* wanted)
+{
+	Limiter* old = wanted;
+	{
+		lock_guard<mutex> lock(mtx);
+		default_limiter = false;
+		std::swap(old, limiter);
+	}
+	delete old;
+}
+
+void Engine::profileVoice(SoundGenerator* generator, Slot& slot)
+{
+	ParseContext ctx(*this);
+	ProfiledSound::profile(ctx, generator);
+	if (slot.profile == nullptr)
+		slot.profile = new NodeProfile;
+	slot.profile->clear();
+}
+
+void Engine::setProfiling(bool enabled)
+{
+	lock_guard<mutex> lock(mtx);
+	if (enabled == profiling)
+		return;
+	ParseContext ctx(*this);
+	for (auto& voice : voices)
+	{
+		if (enabled)
+			profileVoice(voice.generator, slots[voice.slot]);
+		else
+			ProfiledSound::unprofile(voice.generator);
+		if (voice.outgoing && !enabled)
+			ProfiledSound::unprofile(voice.outgoing);
+	}
+	for (auto bus : buses)
+		if (bus->effect)
+		{
+			if (enabled)
+				ProfiledSound::profile(ctx, bus->effect);
+			else
+				ProfiledSound::unprofile(bus->effect);
+			bus->effect_profile.clear();
+		}
+	engine_profile.clear();
+	profiling = enabled;
+}
+
+NodeStats Engine::stats()
+{
+	lock_guard<mutex> lock(mtx);
+	NodeStats stats = engine_profile.read("engine");
+	for (auto& voice : voices)
+		stats.inputs.push_back(ProfiledSound::stats(voice.generator, slots[voice.slot].profile));
+	for (auto bus : buses)
+		if (bus->effect)
+		{
+			stats.inputs.push_back(ProfiledSound::stats(bus->effect, &bus->effect_profile));
+			stats.inputs.back().name = "bus " + bus->name + ": " + bus->effect->name;
+		}
+	// Mix, buses and limiter (sounds rendered by bus threads are not part of the renders)
+	uint64_t sounds = 0;
+	for (auto& input : stats.inputs)
+		sounds += input.inclusive;
+	stats.self = stats.inclusive > sounds ? stats.inclusive - sounds : 0;
+	return stats;
+}
+
+void Engine::sleepVoices()
+{
+	sleeping_count = 0;
+	for (uint32_t index = voices.size(); index-- > 0; )
+	{
+		Voice& voice = voices[index];
+		voice.asleep = voice.outgoing == nullptr && voice.generator->silent();
+		if (!voice.asleep)
+			continue;
+		// Not more than the ring holds, the others are removed once collected
+		if (auto_remove && (!on_finished || finished.space()))
+		{
+			if (on_finished)
+			{
+				pair<Handle, SoundGenerator*> item(makeHandle(voice.slot), voice.generator);
+				finished.write(&item, 1);
+			}
+			removeVoice(&slots[voice.slot]);
+		}
+		else
+			sleeping_count++;
+	}
+}
+
+void Engine::setAutoRemove(bool remove, Finished callback)
+{
+	lock_guard<mutex> lock(mtx);
+	auto_remove = remove;
+	on_finished = callback;
+}
+
+void Engine::renderAheadLoop()
+{
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+	if (tracer)
+		Tracer::setThreadName("render ahead");
+
+	uint32_t block = 2 * buf_size;
+	vector<int16_t> buffer(block);
+	chrono::microseconds idle(250000 * buf_size / samples_per_seconds);	// quarter of a block
+
+	while (render_running)
+	{
+		if (ring->space() >= block)
+		{
+			uint64_t start = CallbackTiming::now();
+			render(&buffer[0], block);
+			callback_timing.rendered(CallbackTiming::now() - start);
+			ring->write(&buffer[0], block);
+		}
+		else
+			this_thread::sleep_for(idle);
+	}
+}
+
+bool Engine::setRenderAhead(uint16_t blocks)
+{
+	if (init_done)
+	{
+		cerr << "libsynth, ERROR Unable to change render ahead once sound is played." << endl;
+		return false;
+	}
+	render_ahead = blocks;
+	return true;
+}
+
+bool Engine::setTracing(uint32_t events, uint16_t sample, const string& file)
+{
+	if (init_done)
+	{
+		cerr << "libsynth, ERROR Unable to change tracing once sound is played." << endl;
+		return false;
+	}
+	delete tracer;
+	tracer = events ? new Tracer(events, sample) : nullptr;
+	trace_file = file;
+	return true;
+}
+
+bool Engine::dumpTrace(const string& file)
+{
+	if (tracer == nullptr)
+		return false;
+	ofstream out(file);
+	size_t written = tracer->write(out);
+	if (!out.good())
+	{
+		cerr << "libsynth, ERROR Unable to write trace " << file << endl;
+		return false;
+	}
+	if (parser.verbose)
+		cout << "Trace          : " << written << " events written to " << file << endl;
+	return true;
+}
+
+void Engine::writeTrace()
+{
+	if (tracer && trace_file.length())
+		dumpTrace(trace_file);
+}
+
+uint16_t Engine::queueDepth() const
+{
+	if (ring == nullptr || buf_size == 0)
+		return 0;
+	return ring->available() / (2 * buf_size);
+}
+
+bool Engine::setSamplesPerSeconds(uint32_t spf)
+{
+	if (init_done)
+	{
+		cerr << "Unable to change samples per second once sound engine has started. :-(" << endl;
+		return false;
+	}
+	samples_per_seconds = spf;
+	return true;
+}
+
+bool Engine::setBufferSize(uint32_t buffer_size)
+{
+	if (init_done)
+	{
+		cerr << "Unable to change buffer length once sound is played. :-(" << endl;
+		return false;
+	}
+	wanted_buffer_size = buffer_size;
+	return true;
+}
+
+bool Engine::init()
+{
+	if (init_done)
+		return true;
+	buf_size = wanted_buffer_size;
+	if (backend == nullptr)
+		backend = new SdlBackend;
+	if (this == &getDefault())
+		std::atexit(SoundGenerator::quit);
+	SDL_AudioSpec want;
+
+	SDL_memset(&want, 0, sizeof (want)); /* or SDL_zero(want) */
+	want.freq = samples_per_seconds;
+	want.format = AUDIO_S16SYS;
+	want.channels = 2;
+	want.samples = wanted_buffer_size;
+	want.callback = audioCallback;
+	want.userdata = this;
+
+	bool opened = backend->open(want, have);
+	if (opened)
+	{
+		buf_size = have.samples;
+		samples_per_seconds = have.freq;
+		if (default_limiter && limiter == nullptr)
+			limiter = new Limiter(samples_per_seconds);
+		callback_timing.setBudget(double(buf_size) / samples_per_seconds);
+		callback_timing.clear();
+		if (parser.verbose)
+		{
+			reporting = true;
+			report_thread = new thread(&Engine::reportLoop, this);
+		}
+		bus_running = true;
+		for (uint16_t i = 0; i < bus_thread_count; i++)
+			bus_threads.push_back(new thread(&Engine::busLoop, this));
+		if (render_ahead)
+		{
+			ring = new RingBuffer<int16_t>(2 * buf_size * render_ahead);
+			render_running = true;
+			render_thread = new thread(&Engine::renderAheadLoop, this);
+		}
+		backend->start();
+	}
+	init_done = true;
+	return true;
+}
+
+void Engine::quit()
+{
+	mtx.lock();
+	// FIXME unallocate list_generator ???
+	// but what if this is not us that have allocated them ?
+	for (auto& voice : voices)
+	{
+		voice.generator->handle = 0;
+		if (voice.outgoing)
+			retire(voice.outgoing);
+	}
+	voices.clear();
+	for (auto& slot : slots)
+		delete slot.profile;
+	slots.clear();
+	free_slot = 0;
+	list_generator_size = 0;
+	sleeping_count = 0;
+	mtx.unlock();
+	if (backend)
+	{
+		backend->close();
+		if (parser.verbose)
+			backend->report(cout);
+	}
+	stopRenderAhead();
+	stopBusThreads();
+	stopReport();
+	if (parser.verbose && callback_timing.read().callbacks)
+		callback_timing.read().print(cout);
+}
+
+void Engine::close()
+{
+	if (backend)
+		backend->close();
+	stopRenderAhead();
+	stopBusThreads();
+	stopReport();
+	writeTrace();
+	init_done = false;
+}
+
+bool Engine::setBackend(const string& spec)
+{
+	if (init_done)
+	{
+		cerr << "libsynth, ERROR Unable to change audio backend once sound is played." << endl;
+		return false;
+	}
+	AudioBackend* wanted = AudioBackend::create(spec);
+	if (wanted == nullptr)
+		return false;
+	return setBackend(wanted);
+}
+
+bool Engine::setBackend(AudioBackend* wanted)
+{
+	if (init_done)
+		return false;
+	delete backend;
+	backend = wanted;
+	return true;
+}
+
+void Engine::stopRenderAhead()
+{
+	if (render_thread)
+	{
+		render_running = false;
+		render_thread->join();
+		delete render_thread;
+		render_thread = nullptr;
+	}
+	delete ring;
+	ring = nullptr;
+}
+
+void Engine::reportLoop()
+{
+	unique_lock<mutex> lock(report_mtx);
+	while (!report_wake.wait_for(lock, chrono::seconds(2), [this] { return !reporting; }))
+		callback_timing.read().print(cout);
+}
+
+void Engine::stopReport()
+{
+	if (report_thread == nullptr)
+		return;
+	{
+		lock_guard<mutex> lock(report_mtx);
+		reporting = false;
+	}
+	report_wake.notify_all();
+	report_thread->join();
+	delete report_thread;
+	report_thread = nullptr;
+}
+
+Engine::Slot* Engine::find(Handle handle)
+{
+	uint32_t index = handle & 0xFFFF;
+	if (handle == 0 || index >= slots.size())
+		return nullptr;
+	Slot* slot = &slots[index];
+	if (slot->generation != (handle >> 16) || slot->index >= voices.size())
+		return nullptr;
+	return slot;
+}
+
+void Engine::removeVoice(Slot* slot)
+{
+	uint32_t index = slot->index;
+	if (tracer)
+		tracer->instant("remove", voices[index].generator->name.c_str(), "handle", voices[index].generator->handle);
+	voices[index].generator->handle = 0;
+	if (voices[index].outgoing)
+		retire(voices[index].outgoing);
+	if (index != voices.size() - 1)
+	{
+		// Keep voices dense, the last one takes the place of the removed one
+		voices[index] = voices.back();
+		slots[voices[index].slot].index = index;
+	}
+	voices.pop_back();
+
+	uint32_t slot_index = slot - &slots[0];
+	if (++slot->generation == 0)
+		slot->generation = 1;
+	slot->index = free_slot;
+	free_slot = slot_index;
+	list_generator_size = voices.size();
+}
+
+bool Engine::has(Handle handle)
+{
+	lock_guard<mutex> lock(mtx);
+	return find(handle) != nullptr;
+}
+
+SoundGenerator* Engine::get(Handle handle)
+{
+	lock_guard<mutex> lock(mtx);
+	Slot* slot = find(handle);
+	return slot ? voices[slot->index].generator : nullptr;
+}
+
+bool Engine::remove(Handle handle)
+{
+	lock_guard<mutex> lock(mtx);
+	Slot* slot = find(handle);
+	if (slot == nullptr)
+		return false;
+	removeVoice(slot);
+	return true;
+}
+
+bool Engine::setVolume(Handle handle, sgfloat vol)
+{
+	lock_guard<mutex> lock(mtx);
+	Slot* slot = find(handle);
+	if (slot == nullptr)
+		return false;
+	voices[slot->index].volume = vol;
+	return true;
+}
+
+bool Engine::setValue(Handle handle, string name, sgfloat value)
+{
+	lock_guard<mutex> lock(mtx);
+	Slot* slot = find(handle);
+	if (slot == nullptr)
+		return false;
+	return voices[slot->index].generator->setValue(name, value);
+}
+
+bool Engine::has(SoundGenerator* generator, bool lock)
+{
+	if (generator == nullptr)
+		return false;
+	if (lock) mtx.lock();
+	Slot* slot = find(generator->handle);
+	bool bRet = slot && voices[slot->index].generator == generator;
+	if (lock) mtx.unlock();
+	return bRet;
+}
+
+Engine::Handle Engine::play(SoundGenerator* generator, Bus bus)
+{
+	init();
+	if (generator == 0)
+		return 0;
+	if (!generator->isValid())
+	{
+		cerr << "libsynth ERROR: skipping invalid generator play." << endl;
+		return 0;
+	}
+
+	lock_guard<mutex> lock(mtx);
+	if (has(generator, false))
+		return generator->handle;
+	if (bus >= buses.size())
+	{
+		cerr << "libsynth ERROR: no bus " << bus << '.' << endl;
+		return 0;
+	}
+	if (voices.size() >= 0xFFFF)
+	{
+		cerr << "libsynth ERROR: too many playing sounds." << endl;
+		return 0;
+	}
+
+	if (free_slot == slots.size())
+	{
+		Slot slot;
+		slot.generation = 1;
+		slot.index = slots.size() + 1;
+		slot.profile = nullptr;
+		slots.push_back(slot);
+	}
+	uint32_t slot_index = free_slot;
+	Slot& slot = slots[slot_index];
+	free_slot = slot.index;
+	slot.index = voices.size();
+	if (profiling)
+		profileVoice(generator, slot);
+
+	Voice voice;
+	voice.generator = generator;
+	voice.volume = 1.0;
+	voice.slot = slot_index;
+	voice.asleep = false;
+	voice.bus = bus;
+	voice.outgoing = nullptr;
+	voice.xfade = 0;
+	voice.xfade_length = 0;
+	voices.push_back(voice);
+	// Render only dispatches voices, without allocation
+	if (buses[bus]->playing.capacity() < voices.size())
+		buses[bus]->playing.reserve(voices.capacity());
+	if (buses[bus]->spent.capacity() < voices.size())
+		buses[bus]->spent.reserve(voices.capacity());
+	list_generator_size = voices.size();
+
+	generator->handle = makeHandle(slot_index);
+	if (tracer)
+		tracer->instant("play", generator->name.c_str(), "handle", generator->handle);
+	return generator->handle;
+}
+
+bool Engine::remove(SoundGenerator* generator)
+{
+	bool bRet = false;
+	mtx.lock();
+	if (has(generator, false))
+	{
+		bRet = true;
+		removeVoice(find(generator->handle));
+	}
+	else
+		cerr << "libsynth, WARNING : Unable to remove sound generator " << generator << ", size=" << list_generator_size << endl;
+	mtx.unlock();
+	return bRet;
+}
@@ -1,22 +1,22 @@
 #include <libsynth.hpp>
 #include <math.h>
 
-Filter::Filter()
-: lleft(0), lright(0)
-{
-}
-
-
-Filter::Filter(istream& in)
-: lleft(0), lright(0)
+Filter::Filter(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx), lleft(0), lright(0)
 {
     string s;
-	freq = readFrequency(in);
+	freq = ctx.readFrequency(in);
     
-	coeff = expf(-2*M_PI*freq/SoundGenerator::samplesPerSeconds());
+	coeff = expf(-2*M_PI*freq/sampleRate());
 	if (coeff>1) coeff=1;
 	if (coeff<0) coeff=0;
 	mcoeff = 1 - coeff;
 	
-    generator = SoundGenerator::factory(in);
+    generator = ctx.factory(in);
+}
+
+sgfloat  Filter::tail() const
+{
+	// One pole, down to -80dB
+	return log(1e4) / (2 * M_PI * freq) + SoundGenerator::tail();
 }
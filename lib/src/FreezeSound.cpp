@@ -0,0 +1,193 @@
+#include <libsynth.hpp>
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+	while (b)
+	{
+		uint64_t r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+// Definitions of the defines used by a text, nested ones too
+static void usedDefines(Engine& engine, const string& text, map<string, string>& used)
+{
+	stringstream in(text);
+	string token;
+	while (in >> token)
+	{
+		string definition;
+		if (used.find(token) == used.end() && engine.getDefine(token, definition))
+		{
+			used[token] = definition;
+			usedDefines(engine, definition, used);
+		}
+	}
+}
+
+FreezeSound::FreezeSound(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	string duration;
+	in >> duration;
+	sgfloat  seconds = 0;
+	if (duration != "auto")
+	{
+		seconds = atof(duration.c_str());
+		if (seconds <= 0 || seconds > 600)
+		{
+			ctx.fail("freeze: duration must be from 0 to 600s, or auto.");
+			return;
+		}
+	}
+
+	sgfloat  fade_ms = 0;
+	while (in.good())
+	{
+		stringstream::pos_type last = in.tellg();
+		string option;
+		in >> option;
+		if (option == "once")
+			once = true;
+		else if (option == "xfade")
+			fade_ms = ctx.readFloat(in, 0, 60000, "xfade");
+		else
+		{
+			in.clear();
+			in.seekg(last);
+			break;
+		}
+	}
+
+	string text;
+	SoundGenerator* sound = ctx.factory(in, text);
+	if (sound == nullptr)
+		return;
+	if (ctx.optimizing)
+		sound = ctx.optimize(sound);
+
+	if (seconds)
+		length = seconds * sampleRate();
+	else
+	{
+		// Loops of 2s and 3s repeat together every 6s
+		vector<SoundGenerator*> nodes;
+		sound->collect(nodes);
+		uint64_t period = 0;
+		for (auto node : nodes)
+		{
+			AdsrGenerator* adsr = dynamic_cast<AdsrGenerator*>(node);
+			EnvelopeSound* envelope = dynamic_cast<EnvelopeSound*>(node);
+			uint64_t frames = 0;
+			if (adsr)
+				frames = llround(adsr->loopTime() * sampleRate());
+			if (envelope)
+				frames = llround(envelope->loopTime() * sampleRate());
+			if (frames)
+				period = period ? period / gcd(period, frames) * frames : frames;
+			if (period > 600 * sampleRate())
+				break;
+		}
+		if (period == 0 || period > 600 * sampleRate())
+		{
+			ctx.drop(sound);
+			ctx.fail(period ? "freeze: loops not repeating within 600s for auto in " + text : "freeze: no loop found for auto in " + text);
+			return;
+		}
+		length = period;
+		if (ctx.verbose)
+			cout << "freeze: period " << double(length) / sampleRate() << 's' << endl;
+	}
+
+	fade = fade_ms * sampleRate() / 1000;
+	if (fade > length || once)
+		fade = 0;
+	is_mono = sound->mono();
+
+	// Keyed by the definitions too : a redefined define renders again
+	string key = text + '|' + to_string(length) + '|' + to_string(fade) + '|' + to_string(sampleRate());
+	map<string, string> defines;
+	usedDefines(ctx.engine, text, defines);
+	for (const auto& define : defines)
+		key += '|' + define.first + '=' + define.second;
+	uint32_t frames = length + fade;
+	samples = ctx.engine.frozen(key, [sound, frames]()
+	{
+		vector<sgfloat> rendered(2 * frames);
+		for (uint32_t i = 0; i < frames; i++)
+		{
+			sgfloat  l = 0, r = 0;
+			sound->next(l, r);
+			rendered[2 * i] = l;
+			rendered[2 * i + 1] = r;
+		}
+		return rendered;
+	});
+	ctx.drop(sound);
+}
+
+void FreezeSound::frame(uint32_t index, bool wrapped, sgfloat & left, sgfloat & right) const
+{
+	if (index == length)
+	{
+		if (once)
+		{
+			left = right = 0;
+			return;
+		}
+		index = 0;
+		wrapped = true;
+	}
+
+	const sgfloat * sample = &(*samples)[2 * index];
+	left = sample[0];
+	right = sample[1];
+	if (wrapped && index < fade)
+	{
+		// Fade from what followed the end of the loop to its beginning
+		const sgfloat * after = &(*samples)[2 * (length + index)];
+		sgfloat  w = (sgfloat ) index / fade;
+		left = left * w + after[0] * (1 - w);
+		right = right * w + after[1] * (1 - w);
+	}
+}
+
+void FreezeSound::next(sgfloat & left, sgfloat & right, sgfloat  speed)
+{
+	if (once && position >= length)
+		return;
+
+	uint32_t index = position;
+	sgfloat  frac = position - index;
+	sgfloat  l, r;
+	frame(index, looped, l, r);
+	if (frac > 0)
+	{
+		sgfloat  l2, r2;
+		frame(index + 1, looped, l2, r2);
+		l += (l2 - l) * frac;
+		r += (r2 - r) * frac;
+	}
+	left += l;
+	right += r;
+
+	position += speed;
+	if (!once && position >= length)
+	{
+		position -= length;
+		looped = true;
+	}
+}
+
+void FreezeSound::help(Help& help) const
+{
+	HelpEntry* entry = new HelpEntry("freeze", "Render a sound once and play it from memory");
+	entry->addOption(new HelpOption("seconds", "Duration to render, or auto (common period of the adsr/envelope loops)"));
+	entry->addOption(new HelpOption("once", "Play once instead of looping", HelpOption::OPTIONAL));
+	entry->addOption(new HelpOption("xfade ms", "Crossfade at the end of the loop", HelpOption::OPTIONAL));
+	entry->addOption(new HelpOption("sound", "Sound to freeze", HelpOption::GENERATOR));
+	entry->addExample("freeze auto xfade 50 engine");
+	help.add(entry);
+}
@@ -0,0 +1,131 @@
+#include <libsynth.hpp>
+
+const uint32_t GainRamp::SEGMENT;
+
+void GainRamp::start(sgfloat wanted, uint32_t frames, Curve shape)
+{
+	from = gain;
+	target = wanted;
+	curve = shape;
+	length = frames;
+	done = 0;
+	if (length == 0)
+		gain = from = target;
+	if (curve == EXPONENTIAL && length)
+	{
+		// Same ratio between successive frames all along the ramp
+		const double floor = 0.001;
+		double step = pow(max(double(target), floor) / max(double(from), floor), 1.0 / length);
+		for (uint32_t k = 0; k < SEGMENT; k++)
+			ratio[k] = pow(step, k);
+	}
+}
+
+sgfloat GainRamp::at(uint32_t frame) const
+{
+	if (frame >= length)
+		return target;
+	double t = double(frame) / length;
+	switch (curve)
+	{
+		case EQUAL_POWER:
+			if (target > from)
+				return from + (target - from) * sin(M_PI_2 * t);
+			return target + (from - target) * cos(M_PI_2 * t);
+
+		case EXPONENTIAL:
+		{
+			const double floor = 0.001;
+			double a = max(double(from), floor);
+			double b = max(double(target), floor);
+			return a * pow(b / a, t);
+		}
+
+		default:
+			return from + (target - from) * t;
+	}
+}
+
+void GainRamp::process(sgfloat* left, sgfloat* right, uint32_t frames)
+{
+	uint32_t i = 0;
+	if (curve == LINEAR && done < length)
+	{
+		// A single piece, the gain of a frame only depends on its position
+		sgfloat delta = (target - from) / length;
+		uint32_t end = min(frames, length - done);
+		uint32_t inner = done + end == length ? end - 1 : end;
+		for (; i < inner; i++)
+		{
+			sgfloat g = from + delta * (done + i + 1);
+			left[i] *= g;
+			right[i] *= g;
+		}
+		done += end;
+		gain = from + delta * done;
+		if (done == length)
+		{
+			left[i] *= target;
+			right[i] *= target;
+			i++;
+			gain = target;
+		}
+	}
+	while (done < length && i < frames)
+	{
+		// Pieces start at fixed positions of the ramp, the gains do not
+		// depend on the block sizes. Frame k of a piece has the gain of
+		// position k + 1 (the target is on the last frame of the ramp).
+		uint32_t base = done - done % SEGMENT;
+		uint32_t span = min(SEGMENT, length - base);
+		uint32_t first = done - base;
+		uint32_t end = min(span, first + frames - i);
+		sgfloat start = first == 0 && done ? gain : at(base);		// end of the previous piece
+		sgfloat stop = at(base + span);
+
+		// Inner frames (the last one of the piece is exact below)
+		uint32_t inner = min(end, span - 1);
+		if (curve == EXPONENTIAL)
+			for (uint32_t k = first; k < inner; k++, i++)
+			{
+				sgfloat g = start * ratio[k + 1];
+				left[i] *= g;
+				right[i] *= g;
+			}
+		else
+		{
+			sgfloat step = (stop - start) / span;
+			for (uint32_t k = first; k < inner; k++, i++)
+			{
+				sgfloat g = start + step * (k + 1);
+				left[i] *= g;
+				right[i] *= g;
+			}
+		}
+		if (end == span)
+		{
+			left[i] *= stop;
+			right[i] *= stop;
+			i++;
+			gain = stop;
+		}
+		else
+			gain = curve == EXPONENTIAL ? start * ratio[end] : start + (stop - start) / span * end;
+		done = base + end;
+	}
+	if (gain == 1)
+		return;
+	for (; i < frames; i++)
+	{
+		left[i] *= gain;
+		right[i] *= gain;
+	}
+}
+
+void GainRamp::advance(uint32_t frames)
+{
+	if (done >= length)
+		return;
+	done += min(frames, length - done);
+	gain = at(done);
+}
@@ -1,7 +1,7 @@
 #include <libsynth.hpp>
 
-HighFilter::HighFilter(istream& in)
-: Filter(in)
+HighFilter::HighFilter(istream& in, ParseContext& ctx)
+: Filter(in, ctx)
 {
 	coeff = 1.0 - coeff;
 	mcoeff = 1.0 - mcoeff;
@@ -16,6 +16,9 @@ void HighFilter::help(Help& help) const
 
 void HighFilter::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 {
+	if (single)
+		return widen(left, right, speed);
+
 	sgfloat  l=0,r=0;
 	
 	generator->next(l, r, speed);
@@ -26,3 +29,10 @@ void HighFilter::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 	right += r - lright;
 	return;
 }
+
+sgfloat  HighFilter::nextMono(sgfloat  speed)
+{
+	sgfloat  v = generator->nextMono(speed);
+	lleft = lleft * mcoeff + v*coeff;
+	return v - lleft;
+}
@@ -0,0 +1,165 @@
+#include <libsynth.hpp>
+
+Limiter::Limiter(uint32_t samples_per_seconds, sgfloat lookahead_ms, sgfloat release_ms, sgfloat ceiling, bool true_peak)
+: ceiling(ceiling), true_peak(true_peak)
+{
+	lookahead = max(1u, uint32_t(lookahead_ms * samples_per_seconds / 1000));
+	// A true peak is found TAPS / 2 frames after it
+	delay = lookahead + (true_peak ? TAPS / 2 : 0);
+	window = delay + 1;
+	release = 1 - exp(-1000.0 / (max(sgfloat(1), release_ms) * samples_per_seconds));
+
+	delayed.resize(2 * delay);
+	history.resize(2 * TAPS);
+	minimum.resize(window + 1);
+	held.assign(lookahead, 1);
+	held_sum = lookahead;
+	unity = lookahead;
+
+	// Windowed sinc, points between the frames TAPS / 2 and TAPS / 2 - 1 before the last one
+	for (int phase = 1; phase < PHASES; phase++)
+	{
+		sgfloat* c = coeffs[phase - 1];
+		double sum = 0;
+		for (int k = 0; k < TAPS; k++)
+		{
+			double d = TAPS / 2 - k - double(phase) / PHASES;
+			double sinc = d == 0 ? 1 : sin(M_PI * d) / (M_PI * d);
+			c[k] = sinc * 0.5 * (1 + cos(M_PI * d / (TAPS / 2)));
+			sum += c[k];
+		}
+		double gain = 0;
+		for (int k = 0; k < TAPS; k++)
+		{
+			c[k] /= sum;
+			gain += fabs(c[k]);
+		}
+		if (gain > overshoot)
+			overshoot = gain;
+	}
+}
+
+sgfloat Limiter::peak(const sgfloat* left, const sgfloat* right, uint32_t frames)
+{
+	// Absolute floats compare like their bits as integers : this loop vectorizes
+	uint32_t bits = 0;
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		uint32_t l, r;
+		memcpy(&l, &left[i], sizeof(l));
+		memcpy(&r, &right[i], sizeof(r));
+		l &= 0x7FFFFFFF;
+		r &= 0x7FFFFFFF;
+		bits = l > bits ? l : bits;
+		bits = r > bits ? r : bits;
+	}
+	sgfloat value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+sgfloat Limiter::framePeak(sgfloat left, sgfloat right)
+{
+	sgfloat peak = max(fabs(left), fabs(right));
+	if (!true_peak)
+		return peak;
+
+	history_pos = (history_pos + 1) % TAPS;
+	history[2 * history_pos] = left;
+	history[2 * history_pos + 1] = right;
+	for (int phase = 0; phase < PHASES - 1; phase++)
+	{
+		sgfloat l = 0;
+		sgfloat r = 0;
+		for (int k = 0; k < TAPS; k++)
+		{
+			uint32_t index = 2 * ((history_pos + TAPS - k) % TAPS);
+			l += coeffs[phase][k] * history[index];
+			r += coeffs[phase][k] * history[index + 1];
+		}
+		peak = max(peak, max(fabs(l), fabs(r)));
+	}
+	return peak;
+}
+
+void Limiter::process(sgfloat* left, sgfloat* right, uint32_t frames)
+{
+	if (frame >= quiet && unity >= lookahead && peak(left, right, frames) * overshoot <= ceiling)
+	{
+		// Nothing to limit, delayed only
+		if (true_peak)
+			for (uint32_t i = frames > TAPS ? frames - TAPS : 0; i < frames; i++)
+			{
+				history_pos = (history_pos + 1) % TAPS;
+				history[2 * history_pos] = left[i];
+				history[2 * history_pos + 1] = right[i];
+			}
+		for (uint32_t i = 0; i < frames; i++)
+		{
+			sgfloat l = delayed[2 * delay_pos];
+			sgfloat r = delayed[2 * delay_pos + 1];
+			delayed[2 * delay_pos] = left[i];
+			delayed[2 * delay_pos + 1] = right[i];
+			if (++delay_pos == delay)
+				delay_pos = 0;
+			left[i] = l;
+			right[i] = r;
+		}
+		frame += frames;
+		unity = min(unity + frames, lookahead);
+		current = 1;
+		return;
+	}
+
+	uint32_t size = minimum.size();
+	for (uint32_t i = 0; i < frames; i++, frame++)
+	{
+		// Gain needed by this frame
+		sgfloat peak = framePeak(left[i], right[i]);
+		sgfloat gain = 1;
+		if (peak > ceiling)
+		{
+			gain = ceiling / peak;
+			quiet = frame + window;
+		}
+
+		// Smallest gain needed by the frames of the window
+		while (min_size && minimum[(min_head + min_size - 1) % size].second >= gain)
+			min_size--;
+		minimum[(min_head + min_size++) % size] = make_pair(frame, gain);
+		while (minimum[min_head].first + window <= frame)
+		{
+			min_head = (min_head + 1) % size;
+			min_size--;
+		}
+		sgfloat hold = minimum[min_head].second;
+
+		// Down at once, back up in release time
+		if (hold < envelope)
+			envelope = hold;
+		else
+			envelope += (hold - envelope) * release;
+		if (envelope > 0.99999f)
+			envelope = 1;
+
+		// Averaged over lookahead : the ramp ends at the delayed peak
+		held_sum += envelope - held[held_pos];
+		held[held_pos] = envelope;
+		if (++held_pos == lookahead)
+			held_pos = 0;
+		if (envelope < 1)
+			unity = 0;
+		else if (unity < lookahead && ++unity == lookahead)
+			held_sum = lookahead;	// only ones, no rounding left
+		current = held_sum / lookahead;
+
+		sgfloat l = delayed[2 * delay_pos];
+		sgfloat r = delayed[2 * delay_pos + 1];
+		delayed[2 * delay_pos] = left[i];
+		delayed[2 * delay_pos + 1] = right[i];
+		if (++delay_pos == delay)
+			delay_pos = 0;
+		left[i] = l * current;
+		right[i] = r * current;
+	}
+}
@@ -9,6 +9,9 @@ void LowFilter::help(Help& help) const
 
 void LowFilter::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 {
+	if (single)
+		return widen(left, right, speed);
+
 	sgfloat  l=0,r=0;
 	
 	generator->next(l, r, speed);
@@ -20,3 +23,10 @@ void LowFilter::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 	lright = r;
 	return;
 }
+
+sgfloat  LowFilter::nextMono(sgfloat  speed)
+{
+	sgfloat  v = generator->nextMono(speed);
+	lleft = lleft * coeff + mcoeff * v;
+	return lleft;
+}
@@ -0,0 +1,304 @@
+#include <libsynth.hpp>
+#include <algorithm>
+#include <cmath>
+
+static uint32_t readBe(const uint8_t* data, int bytes)
+{
+	uint32_t value = 0;
+	for (int i = 0; i < bytes; i++)
+		value = (value << 8) | data[i];
+	return value;
+}
+
+// Variable length quantity, @return false if past end
+static bool readVlq(const uint8_t*& data, const uint8_t* end, uint32_t& value)
+{
+	value = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		if (data >= end)
+			return false;
+		uint8_t byte = *data++;
+		value = (value << 7) | (byte & 0x7F);
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+bool MidiFile::load(const string& file_name)
+{
+	ifstream file(file_name, ios::binary);
+	if (!file.good())
+	{
+		cerr << "midi: unable to open " << file_name << endl;
+		return false;
+	}
+	vector<uint8_t> content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	const uint8_t* data = content.size() ? &content[0] : nullptr;
+	const uint8_t* end = data + content.size();
+
+	if (content.size() < 14 || memcmp(data, "MThd", 4) || readBe(data + 4, 4) < 6)
+	{
+		cerr << "midi: " << file_name << " is not a standard midi file" << endl;
+		return false;
+	}
+	format = readBe(data + 8, 2);
+	tracks = readBe(data + 10, 2);
+	division = readBe(data + 12, 2);
+	if (format > 1)
+	{
+		cerr << "midi: format " << format << " not supported (only 0 and 1)" << endl;
+		return false;
+	}
+	data += 8 + readBe(data + 4, 4);
+
+	vector<TrackEvent> list;
+	for (uint16_t track = 0; track < tracks; track++)
+	{
+		if (end - data < 8 || memcmp(data, "MTrk", 4))
+		{
+			cerr << "midi: missing track " << track << " in " << file_name << endl;
+			return false;
+		}
+		uint32_t size = readBe(data + 4, 4);
+		data += 8;
+		if (size > (uint32_t) (end - data) || !readTrack(data, size, list))
+		{
+			cerr << "midi: corrupted track " << track << " in " << file_name << endl;
+			return false;
+		}
+		data += size;
+	}
+
+	stable_sort(list.begin(), list.end(), [](const TrackEvent& a, const TrackEvent& b)
+	{
+		return a.tick < b.tick || (a.tick == b.tick && a.order < b.order);
+	});
+
+	// Ticks to seconds
+	double tick_duration;
+	bool smpte = division & 0x8000;
+	if (smpte)
+	{
+		int fps = -(int8_t) (division >> 8);
+		tick_duration = 1.0 / ((fps == 29 ? 29.97 : fps) * (division & 0xFF));
+	}
+	else
+		tick_duration = 0.5 / division;	// 120 bpm until a tempo change
+
+	events.clear();
+	events.reserve(list.size());
+	uint64_t last_tick = 0;
+	double time = 0;
+	for (auto& item : list)
+	{
+		time += (item.tick - last_tick) * tick_duration;
+		last_tick = item.tick;
+		if (item.tempo)
+		{
+			if (!smpte)
+				tick_duration = item.tempo / 1e6 / division;
+			continue;
+		}
+		item.event.time = time;
+		events.push_back(item.event);
+	}
+	return true;
+}
+
+bool MidiFile::readTrack(const uint8_t* data, uint32_t size, vector<TrackEvent>& list)
+{
+	const uint8_t* end = data + size;
+	uint64_t tick = 0;
+	uint8_t status = 0;
+
+	while (data < end)
+	{
+		uint32_t delta;
+		if (!readVlq(data, end, delta) || data >= end)
+			return false;
+		tick += delta;
+
+		if (*data & 0x80)
+			status = *data++;
+		else if (status == 0)
+			return false;	// running status without status
+
+		if (status == 0xFF)
+		{
+			if (data >= end)
+				return false;
+			uint8_t type = *data++;
+			uint32_t length;
+			if (!readVlq(data, end, length) || length > (uint32_t) (end - data))
+				return false;
+			if (type == 0x2F)
+				break;		// end of track
+			if (type == 0x51 && length == 3)
+			{
+				TrackEvent item;
+				item.tick = tick;
+				item.order = list.size();
+				item.tempo = readBe(data, 3);
+				list.push_back(item);
+			}
+			data += length;
+			status = 0;
+		}
+		else if (status == 0xF0 || status == 0xF7)
+		{
+			uint32_t length;
+			if (!readVlq(data, end, length) || length > (uint32_t) (end - data))
+				return false;
+			data += length;
+			status = 0;
+		}
+		else
+		{
+			uint8_t type = status & 0xF0;
+			int bytes = (type == 0xC0 || type == 0xD0) ? 1 : 2;
+			if (end - data < bytes)
+				return false;
+
+			TrackEvent item;
+			item.tick = tick;
+			item.order = list.size();
+			item.tempo = 0;
+			item.event.status = status;
+			item.event.data1 = data[0] & 0x7F;
+			item.event.data2 = bytes == 2 ? data[1] & 0x7F : 0;
+			list.push_back(item);
+			data += bytes;
+		}
+	}
+	return true;
+}
+
+const string* MidiRenderer::patchFor(uint8_t channel, uint8_t program) const
+{
+	auto channel_it = channel_patches.find(channel + 1);
+	if (channel_it != channel_patches.end())
+		return &channel_it->second;
+	auto program_it = program_patches.find(program);
+	if (program_it != program_patches.end())
+		return &program_it->second;
+	if (default_patch.length())
+		return &default_patch;
+	return nullptr;
+}
+
+double MidiRenderer::render(const MidiFile& midi, const string& output)
+{
+	const vector<MidiFile::Event>& events = midi.getEvents();
+
+	// One poly instrument per channel and patch used
+	map<pair<uint8_t, const string*>, PolySound*> instruments;
+	uint8_t programs[16] = { 0 };
+	ParseContext ctx(engine);
+	ctx.echo = false;
+	// Whole trees (the voices of a poly are its inputs)
+	auto dropInstruments = [&instruments, &ctx]()
+	{
+		for (auto& instrument : instruments)
+			if (instrument.second)
+				ctx.drop(instrument.second);
+	};
+	for (auto& event : events)
+	{
+		uint8_t channel = event.status & 0x0F;
+		uint8_t type = event.status & 0xF0;
+		if (type == 0xC0)
+			programs[channel] = event.data1;
+		else if (type == 0x90 && event.data2)
+		{
+			const string* patch = patchFor(channel, programs[channel]);
+			if (patch == nullptr)
+			{
+				cerr << "midi: no patch for channel " << channel + 1 << ", program " << (int) programs[channel] << endl;
+				dropInstruments();
+				return -1;
+			}
+			PolySound*& poly = instruments[make_pair(channel, patch)];
+			if (poly == nullptr)
+			{
+				poly = dynamic_cast<PolySound*>(ctx.factory("poly " + to_string(voices) + " " + *patch));
+				if (poly == nullptr || !poly->isValid())
+				{
+					cerr << "midi: unable to build patch " << *patch << endl;
+					dropInstruments();
+					return -1;
+				}
+			}
+		}
+	}
+
+	FileBackend* file = new FileBackend(output);
+	file->setOffline(true);
+	if (!engine.setBackend(file))
+	{
+		delete file;
+		dropInstruments();
+		return -1;
+	}
+	for (auto& instrument : instruments)
+		engine.play(instrument.second);
+
+	// Sample accurate : render up to each event, the poly handles it on its next sample
+	uint32_t rate = engine.samplesPerSeconds();
+	PolySound* playing[16][128] = { { nullptr } };
+	memset(programs, 0, sizeof(programs));
+	uint64_t done = 0;
+	for (auto& event : events)
+	{
+		uint64_t frame = llround(event.time * rate);
+		if (frame > done)
+		{
+			file->process(frame - done);
+			done = frame;
+		}
+
+		uint8_t channel = event.status & 0x0F;
+		uint8_t type = event.status & 0xF0;
+		sgfloat  freq = 440.0 * pow(2.0, (event.data1 - 69) / 12.0);
+		PolySound*& poly = playing[channel][event.data1];
+		if (type == 0xC0)
+			programs[channel] = event.data1;
+		else if (type == 0x90 && event.data2)
+		{
+			poly = instruments[make_pair(channel, patchFor(channel, programs[channel]))];
+			while (!poly->noteOn(freq, event.data2 / 127.0))
+			{
+				file->process(1);	// event queue full
+				done++;
+			}
+		}
+		else if ((type == 0x80 || type == 0x90) && poly)
+		{
+			while (!poly->noteOff(freq))
+			{
+				file->process(1);
+				done++;
+			}
+			poly = nullptr;
+		}
+	}
+
+	// Let the releases end
+	uint64_t tail_end = done + tail * rate;
+	uint32_t block = engine.bufSize();
+	while (done < tail_end)
+	{
+		bool active = false;
+		for (auto& instrument : instruments)
+			active = active || instrument.second->activeVoices();
+		if (!active)
+			break;
+		file->process(block);
+		done += block;
+	}
+
+	engine.quit();
+	dropInstruments();
+	return (double) done / rate;
+}
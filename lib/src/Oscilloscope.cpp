@@ -1,5 +1,4 @@
 #include <libsynth.hpp>
-#include <future>
 
 Oscilloscope::Oscilloscope::Buffer::Buffer(uint32_t sz, bool auto_thr)
 : size(sz), auto_threshold(auto_thr)
@@ -98,21 +97,63 @@ Oscilloscope::Oscilloscope() : SoundGenerator("oscillo")
 
 Oscilloscope::~Oscilloscope()
 {
+	if (drawer)
+	{
+		running = false;
+		drawer->join();
+		delete drawer;
+	}
 	if (buffer)
 		delete buffer;
 	if (sound)
 		delete sound;
 }
 
-Oscilloscope::Oscilloscope(istream& in)
+Oscilloscope::Oscilloscope(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
 	buffer = new Buffer(10000);
-	sound = factory(in, true);
+	sound = ctx.factory(in, true);
 	if (SDL_Init(SDL_INIT_VIDEO))	// FIXME no a good place for that
 	{
-		cerr << "Unable to init video" << endl;
-		exit(1);
+		ctx.fail("Unable to init video");
+		return;
+	}
+	running = true;
+	drawer = new thread(&Oscilloscope::drawLoop, this);
+}
+
+void Oscilloscope::drawLoop()
+{
+	SDL_Window* window = NULL;
+	SDL_Renderer* renderer = NULL;
+	while (running)
+	{
+		// The audio thread does not wait, nor wake this one up
+		if (!full)
+		{
+			this_thread::sleep_for(chrono::milliseconds(10));
+			continue;
+		}
+		if (window == NULL && SDL_CreateWindowAndRenderer(640, 200, 0, &window, &renderer))
+		{
+			window = NULL;
+			renderer = NULL;
+		}
+		if (renderer)
+		{
+			SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
+			SDL_RenderClear(renderer);
+			buffer->render(renderer, 640, 200, true, 1);
+			SDL_RenderPresent(renderer);
+		}
+		buffer->reset();
+		full = false;
 	}
+	if (renderer)
+		SDL_DestroyRenderer(renderer);
+	if (window)
+		SDL_DestroyWindow(window);
 }
 
 void Oscilloscope::next(sgfloat & left, sgfloat & right, sgfloat  speed)
@@ -123,37 +164,8 @@ void Oscilloscope::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 	sound->next(l,r,speed);
 	left += l;
 	right += r;
-	
-	if (buffer->fill(l,r))
-	{
-		static atomic<bool> rendering(false);
-		if (rendering)
-			return;
-		
-		static SDL_Window* window = NULL;
-		static SDL_Renderer* renderer = NULL;
-		rendering = true;
-		static Buffer* b = buffer;
-		static thread* f = 0;
-		if (f)
-			f->join();
-		f = new thread([]{
-			if (window == NULL)
-			{
-				if (SDL_CreateWindowAndRenderer(640, 200, 0, &window, &renderer))
-					return;
-			}
 
-			SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
-			SDL_RenderClear(renderer);
-			b->render(renderer, 640, 200, true, 1);
-			SDL_RenderPresent(renderer);
-			
-			b->reset();
-			rendering = false;
-		});
-		
-		
-	}
+	// Buffer given to the drawing thread once full
+	if (!full && buffer->fill(l,r))
+		full = true;
 }
-	
\ No newline at end of file
@@ -0,0 +1,599 @@
+#include <libsynth.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <typeinfo>
+#include <algorithm>
+
+const uint32_t PatchWriter::MAGIC;
+const uint32_t PatchWriter::VERSION;
+
+bool PatchWriter::add(const string& name, const SoundGenerator* tree)
+{
+	size_t size = nodes.size();
+	size_t type_count = types.size();
+	if (!input(tree))
+	{
+		nodes.resize(size);
+		types.resize(type_count);
+		return false;
+	}
+	patches.push_back(make_pair(name, size));
+	return true;
+}
+
+vector<uint32_t> PatchWriter::data() const
+{
+	vector<uint32_t> words;
+	words.push_back(MAGIC);
+	words.push_back(VERSION);
+	words.push_back(rate);
+	words.push_back(types.size());
+	for (auto& type : types)
+		text(words, type);
+	words.push_back(patches.size());
+	for (auto& patch : patches)
+	{
+		text(words, patch.first);
+		words.push_back(patch.second);
+	}
+	words.insert(words.end(), nodes.begin(), nodes.end());
+	return words;
+}
+
+bool PatchWriter::save(const string& file) const
+{
+	vector<uint32_t> words = data();
+	ofstream out(file, ios::binary);
+	out.write((const char*) &words[0], words.size() * sizeof(uint32_t));
+	if (!out.good())
+	{
+		cerr << "synthc: unable to write " << file << endl;
+		return false;
+	}
+	return true;
+}
+
+void PatchWriter::real(sgfloat value)
+{
+	uint32_t word;
+	memcpy(&word, &value, sizeof(word));
+	nodes.push_back(word);
+}
+
+void PatchWriter::integer(uint32_t value)
+{
+	nodes.push_back(value);
+}
+
+bool PatchWriter::input(const SoundGenerator* generator)
+{
+	if (generator == nullptr)
+		return false;
+
+	// The name the node has been parsed with, if it builds the same class
+	auto it = SoundGenerator::generators.find(generator->name);
+	if (it == SoundGenerator::generators.end() || typeid(*it->second) != typeid(*generator))
+	{
+		missing = generator->name;
+		return false;
+	}
+	size_t type = find(types.begin(), types.end(), generator->name) - types.begin();
+	if (type == types.size())
+		types.push_back(generator->name);
+	nodes.push_back(type);
+
+	if (!generator->save(*this))
+	{
+		missing = generator->name;
+		return false;
+	}
+	return true;
+}
+
+void PatchWriter::text(vector<uint32_t>& out, const string& s) const
+{
+	out.push_back(s.length());
+	size_t start = out.size();
+	out.resize(start + (s.length() + 3) / 4, 0);
+	if (s.length())
+		memcpy(&out[start], s.data(), s.length());
+}
+
+bool PatchReader::open(const string& file)
+{
+	close();
+	int fd = ::open(file.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		cerr << "synthc: unable to open " << file << endl;
+		return false;
+	}
+	struct stat info;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size >= 4 * (off_t) sizeof(uint32_t))
+		data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+	{
+		cerr << "synthc: unable to map " << file << endl;
+		return false;
+	}
+	words = (const uint32_t*) data;
+	size = info.st_size / sizeof(uint32_t);
+	mapped = true;
+	if (!header())
+	{
+		cerr << "synthc: " << file << " is not a compiled patch file (version " << PatchWriter::VERSION << ')' << endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool PatchReader::open(const uint32_t* data, size_t count)
+{
+	close();
+	words = data;
+	size = count;
+	if (!header())
+	{
+		cerr << "synthc: not a compiled patch (version " << PatchWriter::VERSION << ')' << endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool PatchReader::header()
+{
+	position = 0;
+	failed = false;
+	bool valid = integer() == PatchWriter::MAGIC && integer() == PatchWriter::VERSION;
+	rate = integer();
+	uint32_t count = integer();
+	for (uint32_t i = 0; valid && i < count && !failed; i++)
+	{
+		string type;
+		if (text(type))
+			types.push_back(type);
+	}
+	count = integer();
+	for (uint32_t i = 0; valid && i < count && !failed; i++)
+	{
+		string name;
+		text(name);
+		patches[name] = integer();
+	}
+	base = position;
+	return valid && !failed;
+}
+
+void PatchReader::close()
+{
+	if (words && mapped)
+		munmap((void*) words, size * sizeof(uint32_t));
+	mapped = false;
+	words = nullptr;
+	size = 0;
+	types.clear();
+	patches.clear();
+}
+
+vector<string> PatchReader::names() const
+{
+	vector<string> list;
+	for (auto& patch : patches)
+		list.push_back(patch.first);
+	return list;
+}
+
+SoundGenerator* PatchReader::build(const string& name, ParseContext& context)
+{
+	auto it = patches.find(name);
+	if (it == patches.end())
+	{
+		cerr << "synthc: no patch " << name << endl;
+		return nullptr;
+	}
+	if (context.engine.samplesPerSeconds() != rate)
+	{
+		cerr << "synthc: patch " << name << " compiled for " << rate << "Hz, engine runs at "
+			<< context.engine.samplesPerSeconds() << "Hz" << endl;
+		return nullptr;
+	}
+
+	ctx = &context;
+	position = base + it->second;
+	failed = false;
+	SoundGenerator* tree = input();
+	ctx = nullptr;
+	if (failed || tree == nullptr || !tree->isValid())
+	{
+		cerr << "synthc: corrupted patch " << name << endl;
+		if (tree)
+			context.drop(tree);
+		return nullptr;
+	}
+	// Mono nodes compute one channel (nothing else to optimize)
+	return context.optimizing ? context.optimize(tree) : tree;
+}
+
+sgfloat PatchReader::real()
+{
+	uint32_t word = integer();
+	sgfloat value;
+	memcpy(&value, &word, sizeof(value));
+	return value;
+}
+
+uint32_t PatchReader::integer()
+{
+	if (position >= size)
+	{
+		failed = true;
+		return 0;
+	}
+	return words[position++];
+}
+
+SoundGenerator* PatchReader::input()
+{
+	uint32_t type = integer();
+	if (failed || type >= types.size())
+	{
+		failed = true;
+		return nullptr;
+	}
+	auto it = SoundGenerator::generators.find(types[type]);
+	SoundGenerator* generator = nullptr;
+	if (it != SoundGenerator::generators.end())
+		generator = it->second->load(*this, *ctx);
+	if (generator == nullptr)
+	{
+		failed = true;
+		return nullptr;
+	}
+	generator->name = types[type];
+	return generator;
+}
+
+bool PatchReader::text(string& s)
+{
+	uint32_t length = integer();
+	size_t count = (length + 3) / 4;
+	if (failed || count > size - position)
+	{
+		failed = true;
+		return false;
+	}
+	s.assign((const char*) (words + position), length);
+	position += count;
+	return true;
+}
+
+WhiteNoiseGenerator::WhiteNoiseGenerator(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+}
+
+bool WhiteNoiseGenerator::save(PatchWriter& out) const
+{
+	return true;
+}
+
+TriangleGenerator::TriangleGenerator(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	freq = in.real();
+	volume = in.real();
+	a = in.real();
+	da = in.real();
+	asc_da = in.real();
+	desc_da = in.real();
+	ton = in.real();
+	dir = in.integer();
+}
+
+bool TriangleGenerator::save(PatchWriter& out) const
+{
+	out.real(freq);
+	out.real(volume);
+	out.real(a);
+	out.real(da);
+	out.real(asc_da);
+	out.real(desc_da);
+	out.real(ton);
+	out.integer(dir);
+	return true;
+}
+
+SquareGenerator::SquareGenerator(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	freq = in.real();
+	volume = in.real();
+	a = in.real();
+	da = in.real();
+	invert = in.real();
+	val = (int32_t) in.integer();
+}
+
+bool SquareGenerator::save(PatchWriter& out) const
+{
+	out.real(freq);
+	out.real(volume);
+	out.real(a);
+	out.real(da);
+	out.real(invert);
+	out.integer(val);
+	return true;
+}
+
+SinusGenerator::SinusGenerator(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	freq = in.real();
+	volume = in.real();
+	a = in.real();
+	da = in.real();
+}
+
+bool SinusGenerator::save(PatchWriter& out) const
+{
+	out.real(freq);
+	out.real(volume);
+	out.real(a);
+	out.real(da);
+	return true;
+}
+
+DistortionGenerator::DistortionGenerator(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	level = in.real();
+	generator = in.input();
+}
+
+bool DistortionGenerator::save(PatchWriter& out) const
+{
+	out.real(level);
+	return out.input(generator);
+}
+
+LevelSound::LevelSound(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	level = in.real();
+}
+
+bool LevelSound::save(PatchWriter& out) const
+{
+	out.real(level);
+	return true;
+}
+
+FmModulator::FmModulator(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	min = in.real();
+	max = in.real();
+	mod_gen = in.integer();
+	mod_mod = in.integer();
+	sound = in.input();
+	modulator = in.input();
+}
+
+bool FmModulator::save(PatchWriter& out) const
+{
+	out.real(min);
+	out.real(max);
+	out.integer(mod_gen);
+	out.integer(mod_mod);
+	return out.input(sound) && out.input(modulator);
+}
+
+MixerGenerator::MixerGenerator(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	uint32_t count = in.integer();
+	for (uint32_t i = 0; i < count && in.good(); i++)
+	{
+		SoundGenerator* generator = in.input();
+		if (generator)
+			generators.push_back(generator);
+	}
+	quiet.assign(generators.size(), false);
+}
+
+bool MixerGenerator::save(PatchWriter& out) const
+{
+	out.integer(generators.size());
+	for (auto generator : generators)
+		if (!out.input(generator))
+			return false;
+	return true;
+}
+
+LeftSound::LeftSound(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	generator = in.input();
+}
+
+bool LeftSound::save(PatchWriter& out) const
+{
+	return out.input(generator);
+}
+
+RightSound::RightSound(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	generator = in.input();
+}
+
+bool RightSound::save(PatchWriter& out) const
+{
+	return out.input(generator);
+}
+
+ClampSound::ClampSound(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	level = in.real();
+	generator = in.input();
+}
+
+bool ClampSound::save(PatchWriter& out) const
+{
+	out.real(level);
+	return out.input(generator);
+}
+
+EnvelopeSound::EnvelopeSound(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	loop = in.integer();
+	index = in.real();
+	dindex = in.real();
+	uint32_t count = in.integer();
+	for (uint32_t i = 0; i < count && in.good(); i++)
+		data.push_back(in.real());
+	generator = in.input();
+	if (data.empty())
+		in.fail();
+}
+
+bool EnvelopeSound::save(PatchWriter& out) const
+{
+	out.integer(loop);
+	out.real(index);
+	out.real(dindex);
+	out.integer(data.size());
+	for (auto v : data)
+		out.real(v);
+	return out.input(generator);
+}
+
+MonoGenerator::MonoGenerator(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	generator = in.input();
+}
+
+bool MonoGenerator::save(PatchWriter& out) const
+{
+	return out.input(generator);
+}
+
+AmGenerator::AmGenerator(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	min = in.real();
+	max = in.real();
+	generator = in.input();
+	if (in.integer())
+		modulator = in.input();
+}
+
+bool AmGenerator::save(PatchWriter& out) const
+{
+	out.real(min);
+	out.real(max);
+	if (!out.input(generator))
+		return false;
+	out.integer(modulator != nullptr);	// optimized away when constant
+	return modulator == nullptr || out.input(modulator);
+}
+
+ReverbGenerator::ReverbGenerator(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	echo = in.integer();
+	vol = in.real();
+	ech_vol = in.real();
+	buf_size = in.integer();
+	tail_samples = in.integer();
+	index = 0;
+	if (buf_size == 0 || buf_size > 1000000)
+	{
+		in.fail();
+		buf_size = 1;
+	}
+	buf_left = new sgfloat [buf_size]();
+	buf_right = new sgfloat [buf_size]();
+	generator = in.input();
+}
+
+bool ReverbGenerator::save(PatchWriter& out) const
+{
+	out.integer(echo);
+	out.real(vol);
+	out.real(ech_vol);
+	out.integer(buf_size);
+	out.integer(tail_samples);
+	return out.input(generator);
+}
+
+Filter::Filter(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx), lleft(0), lright(0)
+{
+	freq = in.real();
+	coeff = in.real();
+	mcoeff = in.real();
+	generator = in.input();
+}
+
+bool Filter::save(PatchWriter& out) const
+{
+	out.real(freq);
+	out.real(coeff);
+	out.real(mcoeff);
+	return out.input(generator);
+}
+
+LowFilter::LowFilter(PatchReader& in, ParseContext& ctx)
+: Filter(in, ctx)
+{
+}
+
+HighFilter::HighFilter(PatchReader& in, ParseContext& ctx)
+: Filter(in, ctx)
+{
+}
+
+AdsrGenerator::AdsrGenerator(PatchReader& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	uint32_t count = in.integer();
+	for (uint32_t i = 0; i < count && in.good(); i++)
+	{
+		value v;
+		v.s = in.real();
+		v.vol = in.real();
+		values.push_back(v);
+	}
+	loop = in.integer();
+	sustain = in.integer();
+	dt = in.real();
+	generator = in.input();
+	if (values.empty() || sustain >= values.size())
+		in.fail();
+	else
+		reset();
+}
+
+bool AdsrGenerator::save(PatchWriter& out) const
+{
+	out.integer(values.size());
+	for (auto& v : values)
+	{
+		out.real(v.s);
+		out.real(v.vol);
+	}
+	out.integer(loop);
+	out.integer(sustain);
+	out.real(dt);
+	return out.input(generator);
+}
@@ -0,0 +1,277 @@
+#include <libsynth.hpp>
+#include <dirent.h>
+#include <algorithm>
+#include <set>
+
+PatchLibrary::PatchLibrary(Engine& engine, size_t max_bytes)
+: engine(engine), max_bytes(max_bytes)
+{
+}
+
+PatchLibrary::~PatchLibrary()
+{
+	if (prefetcher)
+	{
+		{
+			unique_lock<mutex> lock(mtx);
+			stopping = true;
+		}
+		queued.notify_all();
+		prefetcher->join();
+		delete prefetcher;
+	}
+}
+
+size_t PatchLibrary::index(const string& dir)
+{
+	DIR* directory = opendir(dir.c_str());
+	if (directory == nullptr)
+	{
+		cerr << "library: unable to read " << dir << endl;
+		return 0;
+	}
+
+	// Words of each file, a word is a dependency if another file defines it
+	map<string, pair<string, set<string>>> files;
+	map<string, string> providers;
+	while (dirent* item = readdir(directory))
+	{
+		string file(item->d_name);
+		if (file.length() <= 6 || file.compare(file.length() - 6, 6, ".synth"))
+			continue;
+		string name = file.substr(0, file.length() - 6);
+		file = dir + '/' + file;
+
+		ifstream in(file);
+		set<string>& words = files[name].second;
+		files[name].first = file;
+		string word, previous;
+		while (in >> word)
+		{
+			if (word[0] == '#')
+				getline(in, word);	// comment
+			else if (previous == "define")
+				providers[word] = name;
+			else if (isalpha((unsigned char) word[0]))
+				words.insert(word);
+			previous = word;
+		}
+	}
+	closedir(directory);
+
+	unique_lock<mutex> lock(mtx);
+	for (auto& file : files)
+	{
+		Entry& entry = entries[file.first];
+		entry.file = file.second.first;
+		entry.needs.clear();
+		for (auto& word : file.second.second)
+		{
+			auto provider = providers.find(word);
+			if (provider != providers.end() && provider->second != file.first
+				&& find(entry.needs.begin(), entry.needs.end(), provider->second) == entry.needs.end())
+				entry.needs.push_back(provider->second);
+		}
+	}
+	return files.size();
+}
+
+vector<string> PatchLibrary::names() const
+{
+	unique_lock<mutex> lock(mtx);
+	vector<string> list;
+	for (auto& entry : entries)
+		list.push_back(entry.first);
+	return list;
+}
+
+vector<string> PatchLibrary::dependencies(const string& name) const
+{
+	unique_lock<mutex> lock(mtx);
+	auto it = entries.find(name);
+	return it == entries.end() ? vector<string>() : it->second.needs;
+}
+
+SoundGenerator* PatchLibrary::build(const string& name)
+{
+	{
+		unique_lock<mutex> lock(mtx);
+		auto it = entries.find(name);
+		if (it == entries.end())
+		{
+			cerr << "library: no patch " << name << endl;
+			return nullptr;
+		}
+		if (it->second.cached)
+			counters.hits++;
+		else
+			counters.misses++;
+	}
+
+	shared_ptr<const vector<uint32_t>> compiled;
+	shared_ptr<const string> text;
+	while (compiled == nullptr && text == nullptr)
+	{
+		{
+			unique_lock<mutex> lock(mtx);
+			Entry& entry = entries[name];
+			if (entry.cached)
+			{
+				lru.splice(lru.begin(), lru, entry.lru);
+				compiled = entry.compiled;
+				text = entry.text;
+				break;
+			}
+		}
+		if (!load(name))
+			return nullptr;
+	}
+
+	// Instances are built without the lock, from the prototype they hold
+	ParseContext ctx(engine);
+	ctx.echo = false;
+	if (compiled)
+	{
+		PatchReader reader;
+		if (!reader.open(&(*compiled)[0], compiled->size()))
+			return nullptr;
+		return reader.build(name, ctx);
+	}
+	return ctx.optimize(ctx.factory(*text));
+}
+
+void PatchLibrary::prefetch(const vector<string>& names)
+{
+	unique_lock<mutex> lock(mtx);
+	queue.insert(queue.end(), names.begin(), names.end());
+	if (prefetcher == nullptr)
+		prefetcher = new thread(&PatchLibrary::worker, this);
+	queued.notify_one();
+}
+
+PatchLibrary::Stats PatchLibrary::stats() const
+{
+	unique_lock<mutex> lock(mtx);
+	return counters;
+}
+
+bool PatchLibrary::load(const string& name)
+{
+	string file;
+	{
+		unique_lock<mutex> lock(mtx);
+		file = entries[name].file;
+	}
+	vector<string> visited(1, name);
+	define(name, visited);
+
+	auto start = chrono::steady_clock::now();
+	ifstream in(file);
+	string content((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	stringstream stream(content);
+	ParseContext ctx(engine);
+	ctx.echo = false;
+	SoundGenerator* tree = ctx.optimize(ctx.factory(stream));
+	if (tree == nullptr || !tree->isValid())
+	{
+		cerr << "library: unable to build " << name << endl;
+		return false;
+	}
+
+	shared_ptr<const vector<uint32_t>> compiled;
+	shared_ptr<const string> text;
+	PatchWriter writer(engine.samplesPerSeconds());
+	if (writer.add(name, tree))
+		compiled = make_shared<const vector<uint32_t>>(writer.data());
+	else
+		text = make_shared<const string>(content);	// parsed again for each instance
+	ctx.drop(tree);
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	unique_lock<mutex> lock(mtx);
+	Entry& entry = entries[name];
+	entry.defined = true;
+	counters.parse_time += elapsed;
+	if (entry.cached)
+		return true;	// loaded meanwhile by another thread
+	entry.compiled = compiled;
+	entry.text = text;
+	entry.bytes = compiled ? compiled->size() * sizeof(uint32_t) : text->size();
+	entry.cached = true;
+	lru.push_front(name);
+	entry.lru = lru.begin();
+	counters.bytes += entry.bytes;
+	counters.prototypes++;
+	evict();
+	return true;
+}
+
+void PatchLibrary::define(const string& name, vector<string>& visited)
+{
+	vector<string> needs;
+	{
+		unique_lock<mutex> lock(mtx);
+		needs = entries[name].needs;
+	}
+	for (auto& need : needs)
+	{
+		if (find(visited.begin(), visited.end(), need) != visited.end())
+			continue;
+		visited.push_back(need);
+		define(need, visited);
+
+		string file;
+		{
+			unique_lock<mutex> lock(mtx);
+			Entry& entry = entries[need];
+			if (entry.defined)
+				continue;
+			file = entry.file;
+		}
+		// Parsing the file stores its defines in the engine
+		ParseContext ctx(engine);
+		ctx.echo = false;
+		SoundGenerator* generator = ctx.factory(file);
+		if (generator)
+			ctx.drop(generator);
+
+		unique_lock<mutex> lock(mtx);
+		entries[need].defined = true;
+	}
+}
+
+void PatchLibrary::evict()
+{
+	// The most recent prototype stays, even alone above the budget
+	while (counters.bytes > max_bytes && lru.size() > 1)
+	{
+		Entry& entry = entries[lru.back()];
+		counters.bytes -= entry.bytes;
+		counters.prototypes--;
+		counters.evictions++;
+		entry.compiled.reset();
+		entry.text.reset();
+		entry.bytes = 0;
+		entry.cached = false;
+		lru.pop_back();
+	}
+}
+
+void PatchLibrary::worker()
+{
+	unique_lock<mutex> lock(mtx);
+	while (true)
+	{
+		queued.wait(lock, [this] { return stopping || queue.size(); });
+		if (stopping)
+			return;
+		string name = queue.front();
+		queue.pop_front();
+		auto it = entries.find(name);
+		if (it == entries.end() || it->second.cached)
+			continue;
+		lock.unlock();
+		load(name);
+		lock.lock();
+	}
+}
@@ -0,0 +1,152 @@
+#include <libsynth.hpp>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+
+PatchWatcher::PatchWatcher(Engine& engine, uint32_t crossfade_ms)
+: engine(engine), crossfade_ms(crossfade_ms), running(false), reload_count(0)
+{
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		cerr << "libsynth, WARNING unable to watch patch files, no hot reload" << endl;
+}
+
+PatchWatcher::~PatchWatcher()
+{
+	if (watcher)
+	{
+		running = false;
+		watcher->join();
+		delete watcher;
+	}
+	if (fd >= 0)
+		::close(fd);
+	engine.collect();
+}
+
+Engine::Handle PatchWatcher::play(const string& file)
+{
+	SoundGenerator* generator = build(file);
+	if (generator == nullptr)
+		return 0;
+	Engine::Handle handle = engine.play(generator);
+	if (handle == 0 || fd < 0)
+		return handle;
+
+	// Editors often save to a new file renamed over the old one, the directory is watched
+	size_t slash = file.find_last_of('/');
+	string dir = slash == string::npos ? string(".") : file.substr(0, slash + 1);
+	int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd < 0)
+	{
+		cerr << "libsynth, WARNING unable to watch " << dir << endl;
+		return handle;
+	}
+
+	lock_guard<mutex> lock(mtx);
+	Watched& watched = files[make_pair(wd, file.substr(slash + 1))];
+	watched.file = file;
+	watched.handles.push_back(handle);
+	if (watcher == nullptr)
+	{
+		running = true;
+		watcher = new thread(&PatchWatcher::loop, this);
+	}
+	return handle;
+}
+
+void PatchWatcher::forget(Engine::Handle handle)
+{
+	lock_guard<mutex> lock(mtx);
+	for (auto& item : files)
+	{
+		auto& handles = item.second.handles;
+		handles.erase(std::remove(handles.begin(), handles.end(), handle), handles.end());
+	}
+}
+
+SoundGenerator* PatchWatcher::build(const string& file)
+{
+	ParseContext ctx(engine);
+	ctx.echo = false;
+	ctx.fatal = false;		// a file saved with a typo must not stop the program
+	ctx.verbose = engine.getParser().verbose;
+	SoundGenerator* generator = ctx.factory(file);
+	if (generator == nullptr || !generator->isValid())
+	{
+		cerr << "libsynth, ERROR unable to build " << file << endl;
+		if (generator)
+			ctx.drop(generator);
+		return nullptr;
+	}
+	return engine.getParser().optimizing ? ctx.optimize(generator) : generator;
+}
+
+void PatchWatcher::reload(pair<int, string> key)
+{
+	string file;
+	vector<Engine::Handle> handles;
+	{
+		lock_guard<mutex> lock(mtx);
+		auto it = files.find(key);
+		if (it == files.end())
+			return;
+		file = it->second.file;
+		handles = it->second.handles;
+	}
+
+	// One new tree per playing sound, built without any engine lock
+	for (auto handle : handles)
+	{
+		SoundGenerator* generator = build(file);
+		if (generator == nullptr)
+		{
+			cerr << "libsynth, WARNING " << file << " not reloaded, the playing sound is kept" << endl;
+			return;
+		}
+		if (engine.swap(handle, generator, crossfade_ms))
+		{
+			reload_count++;
+			continue;
+		}
+		ParseContext(engine).drop(generator);
+		forget(handle);	// not playing anymore
+	}
+	if (engine.getParser().verbose && handles.size())
+		cout << "Reloaded " << file << endl;
+}
+
+void PatchWatcher::loop()
+{
+	vector<char> buffer(4096);
+	pollfd item;
+	item.fd = fd;
+	item.events = POLLIN;
+	while (running)
+	{
+		if (poll(&item, 1, 50) > 0)
+		{
+			// Saving may produce many events, each file is reloaded once
+			vector<pair<int, string>> changed;
+			ssize_t length;
+			while ((length = read(fd, &buffer[0], buffer.size())) > 0)
+			{
+				for (ssize_t i = 0; i < length; )
+				{
+					inotify_event* event = reinterpret_cast<inotify_event*>(&buffer[i]);
+					if (event->len)
+					{
+						pair<int, string> key(event->wd, string(event->name));
+						if (find(changed.begin(), changed.end(), key) == changed.end())
+							changed.push_back(key);
+					}
+					i += sizeof(inotify_event) + event->len;
+				}
+			}
+			for (auto& key : changed)
+				reload(key);
+		}
+		engine.collect();
+	}
+}
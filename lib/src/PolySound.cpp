@@ -0,0 +1,281 @@
+#include <libsynth.hpp>
+#include <cmath>
+
+PolySound::PolySound(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
+{
+	uint16_t count = ctx.readFloat(in, 1, 256, "voices");
+
+	while (in.good())
+	{
+		stringstream::pos_type last = in.tellg();
+		string option;
+		in >> option;
+		if (option == "oldest")
+			policy = OLDEST;
+		else if (option == "quietest")
+			policy = QUIETEST;
+		else if (option == "ref")
+			reference = ctx.readFrequency(in, "ref");
+		else if (option == "scalar")
+			scalar = true;
+		else
+		{
+			in.clear();
+			in.seekg(last);
+			break;
+		}
+	}
+	if (reference <= 0)
+	{
+		ctx.fail("poly: reference frequency must be positive.");
+		return;
+	}
+
+	// Build the first voice, then replay the same text for the others
+	string patch;
+	SoundGenerator* sound = ctx.factory(in, patch);
+	if (sound == nullptr)
+		return;
+
+	voices.resize(count);
+	for (uint16_t i = 0; i < count; i++)
+	{
+		Voice& voice = voices[i];
+		if (i == 0)
+			voice.sound = sound;
+		else
+		{
+			stringstream copy(patch);
+			voice.sound = ctx.factory(copy, true);
+		}
+		// Before the nodes are known (the optimizer of the whole tree then has nothing to do)
+		if (ctx.optimizing)
+			voice.sound = ctx.optimize(voice.sound);
+		voice.sound->collect(voice.nodes);
+		for (auto node : voice.nodes)
+		{
+			AdsrGenerator* adsr = dynamic_cast<AdsrGenerator*>(node);
+			if (adsr)
+				voice.envelopes.push_back(adsr);
+		}
+	}
+
+	// Lanes of WideGenerator::LANES voices, if every node of the patch has a wide kernel
+	for (uint16_t first = 0; first < count && !scalar; first += WideGenerator::LANES)
+	{
+		vector<SoundGenerator*> lanes;
+		for (uint16_t i = first; i < count && i < first + WideGenerator::LANES; i++)
+			lanes.push_back(voices[i].sound);
+		WideGenerator* wide = WideGenerator::build(lanes);
+		if (wide == nullptr)
+		{
+			for (auto group : wides)
+				delete group;
+			wides.clear();
+			break;
+		}
+		wides.push_back(wide);
+	}
+
+	events = new RingBuffer<Event>(1024);
+	decay = exp(-1.0 / (0.05 * sampleRate()));	// 50ms
+}
+
+bool PolySound::noteOn(sgfloat  freq, sgfloat  velocity)
+{
+	if (velocity < 0) velocity = 0;
+	if (velocity > 1) velocity = 1;
+	Event event = { freq, velocity };
+	return events->write(&event, 1) == 1;
+}
+
+bool PolySound::noteOff(sgfloat  freq)
+{
+	Event event = { freq, -1 };
+	return events->write(&event, 1) == 1;
+}
+
+uint16_t PolySound::activeVoices() const
+{
+	uint16_t count = 0;
+	for (auto& voice : voices)
+		if (voice.active)
+			count++;
+	return count;
+}
+
+void PolySound::reset()
+{
+	for (auto& voice : voices)
+		voice.active = false;
+}
+
+PolySound::Voice* PolySound::steal()
+{
+	Voice* best = nullptr;
+
+	// Released voices are stolen before held ones
+	for (int pass = 0; pass < 2 && best == nullptr; pass++)
+		for (auto& voice : voices)
+		{
+			if (pass == 0 && !voice.released)
+				continue;
+			if (best == nullptr
+				|| (policy == OLDEST && voice.started < best->started)
+				|| (policy == QUIETEST && voice.level < best->level))
+				best = &voice;
+		}
+	return best;
+}
+
+void PolySound::start(sgfloat  freq, sgfloat  velocity)
+{
+	Voice* voice = nullptr;
+	for (auto& v : voices)
+		if (!v.active)
+		{
+			voice = &v;
+			break;
+		}
+	if (voice == nullptr)
+		voice = steal();
+
+	uint16_t index = voice - &voices[0];
+	if (wides.size())
+		wides[index / WideGenerator::LANES]->reset(index % WideGenerator::LANES);
+	else
+		for (auto node : voice->nodes)
+			node->reset();
+
+	voice->freq = freq;
+	voice->speed = freq / reference;
+	voice->velocity = velocity;
+	voice->level = 0;
+	voice->started = ++notes;
+	voice->active = true;
+	voice->released = false;
+}
+
+void PolySound::stop(sgfloat  freq)
+{
+	for (auto& voice : voices)
+	{
+		if (!voice.active || voice.released)
+			continue;
+		if (freq != 0 && voice.freq != freq)
+			continue;
+
+		voice.released = true;
+		if (wides.size())
+		{
+			uint16_t index = &voice - &voices[0];
+			WideGenerator* wide = wides[index / WideGenerator::LANES];
+			wide->release(index % WideGenerator::LANES);
+			if (wide->finished(index % WideGenerator::LANES))
+				voice.active = false;
+			continue;
+		}
+		for (auto adsr : voice.envelopes)
+			adsr->release();
+		if (voice.envelopes.empty())
+			voice.active = false;
+	}
+}
+
+void PolySound::next(sgfloat & left, sgfloat & right, sgfloat  speed)
+{
+	Event event;
+	while (events->read(&event, 1))
+	{
+		if (event.velocity < 0)
+			stop(event.freq);
+		else
+			start(event.freq, event.velocity);
+	}
+
+	if (wides.size())
+	{
+		nextWide(left, right, speed);
+		return;
+	}
+
+	for (auto& voice : voices)
+	{
+		if (!voice.active)
+			continue;
+
+		sgfloat  l = 0;
+		sgfloat  r = 0;
+		voice.sound->next(l, r, speed * voice.speed);
+		l *= voice.velocity;
+		r *= voice.velocity;
+		left += l;
+		right += r;
+
+		sgfloat  peak = fabs(l) > fabs(r) ? fabs(l) : fabs(r);
+		voice.level = peak > voice.level ? peak : voice.level * decay;
+
+		if (voice.released)
+		{
+			bool finished = true;
+			for (auto adsr : voice.envelopes)
+				finished = finished && adsr->finished();
+			if (finished)
+				voice.active = false;
+		}
+	}
+}
+
+void PolySound::nextWide(sgfloat & left, sgfloat & right, sgfloat  speed)
+{
+	const int LANES = WideGenerator::LANES;
+	for (size_t group = 0; group < wides.size(); group++)
+	{
+		Voice* lanes = &voices[group * LANES];
+		int count = voices.size() - group * LANES;
+		if (count > LANES) count = LANES;
+
+		bool active = false;
+		for (int i = 0; i < count; i++)
+			active = active || lanes[i].active;
+		if (!active)
+			continue;
+
+		sgfloat  l[LANES] = { 0 };
+		sgfloat  r[LANES] = { 0 };
+		sgfloat  speeds[LANES];
+		for (int i = 0; i < LANES; i++)
+			speeds[i] = i < count ? speed * lanes[i].speed : speed;
+		wides[group]->next(l, r, speeds);
+
+		for (int i = 0; i < count; i++)
+		{
+			Voice& voice = lanes[i];
+			if (!voice.active)
+				continue;
+			sgfloat  vl = l[i] * voice.velocity;
+			sgfloat  vr = r[i] * voice.velocity;
+			left += vl;
+			right += vr;
+
+			sgfloat  peak = fabs(vl) > fabs(vr) ? fabs(vl) : fabs(vr);
+			voice.level = peak > voice.level ? peak : voice.level * decay;
+
+			if (voice.released && wides[group]->finished(i))
+				voice.active = false;
+		}
+	}
+}
+
+void PolySound::help(Help& help) const
+{
+	HelpEntry* entry = new HelpEntry("poly", "Polyphonic instrument (notes sent with noteOn / noteOff)");
+	entry->addOption(new HelpOption("voices", "Number of voices built from the patch"));
+	entry->addOption(new HelpOption("steal", "[oldest|quietest] voice stolen when all are playing (default oldest)", HelpOption::OPTIONAL | HelpOption::CHOICE));
+	entry->addOption(new HelpOption("ref freq", "Frequency the patch is written at (default 440)", HelpOption::OPTIONAL));
+	entry->addOption(new HelpOption("scalar", "Do not run voices in simd lanes (same sound, for tests)", HelpOption::OPTIONAL));
+	entry->addOption(new HelpOption("patch", "Sound of one voice, note off releases its adsr", HelpOption::GENERATOR));
+	entry->addExample("poly 8 quietest adsr 10:100 200:60 sustain 600:0 once sinus 440");
+	help.add(entry);
+}
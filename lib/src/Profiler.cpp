@@ -0,0 +1,104 @@
+#include <libsynth.hpp>
+#include <cstdlib>
+#include <new>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+thread_local uint64_t NodeProfile::thread_allocations = 0;
+thread_local uint64_t NodeProfile::children_cycles = 0;
+thread_local uint64_t NodeProfile::children_allocations = 0;
+
+#ifdef SYNTH_PROFILE_ALLOCATIONS
+// Allocations are counted per thread for the profiler (a thread local increment)
+void* operator new(size_t size)
+{
+	NodeProfile::thread_allocations++;
+	void* memory = malloc(size ? size : 1);
+	if (memory == nullptr)
+		throw bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+#endif
+
+uint64_t NodeProfile::cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+NodeStats NodeProfile::read(const string& name) const
+{
+	NodeStats stats;
+	stats.name = name;
+	stats.calls = calls;
+	stats.self = self;
+	stats.inclusive = inclusive;
+	stats.allocations = allocations;
+	return stats;
+}
+
+ProfiledSound::ProfiledSound(ParseContext& ctx, SoundGenerator* generator)
+: SoundGenerator(ctx), generator(generator)
+{
+	name = "profiled";
+}
+
+void ProfiledSound::profile(ParseContext& ctx, SoundGenerator* root)
+{
+	vector<SoundGenerator*> nodes;
+	root->collect(nodes);
+	for (auto node : nodes)
+	{
+		if (dynamic_cast<ProfiledSound*>(node))
+			continue;
+		vector<SoundGenerator**> children;
+		node->inputs(children);
+		for (auto child : children)
+			if (*child && dynamic_cast<ProfiledSound*>(*child) == nullptr)
+				*child = new ProfiledSound(ctx, *child);
+	}
+}
+
+void ProfiledSound::unprofile(SoundGenerator* root)
+{
+	vector<SoundGenerator**> children;
+	root->inputs(children);
+	for (auto child : children)
+	{
+		while (ProfiledSound* profiled = dynamic_cast<ProfiledSound*>(*child))
+		{
+			*child = profiled->generator;
+			profiled->generator = nullptr;
+			delete profiled;
+		}
+		if (*child)
+			unprofile(*child);
+	}
+}
+
+NodeStats ProfiledSound::stats(SoundGenerator* root, const NodeProfile* root_profile)
+{
+	NodeStats stats = root_profile ? root_profile->read(root->name) : NodeStats();
+	stats.name = root->name;
+	vector<SoundGenerator**> children;
+	root->inputs(children);
+	for (auto child : children)
+	{
+		if (*child == nullptr)
+			continue;
+		if (ProfiledSound* profiled = dynamic_cast<ProfiledSound*>(*child))
+			stats.inputs.push_back(ProfiledSound::stats(profiled->generator, &profiled->profiled));
+		else
+			stats.inputs.push_back(ProfiledSound::stats(*child, nullptr));
+	}
+	return stats;
+}
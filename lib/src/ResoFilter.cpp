@@ -1,16 +1,17 @@
 #include <libsynth.hpp>
 
-ResoFilter::ResoFilter(istream& in)
+ResoFilter::ResoFilter(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
-	f = readFloat(in, 0,1,"f");
-	q = readFloat(in, 0,1,"q");
+	f = ctx.readFloat(in, 0,1,"f");
+	q = ctx.readFloat(in, 0,1,"q");
 	fb = q + q/(1.0 - f);
 	lbuf0 = 0;
 	lbuf1 = 0;
 	rbuf0 = 0;
 	rbuf1 = 0;
 	cout << "f " << f << " q " << q <<  endl;
-	generator = factory(in);
+	generator = ctx.factory(in);
 }
 
 void ResoFilter::help(Help& help) const
@@ -0,0 +1,269 @@
+#include <libsynth.hpp>
+
+#ifdef SYNTH_RT_CHECK
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+// glibc allocator, called by the interposed functions
+extern "C" void* __libc_malloc(size_t);
+extern "C" void* __libc_calloc(size_t, size_t);
+extern "C" void* __libc_realloc(void*, size_t);
+extern "C" void __libc_free(void*);
+
+static const uint32_t MAX_RECORDS = 64;
+static const int MAX_FRAMES = 32;
+static const int SKIPPED_FRAMES = 2;	// record and the interposed function
+
+// Preallocated, filled by the audio threads without lock nor allocation
+struct Record
+{
+	atomic<bool> ready;
+	const char* call;
+	char generator[40];
+	uint64_t hash;
+	void* frames[MAX_FRAMES];
+	int depth;
+	atomic<uint64_t> count;
+};
+
+static Record records[MAX_RECORDS];
+static atomic<uint32_t> record_count(0);	// more than MAX_RECORDS : the others are lost
+
+// Plain thread locals (no constructor), usable from malloc
+static __thread int render_depth = 0;
+static __thread bool inside = false;	// recording, calls are not checked
+static __thread const SoundGenerator* current = nullptr;
+
+void RtCheck::enter()
+{
+	render_depth++;
+}
+
+void RtCheck::leave()
+{
+	render_depth--;
+	current = nullptr;
+}
+
+void RtCheck::setGenerator(const SoundGenerator* generator)
+{
+	current = generator;
+}
+
+static void record(const char* call)
+{
+	Record candidate;
+	candidate.call = call;
+	candidate.generator[0] = 0;
+	if (current)
+	{
+		strncpy(candidate.generator, current->name.c_str(), sizeof(candidate.generator) - 1);
+		candidate.generator[sizeof(candidate.generator) - 1] = 0;
+	}
+	candidate.depth = backtrace(candidate.frames, MAX_FRAMES);
+
+	uint64_t hash = 1469598103934665603ull;
+	auto mix = [&hash](uint64_t value) { hash = (hash ^ value) * 1099511628211ull; };
+	mix(uint64_t(call));
+	for (const char* c = candidate.generator; *c; c++)
+		mix(*c);
+	for (int i = SKIPPED_FRAMES; i < candidate.depth; i++)
+		mix(uint64_t(candidate.frames[i]));
+
+	uint32_t known = min(record_count.load(), MAX_RECORDS);
+	for (uint32_t i = 0; i < known; i++)
+		if (records[i].ready && records[i].hash == hash)
+		{
+			records[i].count++;
+			return;
+		}
+
+	uint32_t index = record_count++;
+	if (index >= MAX_RECORDS)
+		return;
+	Record& slot = records[index];
+	slot.call = call;
+	memcpy(slot.generator, candidate.generator, sizeof(slot.generator));
+	memcpy(slot.frames, candidate.frames, sizeof(slot.frames));
+	slot.depth = candidate.depth;
+	slot.hash = hash;
+	slot.count = 1;
+	slot.ready = true;
+}
+
+static inline void check(const char* call)
+{
+	if (render_depth > 0 && !inside)
+	{
+		inside = true;
+		record(call);
+		inside = false;
+	}
+}
+
+// Next definition of a function (libc), looked up once
+template<class F>
+static F next(F& function, const char* name)
+{
+	if (function == nullptr)
+	{
+		bool was_inside = inside;
+		inside = true;
+		function = reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+		inside = was_inside;
+	}
+	return function;
+}
+
+static int (*real_mutex_lock)(pthread_mutex_t*) = nullptr;
+static int (*real_create)(pthread_t*, const pthread_attr_t*, void* (*)(void*), void*) = nullptr;
+static int (*real_join)(pthread_t, void**) = nullptr;
+static ssize_t (*real_write)(int, const void*, size_t) = nullptr;
+static size_t (*real_fwrite)(const void*, size_t, size_t, FILE*) = nullptr;
+static int (*real_nanosleep)(const struct timespec*, struct timespec*) = nullptr;
+
+// The first backtrace loads the unwinder (allocates), before any audio thread runs
+__attribute__((constructor)) static void prepare()
+{
+	void* frames[2];
+	backtrace(frames, 2);
+	next(real_mutex_lock, "pthread_mutex_lock");
+	next(real_create, "pthread_create");
+	next(real_join, "pthread_join");
+	next(real_write, "write");
+	next(real_fwrite, "fwrite");
+	next(real_nanosleep, "nanosleep");
+}
+
+extern "C"
+{
+	void* malloc(size_t size)
+	{
+		check("malloc");
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t count, size_t size)
+	{
+		check("calloc");
+		return __libc_calloc(count, size);
+	}
+
+	void* realloc(void* memory, size_t size)
+	{
+		check("realloc");
+		return __libc_realloc(memory, size);
+	}
+
+	void free(void* memory)
+	{
+		if (memory)
+			check("free");
+		__libc_free(memory);
+	}
+
+	int pthread_mutex_lock(pthread_mutex_t* mutex)
+	{
+		check("pthread_mutex_lock");
+		return next(real_mutex_lock, "pthread_mutex_lock")(mutex);
+	}
+
+	int pthread_create(pthread_t* thread, const pthread_attr_t* attr, void* (*start)(void*), void* arg)
+	{
+		check("pthread_create");
+		return next(real_create, "pthread_create")(thread, attr, start, arg);
+	}
+
+	int pthread_join(pthread_t thread, void** result)
+	{
+		check("pthread_join");
+		return next(real_join, "pthread_join")(thread, result);
+	}
+
+	ssize_t write(int fd, const void* buffer, size_t size)
+	{
+		check("write");
+		return next(real_write, "write")(fd, buffer, size);
+	}
+
+	size_t fwrite(const void* buffer, size_t size, size_t count, FILE* file)
+	{
+		check("fwrite");
+		return next(real_fwrite, "fwrite")(buffer, size, count, file);
+	}
+
+	int nanosleep(const struct timespec* wanted, struct timespec* remaining)
+	{
+		check("nanosleep");
+		return next(real_nanosleep, "nanosleep")(wanted, remaining);
+	}
+}
+
+vector<RtCheck::Violation> RtCheck::violations()
+{
+	vector<Violation> found;
+	uint32_t known = min(record_count.load(), MAX_RECORDS);
+	for (uint32_t i = 0; i < known; i++)
+	{
+		const Record& record = records[i];
+		if (!record.ready)
+			continue;
+		Violation violation;
+		violation.call = record.call;
+		violation.generator = record.generator;
+		violation.count = record.count;
+		char** symbols = backtrace_symbols(record.frames, record.depth);
+		for (int frame = SKIPPED_FRAMES; symbols && frame < record.depth; frame++)
+			violation.stack.push_back(symbols[frame]);
+		free(symbols);
+		found.push_back(violation);
+	}
+	return found;
+}
+
+void RtCheck::clear()
+{
+	uint32_t known = min(record_count.load(), MAX_RECORDS);
+	for (uint32_t i = 0; i < known; i++)
+		records[i].ready = false;
+	record_count = 0;
+}
+
+// Violations left at exit
+static struct ExitReport
+{
+	~ExitReport()
+	{
+		if (record_count)
+			RtCheck::print(cerr);
+	}
+} exit_report;
+
+#else
+
+void RtCheck::enter() { }
+void RtCheck::leave() { }
+
+vector<RtCheck::Violation> RtCheck::violations()
+{
+	return vector<Violation>();
+}
+
+void RtCheck::clear() { }
+
+#endif
+
+void RtCheck::print(ostream& out)
+{
+	for (auto& violation : violations())
+	{
+		out << "libsynth, RT CHECK " << violation.call << " called " << violation.count << " time(s) while rendering "
+			<< (violation.generator.empty() ? "(engine)" : violation.generator) << endl;
+		for (auto& frame : violation.stack)
+			out << "    " << frame << endl;
+	}
+}
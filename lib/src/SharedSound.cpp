@@ -0,0 +1,37 @@
+#include <libsynth.hpp>
+
+SharedNode::~SharedNode()
+{
+	ParseContext::drop(sound);
+}
+
+void SharedNode::fill()
+{
+	uint32_t offset = end % HISTORY;
+	for (uint32_t i = offset; i < offset + BLOCK; i++)
+	{
+		left[i] = 0;
+		right[i] = 0;
+		sound->next(left[i], right[i]);
+	}
+	end += BLOCK;
+	if (end - start > HISTORY)
+		start = end - HISTORY;
+}
+
+void SharedNode::get(uint64_t& position, sgfloat & l, sgfloat & r)
+{
+	while (busy.test_and_set(memory_order_acquire))
+		;
+	if (position < start || position + BLOCK < latest)
+		position = latest;	// not played for a while, join the other users
+	if (position >= end)
+		fill();
+
+	l += left[position % HISTORY];
+	r += right[position % HISTORY];
+	if (position > latest)
+		latest = position;
+	position++;
+	busy.clear(memory_order_release);
+}
@@ -3,34 +3,71 @@
 
 using namespace std;
 
-extern uint32_t samples_per_seconds;
-
 
 // Frequencies list
 static map<string, sgfloat > sf;
+static once_flag sf_loaded;	// patches may be parsed by many threads
 
-SDL_AudioSpec SoundGenerator::have;
-bool SoundGenerator::fading=false;
-sgfloat SoundGenerator::dvol=0.0;
-sgfloat SoundGenerator::main_volume = 1.0;
-
-void SoundGenerator::fade(int dir, int time_ms)
+static void loadFrequencies()
 {
-	if (dir==0) return;
-	fading = true;
-	if (time_ms <= 0) return;
-	dvol = 1000.0 / (sgfloat(time_ms) * (sgfloat) SoundGenerator::samplesPerSeconds());
-	if (dir < 0) dvol = -dvol;
+	ifstream notes("frequencies.def");
+	while (notes.good())
+	{
+		string row;
+		getline(notes, row);
+		stringstream note;
+		note << row;
+
+		sgfloat  freq;
+		note >> freq;
+		if (freq)
+		{
+			string name;
+			while (note.good())
+			{
+				note >> name;
+				sf[name] = freq;
+			}
+		}
+	}
 }
 
 SoundGenerator* SoundGenerator::factory(string s)
+{
+	return Engine::getDefault().factory(s);
+}
+
+SoundGenerator* SoundGenerator::factory(istream& in, bool needed)
+{
+	return Engine::getDefault().factory(in, needed);
+}
+
+SoundGenerator* ParseContext::factory(string s)
 {
 	stringstream stream;
 	stream << s;
 	return factory(stream);
 }
 
-SoundGenerator* SoundGenerator::factory(istream& in, bool needed)
+SoundGenerator* ParseContext::factory(istream& in, bool needed)
+{
+	if (depth == 0)
+		error.clear();
+	else if (failed())
+		return nullptr;		// nothing more is parsed once an error is found
+
+	depth++;
+	SoundGenerator* gen = parse(in, needed);
+	depth--;
+	if (depth == 0 && failed() && gen)
+	{
+		drop(gen);
+		gen = nullptr;
+	}
+	return gen;
+}
+
+SoundGenerator* ParseContext::parse(istream& in, bool needed)
 {
 	SoundGenerator* gen = 0;
 	last_type = "";
@@ -47,7 +84,20 @@ SoundGenerator* SoundGenerator::factory(istream& in, bool needed)
 		}
 	}
 
-	if (type.find(".synth") != string::npos)	// assume a file
+	if (type.find(".synthc") != string::npos)	// compiled patches, file.synthc[:patch]
+	{
+		size_t colon = type.find(':', type.find(".synthc"));
+		PatchReader file;
+		if (file.open(type.substr(0, colon)))
+		{
+			vector<string> names = file.names();
+			if (colon != string::npos)
+				gen = file.build(type.substr(colon + 1), *this);
+			else if (names.size())
+				gen = file.build(names[0], *this);
+		}
+	}
+	else if (type.find(".synth") != string::npos)	// assume a file
 	{
 		ifstream file(type);
 		if (file.good())
@@ -74,11 +124,8 @@ SoundGenerator* SoundGenerator::factory(istream& in, bool needed)
 	{
 		uint32_t buffer_size;
 		in >> buffer_size;
-		if (init_done)
-			cerr << "Unable to change buffer length once sound is played. :-(" << endl;
-		else
-			wanted_buffer_size = buffer_size;
-		cout << "WB" << wanted_buffer_size << endl;
+		engine.setBufferSize(buffer_size);
+		cout << "WB" << engine.wantedBufferSize() << endl;
 
 		return factory(in, needed);
 	}
@@ -86,10 +133,35 @@ SoundGenerator* SoundGenerator::factory(istream& in, bool needed)
 	{
 		uint32_t spf;
 		in >> spf;
-		if (init_done)
-			cerr << "Unable to change samples per second once sound engine has started. :-(" << endl;
-		else
-			samples_per_seconds = spf;
+		engine.setSamplesPerSeconds(spf);
+
+		return factory(in, needed);
+	}
+	else if (type == "-o")
+	{
+		string spec;
+		in >> spec;
+		if (!engine.setBackend(spec))
+		{
+			fail("");
+			return nullptr;
+		}
+
+		return factory(in, needed);
+	}
+	else if (type == "-a")
+	{
+		uint16_t blocks;
+		in >> blocks;
+		engine.setRenderAhead(blocks);
+
+		return factory(in, needed);
+	}
+	else if (type == "-t")
+	{
+		string file;
+		in >> file;
+		engine.setTracing(65536, 16, file);
 
 		return factory(in, needed);
 	}
@@ -118,47 +190,63 @@ SoundGenerator* SoundGenerator::factory(istream& in, bool needed)
 				}
 				define << item << ' ';
 			} while (brackets && in.good());
-			defines[name] = define.str();
+			engine.define(name, define.str());
 			gen = factory(in, needed);
 		}
 		else
+			fail("libsynth, ERROR missing name");
+	}
+	else if (type == "shared")
+	{
+		string name;
+		in >> name;
+		if (name.length() == 0)
 		{
-			cerr << "libsynth, ERROR missing name" << endl;
-			exit(1);
+			fail("libsynth, ERROR missing shared name");
+			return nullptr;
 		}
+		SoundGenerator* sound = factory(in, true);
+		if (sound == nullptr)
+			return nullptr;
+		if (optimizing)
+			sound = optimize(sound);
+		engine.share(name, sound);
+		gen = factory(in, needed);
 	}
 	else if (type.length())
 	{
 		last_type = type;
-		if (generators.find(type) != generators.end())
+		if (SoundGenerator::generators.find(type) != SoundGenerator::generators.end())
 		{
 			gen = factory(type, in);
 			if (gen == 0)
-			{
-				cerr << "libsynth, ERROR Unable to build " << last_type << endl;
-				exit(1);
-			}
+				fail("libsynth, ERROR Unable to build " + last_type);
+		}
+		else if (shared_ptr<SharedNode> node = engine.getShared(last_type))
+		{
+			gen = new SharedSound(*this, node);
+			gen->name = last_type;
 		}
 		else
 		{
-			auto it = defines.find(last_type);
-			if (it != defines.end())
+			string definition;
+			if (engine.getDefine(last_type, definition))
 			{
 				stringstream def;
-				def << defines[last_type];
+				def << definition;
 				gen = factory(def, false);
 				if (gen == 0)
-				{
-					cerr << "libsynth, ERROR Unable to build " << last_type << ", please fix the corresponding define." << endl;
-					exit(1);
-				}
+					fail("libsynth, ERROR Unable to build " + last_type + ", please fix the corresponding define.");
 			}
 		}
 	}
 	if (needed)
 	{
 		if (gen == 0)
-			missingGeneratorExit("");
+		{
+			if (!failed())
+				missingGenerator("");
+		}
 		else if (!gen->isValid())
 		{
 			cerr << "libsynth, ERROR Deleting invalid generator (" << gen->name << ')' << endl;
@@ -169,16 +257,34 @@ SoundGenerator* SoundGenerator::factory(istream& in, bool needed)
 	return gen;
 }
 
-SoundGenerator* SoundGenerator::factory(const std::string type, istream& in)
+SoundGenerator* ParseContext::factory(istream& in, string& text)
+{
+	stringstream::pos_type start = in.tellg();
+	SoundGenerator* generator = factory(in, true);
+	stringstream::pos_type end = in.tellg();
+
+	in.clear();
+	in.seekg(start);
+	if (end == stringstream::pos_type(-1))
+		text.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+	else
+	{
+		text.resize(end - start);
+		in.read(&text[0], text.size());
+	}
+	return generator;
+}
+
+SoundGenerator* ParseContext::factory(const std::string type, istream& in)
 {
 	if (type=="")
 	{
 		return factory(in);
 	}
-	auto it = generators.find(type);
-	if (it != generators.end())
+	auto it = SoundGenerator::generators.find(type);
+	if (it != SoundGenerator::generators.end())
 	{
-		SoundGenerator* generator=it->second->build(in);
+		SoundGenerator* generator=it->second->build(in, *this);
 		if (generator) generator->name = type;
 		return generator;
 	}
@@ -205,147 +311,26 @@ SoundGenerator::SoundGenerator(string name)
 	}
 }
 
-void SoundGenerator::audioCallback(void *unused, Uint8 *byteStream, int byteStreamLength)
-{
-	mtx.lock();
-	uint32_t ech = byteStreamLength / sizeof (int16_t);
-	int16_t* stream =  reinterpret_cast<int16_t*> ( byteStream );
-	uint32_t i;
-
-	for (i = 0; i < ech; i += 2)
-	{
-		if (list_generator_size)
-		{
-			sgfloat  left = 0;
-			sgfloat  right = 0;
-
-			for (auto generator : list_generator)
-				generator->next(left, right);
-
-			if (fading)
-			{
-				main_volume += dvol;
-				if (main_volume > 1.0) { main_volume=1; fading=false; }
-				if (main_volume < 0.0) { main_volume=0; fading=false; }
-			}
-			left  *= main_volume;
-			right *= main_volume;
-
-			if (left > 1.0)
-			{
-				left = 1;
-				saturate = true;
-			}
-			else if (left<-1.0)
-			{
-				left = -1;
-				saturate = true;
-			}
-			if (right > 1.0)
-			{
-				right = 1;
-				saturate = true;
-			}
-			else if (right<-1.0)
-			{
-				right = -1;
-				saturate = true;
-			}
-			stream[i] = 32767 * left / list_generator_size;
-			stream[i + 1] = 32767 * right / list_generator_size;
-		}
-		else
-		{
-			stream[i] = 0;
-			stream[i + 1] = 0;
-		}
-	}
-	mtx.unlock();
-}
-
 bool SoundGenerator::init()
 {
-	if (init_done)
-		return true;
-	buf_size = wanted_buffer_size;
-	if (SDL_InitSubSystem(SDL_INIT_AUDIO | SDL_INIT_TIMER))
-	{
-		SDL_Log("Error while initializing sdl audio subsystem.");
-		return false;
-	}
-	dev = 0;
-	std::atexit(SoundGenerator::quit);
-	SDL_AudioSpec want;
-
-	SDL_memset(&want, 0, sizeof (want)); /* or SDL_zero(want) */
-	want.freq = samples_per_seconds;
-	want.format = AUDIO_S16SYS;
-	want.channels = 2;
-	want.samples = wanted_buffer_size;
-	want.callback = audioCallback;
-
-	dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FORMAT_CHANGE);
-	if (dev == 0)
-	{
-		SDL_Log("Failed to open audio: %s", SDL_GetError());
-	}
-	else
-	{
-		if (have.format != want.format)
-		{ /* we let this one thing change. */
-			SDL_Log("We didn't get Float32 audio format.");
-		}
-		SDL_PauseAudioDevice(dev, 0); /* start audio playing. */
-	}
-	buf_size = have.samples;
-	samples_per_seconds = have.freq;
-	init_done = true;
-	return true;
+	return Engine::getDefault().init();
 }
 
 void SoundGenerator::quit()
 {
-	mtx.lock();
-	// FIXME unallocate list_generator ???
-	// but what if this is not us that have allocated them ?
-	list_generator.clear();
-	SDL_QuitSubSystem(SDL_INIT_AUDIO | SDL_INIT_TIMER);
-	mtx.unlock();
+	Engine::getDefault().quit();
 }
 
 void SoundGenerator::close()
 {
-	SDL_CloseAudioDevice(dev);
-	init_done = false;
+	Engine::getDefault().close();
 }
 
 bool SoundGenerator::readFrequencyVolume(istream& in)
 {
 	bool bRet;
 
-	if (sf.size() == 0)
-	{
-		ifstream notes("frequencies.def");
-		while (notes.good())
-		{
-			string row;
-			getline(notes, row);
-			stringstream note;
-			note << row;
-
-			sgfloat  freq;
-			note >> freq;
-			if (freq)
-			{
-				string name;
-				while (note.good())
-				{
-					note >> name;
-					sf[name] = freq;
-				}
-			}
-		}
-	}
+	call_once(sf_loaded, loadFrequencies);
 
 	string s;
 	string note;
@@ -393,8 +378,12 @@ SoundGenerator::HelpEntry* SoundGenerator::addHelpOption(HelpEntry* entry) const
 void SoundGenerator::help()	// @FIXME memory leak if called many times
 {
 	Help help;
-	help.add(new HelpEntry("-b", "Change sound buffer length, default: " + to_string(wanted_buffer_size)));
-	help.add(new HelpEntry("-s", "Number of samples per seconds, default: " + to_string(samples_per_seconds)));
+	Engine& engine = Engine::getDefault();
+	help.add(new HelpEntry("-b", "Change sound buffer length, default: " + to_string(engine.wantedBufferSize())));
+	help.add(new HelpEntry("-s", "Number of samples per seconds, default: " + to_string(engine.samplesPerSeconds())));
+	help.add(new HelpEntry("-o", "Audio output: sdl (default), null (timer only) or file:name (.wav, - for stdout, |command for a pipe)"));
+	help.add(new HelpEntry("-a", "Render n buffers ahead in a dedicated thread, default: " + to_string(engine.renderAhead()) + " (off)"));
+	help.add(new HelpEntry("-t", "Write a Chrome trace of the audio threads (last 65536 events) to file when done"));
 
 	map<const SoundGenerator*, bool>	done;
 	for (auto generator : generators)
@@ -408,15 +397,73 @@ void SoundGenerator::help()	// @FIXME memory leak if called many times
 	cout << help << endl;
 }
 
-void SoundGenerator::missingGeneratorExit(string msg)
+void ParseContext::fail(const string& message)
+{
+	if (message.length())
+		cerr << message << endl;
+	if (fatal)
+		exit(1);
+	if (error.empty())
+		error = message.length() ? message : "libsynth, ERROR parse error";
+}
+
+void ParseContext::missingGenerator(string msg)
 {
+	string message;
 	if (last_type.length())
-		cerr << "libsynth, ERROR Unknown generator type (" << last_type << ")" << endl;
+		message = "libsynth, ERROR Unknown generator type (" + last_type + ")";
 	else
-		cerr << "libsynth, ERROR Missing generator" << endl;
+		message = "libsynth, ERROR Missing generator";
 	if (msg.length())
-		cerr << msg;
-	exit(1);
+		message += "\n" + msg;
+	fail(message);
+}
+
+SoundGenerator* ParseContext::optimize(SoundGenerator* generator)
+{
+	if (generator == nullptr)
+		return nullptr;
+
+	vector<SoundGenerator**> children;
+	generator->inputs(children);
+	for (auto child : children)
+		*child = optimize(*child);
+
+	SoundGenerator* better = generator->optimize(*this);
+	if (better != generator)
+	{
+		if (verbose)
+			cout << "optimize: " << generator->name << " -> " << better->name << endl;
+		drop(generator, better);
+	}
+	// Mono trees compute one channel, widened by the first stereo node above
+	better->single = better->mono();
+	return better;
+}
+
+void ParseContext::drop(SoundGenerator* root, SoundGenerator* keep)
+{
+	vector<SoundGenerator*> nodes;
+	vector<SoundGenerator*> kept;
+	root->collect(nodes);
+	if (keep)
+		keep->collect(kept);
+
+	vector<SoundGenerator*> dropped;
+	for (auto node : nodes)
+		if (find(kept.begin(), kept.end(), node) == kept.end())
+			dropped.push_back(node);
+
+	// Detach first, some generators delete their inputs
+	for (auto node : dropped)
+	{
+		vector<SoundGenerator**> children;
+		node->inputs(children);
+		for (auto child : children)
+			*child = nullptr;
+	}
+	for (auto node : dropped)
+		delete node;
 }
 
 void SoundGenerator::help(Help& help) const
@@ -427,32 +474,12 @@ void SoundGenerator::help(Help& help) const
 
 bool SoundGenerator::has(SoundGenerator* generator, bool lock)
 {
-	bool bRet;
-	if (lock) mtx.lock();
-	auto it = find(list_generator.begin(), list_generator.end(), generator);
-	if (it == list_generator.end())
-		bRet = false;
-	else
-		bRet = true;
-	if (lock) mtx.unlock();
-	return bRet;
+	return Engine::getDefault().has(generator, lock);
 }
 
-void SoundGenerator::play(SoundGenerator* generator)
+Engine::Handle SoundGenerator::play(SoundGenerator* generator)
 {
-	init();
-	if (generator == 0)
-		return;
-	if (generator->isValid())
-	{
-		mtx.lock();
-		if (has(generator, false) == false)
-			list_generator.push_back(generator);
-		list_generator_size = list_generator.size();
-		mtx.unlock();
-	}
-	else
-		cerr << "libsynth ERROR: skipping invalid generator play." << endl;
+	return Engine::getDefault().play(generator);
 }
 
 bool SoundGenerator::stop(SoundGenerator* generator)
@@ -465,18 +492,7 @@ bool SoundGenerator::stop(SoundGenerator* generator)
 
 bool SoundGenerator::remove(SoundGenerator* generator)
 {
-	bool bRet = false;
-	mtx.lock();
-	if (has(generator, false))
-	{
-		bRet = true;
-		list_generator.remove(generator);
-		list_generator_size = list_generator.size();
-	}
-	else
-		cerr << "libsynth, WARNING : Unable to remove sound generator " << generator << ", size=" << list_generator_size << endl;
-	mtx.unlock();
-	return bRet;
+	return Engine::getDefault().remove(generator);
 }
 
 ostream& operator << (ostream& out, const SoundGenerator::Help &help)
@@ -571,6 +587,36 @@ string SoundGenerator::HelpOption::str() const
 	return str;
 }
 
+void SoundGenerator::collect(vector<SoundGenerator*>& nodes)
+{
+	nodes.push_back(this);
+
+	vector<SoundGenerator**> children;
+	inputs(children);
+	for (auto child : children)
+		if (*child)
+			(*child)->collect(nodes);
+}
+
+sgfloat  SoundGenerator::nextMono(sgfloat  speed)
+{
+	sgfloat  left = 0;
+	sgfloat  right = 0;
+	next(left, right, speed);
+	return left;
+}
+
+sgfloat  SoundGenerator::tail() const
+{
+	vector<SoundGenerator**> children;
+	const_cast<SoundGenerator*>(this)->inputs(children);
+	sgfloat  longest = 0;
+	for (auto child : children)
+		if (*child)
+			longest = max(longest, (*child)->tail());
+	return longest;
+}
+
 bool SoundGenerator::setValue(string name, sgfloat  value)
 {
 	stringstream in;
@@ -605,8 +651,9 @@ bool SoundGenerator::setValue(string name, istream &in)
 			string note;
 			in >> note;
 
-			if (sf.find(note) != sf.end())
-				note = std::to_string(sf[note]);
+			auto it = sf.find(note);
+			if (it != sf.end())
+				note = std::to_string(it->second);
 
 			freq = atof(note.c_str());
 
@@ -667,8 +714,6 @@ sgfloat  SoundGenerator::readFloat(istream& in, sgfloat  min, sgfloat  max, stri
 		if (f < min) f = min;
 		if (f > max) f = max;
 
-		if (verbose)
-			cout << varname << '=' << f << endl;
 		return f;
 	}
 	else
@@ -684,6 +729,20 @@ sgfloat SoundGenerator::readFrequency(istream& in, string name)
 	in >> f;
 	if (f < 0 || f > 200000.0)
 		cerr << "ERROR: Invalid " << name << " frequency : " << f << endl;
+	return f;
+}
+
+sgfloat ParseContext::readFloat(istream& in, sgfloat  min, sgfloat  max, string varname)
+{
+	sgfloat f = SoundGenerator::readFloat(in, min, max, varname);
+	if (verbose)
+		cout << varname << '=' << f << endl;
+	return f;
+}
+
+sgfloat ParseContext::readFrequency(istream& in, string name)
+{
+	sgfloat f = SoundGenerator::readFrequency(in, name);
 	if (verbose)
 		cout << name << '=' << f << endl;
 	return f;
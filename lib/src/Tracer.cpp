@@ -0,0 +1,154 @@
+#include <libsynth.hpp>
+#include <cstring>
+#include <iomanip>
+
+// Threads are numbered from 1 at their first event, names are literals
+static const uint16_t MAX_THREADS = 256;
+static atomic<const char*> thread_names[MAX_THREADS];
+static atomic<uint16_t> thread_count(0);
+static thread_local uint16_t thread_id = 0;
+
+static uint16_t currentThread()
+{
+	if (thread_id == 0)
+		thread_id = ++thread_count;
+	return thread_id;
+}
+
+void Tracer::setThreadName(const char* name)
+{
+	uint16_t id = currentThread();
+	if (id < MAX_THREADS && thread_names[id].load(memory_order_relaxed) != name)
+		thread_names[id] = name;
+}
+
+Tracer::Tracer(uint32_t capacity, uint16_t sample)
+: capacity(capacity ? capacity : 1), sample(sample ? sample : 1), head(0)
+{
+	events = new Event[this->capacity];
+	for (uint32_t i = 0; i < this->capacity; i++)
+		events[i].sequence = 0;
+}
+
+Tracer::~Tracer()
+{
+	delete[] events;
+}
+
+void Tracer::record(char phase, const char* category, const char* name, uint64_t start, uint64_t duration,
+	const char* arg, int64_t value)
+{
+	uint64_t index = head.fetch_add(1, memory_order_relaxed);
+	Event& event = events[index % capacity];
+
+	// Readers skip an event whose sequence changes while they copy it
+	event.sequence.store(0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	event.start = start;
+	event.duration = duration;
+	event.value = value;
+	event.category = category;
+	event.arg = arg;
+	event.thread = currentThread();
+	event.phase = phase;
+	strncpy(event.name, name, NAME_SIZE - 1);
+	event.name[NAME_SIZE - 1] = 0;
+	event.sequence.store(index + 1, memory_order_release);
+}
+
+void Tracer::span(const char* category, const char* name, uint64_t start, uint64_t end,
+	const char* arg, int64_t value)
+{
+	record('X', category, name, start, end > start ? end - start : 0, arg, value);
+}
+
+void Tracer::instant(const char* category, const char* name, const char* arg, int64_t value)
+{
+	record('i', category, name, CallbackTiming::now(), 0, arg, value);
+}
+
+static void writeString(ostream& out, const char* s)
+{
+	out << '"';
+	for (; *s; s++)
+	{
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			out << '\\' << c;
+		else if (c < 0x20)
+			out << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 15];
+		else
+			out << c;
+	}
+	out << '"';
+}
+
+size_t Tracer::write(ostream& out) const
+{
+	ios::fmtflags flags = out.flags();
+	streamsize precision = out.precision();
+	out << fixed << setprecision(3);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << endl;
+
+	bool first = true;
+	uint16_t threads = min<uint16_t>(thread_count, MAX_THREADS - 1);
+	for (uint16_t id = 1; id <= threads; id++)
+	{
+		const char* name = thread_names[id];
+		if (name == nullptr)
+			continue;
+		out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << id
+			<< ",\"args\":{\"name\":";
+		writeString(out, name);
+		out << "}}";
+		first = false;
+	}
+
+	size_t written = 0;
+	uint64_t end = head;
+	for (uint64_t index = end > capacity ? end - capacity : 0; index < end; index++)
+	{
+		const Event& event = events[index % capacity];
+		if (event.sequence.load(memory_order_acquire) != index + 1)
+			continue;
+		Event copy;
+		copy.start = event.start;
+		copy.duration = event.duration;
+		copy.value = event.value;
+		copy.category = event.category;
+		copy.arg = event.arg;
+		copy.thread = event.thread;
+		copy.phase = event.phase;
+		memcpy(copy.name, event.name, NAME_SIZE);
+		atomic_thread_fence(memory_order_acquire);
+		if (event.sequence.load(memory_order_relaxed) != index + 1)
+			continue;	// overwritten meanwhile
+
+		out << (first ? "" : ",\n") << "{\"name\":";
+		if (copy.phase == 'i')
+			writeString(out, (string(copy.category) + ' ' + copy.name).c_str());
+		else
+			writeString(out, copy.name);
+		out << ",\"cat\":";
+		writeString(out, copy.category);
+		out << ",\"ph\":\"" << copy.phase << "\",\"ts\":" << copy.start * 1e-3;
+		if (copy.phase == 'X')
+			out << ",\"dur\":" << copy.duration * 1e-3;
+		else
+			out << ",\"s\":\"t\"";
+		out << ",\"pid\":1,\"tid\":" << copy.thread;
+		if (copy.arg)
+		{
+			out << ",\"args\":{";
+			writeString(out, copy.arg);
+			out << ':' << copy.value << '}';
+		}
+		out << '}';
+		first = false;
+		written++;
+	}
+	out << "\n]}" << endl;
+	out.flags(flags);
+	out.precision(precision);
+	return written;
+}
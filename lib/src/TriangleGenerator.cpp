@@ -1,9 +1,11 @@
 #include <libsynth.hpp>
 
-TriangleGenerator::TriangleGenerator(istream& in)
+TriangleGenerator::TriangleGenerator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
 	dir = BIDIR;
 	ton = 0.5;
+	da = 0;
 	readFrequencyVolume(in);
 	
 	setValue("type", in);
@@ -47,7 +49,7 @@ bool TriangleGenerator::_setValue(string name, istream& in)
 		sgfloat  f = readFrequency(in);
 		freq = f;
 
-		sgfloat  nech =(sgfloat ) SoundGenerator::samplesPerSeconds() / freq;
+		sgfloat  nech =(sgfloat ) sampleRate() / freq;
 
 		if (dir == BIDIR)
 		{
@@ -65,7 +67,7 @@ bool TriangleGenerator::_setValue(string name, istream& in)
 			da = asc_da;
 		else
 		{
-			if (da>0)
+			if (da>=0)
 				da = asc_da;
 			else
 				da = desc_da;
@@ -92,6 +94,13 @@ void TriangleGenerator::reset()
 }
 
 void TriangleGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
+{
+	sgfloat  v = TriangleGenerator::nextMono(speed);
+	left += v;
+	right += v;
+}
+
+sgfloat  TriangleGenerator::nextMono(sgfloat  speed)
 {
 	a += da;
 
@@ -117,8 +126,7 @@ void TriangleGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 			da=asc_da;
 		}
     }
-	left += a * volume;
-	right += a * volume;
+	return a * volume;
 }
 
 void TriangleGenerator::help(Help& help) const
@@ -0,0 +1,602 @@
+#include <libsynth.hpp>
+#include <typeinfo>
+#include <algorithm>
+
+static const int LANES = WideGenerator::LANES;
+
+WideGenerator::~WideGenerator()
+{
+	for (auto input : inputs)
+		delete input;
+}
+
+void WideGenerator::reset(int lane)
+{
+	for (auto input : inputs)
+		input->reset(lane);
+}
+
+void WideGenerator::release(int lane)
+{
+	for (auto input : inputs)
+		input->release(lane);
+}
+
+bool WideGenerator::finished(int lane) const
+{
+	for (auto input : inputs)
+		if (!input->finished(lane))
+			return false;
+	return true;
+}
+
+WideGenerator* WideGenerator::build(vector<SoundGenerator*> lanes)
+{
+	if (lanes.empty() || lanes.size() > LANES || lanes[0] == nullptr)
+		return nullptr;
+	while (lanes.size() < LANES)
+		lanes.push_back(lanes[0]);
+
+	vector<SoundGenerator**> first;
+	lanes[0]->inputs(first);
+	for (auto lane : lanes)
+	{
+		vector<SoundGenerator**> in;
+		if (lane == nullptr || typeid(*lane) != typeid(*lanes[0]))
+			return nullptr;
+		lane->inputs(in);
+		if (in.size() != first.size())
+			return nullptr;
+	}
+	return lanes[0]->wide(lanes);
+}
+
+bool WideGenerator::buildInputs(const vector<SoundGenerator*>& lanes)
+{
+	vector<vector<SoundGenerator**>> children(lanes.size());
+	for (size_t lane = 0; lane < lanes.size(); lane++)
+		lanes[lane]->inputs(children[lane]);
+
+	for (size_t i = 0; i < children[0].size(); i++)
+	{
+		vector<SoundGenerator*> input;
+		for (auto& child : children)
+			input.push_back(*child[i]);
+		if (count(input.begin(), input.end(), nullptr) == (int) input.size())
+			continue;	// optional input, missing in every lane
+		WideGenerator* wide = build(input);
+		if (wide == nullptr)
+			return false;
+		inputs.push_back(wide);
+	}
+	return true;
+}
+
+// Delete kernel if its inputs cannot be wide
+static WideGenerator* withInputs(WideGenerator* wide, const vector<SoundGenerator*>& lanes)
+{
+	if (wide->buildInputs(lanes))
+		return wide;
+	delete wide;
+	return nullptr;
+}
+
+// sin(x) for any x, polynomial (error < 1e-6) so that lanes are vectorized
+static inline sgfloat wideSin(sgfloat x)
+{
+	const sgfloat pi = M_PI;
+	sgfloat turns = x * sgfloat(1.0 / (2 * M_PI));
+	sgfloat whole = (sgfloat) (int) turns;
+	whole -= turns < whole ? 1.0f : 0.0f;
+	x -= whole * 2 * pi + pi;					// -pi..pi, sin(x) = -sin(x + pi)
+	sgfloat y = x > pi / 2 ? pi - x : x;
+	y = y < -pi / 2 ? -pi - y : y;				// -pi/2..pi/2
+	sgfloat y2 = y * y;
+	return -y * (1 + y2 * (-1.0f/6 + y2 * (1.0f/120 + y2 * (-1.0f/5040 + y2 * (1.0f/362880 + y2 * (-1.0f/39916800))))));
+}
+
+class WideSinus : public WideGenerator
+{
+  public:
+	virtual void next(sgfloat* left, sgfloat* right, const sgfloat* speed) override
+	{
+		for (int i = 0; i < LANES; i++)
+		{
+			sgfloat phase = a[i] + da[i] * speed[i];
+			sgfloat s = volume[i] * wideSin(phase);
+			left[i] += s;
+			right[i] += s;
+			a[i] = phase > sgfloat(2 * M_PI) ? phase - sgfloat(2 * M_PI) : phase;
+		}
+	}
+
+	virtual void reset(int lane) override
+	{
+		a[lane] = 0;
+	}
+
+	sgfloat a[LANES];
+	sgfloat da[LANES];
+	sgfloat volume[LANES];
+};
+
+WideGenerator* SinusGenerator::wide(const vector<SoundGenerator*>& lanes) const
+{
+	WideSinus* wide = new WideSinus;
+	for (int i = 0; i < LANES; i++)
+	{
+		auto lane = static_cast<const SinusGenerator*>(lanes[i]);
+		wide->a[i] = lane->a;
+		wide->da[i] = lane->da;
+		wide->volume[i] = lane->volume;
+	}
+	return wide;
+}
+
+class WideSquare : public WideGenerator
+{
+  public:
+	virtual void next(sgfloat* left, sgfloat* right, const sgfloat* speed) override
+	{
+		for (int i = 0; i < LANES; i++)
+		{
+			sgfloat phase = a[i] + speed[i];
+			sgfloat s = val[i] * volume[i];
+			left[i] += s;
+			right[i] += s;
+			bool flip = phase > invert[i];
+			a[i] = flip ? phase - invert[i] : phase;
+			val[i] = flip ? -val[i] : val[i];
+		}
+	}
+
+	virtual void reset(int lane) override
+	{
+		a[lane] = 0;
+		val[lane] = 1;
+	}
+
+	sgfloat a[LANES];
+	sgfloat invert[LANES];
+	sgfloat val[LANES];
+	sgfloat volume[LANES];
+};
+
+WideGenerator* SquareGenerator::wide(const vector<SoundGenerator*>& lanes) const
+{
+	WideSquare* wide = new WideSquare;
+	for (int i = 0; i < LANES; i++)
+	{
+		auto lane = static_cast<const SquareGenerator*>(lanes[i]);
+		wide->a[i] = lane->a;
+		wide->invert[i] = lane->invert;
+		wide->val[i] = lane->val;
+		wide->volume[i] = lane->volume;
+	}
+	return wide;
+}
+
+class WideFilter : public WideGenerator
+{
+  public:
+	WideFilter(bool high) : high(high) { }
+
+	virtual void next(sgfloat* left, sgfloat* right, const sgfloat* speed) override
+	{
+		sgfloat l[LANES] = { 0 };
+		sgfloat r[LANES] = { 0 };
+		inputs[0]->next(l, r, speed);
+		if (high)
+			for (int i = 0; i < LANES; i++)
+			{
+				lleft[i] = lleft[i] * mcoeff[i] + l[i] * coeff[i];
+				lright[i] = lright[i] * mcoeff[i] + r[i] * coeff[i];
+				left[i] += l[i] - lleft[i];
+				right[i] += r[i] - lright[i];
+			}
+		else
+			for (int i = 0; i < LANES; i++)
+			{
+				lleft[i] = lleft[i] * coeff[i] + mcoeff[i] * l[i];
+				lright[i] = lright[i] * coeff[i] + mcoeff[i] * r[i];
+				left[i] += lleft[i];
+				right[i] += lright[i];
+			}
+	}
+
+	virtual void reset(int lane) override
+	{
+		lleft[lane] = 0;
+		lright[lane] = 0;
+		WideGenerator::reset(lane);
+	}
+
+	bool high;
+	sgfloat lleft[LANES];
+	sgfloat lright[LANES];
+	sgfloat coeff[LANES];
+	sgfloat mcoeff[LANES];
+};
+
+WideGenerator* LowFilter::wide(const vector<SoundGenerator*>& lanes) const
+{
+	WideFilter* wide = new WideFilter(false);
+	for (int i = 0; i < LANES; i++)
+	{
+		auto lane = static_cast<const LowFilter*>(lanes[i]);
+		wide->lleft[i] = lane->lleft;
+		wide->lright[i] = lane->lright;
+		wide->coeff[i] = lane->coeff;
+		wide->mcoeff[i] = lane->mcoeff;
+	}
+	return withInputs(wide, lanes);
+}
+
+WideGenerator* HighFilter::wide(const vector<SoundGenerator*>& lanes) const
+{
+	WideFilter* wide = new WideFilter(true);
+	for (int i = 0; i < LANES; i++)
+	{
+		auto lane = static_cast<const HighFilter*>(lanes[i]);
+		wide->lleft[i] = lane->lleft;
+		wide->lright[i] = lane->lright;
+		wide->coeff[i] = lane->coeff;
+		wide->mcoeff[i] = lane->mcoeff;
+	}
+	return withInputs(wide, lanes);
+}
+
+class WideMixer : public WideGenerator
+{
+  public:
+	virtual void next(sgfloat* left, sgfloat* right, const sgfloat* speed) override
+	{
+		if (inputs.size() == 1)
+		{
+			inputs[0]->next(left, right, speed);
+			return;
+		}
+		sgfloat l[LANES] = { 0 };
+		sgfloat r[LANES] = { 0 };
+		for (auto input : inputs)
+			input->next(l, r, speed);
+		sgfloat count = inputs.size();
+		for (int i = 0; i < LANES; i++)
+		{
+			left[i] += l[i] / count;
+			right[i] += r[i] / count;
+		}
+	}
+};
+
+WideGenerator* MixerGenerator::wide(const vector<SoundGenerator*>& lanes) const
+{
+	return withInputs(new WideMixer, lanes);
+}
+
+class WideLevel : public WideGenerator
+{
+  public:
+	virtual void next(sgfloat* left, sgfloat* right, const sgfloat* speed) override
+	{
+		for (int i = 0; i < LANES; i++)
+		{
+			left[i] += level[i];
+			right[i] += level[i];
+		}
+	}
+
+	sgfloat level[LANES];
+};
+
+WideGenerator* LevelSound::wide(const vector<SoundGenerator*>& lanes) const
+{
+	WideLevel* wide = new WideLevel;
+	for (int i = 0; i < LANES; i++)
+		wide->level[i] = static_cast<const LevelSound*>(lanes[i])->level;
+	return wide;
+}
+
+// Users of shared sounds, the lanes padded with the same user read it once
+class WideShared : public WideGenerator
+{
+  public:
+	virtual void next(sgfloat* left, sgfloat* right, const sgfloat* speed) override
+	{
+		for (int i = 0; i < LANES; i++)
+		{
+			sgfloat l = 0, r = 0;
+			if (same[i] == i)
+				lanes[i]->node->get(lanes[i]->position, l, r);
+			else
+			{
+				l = value_l[same[i]];
+				r = value_r[same[i]];
+			}
+			value_l[i] = l;
+			value_r[i] = r;
+			left[i] += l;
+			right[i] += r;
+		}
+	}
+
+	SharedSound* lanes[LANES];
+	int same[LANES];	// first lane with the same user
+	sgfloat value_l[LANES];
+	sgfloat value_r[LANES];
+};
+
+WideGenerator* SharedSound::wide(const vector<SoundGenerator*>& lanes) const
+{
+	WideShared* wide = new WideShared;
+	for (int i = 0; i < LANES; i++)
+	{
+		wide->lanes[i] = static_cast<SharedSound*>(lanes[i]);
+		wide->same[i] = i;
+		for (int j = 0; j < i; j++)
+			if (wide->lanes[j] == wide->lanes[i])
+			{
+				wide->same[i] = j;
+				break;
+			}
+	}
+	return wide;
+}
+
+class WideAm : public WideGenerator
+{
+  public:
+	virtual void next(sgfloat* left, sgfloat* right, const sgfloat* speed) override
+	{
+		sgfloat l[LANES] = { 0 };
+		sgfloat r[LANES] = { 0 };
+		sgfloat lv[LANES] = { 0 };
+		sgfloat rv[LANES] = { 0 };
+		inputs[0]->next(l, r, speed);
+		if (inputs.size() == 1)
+		{
+			// Constant gain, see AmGenerator::optimize
+			for (int i = 0; i < LANES; i++)
+			{
+				left[i] += min[i] * l[i];
+				right[i] += min[i] * r[i];
+			}
+			return;
+		}
+		inputs[1]->next(lv, rv, speed);
+		for (int i = 0; i < LANES; i++)
+		{
+			left[i] += (min[i] + (max[i] - min[i]) * (lv[i] + 1) / 2) * l[i];
+			right[i] += (min[i] + (max[i] - min[i]) * (rv[i] + 1) / 2) * r[i];
+		}
+	}
+
+	sgfloat min[LANES];
+	sgfloat max[LANES];
+};
+
+WideGenerator* AmGenerator::wide(const vector<SoundGenerator*>& lanes) const
+{
+	for (auto generator : lanes)
+	{
+		auto lane = static_cast<const AmGenerator*>(generator);
+		if (lane->modulator == nullptr && lane->min != lane->max)
+			return nullptr;
+	}
+	WideAm* wide = new WideAm;
+	for (int i = 0; i < LANES; i++)
+	{
+		auto lane = static_cast<const AmGenerator*>(lanes[i]);
+		wide->min[i] = lane->min;
+		wide->max[i] = lane->max;
+	}
+	return withInputs(wide, lanes);
+}
+
+class WideFm : public WideGenerator
+{
+  public:
+	virtual void next(sgfloat* left, sgfloat* right, const sgfloat* speed) override
+	{
+		sgfloat sp[LANES];
+		if (constant)
+		{
+			for (int i = 0; i < LANES; i++)
+				sp[i] = mod_gen ? speed[i] : 1.0f;
+			inputs[0]->next(left, right, sp);
+			return;
+		}
+
+		sgfloat l[LANES] = { 0 };
+		sgfloat r[LANES] = { 0 };
+		for (int i = 0; i < LANES; i++)
+			sp[i] = mod_mod ? speed[i] : 1.0f;
+		inputs[1]->next(l, r, sp);
+		for (int i = 0; i < LANES; i++)
+		{
+			sgfloat m = (l[i] + r[i]) / 2;
+			m = min[i] + (max[i] - min[i]) * (m + 1) / 2;
+			sp[i] = mod_gen ? m * speed[i] : m;
+		}
+		inputs[0]->next(left, right, sp);
+	}
+
+	bool constant;		// min == max, modulator not used
+	bool mod_gen;
+	bool mod_mod;
+	sgfloat min[LANES];
+	sgfloat max[LANES];
+};
+
+WideGenerator* FmModulator::wide(const vector<SoundGenerator*>& lanes) const
+{
+	for (auto generator : lanes)
+	{
+		auto lane = static_cast<const FmModulator*>(generator);
+		if (lane->mod_gen != mod_gen || lane->mod_mod != mod_mod || (lane->min == lane->max) != (min == max))
+			return nullptr;
+	}
+	WideFm* wide = new WideFm;
+	wide->constant = min == max;
+	wide->mod_gen = mod_gen;
+	wide->mod_mod = mod_mod;
+	for (int i = 0; i < LANES; i++)
+	{
+		auto lane = static_cast<const FmModulator*>(lanes[i]);
+		wide->min[i] = lane->min;
+		wide->max[i] = lane->max;
+	}
+	return withInputs(wide, lanes);
+}
+
+// Same state machine as AdsrGenerator, one per lane
+class WideAdsr : public WideGenerator
+{
+  public:
+	virtual void next(sgfloat* left, sgfloat* right, const sgfloat* speed) override
+	{
+		sgfloat l[LANES] = { 0 };
+		sgfloat r[LANES] = { 0 };
+		inputs[0]->next(l, r, speed);
+
+		for (int i = 0; i < LANES; i++)
+		{
+			if (index[i] < size && !(gate[i] && sustain && index[i] == sustain))
+			{
+				t[i] += dt;
+				while (t[i] >= target_s[i])
+				{
+					previous_s[i] = target_s[i];
+					previous_vol[i] = target_vol[i];
+					index[i]++;
+					if (index[i] < size)
+					{
+						target_s[i] = times[index[i]];
+						target_vol[i] = vols[index[i]];
+					}
+					else
+					{
+						if (loop && gate[i]) reset(i, false);
+						break;
+					}
+					if (gate[i] && sustain && index[i] == sustain)
+						break;
+				}
+				if (index[i] < size)
+					vol[i] = previous_vol[i] + (target_vol[i] - previous_vol[i])
+						* (t[i] - previous_s[i]) / (target_s[i] - previous_s[i]);
+				else
+					vol[i] = target_vol[i];
+			}
+			else if (index[i] < size)
+				vol[i] = previous_vol[i];	// sustain
+			else
+				vol[i] = target_vol[i];
+		}
+
+		for (int i = 0; i < LANES; i++)
+		{
+			left[i] += l[i] * vol[i];
+			right[i] += r[i] * vol[i];
+		}
+	}
+
+	virtual void reset(int lane) override
+	{
+		reset(lane, true);
+		WideGenerator::reset(lane);
+	}
+
+	virtual void release(int lane) override
+	{
+		WideGenerator::release(lane);
+		if (!gate[lane])
+			return;
+		gate[lane] = false;
+
+		uint32_t from = sustain ? sustain : size - 1;
+		if (index[lane] > from)
+			return;
+		previous_s[lane] = from ? times[from - 1] : 0;
+		previous_vol[lane] = vol[lane];
+		t[lane] = previous_s[lane];
+		index[lane] = from;
+		target_s[lane] = times[from];
+		target_vol[lane] = vols[from];
+	}
+
+	virtual bool finished(int lane) const override
+	{
+		return index[lane] >= size && WideGenerator::finished(lane);
+	}
+
+	void reset(int lane, bool note_on)
+	{
+		if (note_on)
+		{
+			gate[lane] = true;
+			vol[lane] = 0;
+		}
+		t[lane] = 0;
+		index[lane] = 0;
+		target_s[lane] = times[0];
+		target_vol[lane] = vols[0];
+		previous_s[lane] = 0;
+		previous_vol[lane] = 0;
+	}
+
+	vector<sgfloat> times;
+	vector<sgfloat> vols;
+	uint32_t size;
+	uint32_t sustain;
+	bool loop;
+	sgfloat dt;
+
+	sgfloat t[LANES];
+	uint32_t index[LANES];
+	sgfloat previous_s[LANES];
+	sgfloat previous_vol[LANES];
+	sgfloat target_s[LANES];
+	sgfloat target_vol[LANES];
+	sgfloat vol[LANES];
+	bool gate[LANES];
+};
+
+WideGenerator* AdsrGenerator::wide(const vector<SoundGenerator*>& lanes) const
+{
+	if (generator == nullptr)
+		return nullptr;
+	for (auto generator : lanes)
+	{
+		auto lane = static_cast<const AdsrGenerator*>(generator);
+		if (lane->loop != loop || lane->sustain != sustain || lane->dt != dt || lane->values.size() != values.size())
+			return nullptr;
+		for (size_t i = 0; i < values.size(); i++)
+			if (lane->values[i].s != values[i].s || lane->values[i].vol != values[i].vol)
+				return nullptr;
+	}
+
+	WideAdsr* wide = new WideAdsr;
+	for (auto& value : values)
+	{
+		wide->times.push_back(value.s);
+		wide->vols.push_back(value.vol);
+	}
+	wide->size = values.size();
+	wide->sustain = sustain;
+	wide->loop = loop;
+	wide->dt = dt;
+	for (int i = 0; i < LANES; i++)
+	{
+		auto lane = static_cast<const AdsrGenerator*>(lanes[i]);
+		wide->t[i] = lane->t;
+		wide->index[i] = lane->index;
+		wide->previous_s[i] = lane->previous.s;
+		wide->previous_vol[i] = lane->previous.vol;
+		wide->target_s[i] = lane->target.s;
+		wide->target_vol[i] = lane->target.vol;
+		wide->vol[i] = lane->vol;
+		wide->gate[i] = lane->gate;
+	}
+	return withInputs(wide, lanes);
+}
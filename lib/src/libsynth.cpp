@@ -11,22 +11,7 @@
 #include "libsynth.hpp"
 #include <cstdlib>
 
-uint32_t samples_per_seconds = 48000;
-
 map<string, const SoundGenerator*> SoundGenerator::generators;
-string SoundGenerator::last_type;
-map<string, string> SoundGenerator::defines;
-bool SoundGenerator::echo = true;
-uint8_t SoundGenerator::verbose = 0;
-bool SoundGenerator::init_done = false;
-SDL_AudioDeviceID SoundGenerator::dev;
-list<SoundGenerator*> SoundGenerator::list_generator;
-uint16_t SoundGenerator::list_generator_size = 0; // avoid mx use
-uint16_t SoundGenerator::buf_size;
-bool SoundGenerator::saturate = false;
-mutex SoundGenerator::mtx;
-uint32_t SoundGenerator::wanted_buffer_size = 1024;
-uint32_t SoundGenerator::samples_per_seconds = 48000;
 
 // Auto register for the factory
 static SquareGenerator gen_sq;
@@ -52,12 +37,16 @@ static TriangleGenerator gen_tri;
 static ClampSound gen_clamp;
 static BlepOscillator gen_blep;
 static ResoFilter gen_reso;
+static PolySound gen_poly;
+static FreezeSound gen_freeze;
+static BusInput gen_bus;
 
-SquareGenerator::SquareGenerator(istream& in)
+SquareGenerator::SquareGenerator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
     readFrequencyVolume(in);
     a = 0;
-    da = 1.0f / (sgfloat ) SoundGenerator::samplesPerSeconds() ;
+    da = 1.0f / (sgfloat ) sampleRate() ;
     val = 1;
 }
 
@@ -67,21 +56,28 @@ bool SquareGenerator::_setValue(string name, istream& in)
         return false;
 
     if (name == "f")
-        invert = (sgfloat ) (SoundGenerator::samplesPerSeconds()  >> 1) / freq;
+        invert = (sgfloat ) (sampleRate()  >> 1) / freq;
 
     return true;
 }
 
 void SquareGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
+{
+    sgfloat  v = SquareGenerator::nextMono(speed);
+    left += v;
+    right += v;
+}
+
+sgfloat  SquareGenerator::nextMono(sgfloat  speed)
 {
     a += speed;
-    left += (sgfloat ) val * volume;
-    right += (sgfloat ) val * volume;
+    sgfloat  v = (sgfloat ) val * volume;
     if (a > invert)
     {
         a -= invert;
         val = -val;
     }
+    return v;
 }
 
 void SquareGenerator::help(Help& help) const
@@ -89,7 +85,8 @@ void SquareGenerator::help(Help& help) const
     help.add(SoundGenerator::addHelpOption(new HelpEntry("square", "square sound")));
 }
 
-SinusGenerator::SinusGenerator(istream& in)
+SinusGenerator::SinusGenerator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
     readFrequencyVolume(in);
 }
@@ -99,22 +96,28 @@ bool SinusGenerator::_setValue(string name, istream& in)
     if (name == "f")
     {
         in >> freq;
-        da = (2 * M_PI * freq) / (sgfloat ) SoundGenerator::samplesPerSeconds() ;
+        da = (2 * M_PI * freq) / (sgfloat ) sampleRate() ;
         return true;
     }
     return false;
 }
 
 void SinusGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
+{
+    sgfloat  v = SinusGenerator::nextMono(speed);
+    left += v;
+    right += v;
+}
+
+sgfloat  SinusGenerator::nextMono(sgfloat  speed)
 {
     a += da * speed;
-    sgfloat  s = sin(a);
-    left += volume * s;
-    right += volume * s;
+    sgfloat  v = volume * (sgfloat ) sin(a);
     if (a > 2 * M_PI)
     {
         a -= 2 * M_PI;
     }
+    return v;
 }
 
 void SinusGenerator::help(Help& help) const
@@ -122,14 +125,18 @@ void SinusGenerator::help(Help& help) const
     help.add(addHelpOption(new HelpEntry("sinus", "sinus wave")));
 }
 
-DistortionGenerator::DistortionGenerator(istream& in)
+DistortionGenerator::DistortionGenerator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
-    level = 1.0f + readFloat(in, 0, 100, "level")/100.0f;
-    generator = factory(in, true);
+    level = 1.0f + ctx.readFloat(in, 0, 100, "level")/100.0f;
+    generator = ctx.factory(in, true);
 }
 
 void DistortionGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 {
+    if (single)
+        return widen(left, right, speed);
+
     sgfloat  l=0, r=0;
     generator->next(l, r, speed);
     l *= level;
@@ -138,12 +145,20 @@ void DistortionGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
     if (l > 1) l = 1;
     else if (l<-1) l = -1;
     if (r > 1) r = 1;
-    else if (l<-1) l = -1;
+    else if (r<-1) r = -1;
 
     left += l;
     right += r;
 }
 
+sgfloat  DistortionGenerator::nextMono(sgfloat  speed)
+{
+    sgfloat  v = generator->nextMono(speed) * level;
+    if (v > 1) v = 1;
+    else if (v<-1) v = -1;
+    return v;
+}
+
 void DistortionGenerator::help(Help& help) const
 {
     HelpEntry* entry = new HelpEntry("distortion", "Distort sound");
@@ -153,9 +168,10 @@ void DistortionGenerator::help(Help& help) const
     help.add(entry);
 }
 
-LevelSound::LevelSound(istream& in)
+LevelSound::LevelSound(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
-    level = (readFloat(in, 0, 100, "level")-50) / 50.0f;
+    level = (ctx.readFloat(in, 0, 100, "level")-50) / 50.0f;
 }
 
 void LevelSound::next(sgfloat & left, sgfloat & right, sgfloat  speed)
@@ -164,43 +180,50 @@ void LevelSound::next(sgfloat & left, sgfloat & right, sgfloat  speed)
     right += level;
 }
 
-FmModulator::FmModulator(istream& in)
+sgfloat  LevelSound::nextMono(sgfloat  speed)
+{
+    return level;
+}
+
+FmModulator::FmModulator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
     in >> min;
     in >> max;
     mod_gen = true;
     mod_mod = false;
 
-    sound = factory(in);
+    sound = ctx.factory(in);
 
     if (sound == 0)
     {
-        if (last_type == "generator")
+        if (ctx.last_type == "generator")
         {
             mod_gen = true;
             mod_mod = false;
         }
-        else if (last_type == "modulator")
+        else if (ctx.last_type == "modulator")
         {
             mod_gen = false;
             mod_mod = true;
         }
-        else if (last_type == "both")
+        else if (ctx.last_type == "both")
         {
             mod_gen = true;
             mod_mod = true;
         }
         else
-            missingGeneratorExit("417");
+            ctx.missingGenerator("417");
     }
 
-    if (sound == 0) sound = factory(in, true);
-    modulator = factory(in, true);
+    if (sound == 0) sound = ctx.factory(in, true);
+    modulator = ctx.factory(in, true);
 
     if (min < 0 || min > 2000 || max < 0 || max > 2000 || max < min)
     {
         // this->help(cerr); @TODO
-        exit(1);
+        ctx.fail("fm: min and max must be ordered, from 0 to 2000.");
+        return;
     }
 
     max /= 100.0;
@@ -209,6 +232,9 @@ FmModulator::FmModulator(istream& in)
 
 void FmModulator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 {
+    if (single)
+        return widen(left, right, speed);
+
     if (min == max)
     {
         sound->next(left, right, mod_gen ? speed : 1.0f);
@@ -225,6 +251,29 @@ void FmModulator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
     sound->next(left, right, l);
 }
 
+sgfloat  FmModulator::nextMono(sgfloat  speed)
+{
+    if (min == max)
+        return sound->nextMono(mod_gen ? speed : 1.0f);
+
+    sgfloat  l = 0, r = 0;
+    modulator->next(l, r, mod_mod ? speed : 1.0f); // may be stereo
+
+    l = (l + r) / 2.0;
+    l = min + (max - min)*(l + 1.0) / 2.0;
+
+    if (mod_gen) l *= speed;
+    return sound->nextMono(l);
+}
+
+SoundGenerator* FmModulator::optimize(ParseContext& ctx)
+{
+    // Modulation has no effect, the sound is played at the given speed
+    if (min == max && mod_gen)
+        return sound;
+    return this;
+}
+
 void FmModulator::help(Help& help) const
 {
     HelpEntry* entry = new HelpEntry("fm", "Frequency modulation");
@@ -237,26 +286,28 @@ void FmModulator::help(Help& help) const
     help.add(entry);
 }
 
-MixerGenerator::MixerGenerator(istream& in)
+MixerGenerator::MixerGenerator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
     while (in.good())
     {
-        SoundGenerator* p = factory(in);
+        SoundGenerator* p = ctx.factory(in);
         if (p)
             generators.push_front(p);
         else
             break;
     }
 
-    if (SoundGenerator::last_type != "}")
-    {
-        cerr << "Missing } at end of mixer generator" << endl;
-        exit(1);
-    }
+    if (ctx.last_type != "}")
+        ctx.fail("Missing } at end of mixer generator");
+    quiet.assign(generators.size(), false);
 }
 
 void MixerGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 {
+    if (single)
+        return widen(left, right, speed);
+
     if (generators.size() == 0)
         return;
     else if (generators.size() == 1)
@@ -265,16 +316,72 @@ void MixerGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
         return;
     }
 
+    if (silence_check == 0)
+        checkSilence();
+    silence_check--;
+
     sgfloat  l = 0;
     sgfloat  r = 0;
 
+    auto input_quiet = quiet.begin();
     for (auto generator : generators)
-        generator->next(l, r, speed);
+        if (!*input_quiet++)
+            generator->next(l, r, speed);
 
     left += l / generators.size();
     right += r / generators.size();
 }
 
+sgfloat  MixerGenerator::nextMono(sgfloat  speed)
+{
+    if (generators.size() == 0)
+        return 0;
+    else if (generators.size() == 1)
+        return generators.front()->nextMono(speed);
+
+    if (silence_check == 0)
+        checkSilence();
+    silence_check--;
+
+    sgfloat  v = 0;
+    auto input_quiet = quiet.begin();
+    for (auto generator : generators)
+        if (!*input_quiet++)
+            v += generator->nextMono(speed);
+    return v / generators.size();
+}
+
+void MixerGenerator::checkSilence()
+{
+    auto input_quiet = quiet.begin();
+    for (auto generator : generators)
+        *input_quiet++ = generator->silent();
+    silence_check = Engine::MIX_BLOCK;
+}
+
+bool MixerGenerator::silent() const
+{
+    for (auto generator : generators)
+        if (!generator->silent())
+            return false;
+    return true;
+}
+
+bool MixerGenerator::mono() const
+{
+    for (auto generator : generators)
+        if (!generator->mono())
+            return false;
+    return true;
+}
+
+SoundGenerator* MixerGenerator::optimize(ParseContext& ctx)
+{
+    if (generators.size() == 1)
+        return generators.front();
+    return this;
+}
+
 void MixerGenerator::help(Help& help) const
 {
     HelpEntry* entry = new HelpEntry("{ $ }", "mix together sounds and adjust volume accordingly");
@@ -288,6 +395,15 @@ void LeftSound::next(sgfloat & left, sgfloat & right, sgfloat  speed)
     generator->next(left, v);
 }
 
+SoundGenerator* LeftSound::optimize(ParseContext& ctx)
+{
+    if (dynamic_cast<LeftSound*>(generator))
+        return generator;   // left of left
+    if (dynamic_cast<RightSound*>(generator))
+        return ctx.factory("level 50");    // nothing left
+    return this;
+}
+
 void LeftSound::help(Help& help) const
 {
     HelpEntry* entry = new HelpEntry("left", "Keep left part of signal");
@@ -295,9 +411,10 @@ void LeftSound::help(Help& help) const
     help.add(entry);
 }
 
-RightSound::RightSound(istream& in)
+RightSound::RightSound(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
-    generator = factory(in, true);
+    generator = ctx.factory(in, true);
 }
 
 void RightSound::next(sgfloat & left, sgfloat & right, sgfloat  speed)
@@ -306,6 +423,15 @@ void RightSound::next(sgfloat & left, sgfloat & right, sgfloat  speed)
     generator->next(v, right);
 }
 
+SoundGenerator* RightSound::optimize(ParseContext& ctx)
+{
+    if (dynamic_cast<RightSound*>(generator))
+        return generator;
+    if (dynamic_cast<LeftSound*>(generator))
+        return ctx.factory("level 50");
+    return this;
+}
+
 void RightSound::help(Help& help) const
 {
     HelpEntry* entry = new HelpEntry("right", "Keep right part of signal");
@@ -313,7 +439,8 @@ void RightSound::help(Help& help) const
     help.add(entry);
 }
 
-EnvelopeSound::EnvelopeSound(istream& in)
+EnvelopeSound::EnvelopeSound(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
     int ms;
     index = 0;
@@ -322,8 +449,8 @@ EnvelopeSound::EnvelopeSound(istream& in)
 
     if (ms <= 0)
     {
-        cerr << "Null duration" << endl;
-        exit(1);
+        ctx.fail("Null duration");
+        return;
     }
 
     istream* input = 0;
@@ -353,12 +480,11 @@ EnvelopeSound::EnvelopeSound(istream& in)
         file.open(name);
         input = &file;
     }
-    else
-        cerr << "Unkown type: " << type << endl;
     if (input == 0)
     {
         // this->help(cerr); @TODO
-        exit(1);
+        ctx.fail("Unkown type: " + type);
+        return;
     }
     sgfloat  v;
     while (input->good())
@@ -376,20 +502,49 @@ EnvelopeSound::EnvelopeSound(istream& in)
 
         data.push_back(v);
     }
-    generator = factory(in, true);
+    generator = ctx.factory(in, true);
 
-    dindex = 1000.0 * (data.size() - 1) / (sgfloat ) ms / SoundGenerator::samplesPerSeconds() ;
+    dindex = 1000.0 * (data.size() - 1) / (sgfloat ) ms / sampleRate() ;
+}
+
+bool EnvelopeSound::ended() const
+{
+    if (loop || index < (sgfloat ) data.size() - 1)
+        return false;
+    return index > data.size() || data.back() == 0;
+}
+
+bool EnvelopeSound::silent() const
+{
+    return ended() || generator->silent();
 }
 
 void EnvelopeSound::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 {
-    if (index > data.size())
+    if (single)
+        return widen(left, right, speed);
+    if (ended())
         return;
 
     sgfloat  l = 0;
     sgfloat  r = 0;
     generator->next(l, r, speed);
 
+    sgfloat  f = gain();
+    left += l*f;
+    right += r*f;
+}
+
+sgfloat  EnvelopeSound::nextMono(sgfloat  speed)
+{
+    if (ended())
+        return 0;
+    sgfloat  v = generator->nextMono(speed);
+    return v * gain();
+}
+
+sgfloat  EnvelopeSound::gain()
+{
     index += dindex;
 
     int idx = (int) index;
@@ -407,10 +562,7 @@ void EnvelopeSound::next(sgfloat & left, sgfloat & right, sgfloat  speed)
         idx++;
     sgfloat  next = data[idx];
 
-    sgfloat  f = cur + (next - cur) * dec;
-
-    left += l*f;
-    right += r*f;
+    return cur + (next - cur) * dec;
 }
 
 void EnvelopeSound::help(Help& help) const {
@@ -423,19 +575,32 @@ void EnvelopeSound::help(Help& help) const {
     out << "  values are from -200 to 200 (gfloat , >100 may distort sound)" << endl;
      * */ }
 
-MonoGenerator::MonoGenerator(istream& in)
+MonoGenerator::MonoGenerator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
-    generator = factory(in, true);
+    generator = ctx.factory(in, true);
 }
 
 void MonoGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
+{
+    sgfloat  l = MonoGenerator::nextMono(speed);
+    left += l;
+    right += l;
+}
+
+sgfloat  MonoGenerator::nextMono(sgfloat  speed)
 {
     sgfloat  l = 0;
     sgfloat  v = 0;
     generator->next(l, v, speed);
-    l = (l + v) / 2;
-    left += l;
-    right += l;
+    return (l + v) / 2;
+}
+
+SoundGenerator* MonoGenerator::optimize(ParseContext& ctx)
+{
+    if (generator->mono())
+        return generator;   // (l + l) / 2 == l
+    return this;
 }
 
 void MonoGenerator::help(Help& help) const
@@ -445,20 +610,31 @@ void MonoGenerator::help(Help& help) const
     help.add(entry);
 }
 
-AmGenerator::AmGenerator(istream& in)
+AmGenerator::AmGenerator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
-    min = readFloat(in, 0, 300, "min") / 100.0;
-    max = readFloat(in, 0, 300, "max") / 100.0;
+    min = ctx.readFloat(in, 0, 300, "min") / 100.0;
+    max = ctx.readFloat(in, 0, 300, "max") / 100.0;
 
-    generator = factory(in, true);
-    if (in.good()) modulator = factory(in, true);
+    generator = ctx.factory(in, true);
+    if (in.good()) modulator = ctx.factory(in, true);
 }
 
 void AmGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 {
+    if (single)
+        return widen(left, right, speed);
+
     sgfloat  l = 0, r = 0;
     generator->next(l, r, speed);
 
+    if (min == max)
+    {
+        left += min * l;
+        right += min * r;
+        return;
+    }
+
     sgfloat  lv = 0, rv = 0;
     modulator->next(lv, rv, speed);
 
@@ -469,6 +645,37 @@ void AmGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
     right += rv*r;
 }
 
+sgfloat  AmGenerator::nextMono(sgfloat  speed)
+{
+    sgfloat  v = generator->nextMono(speed);
+    if (min == max)
+        return min * v;
+
+    sgfloat  lv = modulator->nextMono(speed);
+    lv = min + (max - min)*(lv + 1) / 2;
+    return lv*v;
+}
+
+SoundGenerator* AmGenerator::optimize(ParseContext& ctx)
+{
+    LevelSound* level = dynamic_cast<LevelSound*>(modulator);
+    if (level)
+    {
+        // Constant modulator : constant gain
+        min = max = min + (max - min) * (level->getLevel() + 1) / 2;
+        if (ctx.verbose)
+            cout << "optimize: am of a level, gain " << min << endl;
+    }
+    if (min == max && modulator)
+    {
+        ctx.drop(modulator);
+        modulator = nullptr;
+    }
+    if (min == max && min == 1)
+        return generator;
+    return this;
+}
+
 void AmGenerator::help(Help& help) const
 {
     HelpEntry* entry = new HelpEntry("am", "Amplitude modulation");
@@ -480,17 +687,18 @@ void AmGenerator::help(Help& help) const
     help.add(entry);
 }
 
-ReverbGenerator::ReverbGenerator(istream& in)
+ReverbGenerator::ReverbGenerator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
-    echo = (SoundGenerator::last_type == "echo");
+    echo = (ctx.last_type == "echo");
 
     string s;
 
     in >> s;
     if (s.find(':') == string::npos)
     {
-        cerr << "Missing :  in " << SoundGenerator::last_type << " generator." << endl;
-        exit(1);
+        ctx.fail("Missing :  in " + ctx.last_type + " generator.");
+        return;
     }
     sgfloat  ms = atof(s.c_str()) / 1000.0;
     s.erase(0, s.find(':') + 1);
@@ -498,16 +706,16 @@ ReverbGenerator::ReverbGenerator(istream& in)
 
     if (ms <= 0)
     {
-        cerr << "Negatif time not allowed." << endl;
-        exit(1);
+        ctx.fail("Negatif time not allowed.");
+        return;
     }
 
-    buf_size = SoundGenerator::samplesPerSeconds()  * ms;
+    buf_size = sampleRate()  * ms;
 
     if (buf_size == 0 || buf_size > 1000000)
     {
-        cerr << "Bad Buffer size : " << buf_size << endl;
-        exit(1);
+        ctx.fail("Bad Buffer size : " + to_string(buf_size));
+        return;
     }
 
     buf_left = new sgfloat [buf_size];
@@ -521,14 +729,38 @@ ReverbGenerator::ReverbGenerator(istream& in)
     ech_vol = 1.0 - vol;
     ech_vol = 1.0;
 
-    generator = factory(in, true);
+    generator = ctx.factory(in, true);
+
+    // Echoes fade by vol at each turn of the buffer (a long tail is clamped : never silent)
+    uint64_t turns = 1;
+    if (!echo && vol >= 1)
+        turns = 0xFFFFFFFF / buf_size;	// never silent
+    else if (!echo && vol > 0)
+        turns = min(double(0xFFFFFFFF), max(1.0, ceil(log(1e-4) / log(vol))));
+    tail_samples = min(turns * buf_size, uint64_t(0xFFFFFFFF));
+}
+
+sgfloat  ReverbGenerator::tail() const
+{
+    return (sgfloat ) tail_samples / sampleRate() + SoundGenerator::tail();
 }
 
 void ReverbGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 {
+    if (single)
+        return widen(left, right, speed);
+
     sgfloat  l = 0;
     sgfloat  r = 0;
-    generator->next(l, r, speed);
+    if (!inputSilent())
+    {
+        quiet = 0;
+        generator->next(l, r, speed);
+    }
+    else if (quiet < tail_samples)
+        quiet++;
+    else
+        return;
 
     if (echo)
     {
@@ -557,6 +789,36 @@ void ReverbGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
     right += r;
 }
 
+sgfloat  ReverbGenerator::nextMono(sgfloat  speed)
+{
+    sgfloat  v = 0;
+    if (!inputSilent())
+    {
+        quiet = 0;
+        v = generator->nextMono(speed);
+    }
+    else if (quiet < tail_samples)
+        quiet++;
+    else
+        return 0;
+
+    if (echo)
+    {
+        sgfloat  vv = buf_left[index];
+        buf_left[index] = v;
+        v = v * ech_vol + vv*vol;
+    }
+    else
+    {
+        v = v * ech_vol + buf_left[index] * vol;
+        buf_left[index] = v;
+    }
+    index++;
+    if (index == buf_size)
+        index = 0;
+    return v;
+}
+
 void ReverbGenerator::help(Help& help) const
 {
     HelpEntry* entry = new HelpEntry("reverb", "Reverberation");
@@ -565,38 +827,47 @@ void ReverbGenerator::help(Help& help) const
     help.add(entry);
 }
 
-AdsrGenerator::AdsrGenerator(istream& in)
+AdsrGenerator::AdsrGenerator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
     value v;
     value prev;
     prev.s = 0;
     prev.vol = 0;
 
-    while (read(in, v))
+    while (read(in, v, ctx))
     {
         if (v <= prev)
         {
-            cerr << "ADSR times must be ordered." << endl;
-            cerr << "previous ms=" << prev.s << " current=" << v.s << endl;
-            exit(1);
+            ctx.fail("ADSR times must be ordered.\nprevious ms=" + to_string(prev.s) + " current=" + to_string(v.s));
+            return;
         }
         values.push_back(v);
         prev = v;
     }
+    if (ctx.failed())
+        return;
 
     if (values.size() == 0)
     {
-        cerr << "ADSR must contains at least 1 value at t>0ms." << endl;
-        exit(1);
+        ctx.fail("ADSR must contains at least 1 value at t>0ms.");
+        return;
+    }
+    if (sustain >= values.size())
+    {
+        ctx.fail("ADSR sustain must be followed by release values.");
+        return;
     }
 
-    generator = factory(in, true);
-    dt = 1.0 / (sgfloat ) SoundGenerator::samplesPerSeconds() ;
+    generator = ctx.factory(in, true);
+    dt = 1.0 / (sgfloat ) sampleRate() ;
     reset();
 }
 
 void AdsrGenerator::reset()
 {
+    gate = true;
+    vol = 0;
     t = 0;
     index = 0;
     target = values[0];
@@ -604,7 +875,7 @@ void AdsrGenerator::reset()
     previous.vol = 0;
 }
 
-bool AdsrGenerator::read(istream& in, value& val)
+bool AdsrGenerator::read(istream& in, value& val, ParseContext& ctx)
 {
     string s;
     in >> s;
@@ -618,11 +889,21 @@ bool AdsrGenerator::read(istream& in, value& val)
         loop = true;
         return false;
     }
+    else if (s == "sustain")
+    {
+        if (values.empty() || sustain)
+        {
+            ctx.fail("ADSR sustain must follow a value and appear once.");
+            return false;
+        }
+        sustain = values.size();
+        return read(in, val, ctx);
+    }
 
     if (s.find(':') == string::npos)
     {
-        cerr << "Missing : in value or type (once/loop) for adsr." << endl;
-        exit(1);
+        ctx.fail("Missing : in value or type (once/loop) for adsr.");
+        return false;
     }
     val.s = atof(s.c_str()) / 1000;
     s.erase(0, s.find(':') + 1);
@@ -634,15 +915,50 @@ void AdsrGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
 {
     if (generator == 0)
         return;
+    if (single)
+        return widen(left, right, speed);
+
+    if (index >= values.size() && target.vol == 0)
+    {
+        vol = 0;
+        return;	// finished, no need to run the sound
+    }
 
     sgfloat  l = 0;
     sgfloat  r = 0;
     generator->next(l, r, speed);
 
+    advance();
+    left += l*vol;
+    right += r*vol;
+}
+
+sgfloat  AdsrGenerator::nextMono(sgfloat  speed)
+{
+    if (generator == 0)
+        return 0;
+    if (index >= values.size() && target.vol == 0)
+    {
+        vol = 0;
+        return 0;
+    }
+
+    sgfloat  v = generator->nextMono(speed);
+    advance();
+    return v*vol;
+}
+
+void AdsrGenerator::advance()
+{
     if (index >= values.size())
     {
-        left += l * target.vol;
-        right += r * target.vol;
+        vol = target.vol;
+        return;
+    }
+
+    if (gate && sustain && index == sustain)
+    {
+        vol = previous.vol;
         return;
     }
 
@@ -655,35 +971,58 @@ void AdsrGenerator::next(sgfloat & left, sgfloat & right, sgfloat  speed)
             target = values[index];
         else
         {
-            if (loop) reset();
+            if (loop && gate) reset();
             break;
         }
+        if (gate && sustain && index == sustain)
+            break;
     }
 
-    sgfloat  factor = (t - previous.s) / (target.s - previous.s);
-    sgfloat  vol = previous.vol + (target.vol - previous.vol) * factor;
+    if (index < values.size())
+    {
+        sgfloat  factor = (t - previous.s) / (target.s - previous.s);
+        vol = previous.vol + (target.vol - previous.vol) * factor;
+    }
+    else
+        vol = target.vol;
+}
 
-    left += l*vol;
-    right += r*vol;
+void AdsrGenerator::release()
+{
+    if (!gate)
+        return;
+    gate = false;
+
+    uint32_t from = sustain ? sustain : values.size() - 1;
+    if (index > from)
+        return;	// already releasing
+
+    // Release from the current level, with the duration of the release segment
+    previous.s = from ? values[from - 1].s : 0;
+    previous.vol = vol;
+    t = previous.s;
+    index = from;
+    target = values[from];
 }
 
 void AdsrGenerator::help(Help& help) const
 {
     HelpEntry* entry = new HelpEntry("adsr", "Attack Decay Sustain Release (Hold Delay etc) enveloppe generator");
     entry->addOption(new HelpOption("ms:vol", "Couples of time/level for the enveloppe (ms/%)", HelpOption::REPEAT | HelpOption::MS_VOL));
+    entry->addOption(new HelpOption("sustain", "Hold the previous level until note off (poly), following values are the release", HelpOption::OPTIONAL));
     entry->addOption(new HelpOption("type", "[once|loop] repeat option", HelpOption::CHOICE));
     entry->addOption(new HelpOption("sound", "Sound generator to modify", HelpOption::GENERATOR));
     entry->addExample("adsr 1:0 1000:100 2000:0 loop sinus 440");
     help.add(entry);
 }
 
-AvcRegulator::AvcRegulator(istream& in)
+AvcRegulator::AvcRegulator(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
     stringstream::pos_type last = in.tellg();
     float f;
     in >> f;
 
-    // TODO samplesPerSeconds dependant
     if (f == 0)
     {
       in.clear();
@@ -694,7 +1033,12 @@ AvcRegulator::AvcRegulator(istream& in)
 
     min_gain = 0.05;
 
-    generator = factory(in);
+    // factor and recovery are per sample at 48000Hz
+    sgfloat ratio = 48000.0 / sampleRate();
+    attack = pow(factor, ratio);
+    recovery = pow(1.00001, ratio);
+
+    generator = ctx.factory(in);
 
     reset();
 }
@@ -712,12 +1056,12 @@ void AvcRegulator::next(sgfloat & left, sgfloat & right, sgfloat  sp)
 
         if (l > 0.95 || l<-0.95 || r > 0.95 || r<-0.95)
         {
-            gain *= factor;
+            gain *= attack;
             if (gain < min_gain)
                 gain = min_gain;
         }
         else if (gain < 1.0)
-            gain *= 1.00001;    // TODO samplesPerSeconds dependant
+            gain *= recovery;
 
         left += l;
         right += r;
@@ -746,7 +1090,8 @@ void ChainSound::help(Help& help) const
     help.add(entry);
 }
 
-ChainSound::ChainSound(istream& in)
+ChainSound::ChainSound(istream& in, ParseContext& ctx)
+: SoundGenerator(ctx)
 {
     adsr = 0;
     uint32_t ms = 0;
@@ -781,8 +1126,8 @@ ChainSound::ChainSound(istream& in)
             in >> def_ms;
             if (def_ms <= 0)
             {
-                cerr << "Chain: Cannot have null default duration" << endl;
-                exit(1);
+                ctx.fail("Chain: Cannot have null default duration");
+                return;
             }
         }
         else if (sms == "gaps")
@@ -790,11 +1135,11 @@ ChainSound::ChainSound(istream& in)
         else if (sms == "adsr")
         {
             if (adsr == 0)
-                adsr = new AdsrGenerator(in);
+                adsr = new AdsrGenerator(in, ctx);
             else
             {
-                cerr << "Chain: Cannot have multiple adsr" << endl;
-                exit(1);
+                ctx.fail("Chain: Cannot have multiple adsr");
+                return;
             }
         }
         else
@@ -815,17 +1160,20 @@ ChainSound::ChainSound(istream& in)
                 delta = def_ms;
                 if (delta == 0)
                 {
-                    cerr << "Chain: Missing duration (and/or no default duration)" << endl;
-                    exit(1);
+                    ctx.fail("Chain: Missing duration (and/or no default duration)");
+                    return;
                 }
             }
             ms += delta;
 
-            SoundGenerator* sound = factory(generator, in);
+            SoundGenerator* sound = ctx.factory(generator, in);
             if (sound)
                 add(ms, sound);
             else
-                SoundGenerator::missingGeneratorExit();
+            {
+                ctx.missingGenerator();
+                return;
+            }
 
             if (gaps)
             {
@@ -834,7 +1182,7 @@ ChainSound::ChainSound(istream& in)
             }
         }
     }
-    dt = 1.0 / (sgfloat ) SoundGenerator::samplesPerSeconds() ;
+    dt = 1.0 / (sgfloat ) sampleRate() ;
     reset();
 }
 
@@ -0,0 +1,145 @@
+// Silence detection : a finished once adsr is removed with setAutoRemove (the
+// callback, called by collect() and not by render, tells which one and may
+// delete it), a reverb keeps its sound until its tail is over, and without
+// auto remove a silent sound sleeps : still playing, not rendered, the mix
+// unchanged. A reverb asleep wakes up when its sound is triggered again
+// (reset, poly voice reused).
+#include "helpers.hpp"
+
+static const uint32_t block = 256;
+static const char* shot = "adsr 1:100 10:0 once sinus 440";	// 10ms
+
+static bool silent(const vector<int16_t>& stream)
+{
+	for (auto sample : stream)
+		if (sample)
+			return false;
+	return true;
+}
+
+// Non zero samples of frames
+static size_t sounding(SoundGenerator* sound, size_t frames)
+{
+	size_t count = 0;
+	for (auto sample : render(sound, frames))
+		if (sample != 0)
+			count++;
+	return count;
+}
+
+int main()
+{
+	size_t errors = 0;
+
+	// Finished sound removed, the callback called once by collect()
+	{
+		Engine* engine = offlineEngine(block);
+		vector<pair<Engine::Handle, SoundGenerator*>> finished;
+		bool locked = false;
+		engine->setAutoRemove(true, [&](Engine::Handle handle, SoundGenerator* sound)
+		{
+			locked |= engine->has(handle);		// would deadlock under the lock
+			finished.push_back(make_pair(handle, sound));
+			delete sound;
+		});
+		SoundGenerator* sound = engine->factory(shot);
+		Engine::Handle handle = engine->play(sound);
+		SoundGenerator* music = engine->factory("sinus 220");
+		engine->play(music);
+		renderBlocks(*engine, 10);
+		size_t rendering = finished.size();
+		engine->collect();
+		if (rendering || finished.size() != 1 || finished[0].first != handle || finished[0].second != sound || locked
+			|| engine->has(handle) || engine->count() != 1 || !engine->has(music))
+		{
+			cerr << "Finished sound not removed once (" << rendering << " callback(s) by render, "
+				<< finished.size() << " by collect)" << endl;
+			errors++;
+		}
+		delete engine;
+		delete music;
+	}
+
+	// The reverb tail is played before its sound is removed
+	{
+		Engine* engine = offlineEngine(block);
+		engine->setLimiter(nullptr);
+		engine->setAutoRemove(true);
+		SoundGenerator* sound = engine->factory(string("reverb 30:50 ") + shot);
+		engine->play(sound);
+		int blocks = 0;
+		bool echo = false;
+		while (engine->count() && blocks < 1000)
+		{
+			vector<int16_t> stream = renderBlocks(*engine, 1);
+			if (++blocks * block > 48 * 35)		// past the sound and the first echo start
+				echo |= !silent(stream);
+		}
+		if (!echo || engine->count())
+		{
+			cerr << "Reverb tail " << (echo ? "never ends" : "cut") << " (" << blocks << " blocks)" << endl;
+			errors++;
+		}
+		delete engine;
+		delete sound;
+	}
+
+	// Without auto remove, asleep : same mix, no callback
+	{
+		Engine* engine = offlineEngine(block);
+		engine->setLimiter(nullptr);
+		engine->play(engine->factory(shot));
+		engine->play(engine->factory("sinus 220:50"));
+		Engine* alone = offlineEngine(block);
+		alone->setLimiter(nullptr);
+		alone->play(alone->factory("sinus 220:50"));
+		renderBlocks(*engine, 10);
+		renderBlocks(*alone, 10);
+		vector<int16_t> stream = renderBlocks(*engine, 10);
+		if (engine->count() != 2 || engine->sleeping() != 1 || stream != renderBlocks(*alone, 10))
+		{
+			cerr << "Finished sound not asleep (" << engine->sleeping() << " sleeping)" << endl;
+			errors++;
+		}
+		delete engine;
+		delete alone;
+	}
+
+	// Reverb of a one shot, asleep then triggered again
+	{
+		Engine engine(48000);
+		SoundGenerator* sound = engine.factory(string("reverb 10:50 ") + shot);
+		size_t first = sounding(sound, 48000);
+		bool asleep = sound->silent();
+		vector<SoundGenerator*> nodes;
+		sound->collect(nodes);
+		for (auto node : nodes)
+			node->reset();
+		bool awake = !sound->silent();
+		size_t again = sounding(sound, 48000);
+		if (!first || !asleep || !awake || again != first)
+		{
+			cerr << "Reset reverb not woken (" << again << " samples instead of " << first << ")" << endl;
+			errors++;
+		}
+		delete sound;
+
+		PolySound* poly = dynamic_cast<PolySound*>(engine.factory(string("poly 2 scalar { reverb 10:50 ") + shot + " }"));
+		poly->noteOn(440);
+		first = sounding(poly, 48000);
+		poly->noteOff(440);
+		sounding(poly, 1);
+		uint16_t freed = poly->activeVoices();
+		poly->noteOn(440);
+		again = sounding(poly, 48000);
+		if (!first || freed || again != first)
+		{
+			cerr << "Reused poly voice not woken (" << again << " samples instead of " << first << ")" << endl;
+			errors++;
+		}
+		delete poly;
+	}
+
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+// Mixer buses : a sound on a bus sounds like the same sound on the main bus
+// (volume and insert effect included), fades only change their bus, and
+// buses rendered in parallel by bus threads give exactly the same output
+// and retire the replaced sounds once.
+// Also compares the render time with and without bus threads.
+#include "helpers.hpp"
+
+static const uint32_t block = 1024;
+
+// Heavy mix : 4 buses of reverberated sounds, a shared lfo used by all of them
+static vector<int16_t> busMix(uint16_t bus_threads, int blocks, double& seconds)
+{
+	Engine* engine = offlineEngine(block);
+	engine->setBusThreads(bus_threads);
+	const char* names[] = { "music", "sfx", "ambience", "ui" };
+	engine->factory("shared lfo sinus 3:10");
+	for (int i = 0; i < 4; i++)
+	{
+		Engine::Bus bus = engine->bus(names[i]);
+		engine->setBusEffect(bus, "reverb " + to_string(10 + 5 * i) + ":40 bus");
+		for (int j = 0; j < 6; j++)
+		{
+			string patch = "reverb 30:30 fm 80 120 triangle " + to_string(110 + 37 * i + 11 * j) + ":20 lfo";
+			engine->play(engine->factory(patch), bus);
+		}
+	}
+	vector<int16_t> stream = renderBlocks(*engine, blocks, seconds);
+	delete engine;
+	return stream;
+}
+
+int main()
+{
+	size_t errors = 0;
+
+	// Same sound on the main bus or on a bus with the same gain and effect
+	{
+		Engine* direct = offlineEngine(block);
+		Engine::Handle handle = direct->play(direct->factory("reverb 20:50 am 0 100 sinus 440 sinus 3"));
+		direct->setVolume(handle, 0.5);
+
+		Engine* routed = offlineEngine(block);
+		Engine::Bus music = routed->bus("music");
+		routed->setBusVolume(music, 0.5);
+		routed->setBusEffect(music, "reverb 20:50 bus");
+		routed->play(routed->factory("am 0 100 sinus 440 sinus 3"), music);
+
+		if (renderBlocks(*direct, 20) != renderBlocks(*routed, 20) || routed->bus("music") != music
+			|| routed->busCount() != 2)
+		{
+			cerr << "Bus volume or effect differ from the direct sound" << endl;
+			errors++;
+		}
+		delete direct;
+		delete routed;
+	}
+
+	// Fading a bus out leaves the others
+	{
+		Engine* engine = offlineEngine(block);
+		engine->setLimiter(nullptr);	// no reduction left by the other bus
+		Engine::Bus music = engine->bus("music");
+		engine->play(engine->factory("sinus 440"), music);
+		engine->play(engine->factory("sinus 660"));
+		engine->fadeBusOut(music, 10);
+		renderBlocks(*engine, 1);
+
+		Engine* alone = offlineEngine(block);
+		alone->setLimiter(nullptr);
+		alone->play(alone->factory("sinus 660"));
+		renderBlocks(*alone, 1);
+
+		// The faded bus is silent
+		vector<int16_t> faded = renderBlocks(*engine, 4);
+		vector<int16_t> expected = renderBlocks(*alone, 4);
+		if (engine->getBusVolume(music) != 0 || engine->getBusVolume(0) != 1
+			|| faded.size() != expected.size())
+			errors++;
+		int deviation = 0;
+		for (size_t i = 0; i < faded.size() && i < expected.size(); i++)
+			deviation = max(deviation, abs(faded[i] - expected[i]));
+		if (deviation > 1)
+		{
+			cerr << "Fade out changed another bus (deviation " << deviation << ")" << endl;
+			errors++;
+		}
+		delete engine;
+		delete alone;
+	}
+
+	// Crossfades ending on several bus threads in the same block : each
+	// replaced sound is retired once
+	{
+		Engine* engine = offlineEngine(block);
+		engine->setBusThreads(3);
+		vector<Engine::Handle> handles;
+		const char* names[] = { "music", "sfx", "ambience", "ui" };
+		for (int i = 0; i < 4; i++)
+			handles.push_back(engine->play(engine->factory("sinus 440"), engine->bus(names[i])));
+		size_t retired = 0;
+		const int rounds = 200;
+		for (int round = 0; round < rounds; round++)
+		{
+			for (auto handle : handles)
+				engine->swap(handle, engine->factory("square 220"), 1);
+			renderBlocks(*engine, 1);
+			retired += engine->collect();
+		}
+		if (retired != 4 * rounds)
+		{
+			cerr << "Retired " << retired << " replaced sounds out of " << 4 * rounds << endl;
+			errors++;
+		}
+		delete engine;
+	}
+
+	// Parallel buses, same output
+	const int blocks = 100;
+	double serial_time, parallel_time;
+	vector<int16_t> serial = busMix(0, blocks, serial_time);
+	vector<int16_t> parallel = busMix(3, blocks, parallel_time);
+	if (serial != parallel)
+	{
+		cerr << "Parallel buses differ from serial ones" << endl;
+		errors++;
+	}
+	double audio = double(blocks * block) / 48000;
+	cout << "Serial buses   : " << serial_time * 1e3 << "ms for " << audio << "s" << endl;
+	cout << "3 bus threads  : " << parallel_time * 1e3 << "ms (x" << serial_time / parallel_time << ')' << endl;
+
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
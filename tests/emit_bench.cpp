@@ -0,0 +1,53 @@
+// Compiled patches (synth --emit-cpp of tests/patches) against the same
+// .synth files interpreted : checks they sound exactly the same and
+// compares their speed.
+#include <libsynth_static.hpp>
+#include "helpers.hpp"
+
+extern const StaticPatchEntry emit_patches[];
+
+static const size_t samples = 48000 * 10;
+
+int main(int argc, const char* argv[])
+{
+	string dir(argc > 1 ? argv[1] : "patches");
+
+	Engine engine(48000);
+	ParseContext ctx(engine);
+	ctx.echo = false;
+
+	double interpreted_time = 0;
+	double compiled_time = 0;
+	size_t count = 0;
+	size_t errors = 0;
+	for (const StaticPatchEntry* patch = emit_patches; patch->name; patch++)
+	{
+		SoundGenerator* interpreted = ctx.factory(dir + '/' + patch->name + ".synth");
+		SoundGenerator* compiled = patch->build(ctx);
+		if (interpreted == nullptr || compiled == nullptr)
+		{
+			cerr << "Unable to build " << patch->name << endl;
+			return 1;
+		}
+		vector<sgfloat> expected, out;
+		double interpreted_patch = render(interpreted, samples, expected);
+		double compiled_patch = render(compiled, samples, out);
+		interpreted_time += interpreted_patch;
+		compiled_time += compiled_patch;
+		count++;
+		if (out != expected)
+		{
+			cerr << "Mismatch for " << patch->name << endl;
+			errors++;
+		}
+		else
+			cout << patch->name << " : x" << interpreted_patch / compiled_patch << endl;
+		delete interpreted;
+		delete compiled;
+	}
+
+	cout << "Patches        : " << count << ", " << errors << " mismatch" << endl;
+	cout << "Interpreted    : " << interpreted_time << 's' << endl;
+	cout << "Compiled       : " << compiled_time << "s (x" << interpreted_time / compiled_time << ')' << endl;
+	return errors ? 1 : 0;
+}
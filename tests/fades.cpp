@@ -0,0 +1,165 @@
+// Gain ramps : master and bus fades follow their curve (linear, equal power,
+// exponential) and end on the exact frame, whatever the buffer size, and go
+// on while their bus is idle. Also
+// compares the block ramp with the former per frame fade.
+#include <libsynth.hpp>
+
+static const uint32_t rate = 48000;
+
+static double curve(GainRamp::Curve curve, double from, double to, double t)
+{
+	switch (curve)
+	{
+		case GainRamp::EQUAL_POWER:
+			return to > from ? from + (to - from) * sin(M_PI_2 * t) : to + (from - to) * cos(M_PI_2 * t);
+		case GainRamp::EXPONENTIAL:
+			return max(from, 0.001) * pow(max(to, 0.001) / max(from, 0.001), t);
+		default:
+			return from + (to - from) * t;
+	}
+}
+
+// Full scale sound (level 100) faded out in 10ms, buffers of buffer frames
+static vector<int16_t> fadeOut(GainRamp::Curve shape, uint32_t buffer, bool bus)
+{
+	NullBackend* backend = new NullBackend;
+	backend->setOffline(true);
+	Engine engine(rate, buffer);
+	engine.setBackend(backend);
+	engine.setLimiter(nullptr);
+	Engine::Bus music = engine.bus("music");
+	engine.play(engine.factory("level 100"), bus ? music : 0);
+	if (bus)
+		engine.fadeBusOut(music, 10, shape);
+	else
+		engine.fade_out(10, shape);
+
+	vector<int16_t> stream(2 * 1000);
+	for (size_t start = 0; start < stream.size(); start += 2 * buffer)
+		engine.render(&stream[start], min(size_t(2 * buffer), stream.size() - start));
+	return stream;
+}
+
+int main()
+{
+	size_t errors = 0;
+	const uint32_t frames = 480;
+	const char* names[] = { "linear", "equal power", "exponential" };
+
+	for (int shape = GainRamp::LINEAR; shape <= GainRamp::EXPONENTIAL; shape++)
+	{
+		GainRamp::Curve c = GainRamp::Curve(shape);
+		vector<int16_t> reference = fadeOut(c, 256, false);
+		double deviation = 0;
+		for (uint32_t i = 0; i < reference.size() / 2; i++)
+		{
+			// Frame i has the gain of the end of the frame (16 frame linear pieces)
+			double expected = i + 1 < frames ? 32767 * curve(c, 1, 0, double(i + 1) / frames) : 0;
+			deviation = max(deviation, fabs(reference[2 * i] - expected));
+			deviation = max(deviation, fabs(reference[2 * i + 1] - expected));
+		}
+		// Ends on the exact frame, any buffer size, master or bus
+		bool exact = reference[2 * (frames - 2)] != 0 && reference[2 * (frames - 1)] == 0;
+		if (deviation > 16 || !exact || fadeOut(c, 100, false) != reference || fadeOut(c, 1000, true) != reference)
+		{
+			cerr << "Wrong " << names[shape] << " fade (deviation " << deviation << ")" << endl;
+			errors++;
+		}
+		cout << "Fade " << names[shape] << string(15 - strlen(names[shape]), ' ') << ": deviation " << deviation << endl;
+	}
+
+	// Fade in up to a volume
+	{
+		GainRamp ramp(0);
+		ramp.start(0.5, 300, GainRamp::EQUAL_POWER);
+		vector<sgfloat> left(512, 1), right(512, 1);
+		ramp.process(&left[0], &right[0], 200);
+		ramp.process(&left[200], &right[200], 312);
+		if (left[299] != 0.5f || left[511] != 0.5f || right[149] > 0.5f * sin(M_PI_2 / 2) + 1e-5
+			|| ramp.ramping() || ramp.value() != 0.5f)
+		{
+			cerr << "Wrong fade in" << endl;
+			errors++;
+		}
+	}
+
+	// An idle bus fades out as well (its sounds come later)
+	{
+		NullBackend* backend = new NullBackend;
+		backend->setOffline(true);
+		Engine engine(rate, 256);
+		engine.setBackend(backend);
+		engine.setLimiter(nullptr);
+		Engine::Bus music = engine.bus("music");
+		engine.fadeBusOut(music, 10);
+		vector<int16_t> stream(2 * 256);
+		for (int i = 0; i < 4; i++)
+			engine.render(&stream[0], stream.size());
+		engine.play(engine.factory("level 100"), music);
+		engine.render(&stream[0], stream.size());
+		int16_t loudest = 0;
+		for (auto sample : stream)
+			loudest = max<int16_t>(loudest, abs(sample));
+		if (engine.getBusVolume(music) != 0 || loudest != 0)
+		{
+			cerr << "Idle bus not faded out" << endl;
+			errors++;
+		}
+
+		// Advanced ramp continues as the processed one
+		GainRamp processed(1), advanced(1);
+		processed.start(0, 300, GainRamp::EXPONENTIAL);
+		advanced.start(0, 300, GainRamp::EXPONENTIAL);
+		vector<sgfloat> left(512, 1), right(512, 1), other(512, 1);
+		processed.process(&left[0], &right[0], 100);
+		advanced.advance(100);
+		processed.process(&left[100], &right[100], 412);
+		advanced.process(&other[100], &right[100], 412);
+		if (!equal(left.begin() + 100, left.end(), other.begin() + 100))
+		{
+			cerr << "Wrong advanced ramp" << endl;
+			errors++;
+		}
+	}
+
+	// Block ramp against the former per frame fade with its branches
+	{
+		const int rounds = 2000;
+		const uint32_t block = 256;
+		vector<sgfloat> left(block), right(block);
+		auto start = chrono::steady_clock::now();
+		sgfloat volume = 1;
+		sgfloat dvol = -1.0 / (rounds * block);
+		for (int round = 0; round < rounds; round++)
+		{
+			for (uint32_t i = 0; i < block; i++)
+			{
+				left[i] = right[i] = 0.5;
+				volume += dvol;
+				if (volume > 1.0) { volume = 1; }
+				if (volume < 0.0) { volume = 0; }
+				left[i] *= volume;
+				right[i] *= volume;
+			}
+		}
+		double frame_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		sgfloat sink = left[0];
+
+		GainRamp ramp;
+		ramp.start(0, rounds * block);
+		start = chrono::steady_clock::now();
+		for (int round = 0; round < rounds; round++)
+		{
+			for (uint32_t i = 0; i < block; i++)
+				left[i] = right[i] = 0.5;
+			ramp.process(&left[0], &right[0], block);
+		}
+		double ramp_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		sink += left[0];
+		cout << "Per frame fade : " << frame_time * 1e9 / rounds << "ns per block" << endl;
+		cout << "Block ramp     : " << ramp_time * 1e9 / rounds << "ns per block" << (sink > 1 ? " " : "") << endl;
+	}
+
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+// Freeze : the first loop of a frozen sound is the sound itself, then it
+// loops on the period of its adsr loops (auto, 20ms and 30ms loops repeat
+// every 60ms), with xfade the loop point goes on with what followed the
+// loop end and blends into the beginning, and once stops.
+// A redefined define is frozen again instead of reusing the old samples.
+// Also compares the speed of the frozen and the live sound.
+#include "helpers.hpp"
+
+static const char* patch = "adsr 100:100 200:0 loop low 2000 fm 80 120 square 220 sinus 5";
+static const size_t loop = 48000 / 5;	// 200ms
+
+// Samples differing between count frames of out (at first) and of other (at from)
+static size_t differences(const vector<sgfloat>& out, size_t first, const vector<sgfloat>& other, size_t from, size_t count)
+{
+	size_t differ = 0;
+	for (size_t i = 0; i < 2 * count; i++)
+		if (out[2 * first + i] != other[2 * from + i])
+			differ++;
+	return differ;
+}
+
+int main()
+{
+	Engine engine(48000);
+	size_t errors = 0;
+
+	vector<sgfloat> live;
+	SoundGenerator* sound = engine.factory(patch);
+	double live_time = render(sound, 3 * loop, live);
+	delete sound;
+
+	// First loop identical, then the same loop again
+	double frozen_time;
+	{
+		vector<sgfloat> out;
+		SoundGenerator* frozen = engine.factory(string("freeze auto ") + patch);
+		frozen_time = render(frozen, 3 * loop, out);
+		size_t first = differences(out, 0, live, 0, loop);
+		size_t looped = differences(out, loop, out, 0, loop) + differences(out, 2 * loop, out, 0, loop);
+		if (first || looped)
+		{
+			cerr << "Frozen sound differs : " << first << " in the first loop, " << looped << " once looped" << endl;
+			errors++;
+		}
+		delete frozen;
+	}
+
+	// Loops of 20ms and 30ms, frozen over 60ms
+	{
+		const char* loops = "{ adsr 10:100 20:0 loop sinus 440 adsr 10:100 30:0 loop sinus 660 }";
+		const size_t period = 48000 * 60 / 1000;
+		SoundGenerator* sound = engine.factory(loops);
+		vector<sgfloat> expected = render(sound, period);
+		SoundGenerator* frozen = engine.factory(string("freeze auto ") + loops);
+		vector<sgfloat> out = render(frozen, 2 * period);
+		size_t differ = differences(out, 0, expected, 0, period) + differences(out, period, expected, 0, period);
+		if (differ)
+		{
+			cerr << "Wrong auto period for two loops : " << differ << " differences" << endl;
+			errors++;
+		}
+		delete sound;
+		delete frozen;
+	}
+
+	// Crossfade of 20ms from the second loop on
+	{
+		const size_t fade = 960;
+		vector<sgfloat> out;
+		SoundGenerator* frozen = engine.factory(string("freeze auto xfade 20 ") + patch);
+		render(frozen, 2 * loop, out);
+		size_t first = differences(out, 0, live, 0, loop);
+		size_t after = differences(out, loop + fade, live, fade, loop - fade);
+		double deviation = 0;
+		for (size_t i = 0; i < fade; i++)
+		{
+			double w = double(i) / fade;
+			double expected = live[2 * i] * w + live[2 * (loop + i)] * (1 - w);
+			deviation = max(deviation, fabs(out[2 * (loop + i)] - expected));
+		}
+		if (first || after || out[2 * loop] != live[2 * loop] || deviation > 1e-5)
+		{
+			cerr << "Wrong crossfade : " << first << " and " << after << " differences, deviation " << deviation << endl;
+			errors++;
+		}
+		delete frozen;
+	}
+
+	// Once : silent after the first loop
+	{
+		vector<sgfloat> out;
+		SoundGenerator* frozen = engine.factory(string("freeze 0.2 once ") + patch);
+		render(frozen, 2 * loop, out);
+		size_t noise = 0;
+		for (size_t i = 2 * loop; i < out.size(); i++)
+			if (out[i] != 0)
+				noise++;
+		if (differences(out, 0, live, 0, loop) || noise || !frozen->silent())
+		{
+			cerr << "Frozen once not silent (" << noise << " samples)" << endl;
+			errors++;
+		}
+		delete frozen;
+	}
+
+	// Same text, redefined define
+	{
+		engine.define("frozen_tone", "sinus 440");
+		SoundGenerator* before = engine.factory("freeze 0.1 frozen_tone");
+		engine.define("frozen_tone", "sinus 660");
+		SoundGenerator* after = engine.factory("freeze 0.1 frozen_tone");
+		SoundGenerator* tone = engine.factory("sinus 660");
+		vector<sgfloat> old_samples = render(before, loop / 2);
+		vector<sgfloat> new_samples = render(after, loop / 2);
+		if (new_samples != render(tone, loop / 2) || old_samples == new_samples)
+		{
+			cerr << "Redefined define not frozen again" << endl;
+			errors++;
+		}
+		delete before;
+		delete after;
+		delete tone;
+	}
+
+	cout << "Live           : " << live_time << "s" << endl;
+	cout << "Frozen         : " << frozen_time << "s (x" << live_time / frozen_time << ')' << endl;
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+// Handles : a handle of a removed sound is rejected once its slot is reused,
+// even after its generation went past 32767 and wrapped (never 0), and
+// removing from the middle keeps every other handle on its own sound.
+// Also reports the cost of play / remove with many playing sounds.
+#include "helpers.hpp"
+
+int main()
+{
+	Engine* engine = offlineEngine(256);
+	size_t errors = 0;
+
+	// Slot reused by another sound
+	{
+		SoundGenerator* first = engine->factory("sinus 440");
+		SoundGenerator* second = engine->factory("sinus 660");
+		Engine::Handle stale = engine->play(first);
+		engine->remove(stale);
+		Engine::Handle handle = engine->play(second);
+		if ((handle & 0xFFFF) != (stale & 0xFFFF) || handle == stale)
+		{
+			cerr << "Slot not reused (" << hex << stale << " then " << handle << dec << ")" << endl;
+			errors++;
+		}
+		if (engine->has(stale) || engine->get(stale) || engine->setVolume(stale, 0.5) || engine->remove(stale)
+			|| engine->has(first) || engine->get(handle) != second || !engine->has(second))
+		{
+			cerr << "Stale handle reaches the new sound" << endl;
+			errors++;
+		}
+		engine->remove(handle);
+		delete first;
+		delete second;
+	}
+
+	// Generations of one slot past 32767, then wrapping
+	{
+		SoundGenerator* sound = engine->factory("sinus 440");
+		Engine::Handle previous = 0;
+		uint32_t highest = 0;
+		for (int i = 0; i < 70000; i++)
+		{
+			Engine::Handle handle = engine->play(sound);
+			highest = max(highest, handle >> 16);
+			if (handle == 0 || handle == previous || !engine->has(handle) || engine->get(handle) != sound
+				|| (previous && engine->has(previous)) || !engine->remove(handle))
+			{
+				cerr << "Wrong handle " << hex << handle << " after " << previous << dec << endl;
+				errors++;
+				break;
+			}
+			previous = handle;
+		}
+		if (highest != 0xFFFF)
+		{
+			cerr << "Generations up to " << highest << " only" << endl;
+			errors++;
+		}
+		delete sound;
+	}
+
+	// Removing from the middle (the last voice takes its place)
+	{
+		vector<SoundGenerator*> sounds;
+		vector<Engine::Handle> handles;
+		for (int i = 0; i < 100; i++)
+		{
+			sounds.push_back(engine->factory("sinus " + to_string(100 + i)));
+			handles.push_back(engine->play(sounds.back()));
+		}
+		for (int i = 1; i < 100; i += 2)
+			engine->remove(handles[i]);
+		size_t lost = 0;
+		for (int i = 0; i < 100; i++)
+			if (engine->has(handles[i]) != (i % 2 == 0) || (i % 2 == 0 && engine->get(handles[i]) != sounds[i]))
+				lost++;
+		if (lost || engine->count() != 50)
+		{
+			cerr << lost << " handle(s) lost after removing from the middle" << endl;
+			errors++;
+		}
+		for (int i = 0; i < 100; i += 2)
+			engine->remove(handles[i]);
+		for (auto sound : sounds)
+			delete sound;
+	}
+
+	// play / remove with many playing sounds
+	{
+		const int count = 10000;
+		vector<SoundGenerator*> sounds;
+		vector<Engine::Handle> handles;
+		for (int i = 0; i < count; i++)
+			sounds.push_back(engine->factory("sinus 440"));
+		auto start = chrono::steady_clock::now();
+		for (auto sound : sounds)
+			handles.push_back(engine->play(sound));
+		srand(1);
+		for (int i = count - 1; i > 0; i--)
+			swap(handles[i], handles[rand() % (i + 1)]);
+		for (auto handle : handles)
+			engine->remove(handle);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (engine->count())
+			errors++;
+		cout << "Play / remove  : " << seconds * 1e9 / (2 * count) << "ns with up to " << count << " sounds" << endl;
+		for (auto sound : sounds)
+			delete sound;
+	}
+
+	delete engine;
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,68 @@
+// Fixtures shared by the tests : engines without audio device and the
+// frames rendered by an engine or a generator alone.
+#ifndef SYNTH_TESTS_HELPERS_HPP
+#define SYNTH_TESTS_HELPERS_HPP
+
+#include <libsynth.hpp>
+
+// Engine on an offline NullBackend, rendered by renderBlocks or processBlocks
+inline Engine* offlineEngine(uint32_t block, uint32_t rate = 48000)
+{
+	NullBackend* backend = new NullBackend;
+	backend->setOffline(true);
+	Engine* engine = new Engine(rate, block);
+	engine->setBackend(backend);
+	return engine;
+}
+
+// Blocks of the engine buffer size mixed by Engine::render, seconds spent
+inline vector<int16_t> renderBlocks(Engine& engine, int blocks, double& seconds)
+{
+	uint32_t block = engine.wantedBufferSize();
+	vector<int16_t> stream(2 * block * blocks);
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < blocks; i++)
+		engine.render(&stream[2 * block * i], 2 * block);
+	seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return stream;
+}
+
+inline vector<int16_t> renderBlocks(Engine& engine, int blocks)
+{
+	double seconds;
+	return renderBlocks(engine, blocks, seconds);
+}
+
+// Blocks rendered through the audio callback (timing, tracing), seconds spent
+inline double processBlocks(Engine& engine, int blocks)
+{
+	auto start = chrono::steady_clock::now();
+	static_cast<NullBackend*>(engine.getBackend())->process(blocks * engine.wantedBufferSize());
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Frames of a generator alone, the noises start the same each time, seconds spent
+inline double render(SoundGenerator* generator, size_t frames, vector<sgfloat>& out)
+{
+	out.clear();
+	out.reserve(2 * frames);
+	srand(1);
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < frames; i++)
+	{
+		sgfloat left = 0, right = 0;
+		generator->next(left, right);
+		out.push_back(left);
+		out.push_back(right);
+	}
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+inline vector<sgfloat> render(SoundGenerator* generator, size_t frames)
+{
+	vector<sgfloat> out;
+	render(generator, frames, out);
+	return out;
+}
+
+#endif
@@ -0,0 +1,144 @@
+// Hot reload : a playing patch file is saved again (rewritten, then renamed
+// over like editors do), the watcher swaps the sound with a crossfade. Checks
+// the handle keeps playing without any click, even when a save has a typo, and
+// that every replaced tree reaches Engine::collect().
+#include <libsynth.hpp>
+#include <unistd.h>
+
+static const uint32_t block = 256;
+
+// Largest step between two successive samples (a click is a big one)
+static int largestStep(const vector<int16_t>& stream)
+{
+	int step = 0;
+	for (size_t i = 2; i < stream.size(); i++)
+		step = max(step, abs(stream[i] - stream[i - 2]));
+	return step;
+}
+
+static void renderBlock(Engine& engine, vector<int16_t>& stream)
+{
+	size_t size = stream.size();
+	stream.resize(size + 2 * block);
+	engine.render(&stream[size], 2 * block);
+}
+
+// Render until the watcher has done reloads (2s max)
+static bool waitReloads(Engine& engine, PatchWatcher& watcher, uint32_t reloads, vector<int16_t>& stream)
+{
+	for (int wait = 0; wait < 2000 && watcher.reloads() < reloads; wait++)
+	{
+		renderBlock(engine, stream);
+		usleep(1000);
+	}
+	return watcher.reloads() == reloads;
+}
+
+int main()
+{
+	char dir_template[] = "/tmp/hot_reload_XXXXXX";
+	if (mkdtemp(dir_template) == nullptr)
+	{
+		cerr << "Unable to create a temporary directory" << endl;
+		return 1;
+	}
+	string dir(dir_template);
+	string file = dir + "/patch.synth";
+	string saved = dir + "/patch.synth.new";
+	ofstream(file) << "sinus 440:50" << endl;
+
+	NullBackend* backend = new NullBackend;
+	backend->setOffline(true);
+	Engine engine(48000, block);
+	engine.setBackend(backend);
+
+	size_t errors = 0;
+	vector<int16_t> stream;
+	{
+		PatchWatcher watcher(engine, 10);
+		Engine::Handle handle = watcher.play(file);
+		for (int i = 0; i < 20; i++)
+			renderBlock(engine, stream);
+
+		ofstream(file) << "sinus 660:50" << endl;
+		if (!waitReloads(engine, watcher, 1, stream))
+		{
+			cerr << "No reload after rewriting " << file << endl;
+			errors++;
+		}
+		for (int i = 0; i < 20; i++)
+			renderBlock(engine, stream);
+
+		ofstream(saved) << "sinus 550:50" << endl;
+		rename(saved.c_str(), file.c_str());
+		if (!waitReloads(engine, watcher, 2, stream))
+		{
+			cerr << "No reload after renaming over " << file << endl;
+			errors++;
+		}
+		for (int i = 0; i < 20; i++)
+			renderBlock(engine, stream);
+
+		// Typos do not stop the program, the playing sound is kept until fixed
+		const char* typos[] = { "adsr 100:50 50:0 once sinus 440", "am 0 100 sinus 440 sinux 3", "fm 20 10 sinus 440 sinus 3" };
+		for (auto typo : typos)
+		{
+			ofstream(file) << typo << endl;
+			waitReloads(engine, watcher, 3, stream);
+		}
+		if (watcher.reloads() != 2)
+		{
+			cerr << "Patch with a typo reloaded" << endl;
+			errors++;
+		}
+		ofstream(file) << "sinus 440:50" << endl;
+		if (!waitReloads(engine, watcher, 3, stream))
+		{
+			cerr << "No reload once the typo is fixed" << endl;
+			errors++;
+		}
+		for (int i = 0; i < 20; i++)
+			renderBlock(engine, stream);
+
+		if (!engine.has(handle) || engine.count() != 1)
+		{
+			cerr << "Handle lost by reload" << endl;
+			errors++;
+		}
+		engine.remove(handle);
+	}
+	// Sinus at 50% : steps of at most 0.5 * 2pi * 660 / 48000 of the full scale
+	int step = largestStep(stream);
+	if (step > 0.06 * 32767)
+	{
+		cerr << "Click during reload (step " << step << ")" << endl;
+		errors++;
+	}
+	cout << "Reload         : " << stream.size() / 2 << " frames, largest step " << step << endl;
+
+	// Swaps faster than collect, replaced trees are all deleted
+	const size_t swaps = 1000;
+	Engine::Handle handle = engine.play(engine.factory("sinus 440:50"));
+	for (size_t i = 0; i < swaps; i++)
+	{
+		engine.swap(handle, engine.factory("sinus " + to_string(200 + i) + ":50"), 5);
+		if (i % 4 == 0)
+			renderBlock(engine, stream);
+	}
+	// The last one waits for room in the full retired queue
+	size_t collected = engine.collect();
+	for (int i = 0; i < 2; i++)
+		renderBlock(engine, stream);
+	collected += engine.collect();
+	if (collected != swaps)
+	{
+		cerr << "Collected " << collected << " trees out of " << swaps << endl;
+		errors++;
+	}
+	cout << "Swap           : " << swaps << " swaps, " << collected << " trees collected" << endl;
+
+	unlink(file.c_str());
+	rmdir(dir.c_str());
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,180 @@
+// Look-ahead limiter : loud sounds never go above the ceiling (sample or true
+// peak), quiet ones are only delayed by latency() frames, and the engine
+// plays several loud sounds without clipping nor dividing by their count.
+// The limiter of a bus is flushed when the bus goes idle.
+// Also compares the cost of the quiet (delay only) and limiting blocks.
+#include "helpers.hpp"
+
+static const uint32_t rate = 48000;
+static const uint32_t block = 256;
+
+// Stereo sinus of amplitude, phase in fraction of turn
+static void sinus(vector<sgfloat>& left, vector<sgfloat>& right, double freq, double amplitude, double phase = 0)
+{
+	for (size_t i = 0; i < left.size(); i++)
+	{
+		left[i] += amplitude * sin(2 * M_PI * (freq * i / rate + phase));
+		right[i] += amplitude * sin(2 * M_PI * (freq * i / rate + phase + 0.25));
+	}
+}
+
+static void process(Limiter& limiter, vector<sgfloat>& left, vector<sgfloat>& right)
+{
+	for (size_t i = 0; i < left.size(); i += block)
+		limiter.process(&left[i], &right[i], min(size_t(block), left.size() - i));
+}
+
+int main()
+{
+	size_t errors = 0;
+	const size_t frames = rate;
+
+	// Quiet noise is delayed, unchanged
+	{
+		Limiter limiter(rate);
+		vector<sgfloat> left(frames), right(frames);
+		srand(1);
+		for (size_t i = 0; i < frames; i++)
+		{
+			left[i] = 0.9 * (rand() / (sgfloat) RAND_MAX - 0.5);
+			right[i] = 0.9 * (rand() / (sgfloat) RAND_MAX - 0.5);
+		}
+		vector<sgfloat> l = left, r = right;
+		process(limiter, l, r);
+		uint32_t latency = limiter.latency();
+		bool same = latency == rate * 5 / 1000;
+		for (size_t i = 0; i + latency < frames; i++)
+			same = same && l[i + latency] == left[i] && r[i + latency] == right[i];
+		if (!same || limiter.gain() != 1)
+		{
+			cerr << "Quiet sound changed by the limiter" << endl;
+			errors++;
+		}
+	}
+
+	// Loud chords (up to 3 times the full scale) stay under the ceiling
+	for (int true_peak = 0; true_peak < 2; true_peak++)
+	{
+		Limiter limiter(rate, 2, 50, 0.9, true_peak);
+		vector<sgfloat> left(frames), right(frames);
+		sinus(left, right, 220, 1);
+		sinus(left, right, 277, 1);
+		sinus(left, right, 330, 1);
+		// Then quiet again, the gain goes back up
+		for (size_t i = frames / 2; i < frames; i++)
+		{
+			left[i] *= 0.1;
+			right[i] *= 0.1;
+		}
+		process(limiter, left, right);
+		sgfloat peak = Limiter::peak(&left[0], &right[0], frames);
+		if (peak > 0.9001 || peak < 0.8 || limiter.gain() < 0.999)
+		{
+			cerr << "Loud chord limited to " << peak << " (ceiling 0.9)" << endl;
+			errors++;
+		}
+	}
+
+	// Samples at 0.85, but the sound between them goes up to 1.2
+	{
+		Limiter sample_peak(rate);
+		Limiter true_peak(rate, 5, 80, 0.98, true);
+		vector<sgfloat> left(frames), right(frames);
+		sinus(left, right, rate / 4, 1.2, 0.125);
+		vector<sgfloat> l = left, r = right;
+		process(sample_peak, l, r);
+		process(true_peak, left, right);
+		if (sample_peak.gain() != 1 || fabs(true_peak.gain() - 0.98 / 1.2) > 0.02)
+		{
+			cerr << "True peak not limited (gain " << true_peak.gain() << ")" << endl;
+			errors++;
+		}
+		cout << "True peak      : gain " << true_peak.gain() << " (sample peak " << sample_peak.gain() << ')' << endl;
+	}
+
+	// Cost of a block, quiet (delay only) or limiting
+	{
+		const int rounds = 20;
+		vector<sgfloat> quiet(frames), unused(frames);
+		sinus(quiet, unused, 440, 0.5);
+		vector<sgfloat> loud = quiet;
+		for (auto& value : loud)
+			value *= 4;
+		double seconds[2];
+		for (int limiting = 0; limiting < 2; limiting++)
+		{
+			Limiter limiter(rate);
+			auto start = chrono::steady_clock::now();
+			for (int round = 0; round < rounds; round++)
+			{
+				vector<sgfloat> left = limiting ? loud : quiet;
+				vector<sgfloat> right = left;
+				process(limiter, left, right);
+			}
+			seconds[limiting] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		}
+		double blocks = double(rounds * frames) / block;
+		cout << "Quiet block    : " << seconds[0] * 1e9 / blocks << "ns" << endl;
+		cout << "Limited block  : " << seconds[1] * 1e9 / blocks << "ns" << endl;
+	}
+
+	// Engine : loud sounds are limited, not clipped nor divided by their count
+	{
+		Engine* engine = offlineEngine(block, rate);
+		engine->play(engine->factory("sinus 220"));
+		engine->play(engine->factory("sinus 330"));
+		engine->play(engine->factory("sinus 440"));
+		vector<int16_t> stream = renderBlocks(*engine, 100);
+		int loudest = 0;
+		for (auto sample : stream)
+			loudest = max(loudest, abs(int(sample)));
+		if (engine->saturated() || loudest > 0.98 * 32767 + 1 || loudest < 0.9 * 32767)
+		{
+			cerr << "Loud sounds clipped (loudest " << loudest << ")" << endl;
+			errors++;
+		}
+
+		// A sound alone plays at its own level
+		Engine* single = offlineEngine(block, rate);
+		single->play(single->factory("sinus 440:50"));
+		stream = renderBlocks(*single, 10);
+		loudest = 0;
+		for (auto sample : stream)
+			loudest = max(loudest, abs(int(sample)));
+		if (loudest < 0.49 * 32767 || loudest > 0.5 * 32767 + 1)
+		{
+			cerr << "Single sound at " << loudest << " instead of 16383" << endl;
+			errors++;
+		}
+		cout << "Engine         : loudest " << loudest << ", latency " << single->getLimiter()->latency() << " frames" << endl;
+		delete engine;
+		delete single;
+	}
+
+	// The limiter of a bus is flushed once its sounds are removed, its delay
+	// line is not played when the next sound starts
+	{
+		Engine* engine = offlineEngine(block, rate);
+		engine->setLimiter(nullptr);
+		Engine::Bus sfx = engine->bus("sfx");
+		engine->setBusLimiter(sfx, new Limiter(rate));
+		Engine::Handle handle = engine->play(engine->factory("sinus 440"), sfx);
+		renderBlocks(*engine, 10);
+		engine->remove(handle);
+		renderBlocks(*engine, rate / block);
+		engine->play(engine->factory("sinus 10:1"), sfx);		// almost silent, not asleep
+		vector<int16_t> stream = renderBlocks(*engine, 1);
+		int loudest = 0;
+		for (auto sample : stream)
+			loudest = max(loudest, abs(int(sample)));
+		if (loudest > 0.01 * 32767 + 1)
+		{
+			cerr << "Idle bus limiter replayed its delay line (peak " << loudest << ")" << endl;
+			errors++;
+		}
+		delete engine;
+	}
+
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
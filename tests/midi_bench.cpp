@@ -0,0 +1,116 @@
+// Writes a dense multi track midi file (16 channels playing chords) in a
+// temporary directory and renders it offline, reporting the real time factor.
+#include <libsynth.hpp>
+#include <unistd.h>
+
+static const uint32_t seconds = 60;
+static const uint16_t division = 480;		// ticks per quarter note, 120 bpm
+
+static void writeBe(string& out, uint32_t value, int bytes)
+{
+	for (int i = bytes - 1; i >= 0; i--)
+		out += char((value >> (8 * i)) & 0xFF);
+}
+
+static void writeVlq(string& out, uint32_t value)
+{
+	char bytes[4];
+	int count = 0;
+	do
+	{
+		bytes[count++] = value & 0x7F;
+		value >>= 7;
+	} while (value);
+	while (count--)
+		out += char(bytes[count] | (count ? 0x80 : 0));
+}
+
+static void addTrack(string& file, const string& track)
+{
+	file += "MTrk";
+	writeBe(file, track.size() + 4, 4);
+	file += track;
+	file += string("\x00\xFF\x2F\x00", 4);
+}
+
+// Channel c plays a 4 notes chord each eighth note, with running status
+static string chords(uint8_t channel)
+{
+	static const uint8_t chord[] = { 0, 4, 7, 11 };
+	string track;
+	writeVlq(track, 0);
+	track += char(0xC0 | channel);
+	track += char(channel * 8);
+	uint32_t steps = seconds * 4;
+	for (uint32_t step = 0; step < steps; step++)
+	{
+		uint8_t root = 36 + (channel * 3 + step * 5) % 48;
+		for (int i = 0; i < 4; i++)
+		{
+			writeVlq(track, 0);
+			if (i == 0) track += char(0x90 | channel);
+			track += char(root + chord[i]);
+			track += char(64 + i * 16);
+		}
+		for (int i = 0; i < 4; i++)
+		{
+			writeVlq(track, i == 0 ? division / 2 : 0);
+			track += char(root + chord[i]);
+			track += char(0);	// note on velocity 0 = note off
+		}
+	}
+	return track;
+}
+
+int main()
+{
+	char dir_template[] = "/tmp/midi_bench_XXXXXX";
+	if (mkdtemp(dir_template) == nullptr)
+	{
+		cerr << "Unable to create a temporary directory" << endl;
+		return 1;
+	}
+	string dir(dir_template);
+	string midi_file = dir + "/midi_bench.mid";
+
+	string file = "MThd";
+	writeBe(file, 6, 4);
+	writeBe(file, 1, 2);	// format 1
+	writeBe(file, 17, 2);
+	writeBe(file, division, 2);
+
+	string tempo;
+	writeVlq(tempo, 0);
+	tempo += string("\xFF\x51\x03", 3);
+	writeBe(tempo, 500000, 3);
+	addTrack(file, tempo);
+	for (uint8_t channel = 0; channel < 16; channel++)
+		addTrack(file, chords(channel));
+
+	ofstream out(midi_file, ios::binary);
+	out << file;
+	out.close();
+
+	MidiFile midi;
+	bool loaded = midi.load(midi_file);
+	unlink(midi_file.c_str());
+	rmdir(dir.c_str());
+	if (!loaded)
+		return 1;
+
+	Engine engine(48000, 1024);
+	MidiRenderer renderer(engine);
+	renderer.setPatch("adsr 5:100 100:70 sustain 300:0 once fm 95 105 { sinus 440 square 880:30 } sinus 5");
+	renderer.setVoices(8);
+
+	auto start = chrono::steady_clock::now();
+	double rendered = renderer.render(midi, "/dev/null");
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	if (rendered <= 0)
+		return 1;
+
+	cout << "Events         : " << midi.getEvents().size() << " on 16 channels" << endl;
+	cout << "Rendered       : " << rendered << "s in " << elapsed << "s" << endl;
+	cout << "Real time x    : " << rendered / elapsed << endl;
+	return 0;
+}
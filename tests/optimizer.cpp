@@ -0,0 +1,90 @@
+// Optimizes the patches of tests.sh (and a few more that the optimizer
+// rewrites), checks they sound exactly the same and compares their speed.
+// Optimized mono trees also compute only one channel.
+#include "helpers.hpp"
+
+static const char* patches[] =
+{
+	"mono { sinus 440 adsr 1:100 200:0 loop square 220 }",
+	"fm 100 100 { sinus 440 } sinus 3",
+	"am 0 100 low 800 square 220 level 75",
+	"am 0 100 triangle 330 level 100",
+	"left left { sinus 440 sinus 660 }",
+	"reverb 100:30 mono fm 50 100 sq 880:30 tri 5 asc",
+	"{ right left sinus 440 } sinus 220",
+	"reverb 100:30 high 200 low 2000 adsr 1:100 200:60 400:0 loop fm 90 110 square 220 sinus 5",
+};
+
+static const size_t samples = 48000 * 5;
+
+static size_t nodes(SoundGenerator* generator)
+{
+	vector<SoundGenerator*> all;
+	generator->collect(all);
+	return all.size();
+}
+
+int main(int argc, const char* argv[])
+{
+	vector<string> list(patches, patches + sizeof(patches) / sizeof(patches[0]));
+
+	// synth [ms] patch lines of tests.sh
+	ifstream script(argc > 1 ? argv[1] : "tests.sh");
+	string line;
+	while (getline(script, line))
+	{
+		stringstream words(line);
+		string word;
+		words >> word;
+		if (word != "synth")
+			continue;
+		streampos patch = words.tellg();
+		words >> word;
+		if (word.find_first_not_of("0123456789") != string::npos)
+			words.seekg(patch);
+		getline(words, line);
+		list.push_back(line);
+	}
+
+	Engine engine(48000);
+	ParseContext ctx(engine);
+	ctx.echo = false;
+	ctx.optimizing = false;
+
+	double raw_time = 0;
+	double opt_time = 0;
+	size_t raw_nodes = 0;
+	size_t opt_nodes = 0;
+	size_t errors = 0;
+	for (auto& patch : list)
+	{
+		SoundGenerator* raw = ctx.factory(patch);
+		SoundGenerator* optimized = ctx.optimize(ctx.factory(patch));
+		if (raw == nullptr || optimized == nullptr)
+		{
+			cerr << "Unable to build " << patch << endl;
+			return 1;
+		}
+		vector<sgfloat> expected, out;
+		double raw_patch = render(raw, samples, expected);
+		double opt_patch = render(optimized, samples, out);
+		raw_time += raw_patch;
+		opt_time += opt_patch;
+		raw_nodes += nodes(raw);
+		opt_nodes += nodes(optimized);
+		if (out != expected)
+		{
+			cerr << "Mismatch for " << patch << endl;
+			errors++;
+		}
+		else if (nodes(raw) != nodes(optimized) || optimized->mono())
+			cout << nodes(raw) << " -> " << nodes(optimized) << " nodes" << (optimized->mono() ? ", mono" : "")
+				<< ", x" << raw_patch / opt_patch << " : " << patch << endl;
+	}
+
+	cout << "Patches        : " << list.size() << ", " << errors << " mismatch" << endl;
+	cout << "Nodes          : " << raw_nodes << " -> " << opt_nodes << endl;
+	cout << "Before         : " << raw_time << 's' << endl;
+	cout << "After          : " << opt_time << "s (x" << raw_time / opt_time << ')' << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+// Builds thousands of patches concurrently (one ParseContext per thread)
+// and checks that they sound exactly like the same patches built serially.
+#include "helpers.hpp"
+
+static const char* patches[] =
+{
+	"sinus 440",
+	"am 0 100 sinus 220 square 5",
+	"tri 440:50",
+	"{ am 0 100 { fm 80 120 sq 440:25 tri 1 } sq 5 } { am 0 100 { fm 80 120 sq 330:25 tri 1 } square 6 } { fm 80 120 sinus 1200:30 sinus 3 }",
+	"fm 60 140 { fm 60 140 generator sinus 800 sinus 10 } sinus 1",
+	"fm 60 140 { fm 60 140 modulator sinus 800 sinus 10 } sinus 1",
+	"fm 60 140 { fm 60 140 both sinus 800 sinus 10 } sinus 1",
+	"envelope 10000 once data 0 100 75 50 25 0 end fm 60 140 { fm 60 140 modulator square 880 sinus 50 } sinus 10",
+	"left sinus 440",
+	"right triangle 440:50",
+	"adsr 1:100 200:50 400:50 450:0 500:0 loop { sinus 440 sinus 880:50 sinus 1320:25 }",
+	"reverb 1387:60 adsr 1:100 50:100 51:0 100:0 101:100 150:100 151:0 1000:0 loop triangle 440:90",
+	"echo 450:90 reverb 10:80 adsr 1:80 100:0 333:0 loop sinus 440:80",
+	"fm 100 150 am 0 100 square 100:20 square 39 adsr 1:0 1000:0 2000:100 5001:100 6000:-100 8000:0 loop level 1",
+	"reverb 100:30 fm 50 100 sq 880:30 tri 5 asc",
+	"define engine { fm 0 150 am 0 100 triangle 100:50 square 39 adsr 1:0 1000:0 2000:100 5001:400 6000:400 8000:-100 9000:0 loop level 1 } reverb 10:50 engine",
+	"mono { left sinus 440 right sinus 660 }",
+	"low 800 square 220",
+	"high 800 square 220",
+	"blep 220 0.3",
+	"clamp 50 sinus 440",
+	"avc 0.99 sinus 220",
+	"distorsion 50 sinus 200",
+	"chain ms 20 gen sinus 262 294 330 349 mix 5 loop",
+};
+
+static const size_t patches_count = sizeof(patches) / sizeof(patches[0]);
+static const size_t builds = 4000;
+static const size_t samples = 2000;
+
+static vector<sgfloat> build(Engine& engine, ParseContext& ctx, size_t i)
+{
+	SoundGenerator* generator = ctx.factory(patches[i % patches_count]);
+	if (generator == nullptr)
+	{
+		cerr << "Unable to build " << patches[i % patches_count] << endl;
+		exit(1);
+	}
+	vector<sgfloat> out = render(generator, samples);
+	delete generator;
+	return out;
+}
+
+int main()
+{
+	Engine engine(48000);
+	ParseContext serial(engine);
+	serial.echo = false;
+
+	vector<vector<sgfloat>> expected;
+	for (size_t i = 0; i < patches_count; i++)
+		expected.push_back(build(engine, serial, i));
+
+	unsigned threads_count = thread::hardware_concurrency();
+	if (threads_count < 4) threads_count = 4;
+
+	atomic<size_t> next(0);
+	atomic<size_t> errors(0);
+	vector<thread> threads;
+	for (unsigned t = 0; t < threads_count; t++)
+		threads.push_back(thread([&]
+		{
+			ParseContext ctx(engine);
+			ctx.echo = false;
+			size_t i;
+			while ((i = next++) < builds)
+			{
+				if (build(engine, ctx, i) != expected[i % patches_count])
+				{
+					cerr << "Mismatch for " << patches[i % patches_count] << endl;
+					errors++;
+				}
+			}
+		}));
+
+	for (auto& t : threads)
+		t.join();
+
+	cout << builds << " patches built on " << threads_count << " threads, " << errors << " mismatch(es)" << endl;
+	return errors ? 1 : 0;
+}
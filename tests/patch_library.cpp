@@ -0,0 +1,142 @@
+// Lazy patch library : a directory of many patches is indexed without being
+// parsed, patches used are parsed once (with the defines they depend on) and
+// their prototypes kept in a memory bounded cache. Checks the instances sound
+// like the parsed patches and reports the cache behaviour.
+#include "helpers.hpp"
+#include <unistd.h>
+
+static const int patches = 2000;
+static const int working_set = 40;
+static const int rounds = 25;
+static const size_t samples = 4800;
+
+static string patchName(int i)
+{
+	return "p" + to_string(i);
+}
+
+// common.synth defines sounds used by half of the patches, every tenth
+// patch uses blep (no compiled version, kept as text)
+static void writeLibrary(const string& dir)
+{
+	ofstream(dir + "/common.synth") << "define wobble { sinus 3 }" << endl
+		<< "define pad { am 50 100 sinus 220 wobble }" << endl;
+	for (int i = 0; i < patches; i++)
+	{
+		ofstream out(dir + '/' + patchName(i) + ".synth");
+		out << "# patch " << i << endl;
+		if (i % 10 == 0)
+			out << "am 0 100 blep " << 100 + i << " 0.5 wobble" << endl;
+		else if (i % 2)
+			out << "{ pad am 0 100 sinus " << 100 + i << " wobble }" << endl;
+		else
+			out << "low 2000 fm 90 110 square " << 100 + i << " sinus 5" << endl;
+	}
+}
+
+static void removeLibrary(const string& dir)
+{
+	unlink((dir + "/common.synth").c_str());
+	for (int i = 0; i < patches; i++)
+		unlink((dir + '/' + patchName(i) + ".synth").c_str());
+	rmdir(dir.c_str());
+}
+
+int main()
+{
+	char dir_template[] = "/tmp/patch_library_XXXXXX";
+	if (mkdtemp(dir_template) == nullptr)
+	{
+		cerr << "Unable to create a temporary directory" << endl;
+		return 1;
+	}
+	string dir(dir_template);
+	writeLibrary(dir);
+
+	Engine engine(48000);
+	size_t errors = 0;
+	{
+		PatchLibrary library(engine);
+		auto start = chrono::steady_clock::now();
+		size_t count = library.index(dir);
+		double index_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (count != patches + 1 || library.dependencies("p1") != vector<string>(1, "common")
+			|| library.dependencies("p2").size())
+		{
+			cerr << "Bad index (" << count << " patches)" << endl;
+			errors++;
+		}
+
+		// Same sound as parsing the file
+		for (int i = 0; i < working_set; i++)
+		{
+			SoundGenerator* built = library.build(patchName(i));
+			ParseContext ctx(engine);
+			ctx.echo = false;
+			SoundGenerator* parsed = ctx.optimize(ctx.factory(dir + '/' + patchName(i) + ".synth"));
+			if (built == nullptr || parsed == nullptr || render(built, samples) != render(parsed, samples))
+			{
+				cerr << "Mismatch for " << patchName(i) << endl;
+				errors++;
+			}
+			if (built)
+				ctx.drop(built);
+			if (parsed)
+				ctx.drop(parsed);
+		}
+
+		start = chrono::steady_clock::now();
+		ParseContext ctx(engine);
+		for (int round = 0; round < rounds; round++)
+			for (int i = 0; i < working_set; i++)
+				ctx.drop(library.build(patchName(i)));
+		double build_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		PatchLibrary::Stats stats = library.stats();
+		if (stats.misses != working_set || stats.evictions)
+			errors++;
+		cout << "Index          : " << count << " patches in " << index_time * 1e3 << "ms" << endl;
+		cout << "Parse          : " << stats.prototypes << " prototypes, " << stats.bytes << " bytes, "
+			<< stats.parse_time * 1e6 / stats.misses << "us per prototype" << endl;
+		cout << "Build          : " << build_time * 1e6 / (rounds * working_set) << "us per instance, hit rate "
+			<< stats.hitRate() * 100 << '%' << endl;
+	}
+	{
+		// A few prototypes only fit, the least recently used go
+		PatchLibrary library(engine, 1024);
+		library.index(dir);
+		ParseContext ctx(engine);
+		for (int round = 0; round < 3; round++)
+			for (int i = 0; i < working_set; i++)
+				ctx.drop(library.build(patchName(i)));
+		PatchLibrary::Stats stats = library.stats();
+		if (stats.evictions == 0 || (stats.bytes > 1024 && stats.prototypes > 1))
+		{
+			cerr << "Cache above its budget (" << stats.bytes << " bytes)" << endl;
+			errors++;
+		}
+		cout << "Small cache    : " << stats.prototypes << " prototypes, " << stats.evictions << " evictions" << endl;
+	}
+	{
+		// Prefetched patches are hits
+		PatchLibrary library(engine);
+		library.index(dir);
+		vector<string> names;
+		for (int i = 0; i < working_set; i++)
+			names.push_back(patchName(patches - 1 - i));
+		library.prefetch(names);
+		for (int wait = 0; library.stats().prototypes < names.size() && wait < 5000; wait++)
+			usleep(1000);
+		ParseContext ctx(engine);
+		for (auto& name : names)
+			ctx.drop(library.build(name));
+		PatchLibrary::Stats stats = library.stats();
+		if (stats.misses)
+			errors++;
+		cout << "Prefetch       : " << stats.hits << " hits, " << stats.misses << " misses" << endl;
+	}
+
+	removeLibrary(dir);
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
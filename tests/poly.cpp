@@ -0,0 +1,105 @@
+// Poly voices : a note off releases the adsr of its own voice, finished voices
+// are reused, and once every voice plays the oldest or the quietest one is
+// stolen, released voices first. Voices in simd lanes and scalar voices
+// behave the same.
+// The voices are constant levels : the output is the sum of their velocities.
+#include "helpers.hpp"
+
+static const char* held = "adsr 1:100 sustain 1000:0 once level 100";	// 999ms release
+
+// Left output of the last of frames
+static sgfloat play(PolySound* poly, size_t frames)
+{
+	sgfloat left = 0, right = 0;
+	for (size_t i = 0; i < frames; i++)
+	{
+		left = right = 0;
+		poly->next(left, right);
+	}
+	return left;
+}
+
+static bool near(sgfloat value, sgfloat expected)
+{
+	return fabs(value - expected) < 0.01;
+}
+
+int main()
+{
+	Engine engine(48000);
+	size_t errors = 0;
+	const size_t ms = 48;
+
+	for (string mode : { "", "scalar " })
+	{
+		// The oldest voice is stolen (220), or the quietest (330)
+		for (string policy : { "oldest", "quietest" })
+		{
+			PolySound* poly = dynamic_cast<PolySound*>(engine.factory("poly 2 " + policy + ' ' + mode + "level 100"));
+			poly->noteOn(220, 0.4);
+			poly->noteOn(330, 0.1);
+			sgfloat both = play(poly, 1);
+			poly->noteOn(440, 0.2);
+			sgfloat stolen = play(poly, 1);
+			sgfloat expected = policy == "oldest" ? 0.3 : 0.6;
+			if (!near(both, 0.5) || !near(stolen, expected) || poly->activeVoices() != 2)
+			{
+				cerr << mode << policy << " : " << stolen << " instead of " << expected << " once stolen" << endl;
+				errors++;
+			}
+			delete poly;
+		}
+
+		// A released voice is stolen before the oldest one
+		{
+			PolySound* poly = dynamic_cast<PolySound*>(engine.factory("poly 2 oldest " + mode + held));
+			poly->noteOn(220, 0.4);
+			poly->noteOn(330, 0.1);
+			play(poly, 10 * ms);
+			poly->noteOff(330);
+			play(poly, 1);
+			poly->noteOn(440, 0.2);
+			sgfloat stolen = play(poly, 10 * ms);
+			if (!near(stolen, 0.6))
+			{
+				cerr << mode << "released voice not stolen first (" << stolen << ")" << endl;
+				errors++;
+			}
+			delete poly;
+		}
+
+		// A note off releases its voice only, a finished voice is reused
+		{
+			PolySound* poly = dynamic_cast<PolySound*>(engine.factory("poly 2 " + mode + held));
+			poly->noteOn(220, 1);
+			poly->noteOn(330, 0.5);
+			sgfloat sustained = play(poly, 10 * ms);
+			poly->noteOff(330);
+			poly->noteOff(440);		// not playing
+			sgfloat releasing = play(poly, 500 * ms);
+			sgfloat released = play(poly, 600 * ms);
+			uint16_t after_release = poly->activeVoices();
+			if (!near(sustained, 1.5) || !near(releasing, 1.25) || !near(released, 1) || after_release != 1)
+			{
+				cerr << mode << "wrong release : " << sustained << ", " << releasing << ", " << released
+					<< " with " << after_release << " voice(s)" << endl;
+				errors++;
+			}
+
+			poly->allNotesOff();
+			sgfloat silent = play(poly, 1100 * ms);
+			uint16_t after_all = poly->activeVoices();
+			poly->noteOn(550, 0.3);
+			sgfloat reused = play(poly, 10 * ms);
+			if (!near(silent, 0) || after_all != 0 || !near(reused, 0.3) || poly->activeVoices() != 1)
+			{
+				cerr << mode << "voices not reused : " << silent << ", " << reused << endl;
+				errors++;
+			}
+			delete poly;
+		}
+	}
+
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+// Plays the same notes on poly instruments running their voices in simd
+// lanes and in scalar mode, checks that they sound the same and compares speed.
+#include <libsynth.hpp>
+
+static const char* patches[] =
+{
+	"sinus 440",
+	"square 440:50",
+	"adsr 5:100 100:60 sustain 300:0 once sinus 440",
+	"adsr 1:100 50:0 100:100 150:0 loop { sinus 440 sinus 880:50 square 1320:25 }",
+	"adsr 10:100 sustain 200:0 once fm 90 110 sinus 440 sinus 6",
+	"adsr 10:100 200:0 once fm 90 110 modulator sinus 440 sinus 6",
+	"adsr 10:100 sustain 500:0 once low 2000 square 440",
+	"adsr 10:100 sustain 500:0 once high 300 am 0 100 square 440 sinus 3",
+	"am 50 150 sinus 440 level 75",
+};
+
+static const size_t patches_count = sizeof(patches) / sizeof(patches[0]);
+static const uint32_t samples = 48000;
+
+static double play(PolySound* poly, vector<sgfloat>& out)
+{
+	static const sgfloat notes[] = { 261.6, 329.6, 392.0, 493.9, 587.3, 130.8, 196.0, 440.0, 880.0, 110.0 };
+	out.clear();
+	auto start = chrono::steady_clock::now();
+	for (uint32_t i = 0; i < samples; i++)
+	{
+		if (i % 2400 == 0)
+		{
+			uint32_t n = i / 2400;
+			poly->noteOn(notes[n % 10], 0.5 + (n % 3) * 0.25);
+			if (n >= 3)
+				poly->noteOff(notes[(n - 3) % 10]);
+		}
+		sgfloat left = 0, right = 0;
+		poly->next(left, right);
+		out.push_back(left);
+		out.push_back(right);
+	}
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+	Engine engine(48000);
+	ParseContext ctx(engine);
+	int errors = 0;
+	double wide_time = 0;
+	double scalar_time = 0;
+
+	for (size_t i = 0; i < patches_count; i++)
+	{
+		string patch(patches[i]);
+		PolySound* wide = dynamic_cast<PolySound*>(ctx.factory("poly 16 " + patch));
+		PolySound* scalar = dynamic_cast<PolySound*>(ctx.factory("poly 16 scalar " + patch));
+		if (wide == nullptr || scalar == nullptr || !wide->isWide() || scalar->isWide())
+		{
+			cerr << "Unable to build wide and scalar poly for " << patch << endl;
+			return 1;
+		}
+
+		vector<sgfloat> wide_out;
+		vector<sgfloat> scalar_out;
+		wide_time += play(wide, wide_out);
+		scalar_time += play(scalar, scalar_out);
+
+		sgfloat diff = 0;
+		for (size_t s = 0; s < wide_out.size(); s++)
+			diff = max(diff, fabs(wide_out[s] - scalar_out[s]));
+		if (diff > 1e-3)
+		{
+			cerr << "Mismatch (" << diff << ") for " << patch << endl;
+			errors++;
+		}
+		delete wide;
+		delete scalar;
+	}
+
+	cout << "Patches        : " << patches_count << ", " << errors << " mismatch" << endl;
+	cout << "Scalar         : " << scalar_time << "s" << endl;
+	cout << "Wide           : " << wide_time << "s (x" << scalar_time / wide_time << ")" << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+// Per node profiler : the stats tree follows the played trees (names from
+// SoundGenerator::name), self and inclusive cycles add up, allocations are
+// given to the node doing them (-DSYNTH_PROFILE_ALLOCATIONS=ON builds), and the
+// output is the same with or without profiling. Also reports the cost of the
+// profiling mode.
+#include "helpers.hpp"
+
+static const uint32_t block = 512;
+static const char* patch = "reverb 30:30 am 0 100 low 2000 square 220 sinus 3";
+
+// Allocates at each frame (as a generator should not)
+class Allocating : public SoundGenerator
+{
+  public:
+	Allocating(ParseContext& ctx) : SoundGenerator(ctx)
+	{
+		name = "allocating";
+	}
+
+	virtual void next(sgfloat& left, sgfloat& right, sgfloat speed = 1.0) override
+	{
+		vector<sgfloat> buffer(16, 0.1f);
+		left += buffer[0];
+		right += buffer[1];
+	}
+
+  protected:
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return nullptr;
+	}
+};
+
+// Structure of stats like the tree, self below inclusive, inputs inside
+static bool consistent(const NodeStats& stats, SoundGenerator* node, string& error)
+{
+	vector<SoundGenerator**> children;
+	node->inputs(children);
+	if (stats.name != node->name || stats.inputs.size() != children.size() || stats.self > stats.inclusive)
+	{
+		error = stats.name + " / " + node->name;
+		return false;
+	}
+	uint64_t inputs = 0;
+	for (size_t i = 0; i < children.size(); i++)
+	{
+		SoundGenerator* child = *children[i];
+		if (ProfiledSound* profiled = dynamic_cast<ProfiledSound*>(child))
+			child = profiled->generator;
+		if (!consistent(stats.inputs[i], child, error))
+			return false;
+		inputs += stats.inputs[i].inclusive;
+	}
+	if (stats.self + inputs > stats.inclusive + stats.inclusive / 100)
+	{
+		error = "self and inputs above inclusive for " + stats.name;
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	size_t errors = 0;
+	const int blocks = 200;
+	double plain_time, profiled_time, disabled_time;
+
+	Engine* plain = offlineEngine(block);
+	plain->play(plain->factory(patch));
+	vector<int16_t> expected = renderBlocks(*plain, blocks, plain_time);
+	delete plain;
+
+	Engine* engine = offlineEngine(block);
+	engine->setProfiling(true);
+	SoundGenerator* sound = engine->factory(patch);
+	engine->play(sound);
+	if (renderBlocks(*engine, blocks, profiled_time) != expected)
+	{
+		cerr << "Profiled output differs" << endl;
+		errors++;
+	}
+
+	NodeStats stats = engine->stats();
+	vector<SoundGenerator*> nodes;
+	sound->collect(nodes);
+	string error;
+	if (stats.name != "engine" || stats.calls != blocks || stats.inputs.size() != 1
+		|| stats.inputs[0].calls != blocks * block || stats.inputs[0].allocations)
+	{
+		cerr << "Bad engine stats (" << stats.calls << " renders)" << endl;
+		errors++;
+	}
+	else if (!consistent(stats.inputs[0], sound, error))
+	{
+		cerr << "Stats tree differs from the sound (" << error << ')' << endl;
+		errors++;
+	}
+	else
+	{
+		// Half of the nodes are the profiled ones
+		cout << "Profiled       : " << nodes.size() / 2 << " nodes, " << stats.inclusive / blocks << " cycles per render" << endl;
+		const NodeStats& root = stats.inputs[0];
+		cout << "  " << root.name << " : self " << root.self / blocks << ", inclusive " << root.inclusive / blocks << endl;
+	}
+
+	// Allocations are given to the sound doing them
+	ParseContext ctx(*engine);
+	Allocating* allocating = new Allocating(ctx);
+	Engine::Handle handle = engine->play(allocating);
+	renderBlocks(*engine, 10, disabled_time);
+	stats = engine->stats();
+	uint64_t allocations = NodeProfile::countsAllocations() ? 10 * block : 0;
+	if (stats.inputs.size() != 2 || stats.inputs[1].allocations != allocations || stats.inputs[0].allocations)
+	{
+		cerr << "Allocations not found" << endl;
+		errors++;
+	}
+	engine->remove(handle);
+	delete allocating;
+
+	// Disabled : no measure left in the tree, same output
+	engine->setProfiling(false);
+	nodes.clear();
+	sound->collect(nodes);
+	for (auto node : nodes)
+		if (dynamic_cast<ProfiledSound*>(node))
+		{
+			cerr << "Profiled node left in the tree" << endl;
+			errors++;
+			break;
+		}
+	engine->remove(sound);
+	ctx.drop(sound);
+	delete engine;
+	engine = offlineEngine(block);
+	engine->setProfiling(true);
+	engine->setProfiling(false);
+	engine->play(engine->factory(patch));
+	if (renderBlocks(*engine, blocks, disabled_time) != expected)
+	{
+		cerr << "Output differs once disabled" << endl;
+		errors++;
+	}
+	delete engine;
+
+	cout << "Not profiled   : " << plain_time * 1e3 << "ms" << endl;
+	cout << "Profiling      : " << profiled_time * 1e3 << "ms (x" << profiled_time / plain_time << ')' << endl;
+	cout << "Disabled       : " << disabled_time * 1e3 << "ms" << endl;
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,119 @@
+// Crossfade replace : a playing sound is replaced by another one while an
+// other sound plays. Checks the crossfade gains sample by sample, that the
+// mix keeps its sound count, and that replaced trees are collected.
+#include "helpers.hpp"
+
+static const uint32_t block = 256;
+
+int main()
+{
+	Engine* engine = offlineEngine(block);
+	engine->setLimiter(nullptr);		// exact gains
+	size_t errors = 0;
+
+	// From 0 to 1 (level 50 to level 100) in 10ms : the gain is sin(pi/2 t) for 480 frames
+	SoundGenerator* off = engine->factory("level 50");
+	SoundGenerator* on = engine->factory("level 100");
+	Engine::Handle handle = engine->play(off);
+	renderBlocks(*engine, 1);
+	if (!engine->replace(off, on, 10))
+		errors++;
+	vector<int16_t> stream = renderBlocks(*engine, 4);
+	const uint32_t frames = 480;
+	double deviation = 0;
+	for (uint32_t i = 0; i < stream.size() / 2; i++)
+	{
+		double expected = i < frames ? 32767 * sin(M_PI_2 * i / frames) : 32767;
+		deviation = max(deviation, fabs(stream[2 * i] - expected));
+		deviation = max(deviation, fabs(stream[2 * i + 1] - expected));
+	}
+	if (deviation > 1 || engine->get(handle) != on || engine->has(off))
+	{
+		cerr << "Wrong crossfade (deviation " << deviation << ')' << endl;
+		errors++;
+	}
+	cout << "Crossfade      : " << frames << " frames, deviation " << deviation << endl;
+	engine->remove(handle);
+	size_t collected = engine->collect();
+
+	// idle -> revving, the other sound keeps its level (no count change)
+	SoundGenerator* music = engine->factory("sinus 330:30");
+	SoundGenerator* idle = engine->factory("am 0 100 triangle 110:30 sinus 5");
+	engine->play(music);
+	Engine::Handle engine_loop = engine->play(idle);
+	renderBlocks(*engine, 4);
+	SoundGenerator* revving = engine->factory("am 0 100 triangle 220:30 sinus 12");
+	engine->replace(idle, revving, 30);
+	for (int i = 0; i < 10; i++)
+	{
+		renderBlocks(*engine, 1);
+		if (engine->count() != 2)
+			errors++;
+	}
+	collected += engine->collect();
+
+	// Replacing a sound not playing anymore drops the new one
+	SoundGenerator* gone = engine->factory("sinus 100");
+	engine->remove(engine->play(gone));
+	engine->replace(gone, engine->factory("sinus 200"), 30);
+	renderBlocks(*engine, 1);
+	collected += engine->collect();
+	delete gone;
+
+	// Replaced twice before a render : the second one finds the first one playing
+	SoundGenerator* twice = engine->factory("sinus 300");
+	SoundGenerator* first = engine->factory("sinus 400");
+	Engine::Handle handle_twice = engine->play(twice);
+	engine->replace(twice, first, 0);
+	engine->replace(twice, engine->factory("sinus 500"), 0);
+	renderBlocks(*engine, 1);
+	collected += engine->collect();
+	if (engine->get(handle_twice) != first)
+		errors++;
+	engine->remove(handle_twice);
+	delete first;
+
+	if (collected != 5 || !engine->has(revving) || engine->count() != 2)
+	{
+		cerr << "Collected " << collected << " trees out of 5" << endl;
+		errors++;
+	}
+	cout << "Replace        : " << engine->count() << " sounds, " << collected << " trees collected" << endl;
+
+	// Concurrent requests while rendering
+	const int requests = 2000;
+	atomic<int> done(0);
+	SoundGenerator* current = revving;
+	thread player([&engine, &current, &done]
+	{
+		for (int i = 0; i < requests; i++)
+		{
+			SoundGenerator* next = engine->factory("sinus " + to_string(100 + i % 500));
+			while (!engine->replace(current, next, 2))
+			{
+				engine->collect();		// room for the replaced trees
+				this_thread::yield();
+			}
+			current = next;
+			done++;
+		}
+	});
+	while (done < requests)
+		renderBlocks(*engine, 1);
+	player.join();
+	for (int i = 0; i < 4; i++)		// pending requests, waiting for room in the retired trees
+	{
+		engine->collect();
+		renderBlocks(*engine, 1);
+	}
+	if (engine->get(engine_loop) != current || engine->count() != 2)
+	{
+		cerr << "Concurrent replace failed" << endl;
+		errors++;
+	}
+	cout << "Concurrent     : " << requests << " replaces" << endl;
+	delete engine;
+
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,182 @@
+// Real-time safety : every registered generator type is rendered by the
+// engine under the checker (build with -DSYNTH_RT_CHECK=ON), none may
+// allocate, lock, start threads, write or sleep while rendering.
+#include "helpers.hpp"
+
+static const uint32_t block = 512;
+static const int blocks = 100;		// more than the oscilloscope buffer
+
+// A patch for each type, "bus" is a bus effect
+static map<string, string> examples =
+{
+	{ "adsr", "adsr 1:0 50:100 100:0 loop sinus 440" },
+	{ "am", "am 0 100 sq 220 sin 10" },
+	{ "avc", "avc 0.7 sinus 440" },
+	{ "blep", "blep 440 0.5" },
+	{ "bus", "reverb 10:50 low 4000 bus" },
+	{ "chain", "chain ms 20 gen sinus 440 550 660 loop" },
+	{ "clamp", "clamp 50 am 50 150 wnoise tri 2" },
+	{ "distorsion", "distorsion 50 sinus 200" },
+	{ "echo", "echo 20:50 sinus 440" },
+	{ "env", "env 500 loop data 0 100 50 0 end sinus 440" },
+	{ "envelope", "envelope 500 once data 0 100 50 0 end sinus 440" },
+	{ "fm", "fm 80 120 sq 220 sin 10" },
+	{ "freeze", "freeze 0.05 xfade 5 am 0 100 sinus 440 sinus 3" },
+	{ "high", "high 200 wnoise" },
+	{ "left", "left { sinus 440 sinus 660 }" },
+	{ "level", "am 0 100 sinus 440 level 75" },
+	{ "low", "low 2000 square 220" },
+	{ "mono", "mono { sinus 440 square 220 }" },
+	{ "oscillo", "oscillo sinus 440" },
+	{ "poly", "poly 4 adsr 10:100 200:60 sustain 600:0 once sinus 440" },
+	{ "reso", "reso 0.5 0.5 square 220" },
+	{ "reverb", "reverb 30:30 sinus 440" },
+	{ "right", "right { sinus 440 sinus 660 }" },
+	{ "sin", "sin 440" },
+	{ "sinus", "sinus 440:50" },
+	{ "sq", "sq 220" },
+	{ "square", "square 220:50" },
+	{ "tri", "tri 330 asc" },
+	{ "triangle", "triangle 330:50" },
+	{ "wnoise", "wnoise" },
+	{ "{", "{ sinus 440 square 220 }" },
+};
+
+// Allocates at each frame (as a generator should not)
+class Allocating : public SoundGenerator
+{
+  public:
+	Allocating(ParseContext& ctx) : SoundGenerator(ctx)
+	{
+		name = "allocating";
+	}
+
+	virtual void next(sgfloat& left, sgfloat& right, sgfloat speed = 1.0) override
+	{
+		vector<sgfloat> buffer(16, 0.1f);
+		left += buffer[0];
+	}
+
+  protected:
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return nullptr;
+	}
+};
+
+static Engine* checkedEngine()
+{
+	Engine* engine = offlineEngine(block);
+	engine->getParser().optimizing = false;		// the type asked is the one rendered
+	return engine;
+}
+
+int main()
+{
+	size_t errors = 0;
+	setenv("SDL_VIDEODRIVER", "dummy", 0);	// oscilloscope window
+
+	if (!RtCheck::enabled())
+	{
+		cerr << "Built without SYNTH_RT_CHECK" << endl;
+		return 1;
+	}
+
+	// The checker finds an allocating sound
+	{
+		Engine* engine = checkedEngine();
+		ParseContext ctx(*engine);
+		Allocating* allocating = new Allocating(ctx);
+		engine->play(allocating);
+		processBlocks(*engine, blocks);
+		engine->remove(allocating);
+		vector<RtCheck::Violation> found = RtCheck::violations();
+		bool seen = false;
+		for (auto& violation : found)
+			seen |= violation.call == "malloc" && violation.generator == "allocating"
+				&& violation.count >= blocks * block && violation.stack.size();
+		if (!seen)
+		{
+			cerr << "Allocations not reported" << endl;
+			errors++;
+		}
+		RtCheck::clear();
+		delete allocating;
+		delete engine;
+	}
+
+	// Traced bus created once voices play (its node times are reserved)
+	{
+		Engine* engine = checkedEngine();
+		engine->setTracing(4096, 1);
+		for (int i = 0; i < 5; i++)
+			engine->play(engine->factory("sinus 440"));
+		Engine::Bus sfx = engine->bus("sfx");
+		for (int i = 0; i < 2; i++)
+			engine->play(engine->factory("square 220"), sfx);
+		processBlocks(*engine, blocks);
+		engine->quit();
+		delete engine;
+		if (RtCheck::violations().size())
+		{
+			cerr << "Traced bus is not real-time safe :" << endl;
+			RtCheck::print(cerr);
+			errors++;
+		}
+		RtCheck::clear();
+	}
+
+	stringstream types(SoundGenerator::getTypes());
+	string type;
+	size_t checked = 0;
+	while (types >> type)
+	{
+		auto example = examples.find(type);
+		if (example == examples.end())
+		{
+			cerr << "No patch to check " << type << endl;
+			errors++;
+			continue;
+		}
+
+		Engine* engine = checkedEngine();
+		SoundGenerator* sound = nullptr;
+		if (type == "bus")
+		{
+			if (!engine->setBusEffect(0, example->second))
+				errors++;
+			engine->play(engine->factory("sinus 440"));
+		}
+		else
+		{
+			sound = engine->factory(example->second);
+			if (sound == nullptr)
+			{
+				cerr << "Unable to build " << example->second << endl;
+				errors++;
+				delete engine;
+				continue;
+			}
+			engine->play(sound);
+			if (PolySound* poly = dynamic_cast<PolySound*>(sound))
+				poly->noteOn(440);
+		}
+		processBlocks(*engine, blocks);
+		engine->quit();
+		delete engine;
+
+		vector<RtCheck::Violation> found = RtCheck::violations();
+		if (found.size())
+		{
+			cerr << type << " (" << example->second << ") is not real-time safe :" << endl;
+			RtCheck::print(cerr);
+			errors++;
+		}
+		RtCheck::clear();
+		checked++;
+	}
+
+	cout << "Checked        : " << checked << " types" << endl;
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
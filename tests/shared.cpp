@@ -0,0 +1,161 @@
+// Shared sounds : the users of a shared sound hear it in phase, as if each
+// one had its own copy, in one tree or on buses rendered by bus threads, and
+// a user coming later joins the others. The shared tree is deleted once
+// redefined and unused, or with its engine. Also compares the speed of 4
+// voices modulated by a shared lfo and by their own copies.
+#include "helpers.hpp"
+
+static const size_t frames = 48000;
+static const char* lfo = "{ sinus 3 triangle 5 am 0 100 sinus 2 sinus 0.5 }";	// 6 nodes
+
+// Counts the nodes alive
+class Counted : public SoundGenerator
+{
+  public:
+	static int alive;
+
+	Counted(ParseContext& ctx, SoundGenerator* input = nullptr) : SoundGenerator(ctx), input(input)
+	{
+		name = "counted";
+		alive++;
+	}
+
+	virtual ~Counted()
+	{
+		alive--;
+	}
+
+	virtual void next(sgfloat& left, sgfloat& right, sgfloat speed = 1.0) override
+	{
+		if (input)
+			input->next(left, right, speed);
+	}
+
+	virtual void inputs(vector<SoundGenerator**>& in) override
+	{
+		in.push_back(&input);
+	}
+
+  protected:
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return nullptr;
+	}
+
+  private:
+	SoundGenerator* input;
+};
+
+int Counted::alive = 0;
+
+// Voices modulated by name (shared) or by the lfo itself
+static string voices(const string& name, int count)
+{
+	string patch = "{ ";
+	for (int i = 0; i < count; i++)
+		patch += "am 50 100 sinus " + to_string(220 + 110 * i) + ' ' + name + ' ';
+	return patch + '}';
+}
+
+int main()
+{
+	Engine engine(48000);
+	size_t errors = 0;
+
+	// In one tree, the same output as copies
+	double shared_time, copies_time;
+	{
+		vector<sgfloat> shared, copies;
+		SoundGenerator* with_shared = engine.factory(string("shared lfo ") + lfo + ' ' + voices("lfo", 4));
+		SoundGenerator* with_copies = engine.factory(voices(lfo, 4));
+		shared_time = render(with_shared, frames, shared);
+		copies_time = render(with_copies, frames, copies);
+		if (shared != copies)
+		{
+			cerr << "Shared lfo differs from its copies" << endl;
+			errors++;
+		}
+		delete with_shared;
+		delete with_copies;
+	}
+
+	// Users on buses rendered by bus threads
+	{
+		vector<int16_t> streams[2];
+		for (int shared = 0; shared < 2; shared++)
+		{
+			Engine* mix = offlineEngine(256);
+			mix->setBusThreads(2);
+			mix->setLimiter(nullptr);
+			string name = shared ? "bus_lfo" : lfo;
+			if (shared)
+				mix->factory(string("shared bus_lfo ") + lfo);
+			mix->play(mix->factory("am 50 100 sinus 440 " + name), mix->bus("music"));
+			mix->play(mix->factory("am 50 100 sinus 660 " + name), mix->bus("sfx"));
+			streams[shared] = renderBlocks(*mix, 100);
+			delete mix;
+		}
+		if (streams[0] != streams[1])
+		{
+			cerr << "Shared lfo out of phase between buses" << endl;
+			errors++;
+		}
+	}
+
+	// A user built later joins the most advanced one
+	{
+		engine.factory("shared late sinus 3");
+		SoundGenerator* first = engine.factory("late");
+		SoundGenerator* second = engine.factory("late");
+		sgfloat left = 0, right = 0;
+		for (size_t i = 0; i < frames; i++)
+		{
+			left = right = 0;
+			first->next(left, right);
+		}
+		sgfloat joined = 0;
+		second->next(joined, right);
+		size_t apart = joined == left ? 0 : 1;
+		for (size_t i = 0; i < frames; i++)
+		{
+			sgfloat l1 = 0, l2 = 0;
+			first->next(l1, right);
+			second->next(l2, right);
+			if (l1 != l2)
+				apart++;
+		}
+		if (apart)
+		{
+			cerr << "Late user out of phase (" << apart << " frames)" << endl;
+			errors++;
+		}
+		delete first;
+		delete second;
+	}
+
+	// Shared trees deleted
+	{
+		ParseContext ctx(engine);
+		engine.share("counted", new Counted(ctx, new Counted(ctx)));
+		SoundGenerator* user = engine.factory("counted");
+		engine.share("counted", new Counted(ctx));		// the user keeps the first one
+		int used = Counted::alive;
+		delete user;
+		int redefined = Counted::alive;
+
+		Engine* other = new Engine(48000);
+		ParseContext other_ctx(*other);
+		other->share("counted", new Counted(other_ctx, new Counted(other_ctx)));
+		delete other;
+		if (used != 3 || redefined != 1 || Counted::alive != 1)
+		{
+			cerr << "Shared trees leaked (" << used << ", " << redefined << ", " << Counted::alive << " nodes)" << endl;
+			errors++;
+		}
+	}
+
+	cout << "Copies         : " << copies_time << "s" << endl;
+	cout << "Shared lfo     : " << shared_time << "s (x" << copies_time / shared_time << ')' << endl;
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,81 @@
+// Startup time of a patch library : parsing .synth files against building
+// the same patches from a compiled .synthc file (PatchReader), which must
+// sound exactly the same.
+#include "helpers.hpp"
+
+static const int loads = 200;
+static const size_t samples = 48000;
+
+static string patchName(const string& file)
+{
+	string name = file.substr(file.find_last_of('/') + 1);
+	return name.substr(0, name.find('.'));
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 2)
+	{
+		cerr << "Syntax : synthc_bench patch.synth [...]" << endl;
+		return 1;
+	}
+	vector<string> files(argv + 1, argv + argc);
+	const string compiled("synthc_bench.synthc");
+
+	Engine engine(48000);
+	ParseContext ctx(engine);
+	ctx.echo = false;
+
+	PatchWriter writer(engine.samplesPerSeconds());
+	for (auto& file : files)
+	{
+		SoundGenerator* generator = ctx.factory(file);
+		if (generator == nullptr || !writer.add(patchName(file), generator))
+		{
+			cerr << "Unable to compile " << file << endl;
+			return 1;
+		}
+		ctx.drop(generator);
+	}
+	if (!writer.save(compiled))
+		return 1;
+
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < loads; i++)
+		for (auto& file : files)
+			ctx.drop(ctx.factory(file));
+	double parse_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	start = chrono::steady_clock::now();
+	for (int i = 0; i < loads; i++)
+	{
+		PatchReader reader;
+		if (!reader.open(compiled))
+			return 1;
+		for (auto& name : reader.names())
+			ctx.drop(reader.build(name, ctx));
+	}
+	double load_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	size_t errors = 0;
+	PatchReader reader;
+	reader.open(compiled);
+	for (auto& file : files)
+	{
+		SoundGenerator* parsed = ctx.factory(file);
+		SoundGenerator* loaded = reader.build(patchName(file), ctx);
+		if (loaded == nullptr || render(parsed, samples) != render(loaded, samples))
+		{
+			cerr << "Mismatch for " << file << endl;
+			errors++;
+		}
+		ctx.drop(parsed);
+		if (loaded)
+			ctx.drop(loaded);
+	}
+
+	cout << "Patches        : " << files.size() << ", " << errors << " mismatch" << endl;
+	cout << "Parse          : " << parse_time * 1e6 / loads << "us per library" << endl;
+	cout << "Load .synthc   : " << load_time * 1e6 / loads << "us per library (x" << parse_time / load_time << ')' << endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+// Callback timing : percentiles of known durations, deadline misses of a
+// sound too slow for some buffers, underruns of a render ahead queue that
+// can not keep up. Also reports the cost of recording a callback.
+#include <libsynth.hpp>
+
+static const uint32_t block = 256;
+
+// Takes ms milliseconds once every period buffers
+class Slow : public SoundGenerator
+{
+  public:
+	Slow(ParseContext& ctx, uint32_t ms, uint32_t period) : SoundGenerator(ctx), ms(ms), period(period * block) { }
+
+	virtual void next(sgfloat& left, sgfloat& right, sgfloat speed = 1.0) override
+	{
+		if (frame++ % period == 0)
+			this_thread::sleep_for(chrono::milliseconds(ms));
+	}
+
+  protected:
+	virtual SoundGenerator* build(istream& in, ParseContext& ctx) const override
+	{
+		return nullptr;
+	}
+
+	uint32_t ms;
+	uint32_t period;
+	uint64_t frame = 0;
+};
+
+static bool near(double value, double expected)
+{
+	return fabs(value - expected) <= 0.06 * expected;
+}
+
+int main()
+{
+	size_t errors = 0;
+
+	// 1ms to 10ms against a 10ms budget, then 3 misses
+	{
+		CallbackTiming timing;
+		timing.setBudget(0.01);
+		for (int i = 1; i <= 1000; i++)
+			timing.rendered(i * 10000);
+		CallbackTiming::Report report = timing.read();
+		if (!near(report.p50, 0.005) || !near(report.p90, 0.009) || !near(report.p99, 0.0099)
+			|| report.max != 0.01 || report.misses || !near(report.load(), 0.5))
+		{
+			cerr << "Wrong percentiles : p50 " << report.p50 << " p90 " << report.p90 << " p99 " << report.p99 << endl;
+			errors++;
+		}
+		for (int i = 0; i < 3; i++)
+			timing.rendered(20000000);
+		report = timing.read();
+		if (report.misses != 3 || report.max != 0.02 || report.renders != 1003)
+			errors++;
+		report.print(cout);
+
+		const int calls = 1000000;
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < calls; i++)
+		{
+			timing.called(i * 5333333ull, false);
+			timing.rendered(i % 5333333);
+		}
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << "Recording      : " << seconds * 1e9 / calls << "ns per callback" << endl;
+	}
+
+	// A buffer out of 10 takes 8ms (budget 5.3ms)
+	{
+		NullBackend* backend = new NullBackend;
+		backend->setOffline(true);
+		Engine engine(48000, block);
+		engine.setBackend(backend);
+		ParseContext ctx(engine);
+		Slow* slow = new Slow(ctx, 8, 10);
+		engine.play(slow);
+		backend->process(100 * block);
+		CallbackTiming::Report report = engine.timing();
+		if (report.callbacks != 100 || report.renders != 100 || report.misses != 10 || report.underruns
+			|| report.max < 0.008 || report.p50 > report.budget || report.p999 < report.budget)
+		{
+			cerr << "Wrong misses (" << report.misses << " out of " << report.renders << ")" << endl;
+			errors++;
+		}
+		report.print(cout);
+		engine.remove(slow);
+		delete slow;
+	}
+
+	// Render ahead, callbacks asked faster than the buffers are rendered
+	{
+		NullBackend* backend = new NullBackend;
+		backend->setOffline(true);
+		Engine engine(48000, block);
+		engine.setBackend(backend);
+		engine.setRenderAhead(2);
+		ParseContext ctx(engine);
+		Slow* slow = new Slow(ctx, 2, 1);
+		engine.play(slow);
+		backend->process(50 * block);
+		CallbackTiming::Report report = engine.timing();
+		if (report.callbacks != 50 || report.underruns == 0)
+		{
+			cerr << "No underrun found" << endl;
+			errors++;
+		}
+		engine.resetTiming();
+		if (engine.timing().callbacks)
+			errors++;
+		report.print(cout);
+		engine.close();
+		engine.remove(slow);
+		delete slow;
+	}
+
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}
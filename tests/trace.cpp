@@ -0,0 +1,146 @@
+// Tracer : callbacks, renders, sampled node spans, request drains and
+// play / remove / replace events are in the trace, the ring keeps the last
+// events, many threads record while the trace is written. Also reports the
+// cost of tracing.
+#include "helpers.hpp"
+
+static const uint32_t block = 512;
+static const char* patch = "reverb 30:30 am 0 100 low 2000 square 220 sinus 3";
+
+static size_t occurrences(const string& text, const string& what)
+{
+	size_t count = 0;
+	for (size_t pos = text.find(what); pos != string::npos; pos = text.find(what, pos + 1))
+		count++;
+	return count;
+}
+
+static Engine* tracedEngine(uint32_t events, uint16_t sample)
+{
+	Engine* engine = offlineEngine(block);
+	if (events)
+		engine->setTracing(events, sample);
+	return engine;
+}
+
+int main()
+{
+	size_t errors = 0;
+	const int blocks = 32;
+	const int buses = block / Engine::MIX_BLOCK;	// renderBus calls per render
+
+	{
+		Engine* engine = tracedEngine(4096, 4);
+		SoundGenerator* sound = engine->factory(patch);
+		Engine::Handle handle = engine->play(sound);
+		SoundGenerator* other = engine->factory("sinus 440");
+		engine->play(other);
+		processBlocks(*engine, blocks);
+		engine->replace(other, engine->factory("square 220"), 10);
+		processBlocks(*engine, 1);
+		engine->remove(handle);
+		processBlocks(*engine, 1);
+
+		stringstream out;
+		size_t written = engine->getTracer()->write(out);
+		string trace = out.str();
+		const int renders = blocks + 2;
+		// Node spans of renders 0, 4, ... 32 (the remove is before render 33)
+		const int nodes = ((renders + 3) / 4) * 2 * buses;
+		if (written != engine->getTracer()->recorded()
+			|| occurrences(trace, "\"name\":\"callback\"") != renders
+			|| occurrences(trace, "\"name\":\"render\"") != renders
+			|| occurrences(trace, "\"name\":\"lock\"") != renders
+			|| occurrences(trace, "\"cat\":\"node\"") != nodes
+			|| occurrences(trace, "\"name\":\"reverb\"") != ((renders + 3) / 4) * buses
+			|| occurrences(trace, "\"name\":\"main\",\"cat\":\"bus\"") != ((renders + 3) / 4) * buses
+			|| occurrences(trace, "\"name\":\"requests\"") != 1
+			|| occurrences(trace, "\"name\":\"play reverb\"") != 1
+			|| occurrences(trace, "\"name\":\"play sinus\"") != 1
+			|| occurrences(trace, "\"name\":\"replace square\"") != 1
+			|| occurrences(trace, "\"name\":\"remove reverb\"") != 1
+			|| occurrences(trace, "\"name\":\"audio callback\"") != 1
+			|| trace.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[") != 0
+			|| trace.find("\n]}") != trace.length() - 4)
+		{
+			cerr << "Missing events in the trace (" << written << " events) :" << endl << trace.substr(0, 2000) << endl;
+			errors++;
+		}
+		if (engine->setTracing(16))
+		{
+			cerr << "Tracing changed once started" << endl;
+			errors++;
+		}
+		delete engine;
+	}
+
+	// Only the last events are kept
+	{
+		// play, then callback, lock, render, bus and node by renderBus
+		Engine* engine = tracedEngine(64, 1);
+		engine->play(engine->factory("sinus 440"));
+		processBlocks(*engine, blocks);
+		stringstream out;
+		size_t written = engine->getTracer()->write(out);
+		if (written != 64 || engine->getTracer()->recorded() != 1 + blocks * (3 + 2 * buses))
+		{
+			cerr << "Ring not wrapped (" << written << " events written)" << endl;
+			errors++;
+		}
+		delete engine;
+	}
+
+	// Threads recording while the trace is written
+	{
+		Tracer tracer(1000, 1);
+		atomic<bool> running(true);
+		vector<thread*> threads;
+		for (int i = 0; i < 4; i++)
+			threads.push_back(new thread([&tracer, &running]()
+			{
+				Tracer::setThreadName("writer");
+				while (running)
+				{
+					uint64_t now = CallbackTiming::now();
+					tracer.span("test", "writer span", now, now + 1000, "value", 42);
+				}
+			}));
+		for (int i = 0; i < 20; i++)
+		{
+			stringstream out;
+			size_t written = tracer.write(out);
+			string trace = out.str();
+			if (written > 1000 || occurrences(trace, "\"name\":\"writer span\"") != written
+				|| occurrences(trace, "\"args\":{\"value\":42}") != written)
+			{
+				cerr << "Torn trace (" << written << " events)" << endl;
+				errors++;
+				break;
+			}
+		}
+		running = false;
+		for (auto t : threads)
+		{
+			t->join();
+			delete t;
+		}
+	}
+
+	// Cost of tracing
+	{
+		double plain, traced;
+		Engine* engine = tracedEngine(0, 0);
+		engine->play(engine->factory(patch));
+		plain = processBlocks(*engine, 400);
+		delete engine;
+		engine = tracedEngine(65536, 16);
+		engine->play(engine->factory(patch));
+		traced = processBlocks(*engine, 400);
+		delete engine;
+		cout << "Not traced     : " << plain * 1e3 << "ms" << endl;
+		cout << "Traced         : " << traced * 1e3 << "ms (x" << traced / plain << ')' << endl;
+	}
+
+	cout << errors << " error(s)" << endl;
+	return errors ? 1 : 0;
+}